@@ -128,6 +128,8 @@ testScripts = [
     'txn_doublespend.py --mineblock',
     'txn_clone.py',
     'getchaintips.py',
+    'getblockfilter.py',
+    'txreconciliation.py',
     'rest.py',
     'mempool_spendcoinbase.py',
     'mempool_reorg.py',
@@ -171,6 +173,7 @@ testScriptsExt = [
     # vv Tests less than 60s vv
     'bip9-softforks.py',
     'p2p-feefilter.py',
+    'p2p-compactblockrelay.py',
     'rpcbind_test.py',
     # vv Tests less than 30s vv
     'bip65-cltv.py',
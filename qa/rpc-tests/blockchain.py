@@ -27,6 +27,7 @@ class BlockchainTest(BitcoinTestFramework):
     Test blockchain-related RPC calls:
 
         - gettxoutsetinfo
+        - getsigcacheinfo
         - verifychain
 
     """
@@ -45,6 +46,7 @@ class BlockchainTest(BitcoinTestFramework):
     def run_test(self):
         self._test_gettxoutsetinfo()
         self._test_getblockheader()
+        self._test_getsigcacheinfo()
         self.nodes[0].verifychain(4, 0)
 
     def _test_gettxoutsetinfo(self):
@@ -59,6 +61,16 @@ class BlockchainTest(BitcoinTestFramework):
         assert_equal(len(res['bestblock']), 64)
         assert_equal(len(res['hash_serialized']), 64)
 
+    def _test_getsigcacheinfo(self):
+        node = self.nodes[0]
+        res = node.getsigcacheinfo()
+
+        assert(0 <= res['size'] <= res['capacity'])
+        assert_equal(res['usage'], res['capacity'] * 32)
+        assert(0 <= res['hitrate'] <= 1)
+        for key in ('hits', 'misses', 'inserts', 'evictions'):
+            assert(res[key] >= 0)
+
     def _test_getblockheader(self):
         node = self.nodes[0]
 
@@ -0,0 +1,82 @@
+#!/usr/bin/env python3
+# Copyright (c) 2017 The Bitcoin Core developers
+# Distributed under the MIT software license, see the accompanying
+# file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#
+# Test the block filter index (-blockfilterindex) and the getblockfilter RPC:
+# filters of both sides of a reorganization are available, and filter headers
+# chain the filter hashes as BIP 157 specifies.
+#
+
+from binascii import unhexlify
+
+from test_framework.mininode import hash256, wait_until
+from test_framework.test_framework import BitcoinTestFramework
+from test_framework.util import (
+    assert_equal,
+    assert_raises_jsonrpc,
+    connect_nodes_bi,
+    start_nodes,
+)
+
+class GetBlockFilterTest(BitcoinTestFramework):
+    def __init__(self):
+        super().__init__()
+        self.setup_clean_chain = False
+        self.num_nodes = 2
+
+    def setup_network(self):
+        self.nodes = start_nodes(self.num_nodes, self.options.tmpdir,
+                                 [["-blockfilterindex", "-peerblockfilters"], []])
+        connect_nodes_bi(self.nodes, 0, 1)
+        self.is_network_split = False
+        self.sync_all()
+
+    def wait_for_index(self, blockhash):
+        def indexed():
+            try:
+                self.nodes[0].getblockfilter(blockhash)
+                return True
+            except Exception:
+                return False
+        assert wait_until(indexed, timeout=30)
+
+    def run_test(self):
+        node = self.nodes[0]
+
+        # Create a reorganization: blocks on a side branch are indexed too
+        stale_hash = node.generate(1)[0]
+        self.wait_for_index(stale_hash)
+        node.invalidateblock(stale_hash)
+        node.generate(2)
+        self.wait_for_index(node.getbestblockhash())
+        stale_filter = node.getblockfilter(stale_hash)
+        assert_equal(stale_filter, node.getblockfilter(stale_hash, "basic"))
+
+        # Filter headers commit to all filters of the active chain
+        prev_header = b'\x00' * 32
+        for height in range(node.getblockcount() + 1):
+            result = node.getblockfilter(node.getblockhash(height))
+            filter_hash = hash256(unhexlify(result['filter']))
+            header = hash256(filter_hash + prev_header)
+            assert_equal(result['header'], header[::-1].hex())
+            prev_header = header
+
+        # The filter of the stale block chains from the same parent
+        parent = node.getblock(stale_hash)['previousblockhash']
+        parent_header = unhexlify(node.getblockfilter(parent)['header'])[::-1]
+        stale_header = hash256(hash256(unhexlify(stale_filter['filter'])) + parent_header)
+        assert_equal(stale_filter['header'], stale_header[::-1].hex())
+
+        assert_raises_jsonrpc(-5, "Block not found", node.getblockfilter, "00" * 32)
+        assert_raises_jsonrpc(-5, "Unknown filtertype", node.getblockfilter, node.getbestblockhash(), "unknown")
+        assert_raises_jsonrpc(-1, "Index is not enabled for filtertype basic", self.nodes[1].getblockfilter, node.getbestblockhash())
+
+        # The service bit is only set with -peerblockfilters
+        NODE_COMPACT_FILTERS = 1 << 6
+        assert(int(node.getnetworkinfo()['localservices'], 16) & NODE_COMPACT_FILTERS)
+        assert(not int(self.nodes[1].getnetworkinfo()['localservices'], 16) & NODE_COMPACT_FILTERS)
+
+if __name__ == '__main__':
+    GetBlockFilterTest().main()
@@ -0,0 +1,89 @@
+#!/usr/bin/env python3
+# Copyright (c) 2017 The Bitcoin Core developers
+# Distributed under the MIT software license, see the accompanying
+# file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#
+# Measure block propagation over a line of nodes using high-bandwidth
+# compact block relay, with and without announcing blocks before they are
+# connected (-cmpctprerelay).
+#
+
+import time
+
+from test_framework.test_framework import BitcoinTestFramework
+from test_framework.util import (
+    assert_greater_than,
+    connect_nodes_bi,
+    start_nodes,
+    stop_nodes,
+    sync_blocks,
+    sync_mempools,
+)
+
+# Blocks to mine before measuring, so that every node picks the peer it
+# receives blocks from as high-bandwidth peer.
+WARMUP_BLOCKS = 5
+MEASURED_BLOCKS = 10
+TXS_PER_BLOCK = 20
+
+class CompactBlockRelayTest(BitcoinTestFramework):
+    def __init__(self):
+        super().__init__()
+        self.setup_clean_chain = True
+        self.num_nodes = 4
+
+    def setup_network(self):
+        self.start_line([])
+
+    def start_line(self, extra_args):
+        # 0 - 1 - 2 - 3: a block mined on node 0 takes three hops to node 3
+        self.nodes = start_nodes(self.num_nodes, self.options.tmpdir, [["-debug=cmpctblock"] + extra_args] * self.num_nodes)
+        for i in range(self.num_nodes - 1):
+            connect_nodes_bi(self.nodes, i, i + 1)
+        self.is_network_split = False
+        self.sync_all()
+
+    def measure_propagation(self):
+        for i in range(WARMUP_BLOCKS):
+            self.nodes[0].generate(1)
+            sync_blocks(self.nodes)
+
+        delays = []
+        for i in range(MEASURED_BLOCKS):
+            # Blocks with transactions make ConnectBlock do some work at every hop
+            for j in range(TXS_PER_BLOCK):
+                self.nodes[0].sendtoaddress(self.nodes[0].getnewaddress(), 0.01)
+            sync_mempools(self.nodes)
+
+            start = time.time()
+            blockhash = self.nodes[0].generate(1)[0]
+            while self.nodes[-1].getbestblockhash() != blockhash:
+                time.sleep(0.005)
+            delays.append(time.time() - start)
+
+        # Every hop should have reconstructed blocks from its mempool
+        for node in self.nodes[1:]:
+            cmpct = node.getnetworkinfo()['compactblocks']
+            assert_greater_than(cmpct['blocks'], 0)
+            assert_greater_than(cmpct['reconstructed'], 0)
+        return sum(delays) / len(delays)
+
+    def run_test(self):
+        # Mature some coins to fill blocks with
+        self.nodes[0].generate(101)
+        sync_blocks(self.nodes)
+
+        print("Measuring propagation with pre-validation relay")
+        prerelay = self.measure_propagation()
+
+        stop_nodes(self.nodes)
+        self.start_line(["-cmpctprerelay=0"])
+        print("Measuring propagation with relay after connecting")
+        postrelay = self.measure_propagation()
+
+        print("Average propagation over %d hops: %.1fms before connecting, %.1fms after connecting" %
+              (self.num_nodes - 1, prerelay * 1000, postrelay * 1000))
+
+if __name__ == '__main__':
+    CompactBlockRelayTest().main()
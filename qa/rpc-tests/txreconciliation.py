@@ -0,0 +1,82 @@
+#!/usr/bin/env python3
+# Copyright (c) 2017 The Bitcoin Core developers
+# Distributed under the MIT software license, see the accompanying
+# file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#
+# Test reconciliation of transaction announcements (-txreconciliation):
+# two fully connected networks of four nodes relay the same number of
+# transactions, one flooding announcements and one reconciling them, and the
+# bytes spent announcing each transaction are compared.
+#
+
+from test_framework.mininode import wait_until
+from test_framework.test_framework import BitcoinTestFramework
+from test_framework.util import (
+    assert_equal,
+    connect_nodes,
+    start_nodes,
+    sync_mempools,
+)
+
+MESH_SIZE = 4
+NUM_TXS = 20
+ANNOUNCEMENT_MSGS = ["inv", "getdata", "reqrecon", "sketch", "reconcildiff"]
+
+class TxReconciliationTest(BitcoinTestFramework):
+    def __init__(self):
+        super().__init__()
+        self.setup_clean_chain = True
+        self.num_nodes = 2 * MESH_SIZE
+
+    def setup_network(self):
+        # Nodes 0-3 flood announcements, nodes 4-7 reconcile them
+        extra_args = [[]] * MESH_SIZE + [["-txreconciliation"]] * MESH_SIZE
+        self.nodes = start_nodes(self.num_nodes, self.options.tmpdir, extra_args)
+        for mesh in (self.flooding(), self.reconciling()):
+            for i, node in enumerate(mesh):
+                for j in range(i + 1, MESH_SIZE):
+                    connect_nodes(node, self.nodes.index(mesh[j]))
+        self.is_network_split = True
+
+    def flooding(self):
+        return self.nodes[:MESH_SIZE]
+
+    def reconciling(self):
+        return self.nodes[MESH_SIZE:]
+
+    def announcement_bytes(self, mesh):
+        total = 0
+        for node in mesh:
+            for peer in node.getpeerinfo():
+                total += sum(peer['bytessent_per_msg'].get(msg, 0) for msg in ANNOUNCEMENT_MSGS)
+        return total
+
+    def relay(self, mesh):
+        mesh[0].generate(101)
+        wait_until(lambda: all(node.getblockcount() == 101 for node in mesh), timeout=60)
+        before = self.announcement_bytes(mesh)
+        for i in range(NUM_TXS):
+            mesh[0].sendtoaddress(mesh[1 + i % (MESH_SIZE - 1)].getnewaddress(), 1)
+        sync_mempools(mesh, timeout=120)
+        for node in mesh:
+            assert_equal(node.getmempoolinfo()['size'], NUM_TXS)
+        return (self.announcement_bytes(mesh) - before) / NUM_TXS
+
+    def run_test(self):
+        for node in self.flooding():
+            assert(not any(peer['txreconciliation'] for peer in node.getpeerinfo()))
+        for node in self.reconciling():
+            assert(all(peer['txreconciliation'] for peer in node.getpeerinfo()))
+
+        flooding_bytes = self.relay(self.flooding())
+        reconciling_bytes = self.relay(self.reconciling())
+        print("Announcement bytes per transaction: %.1f flooding, %.1f reconciling" % (flooding_bytes, reconciling_bytes))
+
+        # Inbound peers got the transactions through reconciliation rounds
+        sketches = sum(peer['bytessent_per_msg'].get('sketch', 0) for node in self.reconciling() for peer in node.getpeerinfo())
+        assert(sketches > 0)
+        assert(not any('sketch' in peer['bytessent_per_msg'] for node in self.flooding() for peer in node.getpeerinfo()))
+
+if __name__ == '__main__':
+    TxReconciliationTest().main()
@@ -85,6 +85,7 @@ CAddrInfo* CAddrMan::Create(const CAddress& addr, const CNetAddr& addrSource, in
     mapAddr[addr] = nId;
     mapInfo[nId].nRandomPos = vRandom.size();
     vRandom.push_back(nId);
+    nEntries = vRandom.size();
     if (pnId)
         *pnId = nId;
     return &mapInfo[nId];
@@ -119,6 +120,7 @@ void CAddrMan::Delete(int nId)
 
     SwapRandom(info.nRandomPos, vRandom.size() - 1);
     vRandom.pop_back();
+    nEntries = vRandom.size();
     mapAddr.erase(info);
     mapInfo.erase(nId);
     nNew--;
@@ -239,7 +241,14 @@ void CAddrMan::Good_(const CService& addr, int64_t nTime)
     MakeTried(info, nId);
 }
 
-bool CAddrMan::Add_(const CAddress& addr, const CNetAddr& source, int64_t nTimePenalty)
+void CAddrMan::GetNewPosition(const CAddress& addr, const CNetAddr& source, int& nUBucket, int& nUBucketPos) const
+{
+    const CAddrInfo info(addr, source);
+    nUBucket = info.GetNewBucket(nKey, source);
+    nUBucketPos = info.GetBucketPosition(nKey, true, nUBucket);
+}
+
+bool CAddrMan::Add_(const CAddress& addr, const CNetAddr& source, int64_t nTimePenalty, int nUBucket, int nUBucketPos)
 {
     if (!addr.IsRoutable())
         return false;
@@ -288,8 +297,6 @@ bool CAddrMan::Add_(const CAddress& addr, const CNetAddr& source, int64_t nTimeP
         fNew = true;
     }
 
-    int nUBucket = pinfo->GetNewBucket(nKey, source);
-    int nUBucketPos = pinfo->GetBucketPosition(nKey, true, nUBucket);
     if (vvNew[nUBucket][nUBucketPos] != nId) {
         bool fInsert = vvNew[nUBucket][nUBucketPos] == -1;
         if (!fInsert) {
@@ -459,25 +466,68 @@ int CAddrMan::Check_()
 }
 #endif
 
-void CAddrMan::GetAddr_(std::vector<CAddress>& vAddr)
+bool CAddrMan::IsSnapshotStale(const CAddrManSnapshot& snap) const
 {
-    unsigned int nNodes = ADDRMAN_GETADDR_MAX_PCT * vRandom.size() / 100;
-    if (nNodes > ADDRMAN_GETADDR_MAX)
-        nNodes = ADDRMAN_GETADDR_MAX;
+    if (GetTime() - snap.nTime >= ADDRMAN_SNAPSHOT_INTERVAL)
+        return true;
+    size_t nNow = nEntries;
+    size_t nDiff = nNow > snap.nAddresses ? nNow - snap.nAddresses : snap.nAddresses - nNow;
+    return nDiff * ADDRMAN_SNAPSHOT_RESIZE_DIVISOR > snap.nAddresses;
+}
 
-    // gather a list of random nodes, skipping those of low quality
-    for (unsigned int n = 0; n < vRandom.size(); n++) {
-        if (vAddr.size() >= nNodes)
-            break;
+std::shared_ptr<const CAddrManSnapshot> CAddrMan::GetSnapshot()
+{
+    {
+        LOCK(cs_snapshot);
+        if (snapshot && !IsSnapshotStale(*snapshot))
+            return snapshot;
+    }
 
-        int nRndPos = RandomInt(vRandom.size() - n) + n;
-        SwapRandom(n, nRndPos);
-        assert(mapInfo.count(vRandom[n]) == 1);
+    LOCK(cs);
+    {
+        // Another thread may have republished it while we waited for cs
+        LOCK(cs_snapshot);
+        if (snapshot && !IsSnapshotStale(*snapshot))
+            return snapshot;
+    }
 
-        const CAddrInfo& ai = mapInfo[vRandom[n]];
-        if (!ai.IsTerrible())
-            vAddr.push_back(ai);
+    std::shared_ptr<CAddrManSnapshot> snapshotNew = std::make_shared<CAddrManSnapshot>();
+    snapshotNew->nTime = GetTime();
+    snapshotNew->nAddresses = vRandom.size();
+    snapshotNew->vAddr.reserve(vRandom.size());
+    int64_t nNow = GetAdjustedTime();
+    for (std::map<int, CAddrInfo>::const_iterator it = mapInfo.begin(); it != mapInfo.end(); it++) {
+        if (!it->second.IsTerrible(nNow))
+            snapshotNew->vAddr.push_back(it->second);
+    }
+
+    LOCK(cs_snapshot);
+    snapshot = snapshotNew;
+    return snapshot;
+}
+
+void CAddrMan::GetAddr_(const CAddrManSnapshot& snap, std::vector<CAddress>& vAddr) const
+{
+    unsigned int nNodes = ADDRMAN_GETADDR_MAX_PCT * snap.nAddresses / 100;
+    if (nNodes > ADDRMAN_GETADDR_MAX)
+        nNodes = ADDRMAN_GETADDR_MAX;
+    if (nNodes > snap.vAddr.size())
+        nNodes = snap.vAddr.size();
+
+    // pick nNodes distinct entries (Floyd's algorithm), then shuffle them
+    // so that the order does not reveal their position in the snapshot
+    FastRandomContext rng;
+    std::vector<bool> vChosen(snap.vAddr.size(), false);
+    vAddr.reserve(nNodes);
+    for (size_t j = snap.vAddr.size() - nNodes; j < snap.vAddr.size(); j++) {
+        size_t nPos = rng.rand32() % (j + 1);
+        if (vChosen[nPos])
+            nPos = j;
+        vChosen[nPos] = true;
+        vAddr.push_back(snap.vAddr[nPos]);
     }
+    for (size_t n = vAddr.size(); n > 1; n--)
+        std::swap(vAddr[n - 1], vAddr[rng.rand32() % n]);
 }
 
 void CAddrMan::Connected_(const CService& addr, int64_t nTime)
@@ -13,7 +13,9 @@
 #include "timedata.h"
 #include "util.h"
 
+#include <atomic>
 #include <map>
+#include <memory>
 #include <set>
 #include <stdint.h>
 #include <vector>
@@ -171,6 +173,28 @@ public:
 //! the maximum number of nodes to return in a getaddr call
 #define ADDRMAN_GETADDR_MAX 2500
 
+//! after how many seconds the addresses sampled by GetAddr are republished
+#define ADDRMAN_SNAPSHOT_INTERVAL 60
+
+//! ... or earlier, once the number of addresses changed by more than 1/N
+#define ADDRMAN_SNAPSHOT_RESIZE_DIVISOR 8
+
+/**
+ * Immutable copy of the addresses GetAddr may return, published periodically
+ * so that getaddr responses can be sampled without holding CAddrMan::cs.
+ */
+struct CAddrManSnapshot
+{
+    //! when the snapshot was taken
+    int64_t nTime;
+
+    //! number of addresses in the tables at that time, including terrible ones
+    size_t nAddresses;
+
+    //! all addresses that were not terrible
+    std::vector<CAddress> vAddr;
+};
+
 /** 
  * Stochastical (IP) address manager 
  */
@@ -207,6 +231,15 @@ private:
     //! last time Good was called (memory only)
     int64_t nLastGood;
 
+    //! vRandom.size(), readable without cs
+    std::atomic<size_t> nEntries;
+
+    //! protects snapshot; may be taken while holding cs, but not the other way around
+    mutable CCriticalSection cs_snapshot;
+
+    //! last published snapshot for GetAddr
+    std::shared_ptr<const CAddrManSnapshot> snapshot;
+
 protected:
     //! secret key to randomize bucket select with
     uint256 nKey;
@@ -236,8 +269,12 @@ protected:
     //! Mark an entry "good", possibly moving it from "new" to "tried".
     void Good_(const CService &addr, int64_t nTime);
 
-    //! Add an entry to the "new" table.
-    bool Add_(const CAddress &addr, const CNetAddr& source, int64_t nTimePenalty);
+    //! Compute the "new" table position of an address. Only depends on nKey,
+    //! which is not modified after startup, so this needs no lock.
+    void GetNewPosition(const CAddress &addr, const CNetAddr& source, int& nUBucket, int& nUBucketPos) const;
+
+    //! Add an entry to the "new" table, at the position given by GetNewPosition.
+    bool Add_(const CAddress &addr, const CNetAddr& source, int64_t nTimePenalty, int nUBucket, int nUBucketPos);
 
     //! Mark an entry as attempted to connect.
     void Attempt_(const CService &addr, bool fCountFailure, int64_t nTime);
@@ -253,8 +290,14 @@ protected:
     int Check_();
 #endif
 
-    //! Select several addresses at once.
-    void GetAddr_(std::vector<CAddress> &vAddr);
+    //! Whether a snapshot should be republished.
+    bool IsSnapshotStale(const CAddrManSnapshot& snap) const;
+
+    //! Return the current snapshot, republishing it first if it is stale.
+    std::shared_ptr<const CAddrManSnapshot> GetSnapshot();
+
+    //! Select several addresses at once from a snapshot.
+    void GetAddr_(const CAddrManSnapshot& snap, std::vector<CAddress> &vAddr) const;
 
     //! Mark an entry as currently-connected-to.
     void Connected_(const CService &addr, int64_t nTime);
@@ -378,6 +421,7 @@ public:
             mapAddr[info] = n;
             info.nRandomPos = vRandom.size();
             vRandom.push_back(n);
+            nEntries = vRandom.size();
             if (nVersion != 1 || nUBuckets != ADDRMAN_NEW_BUCKET_COUNT) {
                 // In case the new table data cannot be used (nVersion unknown, or bucket count wrong),
                 // immediately try to give them a reference based on their primary source address.
@@ -402,6 +446,7 @@ public:
                 info.nRandomPos = vRandom.size();
                 info.fInTried = true;
                 vRandom.push_back(nIdCount);
+                nEntries = vRandom.size();
                 mapInfo[nIdCount] = info;
                 mapAddr[info] = nIdCount;
                 vvTried[nKBucket][nKBucketPos] = nIdCount;
@@ -467,6 +512,10 @@ public:
         nTried = 0;
         nNew = 0;
         nLastGood = 1; //Initially at 1 so that "never" is strictly worse.
+        nEntries = 0;
+
+        LOCK(cs_snapshot);
+        snapshot.reset();
     }
 
     CAddrMan()
@@ -482,8 +531,7 @@ public:
     //! Return the number of (unique) addresses in all tables.
     size_t size() const
     {
-        LOCK(cs); // TODO: Cache this in an atomic to avoid this overhead
-        return vRandom.size();
+        return nEntries;
     }
 
     //! Consistency check
@@ -502,10 +550,13 @@ public:
     //! Add a single address.
     bool Add(const CAddress &addr, const CNetAddr& source, int64_t nTimePenalty = 0)
     {
+        int nUBucket, nUBucketPos;
+        GetNewPosition(addr, source, nUBucket, nUBucketPos);
+
         LOCK(cs);
         bool fRet = false;
         Check();
-        fRet |= Add_(addr, source, nTimePenalty);
+        fRet |= Add_(addr, source, nTimePenalty, nUBucket, nUBucketPos);
         Check();
         if (fRet)
             LogPrint("addrman", "Added %s from %s: %i tried, %i new\n", addr.ToStringIPPort(), source.ToString(), nTried, nNew);
@@ -515,11 +566,17 @@ public:
     //! Add multiple addresses.
     bool Add(const std::vector<CAddress> &vAddr, const CNetAddr& source, int64_t nTimePenalty = 0)
     {
+        // Hash the addresses into their buckets before taking the lock, as
+        // that is most of the work for addresses from a flood of addr messages.
+        std::vector<std::pair<int, int> > vPos(vAddr.size());
+        for (size_t i = 0; i < vAddr.size(); i++)
+            GetNewPosition(vAddr[i], source, vPos[i].first, vPos[i].second);
+
         LOCK(cs);
         int nAdd = 0;
         Check();
-        for (std::vector<CAddress>::const_iterator it = vAddr.begin(); it != vAddr.end(); it++)
-            nAdd += Add_(*it, source, nTimePenalty) ? 1 : 0;
+        for (size_t i = 0; i < vAddr.size(); i++)
+            nAdd += Add_(vAddr[i], source, nTimePenalty, vPos[i].first, vPos[i].second) ? 1 : 0;
         Check();
         if (nAdd)
             LogPrint("addrman", "Added %i addresses from %s: %i tried, %i new\n", nAdd, source.ToString(), nTried, nNew);
@@ -559,16 +616,11 @@ public:
         return addrRet;
     }
 
-    //! Return a bunch of addresses, selected at random.
+    //! Return a bunch of addresses, selected at random from the last published snapshot.
     std::vector<CAddress> GetAddr()
     {
-        Check();
         std::vector<CAddress> vAddr;
-        {
-            LOCK(cs);
-            GetAddr_(vAddr);
-        }
-        Check();
+        GetAddr_(*GetSnapshot(), vAddr);
         return vAddr;
     }
 
@@ -11,6 +11,7 @@
 #include "consensus/consensus.h"
 #include "consensus/merkle.h"
 #include "consensus/validation.h"
+#include "crypto/sha256.h"
 #include "hash.h"
 #include "script/script.h"
 #include "txmempool.h"
@@ -186,13 +187,21 @@ CAuxPow::CheckMerkleBranch (uint256 hash,
 {
   if (nIndex == -1)
     return uint256 ();
+  unsigned char buf[64];
   for (std::vector<uint256>::const_iterator it(vMerkleBranch.begin ());
        it != vMerkleBranch.end (); ++it)
   {
     if (nIndex & 1)
-      hash = Hash (BEGIN (*it), END (*it), BEGIN (hash), END (hash));
+      {
+        memcpy (buf, it->begin (), 32);
+        memcpy (buf + 32, hash.begin (), 32);
+      }
     else
-      hash = Hash (BEGIN (hash), END (hash), BEGIN (*it), END (*it));
+      {
+        memcpy (buf, hash.begin (), 32);
+        memcpy (buf + 32, it->begin (), 32);
+      }
+    SHA256D64 (hash.begin (), buf, 1);
     nIndex >>= 1;
   }
   return hash;
@@ -0,0 +1,83 @@
+// Copyright (c) 2017 The Bitcoin Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "bench.h"
+#include "addrman.h"
+#include "net.h"
+#include "random.h"
+
+#include <vector>
+#include <boost/thread/thread.hpp>
+
+// Simulates a flood of full addr messages from many local peers, while
+// getaddr requests are being answered.
+static const int FLOOD_PEERS = 16;
+static const int FLOOD_MESSAGES_PER_PEER = 4;
+
+static CAddress RandomAddress(FastRandomContext& rng)
+{
+    struct in_addr ip;
+    ip.s_addr = rng.rand32();
+    CAddress addr(CService(CNetAddr(ip), 8333), NODE_NETWORK);
+    addr.nTime = GetAdjustedTime();
+    return addr;
+}
+
+static void FillMessages(std::vector<CNetAddr>& vSources, std::vector<std::vector<CAddress> >& vMessages)
+{
+    FastRandomContext rng;
+    while (vSources.size() < FLOOD_PEERS) {
+        CNetAddr source = RandomAddress(rng);
+        if (!source.IsRoutable())
+            continue;
+        vSources.push_back(source);
+        vMessages.emplace_back();
+        for (unsigned int i = 0; i < FLOOD_MESSAGES_PER_PEER * MAX_ADDR_TO_SEND; i++)
+            vMessages.back().push_back(RandomAddress(rng));
+    }
+}
+
+static void AddrManAddFlood(benchmark::State& state)
+{
+    std::vector<CNetAddr> vSources;
+    std::vector<std::vector<CAddress> > vMessages;
+    FillMessages(vSources, vMessages);
+
+    while (state.KeepRunning()) {
+        std::unique_ptr<CAddrMan> addrman(new CAddrMan());
+        boost::thread_group tg;
+        for (int nPeer = 0; nPeer < FLOOD_PEERS; nPeer++) {
+            tg.create_thread([&, nPeer] {
+                const std::vector<CAddress>& vAddr = vMessages[nPeer];
+                for (size_t i = 0; i < vAddr.size(); i += MAX_ADDR_TO_SEND) {
+                    std::vector<CAddress> vMessage(vAddr.begin() + i, vAddr.begin() + i + MAX_ADDR_TO_SEND);
+                    addrman->Add(vMessage, vSources[nPeer], 2 * 60 * 60);
+                }
+            });
+        }
+        tg.create_thread([&] {
+            for (int i = 0; i < FLOOD_PEERS; i++)
+                addrman->GetAddr();
+        });
+        tg.join_all();
+    }
+}
+
+static void AddrManGetAddr(benchmark::State& state)
+{
+    std::vector<CNetAddr> vSources;
+    std::vector<std::vector<CAddress> > vMessages;
+    FillMessages(vSources, vMessages);
+
+    CAddrMan addrman;
+    for (int nPeer = 0; nPeer < FLOOD_PEERS; nPeer++)
+        addrman.Add(vMessages[nPeer], vSources[nPeer]);
+
+    while (state.KeepRunning()) {
+        addrman.GetAddr();
+    }
+}
+
+BENCHMARK(AddrManAddFlood);
+BENCHMARK(AddrManGetAddr);
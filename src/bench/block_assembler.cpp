@@ -0,0 +1,170 @@
+// Copyright (c) 2017 The Bitcoin Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "bench.h"
+#include "chainparams.h"
+#include "coins.h"
+#include "miner.h"
+#include "noui.h"
+#include "policy/policy.h"
+#include "script/sigcache.h"
+#include "txdb.h"
+#include "txmempool.h"
+#include "util.h"
+#include "validation.h"
+
+#include <stdio.h>
+
+#include <boost/filesystem.hpp>
+
+// Block template construction on a regtest chain holding only its genesis
+// block, with the global mempool filled with a mix of what selection has to
+// deal with: independent transactions, parents paid for by their children,
+// and chains at the ancestor limit. The mempool holds about three blocks'
+// worth of transactions.
+static const int NUM_INDEPENDENT_TXS = 2000;
+static const int NUM_CPFP_PAIRS = 500;
+static const int NUM_CHAINS = 40;
+static const int CHAIN_LENGTH = 25;
+static const char* BLOCK_MAX_SIZE = "100000";
+
+namespace {
+
+class BlockAssemblerSetup
+{
+    boost::filesystem::path pathTemp;
+    CCoinsViewDB* pcoinsdbview;
+    uint32_t nRand;
+
+    CAmount NextFee()
+    {
+        nRand = nRand * 1103515245 + 12345;
+        return 1000 + (nRand >> 8) % 50000;
+    }
+
+    CTransactionRef AddTx(const COutPoint& prevout, CAmount nValueIn, CAmount nFee)
+    {
+        CMutableTransaction tx;
+        tx.vin.resize(1);
+        tx.vin[0].prevout = prevout;
+        tx.vout.resize(1);
+        tx.vout[0].scriptPubKey = CScript() << OP_TRUE;
+        tx.vout[0].nValue = nValueIn - nFee;
+        CTransactionRef ptx = MakeTransactionRef(tx);
+        LockPoints lp;
+        mempool.addUnchecked(ptx->GetHash(), CTxMemPoolEntry(ptx, nFee, 0, 0, 1, nValueIn, false, 1, lp));
+        return ptx;
+    }
+
+public:
+    BlockAssemblerSetup(bool fClusters, unsigned int nBlockPrioritySize) : nRand(42)
+    {
+        static bool fNoUIConnected = false;
+        if (!fNoUIConnected) {
+            noui_connect();
+            fNoUIConnected = true;
+        }
+        SelectParams(CBaseChainParams::MAIN);
+        InitSignatureCache();
+        InitScriptExecutionCache();
+        ClearDatadirCache();
+        pathTemp = boost::filesystem::temp_directory_path() / boost::filesystem::unique_path("bench_bitcoin_%%%%%%%%");
+        boost::filesystem::create_directories(pathTemp);
+        ForceSetArg("-datadir", pathTemp.string());
+        ForceSetArg("-blockmaxsize", BLOCK_MAX_SIZE);
+        ForceSetArg("-blockprioritysize", std::to_string(nBlockPrioritySize));
+        ForceSetArg("-blockclusters", fClusters ? "1" : "0");
+        pblocktree = new CBlockTreeDB(1 << 20, true);
+        pcoinsdbview = new CCoinsViewDB(1 << 23, true);
+        pcoinsTip = new CCoinsViewCache(pcoinsdbview);
+        InitBlockIndex(Params());
+        CValidationState state;
+        ActivateBestChain(state, Params());
+
+        // All transactions spend outputs of one confirmed transaction
+        const int nOutputs = NUM_INDEPENDENT_TXS + NUM_CPFP_PAIRS + NUM_CHAINS;
+        const CAmount nValue = COIN;
+        uint256 hashFunding = GetRandHash();
+        {
+            LOCK(cs_main);
+            CCoinsModifier coins = pcoinsTip->ModifyCoins(hashFunding);
+            coins->fCoinBase = false;
+            coins->nVersion = 1;
+            coins->nHeight = 0;
+            coins->vout.resize(nOutputs);
+            for (CTxOut& txout : coins->vout) {
+                txout.nValue = nValue;
+                txout.scriptPubKey = CScript() << OP_TRUE;
+            }
+        }
+
+        LOCK(mempool.cs);
+        int n = 0;
+        for (int i = 0; i < NUM_INDEPENDENT_TXS; i++) {
+            AddTx(COutPoint(hashFunding, n++), nValue, NextFee());
+        }
+        for (int i = 0; i < NUM_CPFP_PAIRS; i++) {
+            CTransactionRef parent = AddTx(COutPoint(hashFunding, n++), nValue, 0);
+            AddTx(COutPoint(parent->GetHash(), 0), nValue, 2 * NextFee());
+        }
+        for (int i = 0; i < NUM_CHAINS; i++) {
+            CTransactionRef prev = AddTx(COutPoint(hashFunding, n++), nValue, NextFee());
+            CAmount nValueIn = prev->vout[0].nValue;
+            for (int j = 1; j < CHAIN_LENGTH; j++) {
+                CAmount nFee = NextFee();
+                prev = AddTx(COutPoint(prev->GetHash(), 0), nValueIn, nFee);
+                nValueIn -= nFee;
+            }
+        }
+    }
+
+    ~BlockAssemblerSetup()
+    {
+        mempool.clear();
+        UnloadBlockIndex();
+        delete pcoinsTip;
+        delete pcoinsdbview;
+        delete pblocktree;
+        pcoinsTip = NULL;
+        pblocktree = NULL;
+        ForceSetArg("-blockclusters", "0");
+        ForceSetArg("-blockprioritysize", "0");
+        boost::filesystem::remove_all(pathTemp);
+    }
+};
+
+} // anon namespace
+
+// The fees of the templates are printed once per run, so that the selection
+// algorithms can be compared on what they earn as well as on their speed.
+static void AssembleBlock(benchmark::State& state, const char* name, bool fClusters, unsigned int nBlockPrioritySize)
+{
+    BlockAssemblerSetup setup(fClusters, nBlockPrioritySize);
+    CScript scriptPubKey = CScript() << OP_TRUE;
+    std::unique_ptr<CBlockTemplate> pblocktemplate;
+    while (state.KeepRunning()) {
+        pblocktemplate = BlockAssembler(Params()).CreateNewBlock(scriptPubKey, ALGO_SHA256D);
+    }
+    printf("%s: %u txs, %ld fees\n", name, (unsigned int)pblocktemplate->block.vtx.size() - 1, -pblocktemplate->vTxFees[0]);
+}
+
+static void AssembleBlock_Packages(benchmark::State& state) { AssembleBlock(state, "AssembleBlock_Packages", false, 0); }
+static void AssembleBlock_Clusters(benchmark::State& state) { AssembleBlock(state, "AssembleBlock_Clusters", true, 0); }
+static void AssembleBlock_Priority(benchmark::State& state) { AssembleBlock(state, "AssembleBlock_Priority", false, DEFAULT_BLOCK_PRIORITY_SIZE); }
+
+// Re-keying the coin_age_priority index, which the first template with
+// -blockprioritysize pays for after every block.
+static void MempoolUpdatePriorities(benchmark::State& state)
+{
+    BlockAssemblerSetup setup(false, 0);
+    unsigned int nHeight = 1;
+    while (state.KeepRunning()) {
+        mempool.UpdatePriorities(++nHeight);
+    }
+}
+
+BENCHMARK(AssembleBlock_Packages);
+BENCHMARK(AssembleBlock_Clusters);
+BENCHMARK(AssembleBlock_Priority);
+BENCHMARK(MempoolUpdatePriorities);
@@ -0,0 +1,232 @@
+// Copyright (c) 2017 The Bitcoin Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "bench.h"
+#include "net_processing.h"
+#include "validation.h"
+
+#include <assert.h>
+#include <deque>
+#include <stdio.h>
+#include <vector>
+
+// Simulated initial block download from a mix of fast and slow peers, once
+// with every peer given up to MAX_BLOCKS_IN_TRANSIT_PER_PEER blocks, and once
+// with the requests sized and re-requested by CBlockDownloadStats as
+// SendMessages does. Peers deliver the blocks asked of them one after
+// another, each request after the peer's latency. A peer that stalls the
+// download window for BLOCK_STALLING_TIMEOUT is disconnected and replaced
+// by one of the same kind. The simulated duration of the download is
+// printed once per run.
+static const int NUM_BLOCKS = 5000;
+static const size_t BLOCK_SIZE = 200000;
+// Interval between two rounds of the message handler, in microseconds
+static const int64_t ROUND_TIME = 100000;
+// Time until a disconnected peer is replaced, in microseconds
+static const int64_t RECONNECT_TIME = 5000000;
+
+namespace {
+
+struct SimPeerKind
+{
+    double dBytesPerSec;
+    int64_t nLatency;
+};
+
+static const SimPeerKind FAST_PEER = {1000000, 50000};
+static const SimPeerKind SLOW_PEER = {40000, 800000};
+
+struct SimRequest
+{
+    int nHeight;
+    int64_t nTimeRequested;
+    int64_t nTimeDelivered;
+};
+
+struct SimPeer
+{
+    SimPeerKind kind;
+    bool fConnected;
+    int64_t nReconnect;
+    std::deque<SimRequest> queue;
+    int64_t nLinkFree;
+    int nBlocksInFlight;
+    int64_t nStallingSince;
+    CBlockDownloadStats stats;
+
+    explicit SimPeer(const SimPeerKind& kindIn) : kind(kindIn) { Connect(); }
+
+    void Connect()
+    {
+        fConnected = true;
+        queue.clear();
+        nLinkFree = 0;
+        nBlocksInFlight = 0;
+        nStallingSince = 0;
+        stats = CBlockDownloadStats();
+    }
+};
+
+class SimDownload
+{
+    std::vector<SimPeer> vPeers;
+    std::vector<int> vOwner;
+    std::vector<int64_t> vTimeRequested;
+    std::vector<bool> vReceived;
+    int nFirstMissing;
+    double dAvgBlockSize;
+    int64_t nNow;
+
+    void Request(int nPeer, int nHeight)
+    {
+        SimPeer& peer = vPeers[nPeer];
+        vOwner[nHeight] = nPeer;
+        vTimeRequested[nHeight] = nNow;
+        peer.nLinkFree = std::max(nNow + peer.kind.nLatency, peer.nLinkFree) + (int64_t)(BLOCK_SIZE * 1000000.0 / peer.kind.dBytesPerSec);
+        peer.queue.push_back(SimRequest{nHeight, nNow, peer.nLinkFree});
+        peer.nBlocksInFlight++;
+    }
+
+    // Forget that nHeight is in flight, as MarkBlockAsReceived does
+    void MarkReceived(int nHeight)
+    {
+        if (vOwner[nHeight] == -1)
+            return;
+        SimPeer& peer = vPeers[vOwner[nHeight]];
+        peer.nBlocksInFlight--;
+        peer.nStallingSince = 0;
+        vOwner[nHeight] = -1;
+    }
+
+    void Deliver(int nPeer)
+    {
+        SimPeer& peer = vPeers[nPeer];
+        while (!peer.queue.empty() && peer.queue.front().nTimeDelivered <= nNow) {
+            const SimRequest& req = peer.queue.front();
+            if (vOwner[req.nHeight] == nPeer) {
+                peer.stats.Update(req.nTimeRequested, BLOCK_SIZE, req.nTimeDelivered);
+                if (dAvgBlockSize == 0)
+                    dAvgBlockSize = BLOCK_SIZE;
+                else
+                    dAvgBlockSize += BLOCK_DOWNLOAD_AVG_WEIGHT * (BLOCK_SIZE - dAvgBlockSize);
+                MarkReceived(req.nHeight);
+            }
+            vReceived[req.nHeight] = true;
+            peer.queue.pop_front();
+        }
+    }
+
+    void Disconnect(int nPeer)
+    {
+        SimPeer& peer = vPeers[nPeer];
+        for (const SimRequest& req : peer.queue) {
+            if (vOwner[req.nHeight] == nPeer)
+                MarkReceived(req.nHeight);
+        }
+        peer.queue.clear();
+        peer.fConnected = false;
+        peer.nReconnect = nNow + RECONNECT_TIME;
+    }
+
+    // The block requests of one peer, as FindNextBlocksToDownload and
+    // SendMessages make them
+    void RequestBlocks(int nPeer, bool fAdaptive)
+    {
+        SimPeer& peer = vPeers[nPeer];
+        const int nMaxBlocksInFlight = fAdaptive ? peer.stats.GetMaxBlocksInFlight(dAvgBlockSize) : MAX_BLOCKS_IN_TRANSIT_PER_PEER;
+        if (peer.nBlocksInFlight >= nMaxBlocksInFlight)
+            return;
+
+        int nCount = nMaxBlocksInFlight - peer.nBlocksInFlight;
+        const int nWindowEnd = nFirstMissing - 1 + BLOCK_DOWNLOAD_WINDOW;
+        bool fRequested = false;
+        int nWaitingFor = -1, nWaitingHeight = -1;
+        int nStaller = -1, nStallingHeight = -1;
+        for (int nHeight = nFirstMissing; nHeight < NUM_BLOCKS && nCount > 0; nHeight++) {
+            if (vReceived[nHeight])
+                continue;
+            if (vOwner[nHeight] == -1) {
+                if (nHeight > nWindowEnd) {
+                    if (!fRequested && nWaitingFor != nPeer) {
+                        nStaller = nWaitingFor;
+                        nStallingHeight = nWaitingHeight;
+                    }
+                    break;
+                }
+                Request(nPeer, nHeight);
+                fRequested = true;
+                nCount--;
+            } else if (nWaitingFor == -1) {
+                nWaitingFor = vOwner[nHeight];
+                nWaitingHeight = nHeight;
+            }
+        }
+
+        if (peer.nBlocksInFlight == 0 && nStaller != -1) {
+            SimPeer& staller = vPeers[nStaller];
+            if (fAdaptive && peer.stats.ShouldTakeOver(staller.stats, nNow - vTimeRequested[nStallingHeight], dAvgBlockSize)) {
+                MarkReceived(nStallingHeight);
+                Request(nPeer, nStallingHeight);
+            } else if (staller.nStallingSince == 0) {
+                staller.nStallingSince = nNow;
+            }
+        }
+    }
+
+public:
+    SimDownload() : vOwner(NUM_BLOCKS, -1), vTimeRequested(NUM_BLOCKS, 0), vReceived(NUM_BLOCKS, false),
+                    nFirstMissing(0), dAvgBlockSize(0), nNow(0)
+    {
+        for (int i = 0; i < 4; i++) {
+            vPeers.emplace_back(FAST_PEER);
+            vPeers.emplace_back(SLOW_PEER);
+        }
+    }
+
+    // Returns the simulated duration of the download, in microseconds
+    int64_t Run(bool fAdaptive)
+    {
+        while (nFirstMissing < NUM_BLOCKS) {
+            nNow += ROUND_TIME;
+            assert(nNow < 100000 * ROUND_TIME);
+            for (size_t i = 0; i < vPeers.size(); i++) {
+                if (vPeers[i].fConnected)
+                    Deliver(i);
+                else if (nNow >= vPeers[i].nReconnect)
+                    vPeers[i].Connect();
+            }
+            while (nFirstMissing < NUM_BLOCKS && vReceived[nFirstMissing])
+                nFirstMissing++;
+            for (size_t i = 0; i < vPeers.size(); i++) {
+                SimPeer& peer = vPeers[i];
+                if (!peer.fConnected)
+                    continue;
+                if (peer.nStallingSince && nNow > peer.nStallingSince + BLOCK_STALLING_TIMEOUT * 1000000) {
+                    Disconnect(i);
+                    continue;
+                }
+                RequestBlocks(i, fAdaptive);
+            }
+        }
+        return nNow;
+    }
+};
+
+} // anon namespace
+
+static void BlockDownload(benchmark::State& state, bool fAdaptive)
+{
+    int64_t nDuration = 0;
+    while (state.KeepRunning()) {
+        nDuration = SimDownload().Run(fAdaptive);
+    }
+    printf("%s: %d blocks of %u bytes from 4 fast and 4 slow peers in %.1fs\n", fAdaptive ? "BlockDownload_Adaptive" : "BlockDownload_Fixed",
+        NUM_BLOCKS, (unsigned int)BLOCK_SIZE, nDuration * 0.000001);
+}
+
+static void BlockDownload_Fixed(benchmark::State& state) { BlockDownload(state, false); }
+static void BlockDownload_Adaptive(benchmark::State& state) { BlockDownload(state, true); }
+
+BENCHMARK(BlockDownload_Fixed);
+BENCHMARK(BlockDownload_Adaptive);
@@ -51,6 +51,34 @@ static void SHA256_32b(benchmark::State& state)
     }
 }
 
+static void SHA256D64_1024(benchmark::State& state)
+{
+    std::vector<uint8_t> in(64 * 1024, 0);
+    while (state.KeepRunning()) {
+        SHA256D64(in.data(), in.data(), 1024);
+    }
+}
+
+/**
+ * Run a benchmark with only the given SHA256 implementations allowed. Where
+ * the CPU lacks them, this measures the generic code instead.
+ */
+static void WithSHA256(benchmark::State& state, int nAllowed, void (*bench)(benchmark::State&))
+{
+    SHA256AutoDetect(nAllowed);
+    bench(state);
+    SHA256AutoDetect();
+}
+
+static void SHA256_generic(benchmark::State& state) { WithSHA256(state, SHA256_GENERIC, SHA256); }
+static void SHA256_shani(benchmark::State& state) { WithSHA256(state, SHA256_USE_SHANI, SHA256); }
+static void SHA256_32b_generic(benchmark::State& state) { WithSHA256(state, SHA256_GENERIC, SHA256_32b); }
+static void SHA256_32b_shani(benchmark::State& state) { WithSHA256(state, SHA256_USE_SHANI, SHA256_32b); }
+static void SHA256D64_1024_generic(benchmark::State& state) { WithSHA256(state, SHA256_GENERIC, SHA256D64_1024); }
+static void SHA256D64_1024_sse41(benchmark::State& state) { WithSHA256(state, SHA256_USE_SSE41, SHA256D64_1024); }
+static void SHA256D64_1024_avx2(benchmark::State& state) { WithSHA256(state, SHA256_USE_AVX2, SHA256D64_1024); }
+static void SHA256D64_1024_shani(benchmark::State& state) { WithSHA256(state, SHA256_USE_SHANI, SHA256D64_1024); }
+
 static void SHA512(benchmark::State& state)
 {
     uint8_t hash[CSHA512::OUTPUT_SIZE];
@@ -76,3 +104,13 @@ BENCHMARK(SHA512);
 
 BENCHMARK(SHA256_32b);
 BENCHMARK(SipHash_32b);
+
+BENCHMARK(SHA256_generic);
+BENCHMARK(SHA256_shani);
+BENCHMARK(SHA256_32b_generic);
+BENCHMARK(SHA256_32b_shani);
+BENCHMARK(SHA256D64_1024);
+BENCHMARK(SHA256D64_1024_generic);
+BENCHMARK(SHA256D64_1024_sse41);
+BENCHMARK(SHA256D64_1024_avx2);
+BENCHMARK(SHA256D64_1024_shani);
@@ -0,0 +1,125 @@
+// Copyright (c) 2017 The Bitcoin Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "bench.h"
+#include "key.h"
+#include "keystore.h"
+#include "script/bitcoinconsensus.h"
+#include "script/sign.h"
+#include "script/standard.h"
+#include "streams.h"
+
+// Verification of a block's worth of transactions through libbitcoinconsensus,
+// as an indexer would do it: input by input, or a transaction at a time on
+// different numbers of threads. The spends are a mix of pay-to-pubkey-hash
+// and pay-to-script-hash 2-of-3 multisig, like those of recent blocks; the
+// outputs they spend are made here, as no block ships with its spent outputs.
+static const int NUM_TXS = 100;
+static const int INPUTS_PER_TX = 4;
+
+namespace {
+
+struct ConsensusBlock
+{
+    std::vector<CScript> vScriptPubKeys;
+    std::vector<CDataStream> vTxs;
+    std::vector<const unsigned char*> vScriptPubKeyPtrs;
+    std::vector<unsigned int> vScriptPubKeyLens;
+
+    ConsensusBlock()
+    {
+        CBasicKeyStore keystore;
+        std::vector<CPubKey> pubkeys;
+        for (int i = 0; i < 3; i++) {
+            CKey key;
+            key.MakeNewKey(true);
+            keystore.AddKey(key);
+            pubkeys.push_back(key.GetPubKey());
+        }
+        vScriptPubKeys.push_back(GetScriptForDestination(pubkeys[0].GetID()));
+        CScript redeemScript = GetScriptForMultisig(2, pubkeys);
+        keystore.AddCScript(redeemScript);
+        vScriptPubKeys.push_back(GetScriptForDestination(CScriptID(redeemScript)));
+
+        // Every fourth input is a multisig spend
+        CMutableTransaction funding;
+        funding.vin.resize(1);
+        funding.vout.resize(NUM_TXS * INPUTS_PER_TX);
+        for (size_t i = 0; i < funding.vout.size(); i++) {
+            funding.vout[i].nValue = 1;
+            funding.vout[i].scriptPubKey = vScriptPubKeys[i % INPUTS_PER_TX == INPUTS_PER_TX - 1];
+        }
+        const CTransaction fundingTx(funding);
+
+        for (int i = 0; i < NUM_TXS; i++) {
+            CMutableTransaction spend;
+            spend.vin.resize(INPUTS_PER_TX);
+            for (int j = 0; j < INPUTS_PER_TX; j++)
+                spend.vin[j].prevout = COutPoint(fundingTx.GetHash(), i * INPUTS_PER_TX + j);
+            spend.vout.resize(1);
+            spend.vout[0].nValue = INPUTS_PER_TX;
+            spend.vout[0].scriptPubKey = CScript() << OP_TRUE;
+            for (int j = 0; j < INPUTS_PER_TX; j++) {
+                bool fSigned = SignSignature(keystore, fundingTx, spend, j, SIGHASH_ALL);
+                assert(fSigned);
+            }
+            vTxs.emplace_back(SER_NETWORK, PROTOCOL_VERSION);
+            vTxs.back() << spend;
+        }
+
+        // The scripts spent by the inputs of every transaction, which are the same
+        for (int j = 0; j < INPUTS_PER_TX; j++) {
+            const CScript& script = vScriptPubKeys[j == INPUTS_PER_TX - 1];
+            vScriptPubKeyPtrs.push_back(script.data());
+            vScriptPubKeyLens.push_back(script.size());
+        }
+    }
+};
+
+const ConsensusBlock& GetConsensusBlock()
+{
+    static const ConsensusBlock block;
+    return block;
+}
+
+} // anon namespace
+
+static const unsigned int CONSENSUS_FLAGS = bitcoinconsensus_SCRIPT_FLAGS_VERIFY_P2SH | bitcoinconsensus_SCRIPT_FLAGS_VERIFY_DERSIG |
+                                            bitcoinconsensus_SCRIPT_FLAGS_VERIFY_CHECKLOCKTIMEVERIFY;
+
+static void VerifyConsensusInputs(benchmark::State& state)
+{
+    const ConsensusBlock& block = GetConsensusBlock();
+    while (state.KeepRunning()) {
+        for (const CDataStream& tx : block.vTxs) {
+            for (unsigned int nIn = 0; nIn < INPUTS_PER_TX; nIn++) {
+                bitcoinconsensus_error err;
+                int fOk = bitcoinconsensus_verify_script(block.vScriptPubKeyPtrs[nIn], block.vScriptPubKeyLens[nIn],
+                    (const unsigned char*)&tx[0], tx.size(), nIn, CONSENSUS_FLAGS, &err);
+                assert(fOk == 1 && err == bitcoinconsensus_ERR_OK);
+            }
+        }
+    }
+}
+
+static void VerifyConsensusTransactions(benchmark::State& state, unsigned int nThreads)
+{
+    const ConsensusBlock& block = GetConsensusBlock();
+    int results[INPUTS_PER_TX];
+    while (state.KeepRunning()) {
+        for (const CDataStream& tx : block.vTxs) {
+            bitcoinconsensus_error err;
+            int fOk = bitcoinconsensus_verify_transaction(block.vScriptPubKeyPtrs.data(), block.vScriptPubKeyLens.data(), NULL,
+                (const unsigned char*)&tx[0], tx.size(), INPUTS_PER_TX, CONSENSUS_FLAGS, nThreads, results, &err);
+            assert(fOk == 1 && err == bitcoinconsensus_ERR_OK);
+        }
+    }
+}
+
+static void VerifyConsensusTransactions_Threads1(benchmark::State& state) { VerifyConsensusTransactions(state, 1); }
+static void VerifyConsensusTransactions_Threads4(benchmark::State& state) { VerifyConsensusTransactions(state, 4); }
+
+BENCHMARK(VerifyConsensusInputs);
+BENCHMARK(VerifyConsensusTransactions_Threads1);
+BENCHMARK(VerifyConsensusTransactions_Threads4);
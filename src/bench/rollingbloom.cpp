@@ -6,6 +6,7 @@
 
 #include "bench.h"
 #include "bloom.h"
+#include "random.h"
 #include "utiltime.h"
 
 static void RollingBloom(benchmark::State& state)
@@ -41,3 +42,51 @@ static void RollingBloom(benchmark::State& state)
 }
 
 BENCHMARK(RollingBloom);
+
+// SendMessages looking up the transactions it could announce to a peer in the
+// peer's filterInventoryKnown (50000 entries, 0.0001% false positives): batches
+// of 35 (INVENTORY_BROADCAST_MAX) hashes, half of which the peer already knows.
+static const int INV_BATCH = 35;
+
+static void RollingBloomInvSetup(CRollingBloomFilter& filter, std::vector<uint256>& vBatches)
+{
+    std::vector<uint256> vKnown;
+    for (int i = 0; i < 50000; i++) {
+        vKnown.push_back(GetRandHash());
+        filter.insert(vKnown.back());
+    }
+    for (int i = 0; i < 1000 * INV_BATCH; i++)
+        vBatches.push_back(i % 2 ? vKnown[(i * 7919) % vKnown.size()] : GetRandHash());
+}
+
+static void RollingBloomInv(benchmark::State& state)
+{
+    CRollingBloomFilter filter(50000, 0.000001);
+    std::vector<uint256> vBatches;
+    RollingBloomInvSetup(filter, vBatches);
+    size_t nBatch = 0;
+    uint64_t match = 0;
+    while (state.KeepRunning()) {
+        const uint256* pBatch = &vBatches[(nBatch++ % 1000) * INV_BATCH];
+        for (int i = 0; i < INV_BATCH; i++)
+            match += filter.contains(pBatch[i]);
+    }
+}
+
+static void RollingBloomInvBulk(benchmark::State& state)
+{
+    CRollingBloomFilter filter(50000, 0.000001);
+    std::vector<uint256> vBatches;
+    RollingBloomInvSetup(filter, vBatches);
+    size_t nBatch = 0;
+    std::vector<uint256> vQuery;
+    std::vector<bool> vResult;
+    while (state.KeepRunning()) {
+        std::vector<uint256>::const_iterator it = vBatches.begin() + (nBatch++ % 1000) * INV_BATCH;
+        vQuery.assign(it, it + INV_BATCH);
+        filter.contains(vQuery, vResult);
+    }
+}
+
+BENCHMARK(RollingBloomInv);
+BENCHMARK(RollingBloomInvBulk);
@@ -0,0 +1,122 @@
+// Copyright (c) 2017 The Bitcoin Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "bench.h"
+#include "key.h"
+#include "keystore.h"
+#include "policy/policy.h"
+#include "pubkey.h"
+#include "script/interpreter.h"
+#include "script/sigcache.h"
+#include "script/sign.h"
+#include "script/standard.h"
+
+#include <atomic>
+#include <new>
+#include <stdio.h>
+#include <stdlib.h>
+
+// Heap allocations of the generic interpreter verifying a pay-to-pubkey-hash
+// and a pay-to-script-hash 2-of-3 multisig input, counted by replacing the
+// global operator new for this executable. Only allocations inside the
+// verifications VerifyScriptAllocs times are counted, and the other
+// benchmarks pay no more than a relaxed load per allocation. prevector's own heap
+// storage (that of scripts longer than 28 bytes) goes to malloc and is not
+// counted.
+static std::atomic<bool> fCountAllocations(false);
+static std::atomic<uint64_t> nAllocations(0);
+
+void* operator new(size_t size)
+{
+    if (fCountAllocations.load(std::memory_order_relaxed))
+        nAllocations.fetch_add(1, std::memory_order_relaxed);
+    void* p = malloc(size ? size : 1);
+    if (!p)
+        throw std::bad_alloc();
+    return p;
+}
+
+void operator delete(void* p) noexcept
+{
+    free(p);
+}
+
+namespace {
+
+struct ScriptSpends
+{
+    CScript scriptP2PKH;
+    CScript scriptMultisig;
+    CMutableTransaction spend;
+
+    ScriptSpends()
+    {
+        CBasicKeyStore keystore;
+        std::vector<CPubKey> pubkeys;
+        for (int i = 0; i < 3; i++) {
+            CKey key;
+            key.MakeNewKey(true);
+            keystore.AddKey(key);
+            pubkeys.push_back(key.GetPubKey());
+        }
+        scriptP2PKH = GetScriptForDestination(pubkeys[0].GetID());
+        CScript redeemScript = GetScriptForMultisig(2, pubkeys);
+        keystore.AddCScript(redeemScript);
+        scriptMultisig = GetScriptForDestination(CScriptID(redeemScript));
+
+        CMutableTransaction funding;
+        funding.vin.resize(1);
+        funding.vout.resize(2);
+        funding.vout[0].scriptPubKey = scriptP2PKH;
+        funding.vout[1].scriptPubKey = scriptMultisig;
+        const CTransaction fundingTx(funding);
+
+        spend.vin.resize(2);
+        spend.vin[0].prevout = COutPoint(fundingTx.GetHash(), 0);
+        spend.vin[1].prevout = COutPoint(fundingTx.GetHash(), 1);
+        spend.vout.resize(1);
+        spend.vout[0].scriptPubKey = CScript() << OP_TRUE;
+        for (unsigned int i = 0; i < spend.vin.size(); i++) {
+            bool fSigned = SignSignature(keystore, fundingTx, spend, i, SIGHASH_ALL);
+            assert(fSigned);
+        }
+    }
+};
+
+} // anon namespace
+
+static void VerifyScriptAllocs(benchmark::State& state, bool fMultisig)
+{
+    ECCVerifyHandle verifyHandle;
+    InitSignatureCache();
+    static const ScriptSpends spends;
+    const CTransaction tx(spends.spend);
+    const unsigned int nIn = fMultisig ? 1 : 0;
+    const CScript& scriptPubKey = fMultisig ? spends.scriptMultisig : spends.scriptP2PKH;
+    PrecomputedTransactionData txdata(tx);
+    CachingTransactionSignatureChecker checker(&tx, nIn, 0, true, txdata);
+    // Fill the signature cache
+    bool fOk = VerifyScriptGeneric(tx.vin[nIn].scriptSig, scriptPubKey, STANDARD_SCRIPT_VERIFY_FLAGS, checker);
+    assert(fOk);
+
+    uint64_t nVerified = 0;
+    uint64_t nAllocationsLoop = 0;
+    while (state.KeepRunning()) {
+        nAllocations.store(0, std::memory_order_relaxed);
+        fCountAllocations.store(true, std::memory_order_relaxed);
+        fOk = VerifyScriptGeneric(tx.vin[nIn].scriptSig, scriptPubKey, STANDARD_SCRIPT_VERIFY_FLAGS, checker);
+        fCountAllocations.store(false, std::memory_order_relaxed);
+        nAllocationsLoop += nAllocations.load(std::memory_order_relaxed);
+        assert(fOk);
+        nVerified++;
+    }
+    printf("%s: %.2f heap allocations per input\n", fMultisig ? "VerifyScriptAllocs_Multisig" : "VerifyScriptAllocs_P2PKH",
+        (double)nAllocationsLoop / nVerified);
+}
+
+static void VerifyScriptAllocs_P2PKH(benchmark::State& state) { VerifyScriptAllocs(state, false); }
+static void VerifyScriptAllocs_Multisig(benchmark::State& state) { VerifyScriptAllocs(state, true); }
+
+BENCHMARK(VerifyScriptAllocs_P2PKH);
+BENCHMARK(VerifyScriptAllocs_Multisig);
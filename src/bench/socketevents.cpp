@@ -0,0 +1,137 @@
+// Copyright (c) 2017 The Bitcoin Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "bench.h"
+#include "compat.h"
+#include "net.h"
+#include "netbase.h"
+#include "util.h"
+
+#include <iostream>
+
+#ifndef WIN32
+#include <netinet/in.h>
+#include <sys/socket.h>
+
+// Number of peers that have sent data in each round
+static const int ACTIVE_PEERS = 8;
+
+static void CloseSockets(std::vector<SOCKET>& vSockets)
+{
+    for (SOCKET& hSocket : vSockets)
+        CloseSocket(hSocket);
+    vSockets.clear();
+}
+
+// Open nPeers loopback TCP connections. vNodeSockets are the accepted ends,
+// as serviced by CConnman, vPeerSockets the connecting ends.
+static bool OpenLoopbackPeers(int nPeers, std::vector<SOCKET>& vNodeSockets, std::vector<SOCKET>& vPeerSockets)
+{
+    if (RaiseFileDescriptorLimit(2 * nPeers + 64) < 2 * nPeers + 64)
+        return false;
+
+    SOCKET hListenSocket = socket(AF_INET, SOCK_STREAM, IPPROTO_TCP);
+    if (hListenSocket == INVALID_SOCKET)
+        return false;
+    struct sockaddr_in addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    socklen_t len = sizeof(addr);
+    if (bind(hListenSocket, (struct sockaddr*)&addr, sizeof(addr)) == SOCKET_ERROR ||
+        listen(hListenSocket, SOMAXCONN) == SOCKET_ERROR ||
+        getsockname(hListenSocket, (struct sockaddr*)&addr, &len) == SOCKET_ERROR) {
+        CloseSocket(hListenSocket);
+        return false;
+    }
+
+    bool fSuccess = true;
+    for (int i = 0; i < nPeers && fSuccess; i++) {
+        SOCKET hPeerSocket = socket(AF_INET, SOCK_STREAM, IPPROTO_TCP);
+        if (hPeerSocket == INVALID_SOCKET) {
+            fSuccess = false;
+            break;
+        }
+        vPeerSockets.push_back(hPeerSocket);
+        if (connect(hPeerSocket, (struct sockaddr*)&addr, sizeof(addr)) == SOCKET_ERROR) {
+            fSuccess = false;
+            break;
+        }
+        SOCKET hNodeSocket = accept(hListenSocket, NULL, NULL);
+        if (hNodeSocket == INVALID_SOCKET) {
+            fSuccess = false;
+            break;
+        }
+        vNodeSockets.push_back(hNodeSocket);
+        fSuccess = SetSocketNonBlocking(hNodeSocket, true);
+    }
+    CloseSocket(hListenSocket);
+    if (!fSuccess) {
+        CloseSockets(vNodeSockets);
+        CloseSockets(vPeerSockets);
+    }
+    return fSuccess;
+}
+
+// One round of CConnman::ThreadSocketHandler on mostly idle peers: watch all
+// sockets for receiving, wait, and drain the ones that are ready.
+static void SocketEvents(benchmark::State& state, CSocketEvents::Mode mode, int nPeers)
+{
+    std::vector<SOCKET> vNodeSockets, vPeerSockets;
+    if (!OpenLoopbackPeers(nPeers, vNodeSockets, vPeerSockets)) {
+        std::cerr << "SocketEvents: could not open " << nPeers << " loopback peers" << std::endl;
+        return;
+    }
+    CSocketEvents events(mode);
+    if (events.GetMode() != mode) {
+        std::cerr << "SocketEvents: mode not available" << std::endl;
+        CloseSockets(vNodeSockets);
+        CloseSockets(vPeerSockets);
+        return;
+    }
+
+    const char chSend = 0;
+    char pchBuf[64];
+    size_t nRound = 0;
+    while (state.KeepRunning()) {
+        for (int i = 0; i < ACTIVE_PEERS; i++)
+            send(vPeerSockets[(nRound * ACTIVE_PEERS + i * 97) % nPeers], &chSend, 1, 0);
+        nRound++;
+
+        for (size_t i = 0; i < vNodeSockets.size(); i++)
+            events.Watch(vNodeSockets[i], i, true, false);
+        std::set<SOCKET> setRecv, setSend, setError;
+        events.Wait(SOCKET_EVENTS_TIMEOUT, setRecv, setSend, setError);
+        for (SOCKET hSocket : setRecv)
+            recv(hSocket, pchBuf, sizeof(pchBuf), MSG_DONTWAIT);
+    }
+
+    CloseSockets(vNodeSockets);
+    CloseSockets(vPeerSockets);
+}
+
+// Both ends of every connection live in this process, so select() can only
+// be given about FD_SETSIZE / 2 peers.
+static void SocketEventsSelect400(benchmark::State& state)
+{
+    SocketEvents(state, CSocketEvents::SOCKETEVENTS_SELECT, 400);
+}
+
+BENCHMARK(SocketEventsSelect400);
+
+#ifdef USE_EPOLL
+static void SocketEventsEpoll400(benchmark::State& state)
+{
+    SocketEvents(state, CSocketEvents::SOCKETEVENTS_EPOLL, 400);
+}
+
+static void SocketEventsEpoll4000(benchmark::State& state)
+{
+    SocketEvents(state, CSocketEvents::SOCKETEVENTS_EPOLL, 4000);
+}
+
+BENCHMARK(SocketEventsEpoll400);
+BENCHMARK(SocketEventsEpoll4000);
+#endif
+#endif // WIN32
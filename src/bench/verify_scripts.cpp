@@ -0,0 +1,120 @@
+// Copyright (c) 2017 The Bitcoin Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "bench.h"
+#include "checkqueue.h"
+#include "coins.h"
+#include "key.h"
+#include "keystore.h"
+#include "pubkey.h"
+#include "script/sigcache.h"
+#include "script/sign.h"
+#include "script/standard.h"
+#include "validation.h"
+
+#include <boost/thread/thread.hpp>
+
+// Script verification of a block's worth of pay-to-pubkey-hash spends, as
+// ConnectBlock does it, with the check queue at different -par settings.
+static const int NUM_TXS = 250;
+static const int INPUTS_PER_TX = 4;
+static const int QUEUE_BATCH_SIZE = 128;
+
+namespace {
+
+struct BlockSpends
+{
+    CCoins coins;
+    std::vector<CTransaction> vTxs;
+
+    BlockSpends()
+    {
+        CBasicKeyStore keystore;
+        CKey key;
+        key.MakeNewKey(true);
+        keystore.AddKey(key);
+
+        CMutableTransaction funding;
+        funding.vin.resize(1);
+        funding.vout.resize(NUM_TXS * INPUTS_PER_TX);
+        for (CTxOut& out : funding.vout) {
+            out.nValue = 1;
+            out.scriptPubKey = GetScriptForDestination(key.GetPubKey().GetID());
+        }
+        const CTransaction fundingTx(funding);
+        coins = CCoins(fundingTx, 1);
+
+        for (int i = 0; i < NUM_TXS; i++) {
+            CMutableTransaction spend;
+            spend.vin.resize(INPUTS_PER_TX);
+            for (int j = 0; j < INPUTS_PER_TX; j++)
+                spend.vin[j].prevout = COutPoint(fundingTx.GetHash(), i * INPUTS_PER_TX + j);
+            spend.vout.resize(1);
+            spend.vout[0].nValue = INPUTS_PER_TX;
+            spend.vout[0].scriptPubKey = CScript() << OP_TRUE;
+            for (int j = 0; j < INPUTS_PER_TX; j++) {
+                bool fSigned = SignSignature(keystore, fundingTx, spend, j, SIGHASH_ALL);
+                assert(fSigned);
+            }
+            vTxs.push_back(CTransaction(spend));
+        }
+    }
+};
+
+const BlockSpends& GetBlockSpends()
+{
+    static const BlockSpends spends;
+    return spends;
+}
+
+} // anon namespace
+
+static void VerifyBlockScripts(benchmark::State& state, int nThreads, bool fBatch)
+{
+    ECCVerifyHandle verifyHandle;
+    InitSignatureCache();
+    const BlockSpends& spends = GetBlockSpends();
+    const unsigned int flags = SCRIPT_VERIFY_P2SH | SCRIPT_VERIFY_DERSIG | SCRIPT_VERIFY_CHECKLOCKTIMEVERIFY;
+    const bool fBatchBefore = fBatchVerify;
+    fBatchVerify = fBatch;
+
+    CCheckQueue<CScriptCheck> queue(QUEUE_BATCH_SIZE);
+    boost::thread_group tg;
+    for (int i = 0; i < nThreads - 1; i++)
+        tg.create_thread([&]{queue.Thread();});
+
+    while (state.KeepRunning()) {
+        CCheckQueueControl<CScriptCheck> control(&queue);
+        std::vector<PrecomputedTransactionData> txdata;
+        txdata.reserve(spends.vTxs.size());
+        for (const CTransaction& tx : spends.vTxs) {
+            txdata.emplace_back(tx);
+            std::vector<CScriptCheck> vChecks(tx.vin.size());
+            for (unsigned int i = 0; i < tx.vin.size(); i++) {
+                CScriptCheck check(spends.coins, tx, i, flags, false, &txdata.back());
+                check.swap(vChecks[i]);
+            }
+            control.Add(vChecks);
+        }
+        bool fOk = control.Wait();
+        assert(fOk);
+    }
+    tg.interrupt_all();
+    tg.join_all();
+    fBatchVerify = fBatchBefore;
+}
+
+static void VerifyBlockScripts_Par1(benchmark::State& state) { VerifyBlockScripts(state, 1, true); }
+static void VerifyBlockScripts_Par4(benchmark::State& state) { VerifyBlockScripts(state, 4, true); }
+static void VerifyBlockScripts_Par16(benchmark::State& state) { VerifyBlockScripts(state, 16, true); }
+static void VerifyBlockScripts_Par1_NoBatch(benchmark::State& state) { VerifyBlockScripts(state, 1, false); }
+static void VerifyBlockScripts_Par4_NoBatch(benchmark::State& state) { VerifyBlockScripts(state, 4, false); }
+static void VerifyBlockScripts_Par16_NoBatch(benchmark::State& state) { VerifyBlockScripts(state, 16, false); }
+
+BENCHMARK(VerifyBlockScripts_Par1);
+BENCHMARK(VerifyBlockScripts_Par4);
+BENCHMARK(VerifyBlockScripts_Par16);
+BENCHMARK(VerifyBlockScripts_Par1_NoBatch);
+BENCHMARK(VerifyBlockScripts_Par4_NoBatch);
+BENCHMARK(VerifyBlockScripts_Par16_NoBatch);
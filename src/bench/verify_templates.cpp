@@ -0,0 +1,128 @@
+// Copyright (c) 2017 The Bitcoin Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "bench.h"
+#include "key.h"
+#include "keystore.h"
+#include "policy/policy.h"
+#include "pubkey.h"
+#include "script/interpreter.h"
+#include "script/sigcache.h"
+#include "script/sign.h"
+#include "script/standard.h"
+
+// Script verification of a block's worth of standard spends, pay-to-pubkey-hash
+// and pay-to-script-hash 2-of-3 multisig, through the templates and through
+// the generic interpreter. The signatures are in the signature cache, as they
+// are when a block's transactions were in the mempool, so that the script
+// evaluation around them shows.
+static const int NUM_P2PKH_TXS = 200;
+static const int NUM_MULTISIG_TXS = 50;
+static const int INPUTS_PER_TX = 2;
+
+namespace {
+
+struct StandardSpends
+{
+    std::vector<CScript> vScriptPubKeys;
+    std::vector<CTransaction> vTxs;
+    std::vector<PrecomputedTransactionData> vTxData;
+
+    StandardSpends()
+    {
+        // The multisig spends are signed by the last two keys, so that every
+        // signature matches the first key it is tried with
+        CBasicKeyStore keystore;
+        std::vector<CPubKey> pubkeys;
+        for (int i = 0; i < 4; i++) {
+            CKey key;
+            key.MakeNewKey(true);
+            if (i > 0)
+                keystore.AddKey(key);
+            pubkeys.push_back(key.GetPubKey());
+        }
+        vScriptPubKeys.push_back(GetScriptForDestination(pubkeys[1].GetID()));
+        pubkeys.erase(pubkeys.begin() + 1);
+        CScript redeemScript = GetScriptForMultisig(2, pubkeys);
+        keystore.AddCScript(redeemScript);
+        vScriptPubKeys.push_back(GetScriptForDestination(CScriptID(redeemScript)));
+
+        CMutableTransaction funding;
+        funding.vin.resize(1);
+        funding.vout.resize((NUM_P2PKH_TXS + NUM_MULTISIG_TXS) * INPUTS_PER_TX);
+        for (size_t i = 0; i < funding.vout.size(); i++) {
+            funding.vout[i].nValue = 1;
+            funding.vout[i].scriptPubKey = vScriptPubKeys[i < NUM_P2PKH_TXS * INPUTS_PER_TX ? 0 : 1];
+        }
+        const CTransaction fundingTx(funding);
+
+        vTxs.reserve(NUM_P2PKH_TXS + NUM_MULTISIG_TXS);
+        for (int i = 0; i < NUM_P2PKH_TXS + NUM_MULTISIG_TXS; i++) {
+            CMutableTransaction spend;
+            spend.vin.resize(INPUTS_PER_TX);
+            for (int j = 0; j < INPUTS_PER_TX; j++)
+                spend.vin[j].prevout = COutPoint(fundingTx.GetHash(), i * INPUTS_PER_TX + j);
+            spend.vout.resize(1);
+            spend.vout[0].nValue = INPUTS_PER_TX;
+            spend.vout[0].scriptPubKey = CScript() << OP_TRUE;
+            for (int j = 0; j < INPUTS_PER_TX; j++) {
+                bool fSigned = SignSignature(keystore, fundingTx, spend, j, SIGHASH_ALL);
+                assert(fSigned);
+            }
+            vTxs.push_back(CTransaction(spend));
+        }
+        vTxData.reserve(vTxs.size());
+        for (const CTransaction& tx : vTxs)
+            vTxData.emplace_back(tx);
+    }
+
+    const CScript& ScriptPubKey(int nTx) const
+    {
+        return vScriptPubKeys[nTx < NUM_P2PKH_TXS ? 0 : 1];
+    }
+};
+
+StandardSpends& GetStandardSpends()
+{
+    static StandardSpends spends;
+    return spends;
+}
+
+bool VerifySpends(StandardSpends& spends, bool fTemplates)
+{
+    const unsigned int flags = STANDARD_SCRIPT_VERIFY_FLAGS;
+    for (size_t i = 0; i < spends.vTxs.size(); i++) {
+        const CTransaction& tx = spends.vTxs[i];
+        for (unsigned int j = 0; j < tx.vin.size(); j++) {
+            CachingTransactionSignatureChecker checker(&tx, j, 1, true, spends.vTxData[i]);
+            bool fOk = fTemplates ? VerifyScript(tx.vin[j].scriptSig, spends.ScriptPubKey(i), flags, checker)
+                                  : VerifyScriptGeneric(tx.vin[j].scriptSig, spends.ScriptPubKey(i), flags, checker);
+            if (!fOk)
+                return false;
+        }
+    }
+    return true;
+}
+
+} // anon namespace
+
+static void VerifyStandardSpends(benchmark::State& state, bool fTemplates)
+{
+    ECCVerifyHandle verifyHandle;
+    InitSignatureCache();
+    StandardSpends& spends = GetStandardSpends();
+    // Fill the signature cache
+    bool fOk = VerifySpends(spends, fTemplates);
+    assert(fOk);
+    while (state.KeepRunning()) {
+        fOk = VerifySpends(spends, fTemplates);
+        assert(fOk);
+    }
+}
+
+static void VerifyStandardSpends_Templates(benchmark::State& state) { VerifyStandardSpends(state, true); }
+static void VerifyStandardSpends_Generic(benchmark::State& state) { VerifyStandardSpends(state, false); }
+
+BENCHMARK(VerifyStandardSpends_Templates);
+BENCHMARK(VerifyStandardSpends_Generic);
@@ -104,6 +104,8 @@ ReadStatus PartiallyDownloadedBlock::InitData(const CBlockHeaderAndShortTxIDs& c
         return READ_STATUS_FAILED; // Short ID collision
 
     std::vector<bool> have_txn(txn_available.size());
+    // Whether the transaction in each slot came from extra_txn rather than the mempool
+    std::vector<bool> from_extra(txn_available.size());
     {
     LOCK(pool->cs);
     const std::vector<std::pair<uint256, CTxMemPool::txiter> >& vTxHashes = pool->vTxHashes;
@@ -140,6 +142,7 @@ ReadStatus PartiallyDownloadedBlock::InitData(const CBlockHeaderAndShortTxIDs& c
             if (!have_txn[idit->second]) {
                 txn_available[idit->second] = extra_txn[i].second;
                 have_txn[idit->second]  = true;
+                from_extra[idit->second] = true;
                 mempool_count++;
                 extra_count++;
             } else {
@@ -153,7 +156,8 @@ ReadStatus PartiallyDownloadedBlock::InitData(const CBlockHeaderAndShortTxIDs& c
                         txn_available[idit->second]->GetHash() != extra_txn[i].second->GetHash()) {
                     txn_available[idit->second].reset();
                     mempool_count--;
-                    extra_count--;
+                    if (from_extra[idit->second])
+                        extra_count--;
                 }
             }
         }
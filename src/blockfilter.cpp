@@ -0,0 +1,294 @@
+// Copyright (c) 2017 The Bitcoin Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "blockfilter.h"
+
+#include "hash.h"
+#include "primitives/block.h"
+#include "script/script.h"
+#include "streams.h"
+#include "undo.h"
+#include "version.h"
+
+#include <algorithm>
+#include <limits>
+#include <stdexcept>
+
+/** Writes bits to a byte vector, most significant bit first */
+class BitStreamWriter
+{
+private:
+    std::vector<unsigned char>& vData;
+    uint8_t nBuffer;
+    int nOffset; //!< Number of bits in nBuffer
+
+public:
+    BitStreamWriter(std::vector<unsigned char>& vDataIn) : vData(vDataIn), nBuffer(0), nOffset(0) {}
+
+    ~BitStreamWriter() { Flush(); }
+
+    /** Write the nBits least significant bits of data */
+    void Write(uint64_t data, int nBits) {
+        while (nBits > 0) {
+            int nTake = std::min(8 - nOffset, nBits);
+            nBuffer |= ((data >> (nBits - nTake)) & ((1 << nTake) - 1)) << (8 - nOffset - nTake);
+            nOffset += nTake;
+            nBits -= nTake;
+            if (nOffset == 8)
+                Flush();
+        }
+    }
+
+    /** Write out the partial last byte, padded with zero bits */
+    void Flush() {
+        if (nOffset == 0)
+            return;
+        vData.push_back(nBuffer);
+        nBuffer = 0;
+        nOffset = 0;
+    }
+};
+
+/** Reads bits written by BitStreamWriter, starting at byte nPos */
+class BitStreamReader
+{
+private:
+    const std::vector<unsigned char>& vData;
+    size_t nPos;
+    int nOffset; //!< Number of bits of vData[nPos] already read
+
+public:
+    BitStreamReader(const std::vector<unsigned char>& vDataIn, size_t nPosIn) : vData(vDataIn), nPos(nPosIn), nOffset(0) {}
+
+    uint64_t Read(int nBits) {
+        uint64_t data = 0;
+        while (nBits > 0) {
+            if (nPos >= vData.size())
+                throw std::ios_base::failure("end of filter data");
+            int nTake = std::min(8 - nOffset, nBits);
+            data = (data << nTake) | ((vData[nPos] >> (8 - nOffset - nTake)) & ((1 << nTake) - 1));
+            nOffset += nTake;
+            nBits -= nTake;
+            if (nOffset == 8) {
+                nPos++;
+                nOffset = 0;
+            }
+        }
+        return data;
+    }
+};
+
+static void GolombRiceEncode(BitStreamWriter& bitwriter, uint8_t nP, uint64_t x)
+{
+    // Quotient in unary, as ones terminated by a zero
+    uint64_t q = x >> nP;
+    while (q > 0) {
+        int nBits = q <= 64 ? (int)q : 64;
+        bitwriter.Write(~0ULL, nBits);
+        q -= nBits;
+    }
+    bitwriter.Write(0, 1);
+    bitwriter.Write(x, nP);
+}
+
+static uint64_t GolombRiceDecode(BitStreamReader& bitreader, uint8_t nP)
+{
+    uint64_t q = 0;
+    while (bitreader.Read(1) == 1)
+        q++;
+    uint64_t r = bitreader.Read(nP);
+    return (q << nP) + r;
+}
+
+/** (x * n) >> 64, mapping a uniformly distributed x into [0, n) without division */
+static uint64_t MapIntoRange(uint64_t x, uint64_t n)
+{
+#ifdef __SIZEOF_INT128__
+    return (uint64_t)(((unsigned __int128)x * (unsigned __int128)n) >> 64);
+#else
+    uint64_t xHi = x >> 32, xLo = x & 0xFFFFFFFF;
+    uint64_t nHi = n >> 32, nLo = n & 0xFFFFFFFF;
+    uint64_t lolo = xLo * nLo, lohi = xLo * nHi, hilo = xHi * nLo, hihi = xHi * nHi;
+    uint64_t mid = (lolo >> 32) + (lohi & 0xFFFFFFFF) + (hilo & 0xFFFFFFFF);
+    return hihi + (lohi >> 32) + (hilo >> 32) + (mid >> 32);
+#endif
+}
+
+uint64_t GCSFilter::HashToRange(const Element& element) const
+{
+    uint64_t hash = CSipHasher(nSipK0, nSipK1).Write(element.data(), element.size()).Finalize();
+    return MapIntoRange(hash, nF);
+}
+
+std::vector<uint64_t> GCSFilter::BuildHashedSet(const ElementSet& elements) const
+{
+    std::vector<uint64_t> vHashes;
+    vHashes.reserve(elements.size());
+    for (const Element& element : elements)
+        vHashes.push_back(HashToRange(element));
+    std::sort(vHashes.begin(), vHashes.end());
+    return vHashes;
+}
+
+GCSFilter::GCSFilter(uint64_t nSipK0In, uint64_t nSipK1In, uint8_t nPIn, uint32_t nMIn)
+    : nSipK0(nSipK0In), nSipK1(nSipK1In), nP(nPIn), nM(nMIn), nN(0), nF(0)
+{
+    CVectorWriter writer(SER_NETWORK, PROTOCOL_VERSION, vEncoded, 0);
+    WriteCompactSize(writer, nN);
+}
+
+GCSFilter::GCSFilter(uint64_t nSipK0In, uint64_t nSipK1In, uint8_t nPIn, uint32_t nMIn, const std::vector<unsigned char>& vEncodedIn)
+    : nSipK0(nSipK0In), nSipK1(nSipK1In), nP(nPIn), nM(nMIn), vEncoded(vEncodedIn)
+{
+    CDataStream stream(vEncoded, SER_NETWORK, PROTOCOL_VERSION);
+    uint64_t nElements = ReadCompactSize(stream);
+    if (nElements > std::numeric_limits<uint32_t>::max())
+        throw std::ios_base::failure("N must be < 2^32");
+    nN = nElements;
+    nF = (uint64_t)nN * nM;
+
+    // Decode all elements to check the encoding is complete
+    BitStreamReader bitreader(vEncoded, vEncoded.size() - stream.size());
+    for (uint32_t i = 0; i < nN; i++)
+        GolombRiceDecode(bitreader, nP);
+}
+
+GCSFilter::GCSFilter(uint64_t nSipK0In, uint64_t nSipK1In, uint8_t nPIn, uint32_t nMIn, const ElementSet& elements)
+    : nSipK0(nSipK0In), nSipK1(nSipK1In), nP(nPIn), nM(nMIn)
+{
+    if (elements.size() > std::numeric_limits<uint32_t>::max())
+        throw std::invalid_argument("N must be < 2^32");
+    nN = elements.size();
+    nF = (uint64_t)nN * nM;
+
+    CVectorWriter writer(SER_NETWORK, PROTOCOL_VERSION, vEncoded, 0);
+    WriteCompactSize(writer, nN);
+    BitStreamWriter bitwriter(vEncoded);
+    uint64_t nLast = 0;
+    for (uint64_t value : BuildHashedSet(elements)) {
+        GolombRiceEncode(bitwriter, nP, value - nLast);
+        nLast = value;
+    }
+}
+
+bool GCSFilter::MatchInternal(const uint64_t* pHashes, size_t nHashes) const
+{
+    CDataStream stream(vEncoded, SER_NETWORK, PROTOCOL_VERSION);
+    ReadCompactSize(stream);
+    BitStreamReader bitreader(vEncoded, vEncoded.size() - stream.size());
+
+    // Walk the filter and the sorted query hashes in step
+    uint64_t value = 0;
+    size_t nHash = 0;
+    for (uint32_t i = 0; i < nN; i++) {
+        value += GolombRiceDecode(bitreader, nP);
+        while (true) {
+            if (nHash == nHashes)
+                return false;
+            if (pHashes[nHash] == value)
+                return true;
+            if (pHashes[nHash] > value)
+                break;
+            nHash++;
+        }
+    }
+    return false;
+}
+
+bool GCSFilter::Match(const Element& element) const
+{
+    uint64_t query = HashToRange(element);
+    return MatchInternal(&query, 1);
+}
+
+bool GCSFilter::MatchAny(const ElementSet& elements) const
+{
+    const std::vector<uint64_t> vQueries = BuildHashedSet(elements);
+    return MatchInternal(vQueries.data(), vQueries.size());
+}
+
+std::string BlockFilterTypeName(BlockFilterType filterType)
+{
+    switch (filterType) {
+    case BASIC_FILTER: return "basic";
+    }
+    return "";
+}
+
+bool BlockFilterTypeByName(const std::string& name, BlockFilterType& filterType)
+{
+    if (name == "basic") {
+        filterType = BASIC_FILTER;
+        return true;
+    }
+    return false;
+}
+
+GCSFilter::ElementSet BasicFilterElements(const CBlock& block, const CBlockUndo& blockUndo)
+{
+    GCSFilter::ElementSet elements;
+
+    for (const CTransactionRef& tx : block.vtx) {
+        for (const CTxOut& txout : tx->vout) {
+            const CScript& script = txout.scriptPubKey;
+            if (script.empty() || script[0] == OP_RETURN)
+                continue;
+            elements.emplace(script.begin(), script.end());
+        }
+    }
+
+    for (const CTxUndo& txundo : blockUndo.vtxundo) {
+        for (const CTxInUndo& prevout : txundo.vprevout) {
+            const CScript& script = prevout.txout.scriptPubKey;
+            if (script.empty())
+                continue;
+            elements.emplace(script.begin(), script.end());
+        }
+    }
+
+    return elements;
+}
+
+bool BlockFilter::BuildParams(uint8_t& nP, uint32_t& nM) const
+{
+    switch (filterType) {
+    case BASIC_FILTER:
+        nP = BASIC_FILTER_P;
+        nM = BASIC_FILTER_M;
+        return true;
+    }
+    return false;
+}
+
+BlockFilter::BlockFilter(BlockFilterType filterTypeIn, const uint256& hashBlockIn, const std::vector<unsigned char>& vEncoded)
+    : filterType(filterTypeIn), hashBlock(hashBlockIn)
+{
+    uint8_t nP;
+    uint32_t nM;
+    if (!BuildParams(nP, nM))
+        throw std::ios_base::failure("unknown filter type");
+    filter = GCSFilter(hashBlock.GetUint64(0), hashBlock.GetUint64(1), nP, nM, vEncoded);
+}
+
+BlockFilter::BlockFilter(BlockFilterType filterTypeIn, const CBlock& block, const CBlockUndo& blockUndo)
+    : filterType(filterTypeIn), hashBlock(block.GetHash())
+{
+    uint8_t nP;
+    uint32_t nM;
+    if (!BuildParams(nP, nM))
+        throw std::invalid_argument("unknown filter type");
+    filter = GCSFilter(hashBlock.GetUint64(0), hashBlock.GetUint64(1), nP, nM, BasicFilterElements(block, blockUndo));
+}
+
+uint256 BlockFilter::GetHash() const
+{
+    const std::vector<unsigned char>& vEncoded = GetEncodedFilter();
+    return Hash(vEncoded.begin(), vEncoded.end());
+}
+
+uint256 BlockFilter::ComputeHeader(const uint256& prevHeader) const
+{
+    const uint256 filterHash = GetHash();
+    return Hash(filterHash.begin(), filterHash.end(), prevHeader.begin(), prevHeader.end());
+}
@@ -0,0 +1,142 @@
+// Copyright (c) 2017 The Bitcoin Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#ifndef BITCOIN_BLOCKFILTER_H
+#define BITCOIN_BLOCKFILTER_H
+
+#include "serialize.h"
+#include "uint256.h"
+
+#include <set>
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+class CBlock;
+class CBlockUndo;
+
+/**
+ * Golomb-coded set (BIP 158): a compact probabilistic set of byte strings.
+ *
+ * Elements are hashed with SipHash-2-4 keyed by (nSipK0, nSipK1) into the
+ * range [0, N * M), sorted, and the differences between consecutive values
+ * written with Golomb-Rice coding of parameter P. Membership tests have a
+ * false positive rate of about 1/M.
+ */
+class GCSFilter
+{
+public:
+    typedef std::vector<unsigned char> Element;
+    typedef std::set<Element> ElementSet;
+
+private:
+    uint64_t nSipK0;
+    uint64_t nSipK1;
+    uint8_t nP;
+    uint32_t nM;
+    uint32_t nN;
+    uint64_t nF; //!< Range of element hashes, nN * nM
+    std::vector<unsigned char> vEncoded;
+
+    uint64_t HashToRange(const Element& element) const;
+    std::vector<uint64_t> BuildHashedSet(const ElementSet& elements) const;
+    /** Whether any of the sorted element hashes in pHashes[0..nHashes) is in the filter */
+    bool MatchInternal(const uint64_t* pHashes, size_t nHashes) const;
+
+public:
+    /** Construct an empty filter */
+    GCSFilter(uint64_t nSipK0In = 0, uint64_t nSipK1In = 0, uint8_t nPIn = 0, uint32_t nMIn = 0);
+
+    /** Reconstruct a filter from its encoding. Throws std::ios_base::failure if it is malformed. */
+    GCSFilter(uint64_t nSipK0In, uint64_t nSipK1In, uint8_t nPIn, uint32_t nMIn, const std::vector<unsigned char>& vEncodedIn);
+
+    /** Build a filter holding elements */
+    GCSFilter(uint64_t nSipK0In, uint64_t nSipK1In, uint8_t nPIn, uint32_t nMIn, const ElementSet& elements);
+
+    uint32_t GetN() const { return nN; }
+    const std::vector<unsigned char>& GetEncoded() const { return vEncoded; }
+
+    /** Whether element is in the set, or a false positive */
+    bool Match(const Element& element) const;
+
+    /** Whether any of elements is in the set, faster than calling Match for each */
+    bool MatchAny(const ElementSet& elements) const;
+};
+
+/** Filter types defined by BIP 158 */
+enum BlockFilterType : uint8_t
+{
+    BASIC_FILTER = 0,
+};
+
+/** Golomb-Rice parameter of basic filters */
+static const uint8_t BASIC_FILTER_P = 19;
+/** Inverse false positive rate of basic filters */
+static const uint32_t BASIC_FILTER_M = 784931;
+
+/** Name of a filter type as used in RPC, or "" if unknown */
+std::string BlockFilterTypeName(BlockFilterType filterType);
+/** Look up a filter type by name, returning false if there is none */
+bool BlockFilterTypeByName(const std::string& name, BlockFilterType& filterType);
+
+/**
+ * Elements of the basic filter of a block: every scriptPubKey created in the
+ * block except empty and OP_RETURN ones, and every scriptPubKey spent in it.
+ */
+GCSFilter::ElementSet BasicFilterElements(const CBlock& block, const CBlockUndo& blockUndo);
+
+/**
+ * BIP 158 filter of a block, keyed by the block hash, as sent in cfilter
+ * messages.
+ */
+class BlockFilter
+{
+private:
+    BlockFilterType filterType;
+    uint256 hashBlock;
+    GCSFilter filter;
+
+    bool BuildParams(uint8_t& nP, uint32_t& nM) const;
+
+public:
+    BlockFilter() : filterType(BASIC_FILTER) {}
+
+    /** Reconstruct a filter from its encoding. Throws std::ios_base::failure if it is malformed. */
+    BlockFilter(BlockFilterType filterTypeIn, const uint256& hashBlockIn, const std::vector<unsigned char>& vEncoded);
+
+    /** Compute the filter of a block, given the outputs it spends */
+    BlockFilter(BlockFilterType filterTypeIn, const CBlock& block, const CBlockUndo& blockUndo);
+
+    BlockFilterType GetFilterType() const { return filterType; }
+    const uint256& GetBlockHash() const { return hashBlock; }
+    const GCSFilter& GetFilter() const { return filter; }
+    const std::vector<unsigned char>& GetEncodedFilter() const { return filter.GetEncoded(); }
+
+    /** Double SHA256 of the encoded filter */
+    uint256 GetHash() const;
+
+    /** Header committing to this filter and, through the previous header, to all filters before it */
+    uint256 ComputeHeader(const uint256& prevHeader) const;
+
+    template <typename Stream>
+    void Serialize(Stream& s) const {
+        s << (uint8_t)filterType << hashBlock << filter.GetEncoded();
+    }
+
+    template <typename Stream>
+    void Unserialize(Stream& s) {
+        uint8_t nFilterType;
+        std::vector<unsigned char> vEncoded;
+        s >> nFilterType >> hashBlock >> vEncoded;
+        filterType = (BlockFilterType)nFilterType;
+
+        uint8_t nP;
+        uint32_t nM;
+        if (!BuildParams(nP, nM))
+            throw std::ios_base::failure("unknown filter type");
+        filter = GCSFilter(hashBlock.GetUint64(0), hashBlock.GetUint64(1), nP, nM, vEncoded);
+    }
+};
+
+#endif // BITCOIN_BLOCKFILTER_H
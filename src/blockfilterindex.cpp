@@ -0,0 +1,204 @@
+// Copyright (c) 2017 The Bitcoin Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "blockfilterindex.h"
+
+#include "chain.h"
+#include "chainparams.h"
+#include "undo.h"
+#include "util.h"
+#include "validation.h"
+
+#include <boost/thread.hpp>
+
+static const char DB_FILTER = 'f';
+static const char DB_FILTER_HASH = 'h';
+static const char DB_BEST_BLOCK = 'B';
+
+/** Filter hash and header of a block */
+struct CFilterHashEntry
+{
+    uint256 hash;
+    uint256 header;
+
+    ADD_SERIALIZE_METHODS;
+
+    template <typename Stream, typename Operation>
+    inline void SerializationOp(Stream& s, Operation ser_action) {
+        READWRITE(hash);
+        READWRITE(header);
+    }
+};
+
+std::unique_ptr<CBlockFilterIndex> g_blockfilterindex;
+
+CBlockFilterIndex::CBlockFilterIndex(BlockFilterType filterTypeIn, const boost::filesystem::path& path, size_t nCacheSize, bool fMemory, bool fWipe)
+    : filterType(filterTypeIn), db(path, nCacheSize, fMemory, fWipe), pindexBest(NULL), fWake(false)
+{
+}
+
+bool CBlockFilterIndex::Init()
+{
+    LOCK(cs_main);
+    uint256 hashBest;
+    if (!db.Read(DB_BEST_BLOCK, hashBest))
+        return true;
+    BlockMap::const_iterator it = mapBlockIndex.find(hashBest);
+    if (it == mapBlockIndex.end())
+        return error("%s: %s filter index is ahead of the block index", __func__, BlockFilterTypeName(filterType));
+    pindexBest = it->second;
+    return true;
+}
+
+int CBlockFilterIndex::GetBestHeight() const
+{
+    LOCK(cs_main);
+    return pindexBest ? pindexBest->nHeight : -1;
+}
+
+const CBlockIndex* CBlockFilterIndex::NextToIndex() const
+{
+    AssertLockHeld(cs_main);
+    const CBlockIndex* pindexNext;
+    if (pindexBest == NULL)
+        pindexNext = chainActive.Genesis();
+    else if (chainActive.Contains(pindexBest))
+        pindexNext = chainActive.Next(pindexBest);
+    else
+        pindexNext = chainActive.Next(chainActive.FindFork(pindexBest));
+    // Undo data is written along with connecting the block
+    if (pindexNext && pindexNext->pprev && !(pindexNext->nStatus & BLOCK_HAVE_UNDO))
+        return NULL;
+    return pindexNext;
+}
+
+bool CBlockFilterIndex::WriteBlock(const CBlockIndex* pindex)
+{
+    CDiskBlockPos posBlock, posUndo;
+    {
+        LOCK(cs_main);
+        posBlock = pindex->GetBlockPos();
+        posUndo = pindex->GetUndoPos();
+    }
+
+    CBlock block;
+    if (!ReadBlockFromDisk(block, posBlock, Params().GetConsensus()) || block.GetHash() != pindex->GetBlockHash())
+        return error("%s: failed to read block %s from disk", __func__, pindex->GetBlockHash().ToString());
+    CBlockUndo blockUndo;
+    if (pindex->pprev && !UndoReadFromDisk(blockUndo, posUndo, pindex->pprev->GetBlockHash()))
+        return error("%s: failed to read undo data of block %s from disk", __func__, pindex->GetBlockHash().ToString());
+
+    CFilterHashEntry prevEntry;
+    if (pindex->pprev && !db.Read(std::make_pair(DB_FILTER_HASH, pindex->pprev->GetBlockHash()), prevEntry))
+        return error("%s: previous filter of block %s not found", __func__, pindex->GetBlockHash().ToString());
+
+    BlockFilter filter(filterType, block, blockUndo);
+    CFilterHashEntry entry;
+    entry.hash = filter.GetHash();
+    entry.header = filter.ComputeHeader(prevEntry.header);
+
+    CDBBatch batch(db);
+    batch.Write(std::make_pair(DB_FILTER, pindex->GetBlockHash()), filter.GetEncodedFilter());
+    batch.Write(std::make_pair(DB_FILTER_HASH, pindex->GetBlockHash()), entry);
+    batch.Write(DB_BEST_BLOCK, pindex->GetBlockHash());
+    return db.WriteBatch(batch);
+}
+
+void CBlockFilterIndex::ThreadSync()
+{
+    const std::string strName = BlockFilterTypeName(filterType);
+    bool fSynced = false;
+    while (true) {
+        boost::this_thread::interruption_point();
+
+        const CBlockIndex* pindexNext;
+        {
+            LOCK(cs_main);
+            pindexNext = NextToIndex();
+        }
+
+        if (pindexNext == NULL) {
+            if (!fSynced) {
+                LogPrintf("%s filter index synced to height %d\n", strName, GetBestHeight());
+                fSynced = true;
+            }
+            boost::unique_lock<boost::mutex> lock(mutexWake);
+            if (!fWake)
+                condWake.timed_wait(lock, boost::posix_time::seconds(1));
+            fWake = false;
+            continue;
+        }
+
+        if (!WriteBlock(pindexNext)) {
+            LogPrintf("%s filter index stopped at height %d\n", strName, GetBestHeight());
+            return;
+        }
+        {
+            LOCK(cs_main);
+            pindexBest = pindexNext;
+        }
+        if (!fSynced && pindexNext->nHeight % 10000 == 0)
+            LogPrintf("Syncing %s filter index at height %d\n", strName, pindexNext->nHeight);
+    }
+}
+
+void CBlockFilterIndex::BlockConnected(const std::shared_ptr<const CBlock>& pblock, const CBlockIndex* pindex)
+{
+    boost::unique_lock<boost::mutex> lock(mutexWake);
+    fWake = true;
+    condWake.notify_one();
+}
+
+bool CBlockFilterIndex::LookupFilter(const CBlockIndex* pindex, BlockFilter& filter) const
+{
+    std::vector<unsigned char> vEncoded;
+    if (!db.Read(std::make_pair(DB_FILTER, pindex->GetBlockHash()), vEncoded))
+        return false;
+    try {
+        filter = BlockFilter(filterType, pindex->GetBlockHash(), vEncoded);
+    } catch (const std::exception& e) {
+        return error("%s: corrupt filter of block %s: %s", __func__, pindex->GetBlockHash().ToString(), e.what());
+    }
+    return true;
+}
+
+bool CBlockFilterIndex::LookupFilterHeader(const CBlockIndex* pindex, uint256& header) const
+{
+    CFilterHashEntry entry;
+    if (!db.Read(std::make_pair(DB_FILTER_HASH, pindex->GetBlockHash()), entry))
+        return false;
+    header = entry.header;
+    return true;
+}
+
+bool CBlockFilterIndex::LookupFilterHash(const CBlockIndex* pindex, uint256& hash) const
+{
+    CFilterHashEntry entry;
+    if (!db.Read(std::make_pair(DB_FILTER_HASH, pindex->GetBlockHash()), entry))
+        return false;
+    hash = entry.hash;
+    return true;
+}
+
+bool CBlockFilterIndex::LookupFilterRange(int nStartHeight, const CBlockIndex* pindexStop, std::vector<BlockFilter>& vFilters) const
+{
+    if (nStartHeight < 0 || nStartHeight > pindexStop->nHeight)
+        return false;
+    vFilters.resize(pindexStop->nHeight - nStartHeight + 1);
+    for (const CBlockIndex* pindex = pindexStop; pindex && pindex->nHeight >= nStartHeight; pindex = pindex->pprev)
+        if (!LookupFilter(pindex, vFilters[pindex->nHeight - nStartHeight]))
+            return false;
+    return true;
+}
+
+bool CBlockFilterIndex::LookupFilterHashRange(int nStartHeight, const CBlockIndex* pindexStop, std::vector<uint256>& vHashes) const
+{
+    if (nStartHeight < 0 || nStartHeight > pindexStop->nHeight)
+        return false;
+    vHashes.resize(pindexStop->nHeight - nStartHeight + 1);
+    for (const CBlockIndex* pindex = pindexStop; pindex && pindex->nHeight >= nStartHeight; pindex = pindex->pprev)
+        if (!LookupFilterHash(pindex, vHashes[pindex->nHeight - nStartHeight]))
+            return false;
+    return true;
+}
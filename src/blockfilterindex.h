@@ -0,0 +1,88 @@
+// Copyright (c) 2017 The Bitcoin Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#ifndef BITCOIN_BLOCKFILTERINDEX_H
+#define BITCOIN_BLOCKFILTERINDEX_H
+
+#include "blockfilter.h"
+#include "dbwrapper.h"
+#include "validationinterface.h"
+
+#include <memory>
+#include <vector>
+
+#include <boost/filesystem/path.hpp>
+#include <boost/thread/condition_variable.hpp>
+#include <boost/thread/mutex.hpp>
+
+class CBlockIndex;
+
+/** Default for -blockfilterindex */
+static const bool DEFAULT_BLOCKFILTERINDEX = false;
+/** Default for -peerblockfilters, serving the block filter index over P2P (BIP 157) */
+static const bool DEFAULT_PEERBLOCKFILTERS = false;
+/** Maximum number of filters served in response to a getcfilters message */
+static const int MAX_GETCFILTERS_SIZE = 1000;
+/** Maximum number of filter hashes served in response to a getcfheaders message */
+static const int MAX_GETCFHEADERS_SIZE = 2000;
+/** Height interval between the filter headers of a cfcheckpt message */
+static const int CFCHECKPT_INTERVAL = 1000;
+
+/**
+ * Index of the BIP 158 filters of all blocks in the active chain, along with
+ * their filter headers, in indexes/blockfilter/<type>/.
+ *
+ * Filters are computed from the block and its undo data by a background
+ * thread (ThreadSync), which follows the active chain: it is woken up when a
+ * block is connected, and on start catches up from wherever it stopped.
+ * Entries are keyed by block hash, so ones of blocks that were disconnected
+ * in a reorganization stay valid.
+ */
+class CBlockFilterIndex : public CValidationInterface
+{
+private:
+    const BlockFilterType filterType;
+    CDBWrapper db;
+
+    //! Last block indexed, on or off the active chain
+    const CBlockIndex* pindexBest; // Protected by cs_main
+
+    boost::mutex mutexWake;
+    boost::condition_variable condWake;
+    bool fWake;
+
+    /** The block to index next, or NULL if the index is synced with the active chain */
+    const CBlockIndex* NextToIndex() const;
+    bool WriteBlock(const CBlockIndex* pindex);
+
+protected:
+    void BlockConnected(const std::shared_ptr<const CBlock>& pblock, const CBlockIndex* pindex);
+
+public:
+    CBlockFilterIndex(BlockFilterType filterTypeIn, const boost::filesystem::path& path, size_t nCacheSize, bool fMemory = false, bool fWipe = false);
+
+    BlockFilterType GetFilterType() const { return filterType; }
+
+    /** Load the last indexed block. Requires the block index to be loaded. */
+    bool Init();
+
+    /** Index blocks until interrupted, waiting for new ones once synced */
+    void ThreadSync();
+
+    /** Height of the last indexed block, or -1 */
+    int GetBestHeight() const;
+
+    bool LookupFilter(const CBlockIndex* pindex, BlockFilter& filter) const;
+    bool LookupFilterHeader(const CBlockIndex* pindex, uint256& header) const;
+    bool LookupFilterHash(const CBlockIndex* pindex, uint256& hash) const;
+
+    /** Look up the filters of the ancestors of pindexStop from nStartHeight on, in height order */
+    bool LookupFilterRange(int nStartHeight, const CBlockIndex* pindexStop, std::vector<BlockFilter>& vFilters) const;
+    bool LookupFilterHashRange(int nStartHeight, const CBlockIndex* pindexStop, std::vector<uint256>& vHashes) const;
+};
+
+/** The basic block filter index, if -blockfilterindex is set */
+extern std::unique_ptr<CBlockFilterIndex> g_blockfilterindex;
+
+#endif // BITCOIN_BLOCKFILTERINDEX_H
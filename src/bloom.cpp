@@ -50,67 +50,91 @@ CBloomFilter::CBloomFilter(unsigned int nElements, double nFPRate, unsigned int
 {
 }
 
-inline unsigned int CBloomFilter::Hash(unsigned int nHashNum, const std::vector<unsigned char>& vDataToHash) const
+// 0xFBA4C795 chosen as it guarantees a reasonable bit difference between nHashNum values.
+static inline unsigned int BloomHashSeed(unsigned int nHashNum, unsigned int nTweak)
 {
-    // 0xFBA4C795 chosen as it guarantees a reasonable bit difference between nHashNum values.
-    return MurmurHash3(nHashNum * 0xFBA4C795 + nTweak, vDataToHash) % (vData.size() * 8);
+    return nHashNum * 0xFBA4C795 + nTweak;
 }
 
-void CBloomFilter::insert(const std::vector<unsigned char>& vKey)
+void CBloomFilter::insert(const unsigned char* pKey, size_t nLen)
 {
     if (isFull)
         return;
-    for (unsigned int i = 0; i < nHashFuncs; i++)
+    const CMurmurHash3Seeds hasher(pKey, nLen);
+    unsigned int vSeeds[4], vHashes[4];
+    for (unsigned int i = 0; i < nHashFuncs; i += 4)
     {
-        unsigned int nIndex = Hash(i, vKey);
-        // Sets bit nIndex of vData
-        vData[nIndex >> 3] |= (1 << (7 & nIndex));
+        unsigned int nHashes = std::min(nHashFuncs - i, 4U);
+        for (unsigned int j = 0; j < nHashes; j++)
+            vSeeds[j] = BloomHashSeed(i + j, nTweak);
+        hasher.Hash(vSeeds, nHashes, vHashes);
+        for (unsigned int j = 0; j < nHashes; j++) {
+            unsigned int nIndex = vHashes[j] % (vData.size() * 8);
+            // Sets bit nIndex of vData
+            vData[nIndex >> 3] |= (1 << (7 & nIndex));
+        }
     }
     isEmpty = false;
 }
 
+void CBloomFilter::insert(const std::vector<unsigned char>& vKey)
+{
+    insert(vKey.data(), vKey.size());
+}
+
 void CBloomFilter::insert(const COutPoint& outpoint)
 {
     CDataStream stream(SER_NETWORK, PROTOCOL_VERSION);
     stream << outpoint;
-    std::vector<unsigned char> data(stream.begin(), stream.end());
-    insert(data);
+    insert((const unsigned char*)&stream.begin()[0], stream.size());
 }
 
 void CBloomFilter::insert(const uint256& hash)
 {
-    std::vector<unsigned char> data(hash.begin(), hash.end());
-    insert(data);
+    insert(hash.begin(), hash.size());
 }
 
-bool CBloomFilter::contains(const std::vector<unsigned char>& vKey) const
+bool CBloomFilter::contains(const unsigned char* pKey, size_t nLen) const
 {
     if (isFull)
         return true;
     if (isEmpty)
         return false;
-    for (unsigned int i = 0; i < nHashFuncs; i++)
+    // Most keys are not in the filter and miss one of the first bits, so
+    // hash four seeds at a time and stop at the first missing bit.
+    const CMurmurHash3Seeds hasher(pKey, nLen);
+    unsigned int vSeeds[4], vHashes[4];
+    for (unsigned int i = 0; i < nHashFuncs; i += 4)
     {
-        unsigned int nIndex = Hash(i, vKey);
-        // Checks bit nIndex of vData
-        if (!(vData[nIndex >> 3] & (1 << (7 & nIndex))))
-            return false;
+        unsigned int nHashes = std::min(nHashFuncs - i, 4U);
+        for (unsigned int j = 0; j < nHashes; j++)
+            vSeeds[j] = BloomHashSeed(i + j, nTweak);
+        hasher.Hash(vSeeds, nHashes, vHashes);
+        for (unsigned int j = 0; j < nHashes; j++) {
+            unsigned int nIndex = vHashes[j] % (vData.size() * 8);
+            // Checks bit nIndex of vData
+            if (!(vData[nIndex >> 3] & (1 << (7 & nIndex))))
+                return false;
+        }
     }
     return true;
 }
 
+bool CBloomFilter::contains(const std::vector<unsigned char>& vKey) const
+{
+    return contains(vKey.data(), vKey.size());
+}
+
 bool CBloomFilter::contains(const COutPoint& outpoint) const
 {
     CDataStream stream(SER_NETWORK, PROTOCOL_VERSION);
     stream << outpoint;
-    std::vector<unsigned char> data(stream.begin(), stream.end());
-    return contains(data);
+    return contains((const unsigned char*)&stream.begin()[0], stream.size());
 }
 
 bool CBloomFilter::contains(const uint256& hash) const
 {
-    std::vector<unsigned char> data(hash.begin(), hash.end());
-    return contains(data);
+    return contains(hash.begin(), hash.size());
 }
 
 void CBloomFilter::clear()
@@ -131,6 +155,20 @@ bool CBloomFilter::IsWithinSizeConstraints() const
     return vData.size() <= MAX_BLOOM_FILTER_SIZE && nHashFuncs <= MAX_HASH_FUNCS;
 }
 
+void CBloomFilter::UpdateMatchedOutput(const COutPoint& outpoint, const CScript& scriptPubKey)
+{
+    if ((nFlags & BLOOM_UPDATE_MASK) == BLOOM_UPDATE_ALL)
+        insert(outpoint);
+    else if ((nFlags & BLOOM_UPDATE_MASK) == BLOOM_UPDATE_P2PUBKEY_ONLY)
+    {
+        txnouttype type;
+        std::vector<std::vector<unsigned char> > vSolutions;
+        if (Solver(scriptPubKey, type, vSolutions) &&
+                (type == TX_PUBKEY || type == TX_MULTISIG))
+            insert(outpoint);
+    }
+}
+
 bool CBloomFilter::IsRelevantAndUpdate(const CTransaction& tx)
 {
     bool fFound = false;
@@ -161,16 +199,7 @@ bool CBloomFilter::IsRelevantAndUpdate(const CTransaction& tx)
             if (data.size() != 0 && contains(data))
             {
                 fFound = true;
-                if ((nFlags & BLOOM_UPDATE_MASK) == BLOOM_UPDATE_ALL)
-                    insert(COutPoint(hash, i));
-                else if ((nFlags & BLOOM_UPDATE_MASK) == BLOOM_UPDATE_P2PUBKEY_ONLY)
-                {
-                    txnouttype type;
-                    std::vector<std::vector<unsigned char> > vSolutions;
-                    if (Solver(txout.scriptPubKey, type, vSolutions) &&
-                            (type == TX_PUBKEY || type == TX_MULTISIG))
-                        insert(COutPoint(hash, i));
-                }
+                UpdateMatchedOutput(COutPoint(hash, i), txout.scriptPubKey);
                 break;
             }
         }
@@ -214,6 +243,28 @@ void CBloomFilter::UpdateEmptyFull()
     isEmpty = empty;
 }
 
+/* Every item sets nHashFuncs of the ROLLING_BLOOM_BLOCK_BITS bits of one block.
+ * A block is 8 pairs of 64-bit integers (see below), or two cache lines. */
+static const uint32_t ROLLING_BLOOM_BLOCK_BITS = 512;
+static const uint32_t ROLLING_BLOOM_BLOCK_WORDS = ROLLING_BLOOM_BLOCK_BITS / 32;
+static const size_t ROLLING_BLOOM_BLOCK_ALIGN = 128;
+
+/* False positive rate of a blocked bloom filter with on average
+ * dElementsPerBlock elements in each block: the number of elements in a block
+ * is Poisson distributed, and each block is a small ordinary bloom filter. */
+static double BlockedBloomFPRate(double dElementsPerBlock, int nHashFuncs)
+{
+    double fpRate = 0;
+    double pElements = exp(-dElementsPerBlock);
+    int nMaxElements = (int)(dElementsPerBlock + 12 * sqrt(dElementsPerBlock) + 20);
+    for (int j = 0; j <= nMaxElements; j++) {
+        if (j > 0)
+            pElements *= dElementsPerBlock / j;
+        fpRate += pElements * pow(1.0 - pow(1.0 - 1.0 / ROLLING_BLOOM_BLOCK_BITS, (double)nHashFuncs * j), nHashFuncs);
+    }
+    return fpRate;
+}
+
 CRollingBloomFilter::CRollingBloomFilter(unsigned int nElements, double fpRate)
 {
     double logFpRate = log(fpRate);
@@ -223,7 +274,7 @@ CRollingBloomFilter::CRollingBloomFilter(unsigned int nElements, double fpRate)
     /* In this rolling bloom filter, we'll store between 2 and 3 generations of nElements / 2 entries. */
     nEntriesPerGeneration = (nElements + 1) / 2;
     uint32_t nMaxElements = nEntriesPerGeneration * 3;
-    /* The maximum fpRate = pow(1.0 - exp(-nHashFuncs * nMaxElements / nFilterBits), nHashFuncs)
+    /* The maximum fpRate of an unblocked filter = pow(1.0 - exp(-nHashFuncs * nMaxElements / nFilterBits), nHashFuncs)
      * =>          pow(fpRate, 1.0 / nHashFuncs) = 1.0 - exp(-nHashFuncs * nMaxElements / nFilterBits)
      * =>          1.0 - pow(fpRate, 1.0 / nHashFuncs) = exp(-nHashFuncs * nMaxElements / nFilterBits)
      * =>          log(1.0 - pow(fpRate, 1.0 / nHashFuncs)) = -nHashFuncs * nMaxElements / nFilterBits
@@ -231,22 +282,48 @@ CRollingBloomFilter::CRollingBloomFilter(unsigned int nElements, double fpRate)
      * =>          nFilterBits = -nHashFuncs * nMaxElements / log(1.0 - exp(logFpRate / nHashFuncs))
      */
     uint32_t nFilterBits = (uint32_t)ceil(-1.0 * nHashFuncs * nMaxElements / log(1.0 - exp(logFpRate / nHashFuncs)));
+    /* Blocking makes the filter more sensitive to unevenly filled blocks, grow
+     * it until the blocked false positive rate is met. */
+    nBlocks = (nFilterBits + ROLLING_BLOOM_BLOCK_BITS - 1) / ROLLING_BLOOM_BLOCK_BITS;
+    while (BlockedBloomFPRate((double)nMaxElements / nBlocks, nHashFuncs) > fpRate) {
+        nBlocks += std::max<uint32_t>(1, nBlocks / 32);
+    }
     data.clear();
     /* For each data element we need to store 2 bits. If both bits are 0, the
      * bit is treated as unset. If the bits are (01), (10), or (11), the bit is
      * treated as set in generation 1, 2, or 3 respectively.
-     * These bits are stored in separate integers: position P corresponds to bit
-     * (P & 63) of the integers data[(P >> 6) * 2] and data[(P >> 6) * 2 + 1]. */
-    data.resize(((nFilterBits + 63) / 64) << 1);
+     * These bits are stored in separate integers: position P of a block corresponds to bit
+     * (P & 63) of the integers block[(P >> 6) * 2] and block[(P >> 6) * 2 + 1].
+     * Room is left to align the first block to a cache line. */
+    data.resize(nBlocks * ROLLING_BLOOM_BLOCK_WORDS + ROLLING_BLOOM_BLOCK_ALIGN / sizeof(uint64_t));
+    uintptr_t nMisalignment = (uintptr_t)data.data() % ROLLING_BLOOM_BLOCK_ALIGN;
+    nBlockOffset = nMisalignment ? (ROLLING_BLOOM_BLOCK_ALIGN - nMisalignment) / sizeof(uint64_t) : 0;
     reset();
 }
 
-/* Similar to CBloomFilter::Hash */
-static inline uint32_t RollingBloomHash(unsigned int nHashNum, uint32_t nTweak, const std::vector<unsigned char>& vDataToHash) {
-    return MurmurHash3(nHashNum * 0xFBA4C795 + nTweak, vDataToHash);
+/* Similar to CBloomFilter. Only two hashes are needed per item: one picks the
+ * block, the other the nHashFuncs positions within it. */
+static inline void RollingBloomSeeds(uint32_t nTweak, unsigned int vSeeds[2])
+{
+    vSeeds[0] = nTweak;
+    vSeeds[1] = 0xFBA4C795 + nTweak;
 }
 
-void CRollingBloomFilter::insert(const std::vector<unsigned char>& vKey)
+/* Masks of the bits of block pair 0-7 that an item with second hash h2 uses.
+ * Stepping by an odd number modulo the block size gives distinct positions. */
+static inline void RollingBloomMasks(uint32_t h2, int nHashFuncs, uint64_t vMask[8])
+{
+    for (int i = 0; i < 8; i++)
+        vMask[i] = 0;
+    uint32_t nPos = h2, nStep = (h2 >> 9) | 1;
+    for (int n = 0; n < nHashFuncs; n++) {
+        uint32_t nBit = nPos % ROLLING_BLOOM_BLOCK_BITS;
+        vMask[nBit >> 6] |= ((uint64_t)1) << (nBit & 63);
+        nPos += nStep;
+    }
+}
+
+void CRollingBloomFilter::insert(const unsigned char* pKey, size_t nLen)
 {
     if (nEntriesThisGeneration == nEntriesPerGeneration) {
         nEntriesThisGeneration = 0;
@@ -257,7 +334,7 @@ void CRollingBloomFilter::insert(const std::vector<unsigned char>& vKey)
         uint64_t nGenerationMask1 = -(uint64_t)(nGeneration & 1);
         uint64_t nGenerationMask2 = -(uint64_t)(nGeneration >> 1);
         /* Wipe old entries that used this generation number. */
-        for (uint32_t p = 0; p < data.size(); p += 2) {
+        for (uint32_t p = nBlockOffset; p < nBlockOffset + nBlocks * ROLLING_BLOOM_BLOCK_WORDS; p += 2) {
             uint64_t p1 = data[p], p2 = data[p + 1];
             uint64_t mask = (p1 ^ nGenerationMask1) | (p2 ^ nGenerationMask2);
             data[p] = p1 & mask;
@@ -266,40 +343,84 @@ void CRollingBloomFilter::insert(const std::vector<unsigned char>& vKey)
     }
     nEntriesThisGeneration++;
 
-    for (int n = 0; n < nHashFuncs; n++) {
-        uint32_t h = RollingBloomHash(n, nTweak, vKey);
-        int bit = h & 0x3F;
-        uint32_t pos = (h >> 6) % data.size();
-        /* The lowest bit of pos is ignored, and set to zero for the first bit, and to one for the second. */
-        data[pos & ~1] = (data[pos & ~1] & ~(((uint64_t)1) << bit)) | ((uint64_t)(nGeneration & 1)) << bit;
-        data[pos | 1] = (data[pos | 1] & ~(((uint64_t)1) << bit)) | ((uint64_t)(nGeneration >> 1)) << bit;
+    unsigned int vSeeds[2], vHashes[2];
+    RollingBloomSeeds(nTweak, vSeeds);
+    CMurmurHash3Seeds(pKey, nLen).Hash(vSeeds, 2, vHashes);
+    uint64_t vMask[8];
+    RollingBloomMasks(vHashes[1], nHashFuncs, vMask);
+    uint64_t* pBlock = &data[nBlockOffset + (((uint64_t)vHashes[0] * nBlocks) >> 32) * ROLLING_BLOOM_BLOCK_WORDS];
+    uint64_t nGeneration1 = -(uint64_t)(nGeneration & 1);
+    uint64_t nGeneration2 = -(uint64_t)(nGeneration >> 1);
+    for (int i = 0; i < 8; i++) {
+        pBlock[i * 2] = (pBlock[i * 2] & ~vMask[i]) | (nGeneration1 & vMask[i]);
+        pBlock[i * 2 + 1] = (pBlock[i * 2 + 1] & ~vMask[i]) | (nGeneration2 & vMask[i]);
     }
 }
 
+void CRollingBloomFilter::insert(const std::vector<unsigned char>& vKey)
+{
+    insert(vKey.data(), vKey.size());
+}
+
 void CRollingBloomFilter::insert(const uint256& hash)
 {
-    std::vector<unsigned char> vData(hash.begin(), hash.end());
-    insert(vData);
+    insert(hash.begin(), hash.size());
+}
+
+bool CRollingBloomFilter::BlockContains(uint32_t h1, uint32_t h2) const
+{
+    uint64_t vMask[8];
+    RollingBloomMasks(h2, nHashFuncs, vMask);
+    const uint64_t* pBlock = &data[nBlockOffset + (((uint64_t)h1 * nBlocks) >> 32) * ROLLING_BLOOM_BLOCK_WORDS];
+    /* If a relevant bit is not set in either half of its pair, the filter does not contain the item */
+    uint64_t nMissing = 0;
+    for (int i = 0; i < 8; i++)
+        nMissing |= vMask[i] & ~(pBlock[i * 2] | pBlock[i * 2 + 1]);
+    return nMissing == 0;
+}
+
+bool CRollingBloomFilter::contains(const unsigned char* pKey, size_t nLen) const
+{
+    unsigned int vSeeds[2], vHashes[2];
+    RollingBloomSeeds(nTweak, vSeeds);
+    CMurmurHash3Seeds(pKey, nLen).Hash(vSeeds, 2, vHashes);
+    return BlockContains(vHashes[0], vHashes[1]);
 }
 
 bool CRollingBloomFilter::contains(const std::vector<unsigned char>& vKey) const
 {
-    for (int n = 0; n < nHashFuncs; n++) {
-        uint32_t h = RollingBloomHash(n, nTweak, vKey);
-        int bit = h & 0x3F;
-        uint32_t pos = (h >> 6) % data.size();
-        /* If the relevant bit is not set in either data[pos & ~1] or data[pos | 1], the filter does not contain vKey */
-        if (!(((data[pos & ~1] | data[pos | 1]) >> bit) & 1)) {
-            return false;
-        }
-    }
-    return true;
+    return contains(vKey.data(), vKey.size());
 }
 
 bool CRollingBloomFilter::contains(const uint256& hash) const
 {
-    std::vector<unsigned char> vData(hash.begin(), hash.end());
-    return contains(vData);
+    return contains(hash.begin(), hash.size());
+}
+
+void CRollingBloomFilter::contains(const std::vector<uint256>& vHashes, std::vector<bool>& vResult) const
+{
+    vResult.resize(vHashes.size());
+    unsigned int vSeeds[2];
+    RollingBloomSeeds(nTweak, vSeeds);
+    size_t i = 0;
+    for (; i + 4 <= vHashes.size(); i += 4) {
+        // Hash four keys at a time, and fetch all their blocks before using any.
+        const unsigned char* vKeys[4] = {vHashes[i].begin(), vHashes[i + 1].begin(), vHashes[i + 2].begin(), vHashes[i + 3].begin()};
+        unsigned int vHashes1[4], vHashes2[4];
+        MurmurHash3x4(vSeeds[0], vKeys, 32, vHashes1);
+        MurmurHash3x4(vSeeds[1], vKeys, 32, vHashes2);
+#if defined(__GNUC__)
+        for (int j = 0; j < 4; j++) {
+            const uint64_t* pBlock = &data[nBlockOffset + (((uint64_t)vHashes1[j] * nBlocks) >> 32) * ROLLING_BLOOM_BLOCK_WORDS];
+            __builtin_prefetch(pBlock);
+            __builtin_prefetch(pBlock + ROLLING_BLOOM_BLOCK_WORDS / 2);
+        }
+#endif
+        for (int j = 0; j < 4; j++)
+            vResult[i + j] = BlockContains(vHashes1[j], vHashes2[j]);
+    }
+    for (; i < vHashes.size(); i++)
+        vResult[i] = contains(vHashes[i]);
 }
 
 void CRollingBloomFilter::reset()
@@ -10,6 +10,7 @@
 #include <vector>
 
 class COutPoint;
+class CScript;
 class CTransaction;
 class uint256;
 
@@ -51,7 +52,7 @@ private:
     unsigned int nTweak;
     unsigned char nFlags;
 
-    unsigned int Hash(unsigned int nHashNum, const std::vector<unsigned char>& vDataToHash) const;
+    void insert(const unsigned char* pKey, size_t nLen);
 
     // Private constructor for CRollingBloomFilter, no restrictions on size
     CBloomFilter(unsigned int nElements, double nFPRate, unsigned int nTweak);
@@ -84,6 +85,7 @@ public:
     void insert(const COutPoint& outpoint);
     void insert(const uint256& hash);
 
+    bool contains(const unsigned char* pKey, size_t nLen) const;
     bool contains(const std::vector<unsigned char>& vKey) const;
     bool contains(const COutPoint& outpoint) const;
     bool contains(const uint256& hash) const;
@@ -98,6 +100,12 @@ public:
     //! Also adds any outputs which match the filter to the filter (to match their spending txes)
     bool IsRelevantAndUpdate(const CTransaction& tx);
 
+    //! Adds outpoint, whose scriptPubKey matched the filter, as nFlags' BLOOM_UPDATE_* mode asks for
+    void UpdateMatchedOutput(const COutPoint& outpoint, const CScript& scriptPubKey);
+
+    bool IsFull() const { return isFull; }
+    bool IsEmpty() const { return isEmpty; }
+
     //! Checks for empty and full filters to avoid wasting cpu
     void UpdateEmptyFull();
 };
@@ -113,8 +121,11 @@ public:
  * contains(item) will always return true if item was one of the last N to 1.5*N
  * insert()'ed ... but may also return true for items that were not inserted.
  *
- * It needs around 1.8 bytes per element per factor 0.1 of false positive rate.
- * (More accurately: 3/(log(256)*log(2)) * log(1/fpRate) * nElements bytes)
+ * The filter is blocked: all bits of an item lie in one block of two cache
+ * lines, so a lookup touches one block instead of one cache line per hash
+ * function. To keep the false positive rate, blocking costs around 35% more
+ * memory at a 0.0001% rate and 8% at 0.1%, on top of the around 1.8 bytes per
+ * element per factor 0.1 of false positive rate of an unblocked filter.
  */
 class CRollingBloomFilter
 {
@@ -128,6 +139,8 @@ public:
     void insert(const uint256& hash);
     bool contains(const std::vector<unsigned char>& vKey) const;
     bool contains(const uint256& hash) const;
+    /** Look up several hashes at once, setting vResult[i] to contains(vHashes[i]). */
+    void contains(const std::vector<uint256>& vHashes, std::vector<bool>& vResult) const;
 
     void reset();
 
@@ -136,8 +149,15 @@ private:
     int nEntriesThisGeneration;
     int nGeneration;
     std::vector<uint64_t> data;
+    //! Index in data of the first block, chosen so that blocks are aligned to cache lines.
+    uint32_t nBlockOffset;
+    uint32_t nBlocks;
     unsigned int nTweak;
     int nHashFuncs;
+
+    void insert(const unsigned char* pKey, size_t nLen);
+    bool contains(const unsigned char* pKey, size_t nLen) const;
+    bool BlockContains(uint32_t h1, uint32_t h2) const;
 };
 
 #endif // BITCOIN_BLOOM_H
@@ -5,7 +5,12 @@
 #ifndef BITCOIN_CHECKQUEUE_H
 #define BITCOIN_CHECKQUEUE_H
 
+#include "sync.h"
+
 #include <algorithm>
+#include <atomic>
+#include <deque>
+#include <memory>
 #include <vector>
 
 #include <boost/foreach.hpp>
@@ -16,21 +21,97 @@
 template <typename T>
 class CCheckQueueControl;
 
-/** 
+//! Most ranges of jobs a CCheckQueue worker's queue holds; the master helps out when all are full
+static const uint64_t CHECKQUEUE_RANGE_QUEUE_SIZE = 256;
+//! CCheckQueue workers beyond this many share their queues
+static const int CHECKQUEUE_MAX_RANGE_QUEUES = 64;
+
+/**
+ * Run a worker's batch of checks, returning whether all succeeded. Check
+ * types that save work by running their checks together overload this for
+ * vectors of themselves; the overload is found by argument-dependent lookup.
+ */
+template <typename T>
+bool RunChecks(std::vector<T>& vChecks)
+{
+    BOOST_FOREACH (T& check, vChecks)
+        if (!check())
+            return false;
+    return true;
+}
+
+/**
  * Queue for verifications that have to be performed.
-  * The verifications are represented by a type T, which must provide an
-  * operator(), returning a bool.
-  *
-  * One thread (the master) is assumed to push batches of verifications
-  * onto the queue, where they are processed by N-1 worker threads. When
-  * the master is done adding work, it temporarily joins the worker pool
-  * as an N'th worker, until all jobs are done.
-  */
+ * The verifications are represented by a type T, which must provide an
+ * operator(), returning a bool.
+ *
+ * One thread (the master) is assumed to push batches of verifications
+ * onto the queue, where they are processed by N-1 worker threads. When
+ * the master is done adding work, it temporarily joins the worker pool
+ * as an N'th worker, until all jobs are done.
+ *
+ * Jobs are distributed without locks: every worker has its own queue of
+ * ranges of jobs, which the master fills in turn, and takes from the
+ * others' once its own is empty. The mutex is only taken to sleep when
+ * there is no work, and to wake up the sleepers.
+ */
 template <typename T>
 class CCheckQueue
 {
 private:
-    //! Mutex to protect the inner state
+    /**
+     * Ranges of jobs in the storage, added by the master only and taken by
+     * any worker, in order. A slot is only overwritten once taken, so a
+     * taker that read it before that fails to move top past it.
+     */
+    class RangeQueue
+    {
+    private:
+        struct Slot {
+            std::atomic<T*> begin;
+            std::atomic<T*> end;
+        };
+        Slot slots[CHECKQUEUE_RANGE_QUEUE_SIZE];
+        //! Taken up to top, added up to bottom, on separate cache lines
+        std::atomic<uint64_t> top;
+        char padding[64];
+        std::atomic<uint64_t> bottom;
+
+    public:
+        RangeQueue() : top(0), bottom(0) {}
+
+        bool Push(T* begin, T* end)
+        {
+            const uint64_t nBottom = bottom.load(std::memory_order_relaxed);
+            if (nBottom - top.load(std::memory_order_acquire) >= CHECKQUEUE_RANGE_QUEUE_SIZE)
+                return false;
+            Slot& slot = slots[nBottom % CHECKQUEUE_RANGE_QUEUE_SIZE];
+            slot.begin.store(begin, std::memory_order_relaxed);
+            slot.end.store(end, std::memory_order_relaxed);
+            bottom.store(nBottom + 1);
+            return true;
+        }
+
+        bool Pop(T*& begin, T*& end)
+        {
+            uint64_t nTop = top.load(std::memory_order_acquire);
+            while (nTop < bottom.load(std::memory_order_acquire)) {
+                const Slot& slot = slots[nTop % CHECKQUEUE_RANGE_QUEUE_SIZE];
+                begin = slot.begin.load(std::memory_order_relaxed);
+                end = slot.end.load(std::memory_order_relaxed);
+                if (top.compare_exchange_weak(nTop, nTop + 1, std::memory_order_acq_rel))
+                    return true;
+            }
+            return false;
+        }
+
+        bool Empty() const
+        {
+            return top.load() >= bottom.load();
+        }
+    };
+
+    //! Mutex for sleeping and waking up only
     boost::mutex mutex;
 
     //! Worker threads block on this when out of work
@@ -39,91 +120,91 @@ private:
     //! Master thread blocks on this when out of work
     boost::condition_variable condMaster;
 
-    //! The queue of elements to be processed.
-    //! As the order of booleans doesn't matter, it is used as a LIFO (stack)
-    std::vector<T> queue;
+    //! One queue of ranges per worker
+    std::unique_ptr<RangeQueue[]> rangeQueues;
 
-    //! The number of workers (including the master) that are idle.
-    int nIdle;
+    //! The jobs added since the last Wait(), owned by the master. Workers
+    //! only access them through the ranges they take.
+    std::deque<std::vector<T> > storage;
 
-    //! The total number of workers (including the master).
-    int nTotal;
+    //! The number of worker threads, not counting the master.
+    std::atomic<int> nWorkers;
+
+    //! The number of workers asleep for lack of work.
+    std::atomic<int> nIdle;
+
+    //! The queue the master adds the next range to.
+    int nNextQueue;
 
     //! The temporary evaluation result.
-    bool fAllOk;
+    std::atomic<bool> fAllOk;
 
     /**
      * Number of verifications that haven't completed yet.
      * This includes elements that are no longer queued, but still in the
      * worker's own batches.
      */
-    unsigned int nTodo;
-
-    //! Whether we're shutting down.
-    bool fQuit;
+    std::atomic<unsigned int> nTodo;
 
     //! The maximum number of elements to be processed in one batch
     unsigned int nBatchSize;
 
-    /** Internal function that does bulk of the verification work. */
-    bool Loop(bool fMaster = false)
+    int NumQueues() const
     {
-        boost::condition_variable& cond = fMaster ? condMaster : condWorker;
-        std::vector<T> vChecks;
-        vChecks.reserve(nBatchSize);
-        unsigned int nNow = 0;
-        bool fOk = true;
-        do {
-            {
-                boost::unique_lock<boost::mutex> lock(mutex);
-                // first do the clean-up of the previous loop run (allowing us to do it in the same critsect)
-                if (nNow) {
-                    fAllOk &= fOk;
-                    nTodo -= nNow;
-                    if (nTodo == 0 && !fMaster)
-                        // We processed the last element; inform the master it can exit and return the result
-                        condMaster.notify_one();
-                } else {
-                    // first iteration
-                    nTotal++;
-                }
-                // logically, the do loop starts here
-                while (queue.empty()) {
-                    if ((fMaster || fQuit) && nTodo == 0) {
-                        nTotal--;
-                        bool fRet = fAllOk;
-                        // reset the status for new work later
-                        if (fMaster)
-                            fAllOk = true;
-                        // return the current status
-                        return fRet;
-                    }
-                    nIdle++;
-                    cond.wait(lock); // wait
-                    nIdle--;
-                }
-                // Decide how many work units to process now.
-                // * Do not try to do everything at once, but aim for increasingly smaller batches so
-                //   all workers finish approximately simultaneously.
-                // * Try to account for idle jobs which will instantly start helping.
-                // * Don't do batches smaller than 1 (duh), or larger than nBatchSize.
-                nNow = std::max(1U, std::min(nBatchSize, (unsigned int)queue.size() / (nTotal + nIdle + 1)));
-                vChecks.resize(nNow);
-                for (unsigned int i = 0; i < nNow; i++) {
-                    // We want the lock on the mutex to be as short as possible, so swap jobs from the global
-                    // queue to the local batch vector instead of copying.
-                    vChecks[i].swap(queue.back());
-                    queue.pop_back();
+        return std::max(1, std::min((int)nWorkers, CHECKQUEUE_MAX_RANGE_QUEUES));
+    }
+
+    bool HasWork() const
+    {
+        for (int i = 0; i < NumQueues(); i++)
+            if (!rangeQueues[i].Empty())
+                return true;
+        return false;
+    }
+
+    /**
+     * Take ranges from queue nQueue, and from the others once it is empty,
+     * and run them as one batch. Returns false if there was nothing to take.
+     */
+    bool RunBatch(std::vector<T>& vChecks, int nQueue)
+    {
+        // Do not try to do everything at once, but aim for increasingly
+        // smaller batches so all workers finish approximately simultaneously.
+        const int nQueues = NumQueues();
+        const unsigned int nNow = std::max(1U, std::min(nBatchSize, nTodo.load(std::memory_order_relaxed) / (nWorkers + 2)));
+        T* begin;
+        T* end;
+        for (int i = 0; i < nQueues && vChecks.size() < nNow; i++) {
+            RangeQueue& rangeQueue = rangeQueues[(nQueue + i) % nQueues];
+            while (vChecks.size() < nNow && rangeQueue.Pop(begin, end)) {
+                for (T* pcheck = begin; pcheck != end; pcheck++) {
+                    vChecks.emplace_back();
+                    vChecks.back().swap(*pcheck);
                 }
-                // Check whether we need to do work at all
-                fOk = fAllOk;
             }
-            // execute work
-            BOOST_FOREACH (T& check, vChecks)
-                if (fOk)
-                    fOk = check();
-            vChecks.clear();
-        } while (true);
+        }
+        if (vChecks.empty())
+            return false;
+
+        // Skip the work once a check failed, but still account for it
+        if (fAllOk.load(std::memory_order_relaxed) && !RunChecks(vChecks))
+            fAllOk.store(false, std::memory_order_relaxed);
+        const unsigned int nDone = vChecks.size();
+        vChecks.clear();
+        if (nTodo.fetch_sub(nDone) == nDone) {
+            // We processed the last element; inform the master it can exit and return the result
+            boost::unique_lock<boost::mutex> lock(mutex);
+            condMaster.notify_one();
+        }
+        return true;
+    }
+
+    void WakeWorkers()
+    {
+        if (nIdle > 0) {
+            boost::unique_lock<boost::mutex> lock(mutex);
+            condWorker.notify_all();
+        }
     }
 
 public:
@@ -131,33 +212,80 @@ public:
     boost::mutex ControlMutex;
 
     //! Create a new check queue
-    CCheckQueue(unsigned int nBatchSizeIn) : nIdle(0), nTotal(0), fAllOk(true), nTodo(0), fQuit(false), nBatchSize(nBatchSizeIn) {}
+    CCheckQueue(unsigned int nBatchSizeIn) : rangeQueues(new RangeQueue[CHECKQUEUE_MAX_RANGE_QUEUES]), nWorkers(0), nIdle(0), nNextQueue(0), fAllOk(true), nTodo(0), nBatchSize(nBatchSizeIn) {}
 
     //! Worker thread
     void Thread()
     {
-        Loop();
+        const int nQueue = nWorkers++ % CHECKQUEUE_MAX_RANGE_QUEUES;
+        std::vector<T> vChecks;
+        vChecks.reserve(nBatchSize);
+        while (true) {
+            if (RunBatch(vChecks, nQueue))
+                continue;
+            boost::unique_lock<boost::mutex> lock(mutex);
+            nIdle++;
+            try {
+                // The master wakes us up if it sees nIdle after adding, or we see its work here
+                while (!HasWork())
+                    condWorker.wait(lock);
+            } catch (...) {
+                // Interrupted; the queue stays, for the others to take from
+                nIdle--;
+                throw;
+            }
+            nIdle--;
+        }
     }
 
     //! Wait until execution finishes, and return whether all evaluations were successful.
     bool Wait()
     {
-        return Loop(true);
+        std::vector<T> vChecks;
+        vChecks.reserve(nBatchSize);
+        while (RunBatch(vChecks, 0)) {}
+        {
+            boost::unique_lock<boost::mutex> lock(mutex);
+            while (nTodo != 0)
+                condMaster.wait(lock);
+        }
+        storage.clear();
+        bool fRet = fAllOk;
+        // reset the status for new work later
+        fAllOk = true;
+        return fRet;
     }
 
     //! Add a batch of checks to the queue
     void Add(std::vector<T>& vChecks)
     {
-        boost::unique_lock<boost::mutex> lock(mutex);
-        BOOST_FOREACH (T& check, vChecks) {
-            queue.push_back(T());
-            check.swap(queue.back());
+        if (vChecks.empty())
+            return;
+        storage.emplace_back();
+        storage.back().swap(vChecks);
+        std::vector<T>& vAdded = storage.back();
+        nTodo += vAdded.size();
+
+        // Spread large batches over the workers, in ranges of at most nBatchSize
+        const int nQueues = NumQueues();
+        const size_t nRange = std::max<size_t>(1, std::min<size_t>(nBatchSize, (vAdded.size() + nQueues - 1) / nQueues));
+        std::vector<T> vMasterChecks;
+        for (size_t nPos = 0; nPos < vAdded.size(); nPos += nRange) {
+            T* begin = &vAdded[nPos];
+            T* end = begin + std::min(nRange, vAdded.size() - nPos);
+            int nTried = 0;
+            while (!rangeQueues[nNextQueue].Push(begin, end)) {
+                nNextQueue = (nNextQueue + 1) % nQueues;
+                if (++nTried == nQueues) {
+                    // Everyone has plenty to do: help out
+                    WakeWorkers();
+                    RunBatch(vMasterChecks, nNextQueue);
+                    nTried = 0;
+                }
+            }
+            nNextQueue = (nNextQueue + 1) % nQueues;
         }
-        nTodo += vChecks.size();
-        if (vChecks.size() == 1)
-            condWorker.notify_one();
-        else if (vChecks.size() > 1)
-            condWorker.notify_all();
+        WakeWorkers();
     }
 
     ~CCheckQueue()
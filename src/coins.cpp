@@ -76,8 +76,12 @@ CCoinsMap::const_iterator CCoinsViewCache::FetchCoins(const uint256 &txid) const
     CCoins tmp;
     if (!base->GetCoins(txid, tmp))
         return cacheCoins.end();
+    return InsertFetchedCoins(txid, tmp);
+}
+
+CCoinsMap::iterator CCoinsViewCache::InsertFetchedCoins(const uint256 &txid, CCoins &coins) const {
     CCoinsMap::iterator ret = cacheCoins.insert(std::make_pair(txid, CCoinsCacheEntry())).first;
-    tmp.swap(ret->second.coins);
+    coins.swap(ret->second.coins);
     if (ret->second.coins.IsPruned()) {
         // The parent only has an empty entry for this txid; we can consider our
         // version as fresh.
@@ -258,6 +262,12 @@ void CCoinsViewCache::Uncache(const uint256& hash)
     }
 }
 
+void CCoinsViewCache::AddFetchedCoins(const uint256 &txid, CCoins &coins)
+{
+    if (cacheCoins.count(txid) == 0)
+        InsertFetchedCoins(txid, coins);
+}
+
 unsigned int CCoinsViewCache::GetCacheSize() const {
     return cacheCoins.size();
 }
@@ -441,6 +441,13 @@ public:
      */
     void Uncache(const uint256 &txid);
 
+    /**
+     * Add coins read from the backing view beforehand, unless the cache
+     * already has an entry for them, as if they were fetched now. Only
+     * valid if the backing view did not change since they were read.
+     */
+    void AddFetchedCoins(const uint256 &txid, CCoins &coins);
+
     //! Calculate the size of the cache (in number of transactions)
     unsigned int GetCacheSize() const;
 
@@ -473,6 +480,7 @@ public:
 
 private:
     CCoinsMap::const_iterator FetchCoins(const uint256 &txid) const;
+    CCoinsMap::iterator InsertFetchedCoins(const uint256 &txid, CCoins &coins) const;
 
     /**
      * By making the copy constructor private, we prevent accidentally using it when one intends to create a cache on top of a base cache.
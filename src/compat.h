@@ -83,6 +83,12 @@ typedef u_int SOCKET;
 size_t strnlen( const char *start, size_t max_len);
 #endif // HAVE_DECL_STRNLEN
 
+// epoll is available for socket readiness notification, which has no limit
+// on the value of the descriptors it is given (see CSocketEvents)
+#if defined(__linux__)
+#define USE_EPOLL
+#endif
+
 bool static inline IsSelectableSocket(SOCKET s) {
 #ifdef WIN32
     return true;
@@ -7,6 +7,7 @@
 
 #include <stdint.h>
 #include <stdlib.h>
+#include <string>
 
 /** A hasher class for SHA-256. */
 class CSHA256
@@ -25,4 +26,28 @@ public:
     CSHA256& Reset();
 };
 
+/** Instruction set specific SHA-256 implementations SHA256AutoDetect may pick */
+enum SHA256Implementation {
+    SHA256_GENERIC = 0,
+    SHA256_USE_SSE41 = (1 << 0),
+    SHA256_USE_AVX2 = (1 << 1),
+    SHA256_USE_SHANI = (1 << 2),
+    SHA256_USE_ALL = SHA256_USE_SSE41 | SHA256_USE_AVX2 | SHA256_USE_SHANI,
+};
+
+/**
+ * Select the fastest SHA-256 implementations the CPU supports, out of the
+ * allowed ones and those compiled in. Must be called before any hashing
+ * threads are started. Returns a description of the selection.
+ */
+std::string SHA256AutoDetect(int nAllowed = SHA256_USE_ALL);
+
+/**
+ * Compute the double SHA-256 of each of blocks 64-byte inputs (such as a pair
+ * of merkle tree nodes), writing the 32-byte hashes to out.
+ * Inputs are hashed several at a time where multi-way implementations are
+ * available; out may alias in.
+ */
+void SHA256D64(unsigned char* out, const unsigned char* in, size_t blocks);
+
 #endif // BITCOIN_CRYPTO_SHA256_H
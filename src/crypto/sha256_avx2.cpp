@@ -0,0 +1,57 @@
+// Copyright (c) 2017 The Bitcoin Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#ifdef ENABLE_AVX2
+
+#include <stdint.h>
+#include <immintrin.h>
+
+#include "crypto/common.h"
+#include "crypto/sha256_nway.h"
+
+namespace sha256d64_avx2 {
+namespace {
+
+/** Eight lanes of AVX2 vectors */
+struct Ops
+{
+    typedef __m256i T;
+
+    static T K(uint32_t x) { return _mm256_set1_epi32(x); }
+    static T Add(T x, T y) { return _mm256_add_epi32(x, y); }
+    static T Xor(T x, T y) { return _mm256_xor_si256(x, y); }
+    static T Or(T x, T y) { return _mm256_or_si256(x, y); }
+    static T And(T x, T y) { return _mm256_and_si256(x, y); }
+    static T ShR(T x, int n) { return _mm256_srli_epi32(x, n); }
+    static T ShL(T x, int n) { return _mm256_slli_epi32(x, n); }
+
+    static T Load(const unsigned char* in, int n)
+    {
+        return _mm256_set_epi32(ReadBE32(in + 448 + 4 * n), ReadBE32(in + 384 + 4 * n), ReadBE32(in + 320 + 4 * n), ReadBE32(in + 256 + 4 * n),
+                                ReadBE32(in + 192 + 4 * n), ReadBE32(in + 128 + 4 * n), ReadBE32(in + 64 + 4 * n), ReadBE32(in + 4 * n));
+    }
+
+    static void Store(unsigned char* out, int n, T x)
+    {
+        WriteBE32(out + 4 * n, _mm256_extract_epi32(x, 0));
+        WriteBE32(out + 32 + 4 * n, _mm256_extract_epi32(x, 1));
+        WriteBE32(out + 64 + 4 * n, _mm256_extract_epi32(x, 2));
+        WriteBE32(out + 96 + 4 * n, _mm256_extract_epi32(x, 3));
+        WriteBE32(out + 128 + 4 * n, _mm256_extract_epi32(x, 4));
+        WriteBE32(out + 160 + 4 * n, _mm256_extract_epi32(x, 5));
+        WriteBE32(out + 192 + 4 * n, _mm256_extract_epi32(x, 6));
+        WriteBE32(out + 224 + 4 * n, _mm256_extract_epi32(x, 7));
+    }
+};
+
+} // namespace
+
+void Transform_8way(unsigned char* out, const unsigned char* in)
+{
+    sha256_nway::DoubleSHA256<Ops>::TransformD64(out, in);
+}
+
+} // namespace sha256d64_avx2
+
+#endif
@@ -0,0 +1,146 @@
+// Copyright (c) 2017 The Bitcoin Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#ifndef BITCOIN_CRYPTO_SHA256_NWAY_H
+#define BITCOIN_CRYPTO_SHA256_NWAY_H
+
+#include <stdint.h>
+
+/**
+ * Double SHA-256 of several 64-byte inputs at once, one per lane of a vector
+ * of 32-bit integers. Only to be included by the translation units compiled
+ * for a specific instruction set, which describe their vectors with a class
+ * providing:
+ *
+ *   typedef ... T;
+ *   static T K(uint32_t x);              all lanes set to x
+ *   static T Add(T x, T y), Xor, Or, And
+ *   static T ShR(T x, int n), ShL
+ *   static T Load(const unsigned char* in, int n);
+ *                                        big-endian word n of each input, the inputs being 64 bytes apart
+ *   static void Store(unsigned char* out, int n, T x);
+ *                                        big-endian word n of each output, the outputs being 32 bytes apart
+ */
+namespace sha256_nway
+{
+static const uint32_t K[64] = {
+    0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5, 0x3956c25b, 0x59f111f1, 0x923f82a4, 0xab1c5ed5,
+    0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3, 0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174,
+    0xe49b69c1, 0xefbe4786, 0x0fc19dc6, 0x240ca1cc, 0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da,
+    0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7, 0xc6e00bf3, 0xd5a79147, 0x06ca6351, 0x14292967,
+    0x27b70a85, 0x2e1b2138, 0x4d2c6dfc, 0x53380d13, 0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85,
+    0xa2bfe8a1, 0xa81a664b, 0xc24b8b70, 0xc76c51a3, 0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070,
+    0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5, 0x391c0cb3, 0x4ed8aa4a, 0x5b9cca4f, 0x682e6ff3,
+    0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208, 0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2,
+};
+
+/** K plus the message schedule of the padding block of a 64-byte message, which is the same for all */
+static const uint32_t KPAD64[64] = {
+    0xc28a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5, 0x3956c25b, 0x59f111f1, 0x923f82a4, 0xab1c5ed5,
+    0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3, 0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf374,
+    0x649b69c1, 0xf0fe4786, 0x0fe1edc6, 0x240cf254, 0x4fe9346f, 0x6cc984be, 0x61b9411e, 0x16f988fa,
+    0xf2c65152, 0xa88e5a6d, 0xb019fc65, 0xb9d99ec7, 0x9a1231c3, 0xe70eeaa0, 0xfdb1232b, 0xc7353eb0,
+    0x3069bad5, 0xcb976d5f, 0x5a0f118f, 0xdc1eeefd, 0x0a35b689, 0xde0b7a04, 0x58f4ca9d, 0xe15d5b16,
+    0x007f3e86, 0x37088980, 0xa507ea32, 0x6fab9537, 0x17406110, 0x0d8cd6f1, 0xcdaa3b6d, 0xc0bbbe37,
+    0x83613bda, 0xdb48a363, 0x0b02e931, 0x6fd15ca7, 0x521afaca, 0x31338431, 0x6ed41a95, 0x6d437890,
+    0xc39c91f2, 0x9eccabbd, 0xb5c9a0e6, 0x532fb63c, 0xd2c741c6, 0x07237ea3, 0xa4954b68, 0x4c191d76,
+};
+
+template <typename V>
+class DoubleSHA256
+{
+private:
+    typedef typename V::T T;
+
+    static T Add(T a, T b, T c) { return V::Add(V::Add(a, b), c); }
+    static T Add(T a, T b, T c, T d) { return V::Add(V::Add(a, b), V::Add(c, d)); }
+    static T Rotr(T x, int n) { return V::Or(V::ShR(x, n), V::ShL(x, 32 - n)); }
+    static T Ch(T x, T y, T z) { return V::Xor(z, V::And(x, V::Xor(y, z))); }
+    static T Maj(T x, T y, T z) { return V::Or(V::And(x, y), V::And(z, V::Or(x, y))); }
+    static T Sigma0(T x) { return V::Xor(V::Xor(Rotr(x, 2), Rotr(x, 13)), Rotr(x, 22)); }
+    static T Sigma1(T x) { return V::Xor(V::Xor(Rotr(x, 6), Rotr(x, 11)), Rotr(x, 25)); }
+    static T sigma0(T x) { return V::Xor(V::Xor(Rotr(x, 7), Rotr(x, 18)), V::ShR(x, 3)); }
+    static T sigma1(T x) { return V::Xor(V::Xor(Rotr(x, 17), Rotr(x, 19)), V::ShR(x, 10)); }
+
+    static void Initialize(T* s)
+    {
+        s[0] = V::K(0x6a09e667ul);
+        s[1] = V::K(0xbb67ae85ul);
+        s[2] = V::K(0x3c6ef372ul);
+        s[3] = V::K(0xa54ff53aul);
+        s[4] = V::K(0x510e527ful);
+        s[5] = V::K(0x9b05688cul);
+        s[6] = V::K(0x1f83d9abul);
+        s[7] = V::K(0x5be0cd19ul);
+    }
+
+    /** One round, kw being the round constant plus the message word */
+    static void Round(T* v, T kw)
+    {
+        T t1 = Add(v[7], Sigma1(v[4]), Ch(v[4], v[5], v[6]), kw);
+        T t2 = V::Add(Sigma0(v[0]), Maj(v[0], v[1], v[2]));
+        v[7] = v[6];
+        v[6] = v[5];
+        v[5] = v[4];
+        v[4] = V::Add(v[3], t1);
+        v[3] = v[2];
+        v[2] = v[1];
+        v[1] = v[0];
+        v[0] = V::Add(t1, t2);
+    }
+
+    /** Transform the state s with the message block w */
+    static void Transform(T* s, T* w)
+    {
+        T v[8];
+        for (int i = 0; i < 8; i++)
+            v[i] = s[i];
+        for (int i = 0; i < 64; i++) {
+            if (i >= 16)
+                w[i & 15] = Add(w[i & 15], sigma1(w[(i + 14) & 15]), w[(i + 9) & 15], sigma0(w[(i + 1) & 15]));
+            Round(v, V::Add(V::K(K[i]), w[i & 15]));
+        }
+        for (int i = 0; i < 8; i++)
+            s[i] = V::Add(s[i], v[i]);
+    }
+
+    /** Transform the state s with the padding block of 64-byte messages */
+    static void TransformPad64(T* s)
+    {
+        T v[8];
+        for (int i = 0; i < 8; i++)
+            v[i] = s[i];
+        for (int i = 0; i < 64; i++)
+            Round(v, V::K(KPAD64[i]));
+        for (int i = 0; i < 8; i++)
+            s[i] = V::Add(s[i], v[i]);
+    }
+
+public:
+    static void TransformD64(unsigned char* out, const unsigned char* in)
+    {
+        T s[8], w[16];
+        Initialize(s);
+        for (int i = 0; i < 16; i++)
+            w[i] = V::Load(in, i);
+        Transform(s, w);
+        TransformPad64(s);
+
+        // Hash the 32-byte result, padded in the same block
+        for (int i = 0; i < 8; i++)
+            w[i] = s[i];
+        w[8] = V::K(0x80000000);
+        for (int i = 9; i < 15; i++)
+            w[i] = V::K(0);
+        w[15] = V::K(0x100);
+        Initialize(s);
+        Transform(s, w);
+        for (int i = 0; i < 8; i++)
+            V::Store(out, i, s[i]);
+    }
+};
+
+} // namespace sha256_nway
+
+#endif // BITCOIN_CRYPTO_SHA256_NWAY_H
@@ -0,0 +1,52 @@
+// Copyright (c) 2017 The Bitcoin Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#ifdef ENABLE_SSE41
+
+#include <stdint.h>
+#include <immintrin.h>
+
+#include "crypto/common.h"
+#include "crypto/sha256_nway.h"
+
+namespace sha256d64_sse41 {
+namespace {
+
+/** Four lanes of SSE4.1 vectors */
+struct Ops
+{
+    typedef __m128i T;
+
+    static T K(uint32_t x) { return _mm_set1_epi32(x); }
+    static T Add(T x, T y) { return _mm_add_epi32(x, y); }
+    static T Xor(T x, T y) { return _mm_xor_si128(x, y); }
+    static T Or(T x, T y) { return _mm_or_si128(x, y); }
+    static T And(T x, T y) { return _mm_and_si128(x, y); }
+    static T ShR(T x, int n) { return _mm_srli_epi32(x, n); }
+    static T ShL(T x, int n) { return _mm_slli_epi32(x, n); }
+
+    static T Load(const unsigned char* in, int n)
+    {
+        return _mm_set_epi32(ReadBE32(in + 192 + 4 * n), ReadBE32(in + 128 + 4 * n), ReadBE32(in + 64 + 4 * n), ReadBE32(in + 4 * n));
+    }
+
+    static void Store(unsigned char* out, int n, T x)
+    {
+        WriteBE32(out + 4 * n, _mm_extract_epi32(x, 0));
+        WriteBE32(out + 32 + 4 * n, _mm_extract_epi32(x, 1));
+        WriteBE32(out + 64 + 4 * n, _mm_extract_epi32(x, 2));
+        WriteBE32(out + 96 + 4 * n, _mm_extract_epi32(x, 3));
+    }
+};
+
+} // namespace
+
+void Transform_4way(unsigned char* out, const unsigned char* in)
+{
+    sha256_nway::DoubleSHA256<Ops>::TransformD64(out, in);
+}
+
+} // namespace sha256d64_sse41
+
+#endif
@@ -203,6 +203,9 @@ private:
      * Should be set to log2(n)*/
     uint8_t depth_limit;
 
+    /** evictions counts the live elements insert dropped for lack of room */
+    uint64_t evictions;
+
     /** hash_function is a const instance of the hash function. It cannot be
      * static or initialized at call time as it may have internal state (such as
      * a nonce).
@@ -300,7 +303,7 @@ public:
      * call to setup or setup_bytes, otherwise operations may segfault.
      */
     cache() : table(), size(), collection_flags(0), epoch_flags(),
-    epoch_heuristic_counter(), epoch_size(), depth_limit(0), hash_function()
+    epoch_heuristic_counter(), epoch_size(), depth_limit(0), evictions(0), hash_function()
     {
     }
 
@@ -413,6 +416,7 @@ public:
             // Recompute the locs -- unfortunately happens one too many times!
             locs = compute_hashes(e);
         }
+        ++evictions;
     }
 
     /* contains iterates through the hash locations for a given element
@@ -451,6 +455,32 @@ public:
             }
         return false;
     }
+
+    /** capacity returns the number of slots, as returned by setup */
+    uint32_t capacity() const
+    {
+        return size;
+    }
+
+    /** count_live returns the number of elements not marked as discardable,
+     * which insert keeps unless it runs out of room. It scans the whole
+     * table.
+     */
+    uint32_t count_live() const
+    {
+        uint32_t live = 0;
+        for (uint32_t i = 0; i < size; ++i)
+            live += !collection_flags.bit_is_set(i);
+        return live;
+    }
+
+    /** evicted returns the number of live elements insert dropped for lack
+     * of room since construction
+     */
+    uint64_t evicted() const
+    {
+        return evictions;
+    }
 };
 } // namespace CuckooCache
 
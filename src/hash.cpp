@@ -8,70 +8,182 @@
 #include "pubkey.h"
 
 
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
 inline uint32_t ROTL32(uint32_t x, int8_t r)
 {
     return (x << r) | (x >> (32 - r));
 }
 
-unsigned int MurmurHash3(unsigned int nHashSeed, const std::vector<unsigned char>& vDataToHash)
-{
-    // The following is MurmurHash3 (x86_32), see http://code.google.com/p/smhasher/source/browse/trunk/MurmurHash3.cpp
-    uint32_t h1 = nHashSeed;
-    if (vDataToHash.size() > 0)
-    {
-        const uint32_t c1 = 0xcc9e2d51;
-        const uint32_t c2 = 0x1b873593;
-
-        const int nblocks = vDataToHash.size() / 4;
-
-        //----------
-        // body
-        const uint8_t* blocks = &vDataToHash[0] + nblocks * 4;
+// The following is MurmurHash3 (x86_32), see http://code.google.com/p/smhasher/source/browse/trunk/MurmurHash3.cpp
+static const uint32_t MURMUR_C1 = 0xcc9e2d51;
+static const uint32_t MURMUR_C2 = 0x1b873593;
 
-        for (int i = -nblocks; i; i++) {
-            uint32_t k1 = ReadLE32(blocks + i*4);
-
-            k1 *= c1;
-            k1 = ROTL32(k1, 15);
-            k1 *= c2;
+static inline uint32_t MurmurMixK(uint32_t k1)
+{
+    k1 *= MURMUR_C1;
+    k1 = ROTL32(k1, 15);
+    k1 *= MURMUR_C2;
+    return k1;
+}
 
-            h1 ^= k1;
-            h1 = ROTL32(h1, 13);
-            h1 = h1 * 5 + 0xe6546b64;
-        }
+static inline uint32_t MurmurMixH(uint32_t h1, uint32_t k1)
+{
+    h1 ^= k1;
+    h1 = ROTL32(h1, 13);
+    return h1 * 5 + 0xe6546b64;
+}
 
-        //----------
-        // tail
-        const uint8_t* tail = (const uint8_t*)(&vDataToHash[0] + nblocks * 4);
-
-        uint32_t k1 = 0;
-
-        switch (vDataToHash.size() & 3) {
-        case 3:
-            k1 ^= tail[2] << 16;
-        case 2:
-            k1 ^= tail[1] << 8;
-        case 1:
-            k1 ^= tail[0];
-            k1 *= c1;
-            k1 = ROTL32(k1, 15);
-            k1 *= c2;
-            h1 ^= k1;
-        }
+// Last bytes of the data, not a multiple of 4, as a little endian word.
+static inline uint32_t MurmurTail(const unsigned char* tail, size_t nLen)
+{
+    uint32_t k1 = 0;
+    switch (nLen & 3) {
+    case 3:
+        k1 ^= tail[2] << 16;
+    case 2:
+        k1 ^= tail[1] << 8;
+    case 1:
+        k1 ^= tail[0];
     }
+    return k1;
+}
 
-    //----------
-    // finalization
-    h1 ^= vDataToHash.size();
+static inline uint32_t MurmurFinalize(uint32_t h1, size_t nLen)
+{
+    h1 ^= nLen;
     h1 ^= h1 >> 16;
     h1 *= 0x85ebca6b;
     h1 ^= h1 >> 13;
     h1 *= 0xc2b2ae35;
     h1 ^= h1 >> 16;
-
     return h1;
 }
 
+unsigned int MurmurHash3(unsigned int nHashSeed, const unsigned char* pData, size_t nLen)
+{
+    uint32_t h1 = nHashSeed;
+    const size_t nBlocks = nLen / 4;
+
+    //----------
+    // body
+    for (size_t i = 0; i < nBlocks; i++)
+        h1 = MurmurMixH(h1, MurmurMixK(ReadLE32(pData + i * 4)));
+
+    //----------
+    // tail
+    if (nLen & 3)
+        h1 ^= MurmurMixK(MurmurTail(pData + nBlocks * 4, nLen));
+
+    //----------
+    // finalization
+    return MurmurFinalize(h1, nLen);
+}
+
+unsigned int MurmurHash3(unsigned int nHashSeed, const std::vector<unsigned char>& vDataToHash)
+{
+    return MurmurHash3(nHashSeed, vDataToHash.data(), vDataToHash.size());
+}
+
+#if defined(__SSE2__)
+// Four lanes of the scalar MurmurHash3 steps. SSE2 has no 32-bit multiply
+// keeping the low halves, so it is made of two 32x32->64 bit multiplies.
+static inline __m128i MulLo32x4(__m128i a, __m128i b)
+{
+    __m128i even = _mm_mul_epu32(a, b);
+    __m128i odd = _mm_mul_epu32(_mm_srli_epi64(a, 32), _mm_srli_epi64(b, 32));
+    return _mm_unpacklo_epi32(_mm_shuffle_epi32(even, _MM_SHUFFLE(0, 0, 2, 0)), _mm_shuffle_epi32(odd, _MM_SHUFFLE(0, 0, 2, 0)));
+}
+
+static inline __m128i Rotl32x4(__m128i x, int r)
+{
+    return _mm_or_si128(_mm_slli_epi32(x, r), _mm_srli_epi32(x, 32 - r));
+}
+
+static inline __m128i MurmurMixKx4(__m128i k1)
+{
+    k1 = MulLo32x4(k1, _mm_set1_epi32(MURMUR_C1));
+    k1 = Rotl32x4(k1, 15);
+    return MulLo32x4(k1, _mm_set1_epi32(MURMUR_C2));
+}
+
+static inline __m128i MurmurMixHx4(__m128i h1, __m128i k1)
+{
+    h1 = _mm_xor_si128(h1, k1);
+    h1 = Rotl32x4(h1, 13);
+    // h1 * 5 + 0xe6546b64
+    return _mm_add_epi32(_mm_add_epi32(_mm_slli_epi32(h1, 2), h1), _mm_set1_epi32(0xe6546b64));
+}
+
+static inline __m128i MurmurFinalizex4(__m128i h1, size_t nLen)
+{
+    h1 = _mm_xor_si128(h1, _mm_set1_epi32(nLen));
+    h1 = _mm_xor_si128(h1, _mm_srli_epi32(h1, 16));
+    h1 = MulLo32x4(h1, _mm_set1_epi32(0x85ebca6b));
+    h1 = _mm_xor_si128(h1, _mm_srli_epi32(h1, 13));
+    h1 = MulLo32x4(h1, _mm_set1_epi32(0xc2b2ae35));
+    return _mm_xor_si128(h1, _mm_srli_epi32(h1, 16));
+}
+#endif
+
+CMurmurHash3Seeds::CMurmurHash3Seeds(const unsigned char* pData, size_t nLenIn) : nLen(nLenIn)
+{
+    // The data words are mixed the same way under every seed, do it once.
+    const size_t nBlocks = nLen / 4;
+    vK.resize(nBlocks + ((nLen & 3) ? 1 : 0));
+    for (size_t i = 0; i < nBlocks; i++)
+        vK[i] = MurmurMixK(ReadLE32(pData + i * 4));
+    if (nLen & 3)
+        vK[nBlocks] = MurmurMixK(MurmurTail(pData + nBlocks * 4, nLen));
+}
+
+void CMurmurHash3Seeds::Hash(const unsigned int* pSeeds, size_t nSeeds, unsigned int* pOut) const
+{
+    const size_t nBlocks = nLen / 4;
+    size_t i = 0;
+#if defined(__SSE2__)
+    for (; i + 4 <= nSeeds; i += 4) {
+        __m128i h1 = _mm_loadu_si128((const __m128i*)(pSeeds + i));
+        for (size_t j = 0; j < nBlocks; j++)
+            h1 = MurmurMixHx4(h1, _mm_set1_epi32(vK[j]));
+        if (nLen & 3)
+            h1 = _mm_xor_si128(h1, _mm_set1_epi32(vK[nBlocks]));
+        _mm_storeu_si128((__m128i*)(pOut + i), MurmurFinalizex4(h1, nLen));
+    }
+#endif
+    for (; i < nSeeds; i++) {
+        uint32_t h1 = pSeeds[i];
+        for (size_t j = 0; j < nBlocks; j++)
+            h1 = MurmurMixH(h1, vK[j]);
+        if (nLen & 3)
+            h1 ^= vK[nBlocks];
+        pOut[i] = MurmurFinalize(h1, nLen);
+    }
+}
+
+void MurmurHash3x4(unsigned int nHashSeed, const unsigned char* const pData[4], size_t nLen, unsigned int pOut[4])
+{
+#if defined(__SSE2__)
+    const size_t nBlocks = nLen / 4;
+    __m128i h1 = _mm_set1_epi32(nHashSeed);
+    for (size_t i = 0; i < nBlocks; i++) {
+        __m128i k1 = _mm_set_epi32(ReadLE32(pData[3] + i * 4), ReadLE32(pData[2] + i * 4), ReadLE32(pData[1] + i * 4), ReadLE32(pData[0] + i * 4));
+        h1 = MurmurMixHx4(h1, MurmurMixKx4(k1));
+    }
+    if (nLen & 3) {
+        const size_t nTail = nBlocks * 4;
+        __m128i k1 = _mm_set_epi32(MurmurTail(pData[3] + nTail, nLen), MurmurTail(pData[2] + nTail, nLen), MurmurTail(pData[1] + nTail, nLen), MurmurTail(pData[0] + nTail, nLen));
+        h1 = _mm_xor_si128(h1, MurmurMixKx4(k1));
+    }
+    _mm_storeu_si128((__m128i*)pOut, MurmurFinalizex4(h1, nLen));
+#else
+    for (int i = 0; i < 4; i++)
+        pOut[i] = MurmurHash3(nHashSeed, pData[i], nLen);
+#endif
+}
+
 void BIP32Hash(const ChainCode &chainCode, unsigned int nChild, unsigned char header, const unsigned char data[32], unsigned char output[64])
 {
     unsigned char num[4];
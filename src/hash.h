@@ -169,8 +169,28 @@ uint256 SerializeHash(const T& obj, int nType=SER_GETHASH, int nVersion=PROTOCOL
     return ss.GetHash();
 }
 
+unsigned int MurmurHash3(unsigned int nHashSeed, const unsigned char* pData, size_t nLen);
 unsigned int MurmurHash3(unsigned int nHashSeed, const std::vector<unsigned char>& vDataToHash);
 
+/** MurmurHash3 of four keys of the same length under one seed, four lanes at a time where SIMD is available. */
+void MurmurHash3x4(unsigned int nHashSeed, const unsigned char* const pData[4], size_t nLen, unsigned int pOut[4]);
+
+/**
+ * MurmurHash3 of one key under many seeds, as bloom filters need. The key is
+ * mixed only once, and the seeds are hashed four at a time where SIMD is
+ * available.
+ */
+class CMurmurHash3Seeds
+{
+private:
+    prevector<16, uint32_t> vK;
+    size_t nLen;
+
+public:
+    CMurmurHash3Seeds(const unsigned char* pData, size_t nLen);
+    void Hash(const unsigned int* pSeeds, size_t nSeeds, unsigned int* pOut) const;
+};
+
 void BIP32Hash(const ChainCode &chainCode, unsigned int nChild, unsigned char header, const unsigned char data[32], unsigned char output[64]);
 
 /** SipHash-2-4 */
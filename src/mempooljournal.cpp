@@ -0,0 +1,439 @@
+// Copyright (c) 2017 The Bitcoin Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "mempooljournal.h"
+
+#include "clientversion.h"
+#include "coins.h"
+#include "crypto/common.h"
+#include "hash.h"
+#include "init.h"
+#include "policy/policy.h"
+#include "script/interpreter.h"
+#include "script/sigcache.h"
+#include "util.h"
+#include "utiltime.h"
+#include "validation.h"
+
+#include <boost/bind.hpp>
+#include <boost/filesystem.hpp>
+#include <boost/thread.hpp>
+
+static const uint64_t MEMPOOL_JOURNAL_VERSION = 1;
+
+CMempoolJournal::CMempoolJournal(CTxMemPool& poolIn, const boost::filesystem::path& pathIn) :
+    pool(poolIn), path(pathIn), nRecords(0), fRecording(false)
+{
+}
+
+CMempoolJournal::~CMempoolJournal()
+{
+    Close();
+}
+
+void CMempoolJournal::TransactionAdded(CTransactionRef tx)
+{
+    LOCK(cs_queue);
+    vQueue.push_back(PendingRecord{RECORD_ADD, tx});
+}
+
+void CMempoolJournal::TransactionRemoved(CTransactionRef tx, MemPoolRemovalReason reason)
+{
+    LOCK(cs_queue);
+    vQueue.push_back(PendingRecord{RECORD_REMOVE, tx});
+}
+
+void CMempoolJournal::WriteRecord(CAutoFile& fileout, RecordType type, const CDataStream& payload)
+{
+    std::vector<unsigned char> vch(payload.begin(), payload.end());
+    uint256 hash = Hash(vch.begin(), vch.end());
+    fileout << (uint8_t)type;
+    fileout << vch;
+    fileout << ReadLE32(hash.begin());
+    ++nRecords;
+}
+
+void CMempoolJournal::WriteAdd(CAutoFile& fileout, const TxMempoolInfo& info)
+{
+    CDataStream ss(SER_DISK, CLIENT_VERSION);
+    ss << *info.tx;
+    ss << (int64_t)info.nTime;
+    ss << (int64_t)info.nFeeDelta;
+    WriteRecord(fileout, RECORD_ADD, ss);
+}
+
+void CMempoolJournal::WriteDeltas(CAutoFile& fileout, const std::map<uint256, CAmount>& mapDeltas)
+{
+    CDataStream ss(SER_DISK, CLIENT_VERSION);
+    ss << mapDeltas;
+    WriteRecord(fileout, RECORD_DELTAS, ss);
+}
+
+bool CMempoolJournal::ReopenForAppend()
+{
+    file.reset(new CAutoFile(fopen(path.string().c_str(), "ab"), SER_DISK, CLIENT_VERSION));
+    if (file->IsNull()) {
+        LogPrintf("%s: failed to open %s for appending\n", __func__, path.string());
+        file.reset();
+        return false;
+    }
+    return true;
+}
+
+bool CMempoolJournal::Open()
+{
+    if (!Compact())
+        return false;
+
+    LOCK2(pool.cs, cs_queue);
+    if (!fRecording) {
+        pool.NotifyEntryAdded.connect(boost::bind(&CMempoolJournal::TransactionAdded, this, _1));
+        pool.NotifyEntryRemoved.connect(boost::bind(&CMempoolJournal::TransactionRemoved, this, _1, _2));
+        fRecording = true;
+    }
+    return true;
+}
+
+void CMempoolJournal::Close()
+{
+    {
+        LOCK2(pool.cs, cs_queue);
+        if (!fRecording)
+            return;
+        pool.NotifyEntryAdded.disconnect(boost::bind(&CMempoolJournal::TransactionAdded, this, _1));
+        pool.NotifyEntryRemoved.disconnect(boost::bind(&CMempoolJournal::TransactionRemoved, this, _1, _2));
+        fRecording = false;
+    }
+
+    Flush();
+
+    LOCK(cs_file);
+    if (!file)
+        return;
+    std::map<uint256, CAmount> mapDeltas;
+    {
+        // The deltas recorded with additions may have been changed since, so
+        // all of them are recorded; loading sets them rather than adds them.
+        LOCK(pool.cs);
+        for (const auto& i : pool.mapDeltas) {
+            mapDeltas[i.first] = i.second.second;
+        }
+    }
+    try {
+        WriteDeltas(*file, mapDeltas);
+        FileCommit(file->Get());
+    } catch (const std::exception& e) {
+        LogPrintf("%s: failed to write mempool journal: %s\n", __func__, e.what());
+    }
+    file.reset();
+    LogPrint("mempool", "Closed mempool journal after %u records\n", nRecords);
+}
+
+void CMempoolJournal::Flush()
+{
+    LOCK(cs_file);
+    std::vector<PendingRecord> vRecords;
+    {
+        LOCK(cs_queue);
+        vRecords.swap(vQueue);
+    }
+    if (vRecords.empty() || !file)
+        return;
+
+    try {
+        for (const PendingRecord& record : vRecords) {
+            if (record.type == RECORD_ADD) {
+                // The entry time and fee delta are only known once the
+                // transaction is in the pool; if it has already left again,
+                // the removal that follows makes the addition irrelevant.
+                TxMempoolInfo info = pool.info(record.tx->GetHash());
+                if (!info.tx)
+                    continue;
+                WriteAdd(*file, info);
+            } else {
+                CDataStream ss(SER_DISK, CLIENT_VERSION);
+                ss << record.tx->GetHash();
+                WriteRecord(*file, RECORD_REMOVE, ss);
+            }
+        }
+        fflush(file->Get());
+    } catch (const std::exception& e) {
+        LogPrintf("%s: failed to write mempool journal: %s\n", __func__, e.what());
+    }
+}
+
+bool CMempoolJournal::Compact()
+{
+    int64_t nStart = GetTimeMicros();
+    LOCK(cs_file);
+
+    std::map<uint256, CAmount> mapDeltas;
+    std::vector<TxMempoolInfo> vinfo;
+    {
+        // Taking the snapshot and discarding the queued records must be
+        // atomic with respect to the mempool, so that nothing is lost or
+        // recorded twice.
+        LOCK2(pool.cs, cs_queue);
+        for (const auto& i : pool.mapDeltas) {
+            mapDeltas[i.first] = i.second.second;
+        }
+        vinfo = pool.infoAll();
+        vQueue.clear();
+    }
+
+    boost::filesystem::path pathNew = path;
+    pathNew += ".new";
+    try {
+        CAutoFile fileout(fopen(pathNew.string().c_str(), "wb"), SER_DISK, CLIENT_VERSION);
+        if (fileout.IsNull()) {
+            LogPrintf("%s: failed to open %s\n", __func__, pathNew.string());
+            return false;
+        }
+        uint64_t nRecordsOld = nRecords;
+        nRecords = 0;
+        fileout << MEMPOOL_JOURNAL_VERSION;
+        for (const auto& i : vinfo) {
+            WriteAdd(fileout, i);
+        }
+        WriteDeltas(fileout, mapDeltas);
+        FileCommit(fileout.Get());
+        fileout.fclose();
+        if (!RenameOver(pathNew, path)) {
+            LogPrintf("%s: failed to rename %s\n", __func__, pathNew.string());
+            nRecords = nRecordsOld;
+            return false;
+        }
+    } catch (const std::exception& e) {
+        LogPrintf("%s: failed to write mempool journal: %s\n", __func__, e.what());
+        return false;
+    }
+
+    if (!ReopenForAppend())
+        return false;
+
+    LogPrint("mempool", "Compacted mempool journal to %u transactions: %.2fms\n", vinfo.size(), (GetTimeMicros() - nStart) * 0.001);
+    return true;
+}
+
+void CMempoolJournal::Periodic()
+{
+    Flush();
+
+    size_t nPoolSize = pool.size();
+    if (nRecords > std::max(MEMPOOL_JOURNAL_MIN_COMPACT_RECORDS, (uint64_t)nPoolSize * 2))
+        Compact();
+}
+
+bool ReadMempoolJournal(const boost::filesystem::path& path, std::vector<TxMempoolInfo>& vEntries, std::map<uint256, CAmount>& mapDeltas)
+{
+    CAutoFile file(fopen(path.string().c_str(), "rb"), SER_DISK, CLIENT_VERSION);
+    if (file.IsNull())
+        return false;
+
+    uint64_t version;
+    try {
+        file >> version;
+    } catch (const std::exception& e) {
+        LogPrintf("%s: failed to read mempool journal header: %s\n", __func__, e.what());
+        return false;
+    }
+    if (version != MEMPOOL_JOURNAL_VERSION)
+        return false;
+
+    // Replay the log keeping the order in which transactions were (last)
+    // added; removed entries are left as null placeholders and skipped below.
+    std::vector<TxMempoolInfo> vLog;
+    std::map<uint256, size_t> mapPos;
+    uint64_t nRecords = 0;
+    while (true) {
+        uint8_t type;
+        std::vector<unsigned char> vch;
+        uint32_t nChecksum;
+        try {
+            file >> type;
+        } catch (const std::ios_base::failure&) {
+            break; // clean end of file
+        }
+        try {
+            file >> vch;
+            file >> nChecksum;
+            uint256 hash = Hash(vch.begin(), vch.end());
+            if (ReadLE32(hash.begin()) != nChecksum)
+                throw std::runtime_error("checksum mismatch");
+
+            CDataStream ss(vch, SER_DISK, CLIENT_VERSION);
+            if (type == CMempoolJournal::RECORD_ADD) {
+                TxMempoolInfo info;
+                ss >> info.tx;
+                ss >> info.nTime;
+                ss >> info.nFeeDelta;
+                const uint256& txid = info.tx->GetHash();
+                // The delta recorded with the addition is the more recent one
+                mapDeltas.erase(txid);
+                std::map<uint256, size_t>::iterator it = mapPos.find(txid);
+                if (it != mapPos.end())
+                    vLog[it->second].tx.reset();
+                mapPos[txid] = vLog.size();
+                vLog.push_back(info);
+            } else if (type == CMempoolJournal::RECORD_REMOVE) {
+                uint256 txid;
+                ss >> txid;
+                std::map<uint256, size_t>::iterator it = mapPos.find(txid);
+                if (it != mapPos.end()) {
+                    vLog[it->second].tx.reset();
+                    mapPos.erase(it);
+                }
+            } else if (type == CMempoolJournal::RECORD_DELTAS) {
+                mapDeltas.clear();
+                ss >> mapDeltas;
+            } else {
+                throw std::runtime_error(strprintf("unknown record type %u", type));
+            }
+        } catch (const std::exception& e) {
+            LogPrintf("%s: ignoring mempool journal tail after %u records: %s\n", __func__, nRecords, e.what());
+            break;
+        }
+        ++nRecords;
+    }
+
+    vEntries.clear();
+    vEntries.reserve(mapPos.size());
+    for (const TxMempoolInfo& info : vLog) {
+        if (info.tx) {
+            vEntries.push_back(info);
+        }
+    }
+    return true;
+}
+
+void SetMempoolJournalDelta(CTxMemPool& pool, const uint256& txid, CAmount nFeeDelta)
+{
+    double dPriorityDelta = 0;
+    CAmount nFeeDeltaOld = 0;
+    pool.ApplyDeltas(txid, dPriorityDelta, nFeeDeltaOld);
+    if (nFeeDelta != nFeeDeltaOld)
+        pool.PrioritiseTransaction(txid, txid.ToString(), 0, nFeeDelta - nFeeDeltaOld);
+}
+
+namespace {
+
+/** A script check prepared outside cs_main to warm the signature cache. */
+struct CSigCacheWarmup
+{
+    const CTransaction* ptx;
+    unsigned int nIn;
+    CAmount amount;
+    CScript scriptPubKey;
+    PrecomputedTransactionData* ptxdata;
+};
+
+void WarmSignatureCache(const std::vector<CSigCacheWarmup>& vChecks, size_t nOffset, size_t nStride)
+{
+    for (size_t i = nOffset; i < vChecks.size(); i += nStride) {
+        const CSigCacheWarmup& check = vChecks[i];
+        // Only the side effect matters: successful signature checks are
+        // stored in the cache and hit again by AcceptToMemoryPool.
+        VerifyScript(check.ptx->vin[check.nIn].scriptSig, check.scriptPubKey, STANDARD_SCRIPT_VERIFY_FLAGS,
+                     CachingTransactionSignatureChecker(check.ptx, check.nIn, check.amount, true, *check.ptxdata));
+    }
+}
+
+} // anon namespace
+
+bool LoadMempoolJournal(CTxMemPool& pool, const boost::filesystem::path& path, int nThreads)
+{
+    int64_t nStart = GetTimeMicros();
+    std::vector<TxMempoolInfo> vEntries;
+    std::map<uint256, CAmount> mapDeltas;
+    if (!ReadMempoolJournal(path, vEntries, mapDeltas))
+        return false;
+
+    int64_t nExpiryTimeout = GetArg("-mempoolexpiry", DEFAULT_MEMPOOL_EXPIRY) * 60 * 60;
+    int64_t nNow = GetTime();
+    int64_t count = 0;
+    int64_t skipped = 0;
+    int64_t failed = 0;
+    int64_t nTimeWarm = 0;
+
+    for (size_t nBatchStart = 0; nBatchStart < vEntries.size(); nBatchStart += MEMPOOL_JOURNAL_LOAD_BATCH) {
+        std::vector<const TxMempoolInfo*> vBatch;
+        for (size_t i = nBatchStart; i < std::min(vEntries.size(), nBatchStart + MEMPOOL_JOURNAL_LOAD_BATCH); ++i) {
+            const TxMempoolInfo& info = vEntries[i];
+            if (info.nTime + nExpiryTimeout <= nNow) {
+                ++skipped;
+                continue;
+            }
+            if (info.nFeeDelta) {
+                SetMempoolJournalDelta(pool, info.tx->GetHash(), info.nFeeDelta);
+            }
+            vBatch.push_back(&info);
+        }
+
+        // Look up the outputs spent by the batch, including those created
+        // earlier in the same batch, and verify the signatures in parallel.
+        int64_t nTimeWarmStart = GetTimeMicros();
+        std::vector<PrecomputedTransactionData> vTxData;
+        vTxData.reserve(vBatch.size());
+        std::vector<CSigCacheWarmup> vChecks;
+        {
+            std::map<uint256, const CTransaction*> mapBatch;
+            LOCK2(cs_main, pool.cs);
+            CCoinsViewMemPool viewMemPool(pcoinsTip, pool);
+            for (const TxMempoolInfo* pinfo : vBatch) {
+                const CTransaction& tx = *pinfo->tx;
+                vTxData.emplace_back(tx);
+                for (unsigned int i = 0; i < tx.vin.size(); i++) {
+                    const COutPoint& prevout = tx.vin[i].prevout;
+                    std::map<uint256, const CTransaction*>::const_iterator it = mapBatch.find(prevout.hash);
+                    if (it != mapBatch.end()) {
+                        if (prevout.n < it->second->vout.size()) {
+                            const CTxOut& txout = it->second->vout[prevout.n];
+                            vChecks.push_back(CSigCacheWarmup{&tx, i, txout.nValue, txout.scriptPubKey, &vTxData.back()});
+                        }
+                        continue;
+                    }
+                    CCoins coins;
+                    if (viewMemPool.GetCoins(prevout.hash, coins) && coins.IsAvailable(prevout.n)) {
+                        const CTxOut& txout = coins.vout[prevout.n];
+                        vChecks.push_back(CSigCacheWarmup{&tx, i, txout.nValue, txout.scriptPubKey, &vTxData.back()});
+                    }
+                }
+                mapBatch[tx.GetHash()] = &tx;
+            }
+        }
+        if (nThreads > 1 && vChecks.size() > 1) {
+            boost::thread_group threads;
+            for (int i = 0; i < nThreads; i++) {
+                threads.create_thread(boost::bind(&WarmSignatureCache, boost::cref(vChecks), i, nThreads));
+            }
+            threads.join_all();
+        } else {
+            WarmSignatureCache(vChecks, 0, 1);
+        }
+        nTimeWarm += GetTimeMicros() - nTimeWarmStart;
+
+        {
+            LOCK(cs_main);
+            for (const TxMempoolInfo* pinfo : vBatch) {
+                CValidationState state;
+                AcceptToMemoryPoolWithTime(pool, state, pinfo->tx, true, NULL, pinfo->nTime);
+                if (state.IsValid()) {
+                    ++count;
+                } else {
+                    ++failed;
+                }
+            }
+        }
+        if (ShutdownRequested())
+            return false;
+    }
+
+    for (const auto& i : mapDeltas) {
+        SetMempoolJournalDelta(pool, i.first, i.second);
+    }
+
+    LogPrintf("Imported mempool journal: %i successes, %i failed, %i expired (%.2fs, %.2fs checking signatures on %d threads)\n",
+        count, failed, skipped, (GetTimeMicros() - nStart) * 0.000001, nTimeWarm * 0.000001, std::max(nThreads, 1));
+    return true;
+}
@@ -0,0 +1,113 @@
+// Copyright (c) 2017 The Bitcoin Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#ifndef BITCOIN_MEMPOOLJOURNAL_H
+#define BITCOIN_MEMPOOLJOURNAL_H
+
+#include "amount.h"
+#include "streams.h"
+#include "sync.h"
+#include "txmempool.h"
+
+#include <map>
+#include <memory>
+#include <vector>
+
+#include <boost/filesystem/path.hpp>
+
+/** Default for -mempooljournal */
+static const bool DEFAULT_MEMPOOL_JOURNAL = false;
+/** Seconds between appending queued journal records to disk */
+static const int64_t MEMPOOL_JOURNAL_FLUSH_INTERVAL = 1;
+/** Never compact a journal holding fewer records than this */
+static const uint64_t MEMPOOL_JOURNAL_MIN_COMPACT_RECORDS = 10000;
+/** Number of journal transactions re-validated per cs_main acquisition at startup */
+static const unsigned int MEMPOOL_JOURNAL_LOAD_BATCH = 500;
+
+/**
+ * Append-only on-disk log of mempool changes.
+ *
+ * Every transaction added to or removed from the mempool is queued in memory
+ * from the mempool notification signals and appended to mempool.journal by
+ * Flush(), which is called periodically from the scheduler thread. Once the
+ * log has grown well beyond the size of the live mempool it is rewritten from
+ * a snapshot of the pool by Compact(). This replaces the full rewrite of
+ * mempool.dat at shutdown: closing the journal only has to append whatever is
+ * still queued.
+ *
+ * Lock order: cs_file, then pool.cs, then cs_queue.
+ */
+class CMempoolJournal
+{
+public:
+    CMempoolJournal(CTxMemPool& poolIn, const boost::filesystem::path& pathIn);
+    ~CMempoolJournal();
+
+    /** Write a fresh journal from the current pool contents and start recording changes. */
+    bool Open();
+    /** Append pending records, record all current fee deltas and stop recording. */
+    void Close();
+    /** Append all queued records to the journal. */
+    void Flush();
+    /** Rewrite the journal from a snapshot of the pool. */
+    bool Compact();
+    /** Periodic scheduler task: flush, and compact if the journal has grown too large. */
+    void Periodic();
+
+    uint64_t GetRecordCount() const { return nRecords; }
+
+    enum RecordType : uint8_t {
+        RECORD_ADD = 1,     //! transaction, entry time and fee delta
+        RECORD_REMOVE = 2,  //! txid
+        RECORD_DELTAS = 3,  //! full map of fee deltas, replacing earlier ones
+    };
+
+private:
+    struct PendingRecord
+    {
+        RecordType type;
+        CTransactionRef tx;
+    };
+
+    CTxMemPool& pool;
+    const boost::filesystem::path path;
+
+    mutable CCriticalSection cs_file;
+    std::unique_ptr<CAutoFile> file;
+    uint64_t nRecords;
+
+    mutable CCriticalSection cs_queue;
+    std::vector<PendingRecord> vQueue;
+    bool fRecording;
+
+    void TransactionAdded(CTransactionRef tx);
+    void TransactionRemoved(CTransactionRef tx, MemPoolRemovalReason reason);
+
+    void WriteRecord(CAutoFile& fileout, RecordType type, const CDataStream& payload);
+    void WriteAdd(CAutoFile& fileout, const TxMempoolInfo& info);
+    void WriteDeltas(CAutoFile& fileout, const std::map<uint256, CAmount>& mapDeltas);
+    bool ReopenForAppend();
+};
+
+/**
+ * Replay a mempool journal. On success vEntries holds the transactions that
+ * were in the pool when the journal was last written, in the order they were
+ * added, and mapDeltas the last recorded fee deltas of any transactions,
+ * which override those of the entries. A truncated or corrupt tail (e.g.
+ * after a crash) ends the replay without failing it.
+ */
+bool ReadMempoolJournal(const boost::filesystem::path& path, std::vector<TxMempoolInfo>& vEntries, std::map<uint256, CAmount>& mapDeltas);
+
+/** Set, rather than add to, the fee delta of a transaction, as the journal records them */
+void SetMempoolJournalDelta(CTxMemPool& pool, const uint256& txid, CAmount nFeeDelta);
+
+/**
+ * Load the mempool from a journal. Transactions are re-validated in batches:
+ * the signatures of each batch are checked in parallel on nThreads threads to
+ * populate the signature cache, after which the batch is submitted to
+ * AcceptToMemoryPool under a single cs_main lock.
+ */
+bool LoadMempoolJournal(CTxMemPool& pool, const boost::filesystem::path& path, int nThreads);
+
+#endif // BITCOIN_MEMPOOLJOURNAL_H
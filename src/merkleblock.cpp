@@ -7,8 +7,11 @@
 
 #include "hash.h"
 #include "consensus/consensus.h"
+#include "memusage.h"
 #include "utilstrencodings.h"
 
+#include <map>
+
 CMerkleBlock::CMerkleBlock(const CBlock& block, CBloomFilter& filter)
 {
     header = block.GetBlockHeader();
@@ -35,6 +38,44 @@ CMerkleBlock::CMerkleBlock(const CBlock& block, CBloomFilter& filter)
     txn = CPartialMerkleTree(vHashes, vMatch);
 }
 
+CMerkleBlock::CMerkleBlock(const CBlockPushdataIndex& index, CBloomFilter& filter)
+{
+    header = index.block->GetBlockHeader();
+
+    const unsigned int nTx = index.vTxid.size();
+    std::vector<bool> vMatch(nTx, filter.IsFull());
+
+    if (!filter.IsFull() && !filter.IsEmpty()) {
+        for (unsigned int i = 0; i < nTx; i++)
+            if (filter.contains(index.vTxid[i]))
+                vMatch[i] = true;
+
+        for (size_t e = 0; e < index.GetElementCount(); e++) {
+            const uint32_t nBegin = index.vElementOffset[e];
+            if (!filter.contains(&index.vData[nBegin], index.vElementOffset[e + 1] - nBegin))
+                continue;
+            for (uint32_t o = index.vOccurrenceOffset[e]; o < index.vOccurrenceOffset[e + 1]; o++) {
+                const CBlockPushdataIndex::Occurrence& occurrence = index.vOccurrence[o];
+                vMatch[occurrence.nTx] = true;
+                if (occurrence.nOut >= 0)
+                    filter.UpdateMatchedOutput(COutPoint(index.vTxid[occurrence.nTx], occurrence.nOut),
+                                               index.block->vtx[occurrence.nTx]->vout[occurrence.nOut].scriptPubKey);
+            }
+        }
+
+        // Only now, so that outputs matched above are found when spent later in the block
+        for (const auto& prevout : index.vPrevout)
+            if (!vMatch[prevout.second] && filter.contains(prevout.first))
+                vMatch[prevout.second] = true;
+    }
+
+    for (unsigned int i = 0; i < nTx; i++)
+        if (vMatch[i])
+            vMatchedTxn.push_back(std::make_pair(i, index.vTxid[i]));
+
+    txn = CPartialMerkleTree(nTx, index.vMerkleTree, vMatch);
+}
+
 CMerkleBlock::CMerkleBlock(const CBlock& block, const std::set<uint256>& txids)
 {
     header = block.GetBlockHeader();
@@ -75,6 +116,21 @@ uint256 CPartialMerkleTree::CalcHash(int height, unsigned int pos, const std::ve
     }
 }
 
+std::vector<uint256> CPartialMerkleTree::CalcTreeLevels(const std::vector<uint256> &vTxid) {
+    std::vector<uint256> vTree(vTxid);
+    size_t nLevelBegin = 0, nWidth = vTxid.size();
+    while (nWidth > 1) {
+        for (size_t i = 0; i < nWidth; i += 2) {
+            const uint256& left = vTree[nLevelBegin + i];
+            const uint256& right = vTree[nLevelBegin + std::min(i + 1, nWidth - 1)];
+            vTree.push_back(Hash(BEGIN(left), END(left), BEGIN(right), END(right)));
+        }
+        nLevelBegin += nWidth;
+        nWidth = (nWidth + 1) / 2;
+    }
+    return vTree;
+}
+
 void CPartialMerkleTree::TraverseAndBuild(int height, unsigned int pos, const std::vector<uint256> &vTxid, const std::vector<bool> &vMatch) {
     // determine whether this node is the parent of at least one matched txid
     bool fParentOfMatch = false;
@@ -93,6 +149,24 @@ void CPartialMerkleTree::TraverseAndBuild(int height, unsigned int pos, const st
     }
 }
 
+void CPartialMerkleTree::TraverseAndBuildFromLevels(int height, unsigned int pos, const std::vector<uint256> &vTree, const std::vector<bool> &vMatch) {
+    bool fParentOfMatch = false;
+    for (unsigned int p = pos << height; p < (pos+1) << height && p < nTransactions && !fParentOfMatch; p++)
+        fParentOfMatch |= vMatch[p];
+    vBits.push_back(fParentOfMatch);
+    if (height==0 || !fParentOfMatch) {
+        // levels are stored bottom up, so skip the widths of all levels below this one
+        unsigned int nLevelBegin = 0;
+        for (int h = 0; h < height; h++)
+            nLevelBegin += CalcTreeWidth(h);
+        vHash.push_back(vTree[nLevelBegin + pos]);
+    } else {
+        TraverseAndBuildFromLevels(height-1, pos*2, vTree, vMatch);
+        if (pos*2+1 < CalcTreeWidth(height-1))
+            TraverseAndBuildFromLevels(height-1, pos*2+1, vTree, vMatch);
+    }
+}
+
 uint256 CPartialMerkleTree::TraverseAndExtract(int height, unsigned int pos, unsigned int &nBitsUsed, unsigned int &nHashUsed, std::vector<uint256> &vMatch, std::vector<unsigned int> &vnIndex) {
     if (nBitsUsed >= vBits.size()) {
         // overflowed the bits array - failure
@@ -145,6 +219,14 @@ CPartialMerkleTree::CPartialMerkleTree(const std::vector<uint256> &vTxid, const
     TraverseAndBuild(nHeight, 0, vTxid, vMatch);
 }
 
+CPartialMerkleTree::CPartialMerkleTree(unsigned int nTransactionsIn, const std::vector<uint256> &vTree, const std::vector<bool> &vMatch) : nTransactions(nTransactionsIn), fBad(false) {
+    int nHeight = 0;
+    while (CalcTreeWidth(nHeight) > 1)
+        nHeight++;
+
+    TraverseAndBuildFromLevels(nHeight, 0, vTree, vMatch);
+}
+
 CPartialMerkleTree::CPartialMerkleTree() : nTransactions(0), fBad(true) {}
 
 uint256 CPartialMerkleTree::ExtractMatches(std::vector<uint256> &vMatch, std::vector<unsigned int> &vnIndex) {
@@ -179,3 +261,57 @@ uint256 CPartialMerkleTree::ExtractMatches(std::vector<uint256> &vMatch, std::ve
         return uint256();
     return hashMerkleRoot;
 }
+
+CBlockPushdataIndex::CBlockPushdataIndex(const std::shared_ptr<const CBlock>& blockIn) : hashBlock(blockIn->GetHash()), block(blockIn)
+{
+    vTxid.reserve(block->vtx.size());
+    std::map<std::vector<unsigned char>, std::vector<Occurrence> > mapElements;
+    std::vector<unsigned char> data;
+    for (uint32_t nTx = 0; nTx < block->vtx.size(); nTx++) {
+        const CTransaction& tx = *block->vtx[nTx];
+        vTxid.push_back(tx.GetHash());
+        for (int32_t nOut = 0; nOut < (int32_t)tx.vout.size(); nOut++) {
+            const CScript& script = tx.vout[nOut].scriptPubKey;
+            CScript::const_iterator pc = script.begin();
+            opcodetype opcode;
+            while (pc < script.end() && script.GetOp(pc, opcode, data)) {
+                std::vector<Occurrence>& vOccurrences = mapElements[data];
+                // A repeated element in the same output only needs to be tested once
+                if (data.size() != 0 && (vOccurrences.empty() || vOccurrences.back().nTx != nTx || vOccurrences.back().nOut != nOut))
+                    vOccurrences.push_back(Occurrence{nTx, nOut});
+            }
+        }
+        for (const CTxIn& txin : tx.vin) {
+            vPrevout.push_back(std::make_pair(txin.prevout, nTx));
+            CScript::const_iterator pc = txin.scriptSig.begin();
+            opcodetype opcode;
+            while (pc < txin.scriptSig.end() && txin.scriptSig.GetOp(pc, opcode, data)) {
+                std::vector<Occurrence>& vOccurrences = mapElements[data];
+                if (data.size() != 0 && (vOccurrences.empty() || vOccurrences.back().nTx != nTx || vOccurrences.back().nOut != -1))
+                    vOccurrences.push_back(Occurrence{nTx, -1});
+            }
+        }
+    }
+
+    vElementOffset.reserve(mapElements.size() + 1);
+    vOccurrenceOffset.reserve(mapElements.size() + 1);
+    for (const auto& element : mapElements) {
+        if (element.second.empty())
+            continue;
+        vElementOffset.push_back(vData.size());
+        vOccurrenceOffset.push_back(vOccurrence.size());
+        vData.insert(vData.end(), element.first.begin(), element.first.end());
+        vOccurrence.insert(vOccurrence.end(), element.second.begin(), element.second.end());
+    }
+    vElementOffset.push_back(vData.size());
+    vOccurrenceOffset.push_back(vOccurrence.size());
+
+    vMerkleTree = CPartialMerkleTree::CalcTreeLevels(vTxid);
+}
+
+size_t CBlockPushdataIndex::DynamicMemoryUsage() const
+{
+    return memusage::DynamicUsage(vTxid) + memusage::DynamicUsage(vMerkleTree) + memusage::DynamicUsage(vData) +
+           memusage::DynamicUsage(vElementOffset) + memusage::DynamicUsage(vOccurrence) +
+           memusage::DynamicUsage(vOccurrenceOffset) + memusage::DynamicUsage(vPrevout);
+}
@@ -11,6 +11,7 @@
 #include "primitives/block.h"
 #include "bloom.h"
 
+#include <memory>
 #include <vector>
 
 /** Data structure that represents a partial merkle tree.
@@ -73,6 +74,9 @@ protected:
     /** recursive function that traverses tree nodes, storing the data as bits and hashes */
     void TraverseAndBuild(int height, unsigned int pos, const std::vector<uint256> &vTxid, const std::vector<bool> &vMatch);
 
+    /** same as TraverseAndBuild, but taking node hashes from the levels computed by CalcTreeLevels */
+    void TraverseAndBuildFromLevels(int height, unsigned int pos, const std::vector<uint256> &vTree, const std::vector<bool> &vMatch);
+
     /**
      * recursive function that traverses tree nodes, consuming the bits and hashes produced by TraverseAndBuild.
      * it returns the hash of the respective node and its respective index.
@@ -107,8 +111,21 @@ public:
     /** Construct a partial merkle tree from a list of transaction ids, and a mask that selects a subset of them */
     CPartialMerkleTree(const std::vector<uint256> &vTxid, const std::vector<bool> &vMatch);
 
+    /**
+     * Construct a partial merkle tree of nTransactionsIn transactions from all levels of their merkle
+     * tree, as returned by CalcTreeLevels. Unlike the constructor above this does not hash anything,
+     * so it is cheap to build many partial trees of the same block.
+     */
+    CPartialMerkleTree(unsigned int nTransactionsIn, const std::vector<uint256> &vTree, const std::vector<bool> &vMatch);
+
     CPartialMerkleTree();
 
+    /**
+     * Compute every level of the merkle tree of vTxid: the txids themselves, followed by each
+     * level up to and including the root. An odd last node of a level is paired with itself.
+     */
+    static std::vector<uint256> CalcTreeLevels(const std::vector<uint256> &vTxid);
+
     /**
      * extract the matching txid's represented by this partial merkle tree
      * and their respective indices within the partial tree.
@@ -118,6 +135,41 @@ public:
 };
 
 
+/**
+ * Everything a BIP37 filter can match in a block, computed once per block
+ * instead of once per filtered block request: the txids, the distinct
+ * non-empty pushdata elements of all scriptPubKeys and scriptSigs along with
+ * where they occur, the spent outpoints and all levels of the merkle tree.
+ */
+class CBlockPushdataIndex
+{
+public:
+    /** Occurrence of a pushdata element in output nOut of transaction nTx, or in a scriptSig of it if nOut is -1 */
+    struct Occurrence {
+        uint32_t nTx;
+        int32_t nOut;
+    };
+
+    uint256 hashBlock;
+    std::shared_ptr<const CBlock> block;
+    std::vector<uint256> vTxid;
+    /** Merkle tree levels as computed by CPartialMerkleTree::CalcTreeLevels */
+    std::vector<uint256> vMerkleTree;
+    /** Element i is vData[vElementOffset[i], vElementOffset[i+1]) */
+    std::vector<unsigned char> vData;
+    std::vector<uint32_t> vElementOffset;
+    /** Element i occurs at vOccurrence[vOccurrenceOffset[i], vOccurrenceOffset[i+1]) */
+    std::vector<Occurrence> vOccurrence;
+    std::vector<uint32_t> vOccurrenceOffset;
+    /** Outpoints spent in the block, with the index of their spending transaction */
+    std::vector<std::pair<COutPoint, uint32_t> > vPrevout;
+
+    explicit CBlockPushdataIndex(const std::shared_ptr<const CBlock>& blockIn);
+
+    size_t GetElementCount() const { return vElementOffset.size() - 1; }
+    size_t DynamicMemoryUsage() const;
+};
+
 /**
  * Used to relay blocks as header + vector<merkle branch>
  * to filtered nodes.
@@ -140,6 +192,14 @@ public:
      */
     CMerkleBlock(const CBlock& block, CBloomFilter& filter);
 
+    /**
+     * Create from a block's pushdata index, with the same result as the CBlock constructor
+     * for every transaction the filter truly matches. Each distinct element is tested once,
+     * and as updates to the filter are applied before testing spent outpoints, transactions
+     * that only match through a false positive may differ.
+     */
+    CMerkleBlock(const CBlockPushdataIndex& index, CBloomFilter& filter);
+
     // Create from a CBlock, matching the txids in the set
     CMerkleBlock(const CBlock& block, const std::set<uint256>& txids);
 
@@ -96,6 +96,8 @@ BlockAssembler::BlockAssembler(const CChainParams& _chainparams)
 
     // Limit size to between 1K and MAX_BLOCK_BASE_SIZE-1K for sanity:
     nBlockMaxSize = std::max((unsigned int)1000, std::min((unsigned int)(MAX_BLOCK_BASE_SIZE-1000), nBlockMaxSize));
+
+    fClusterSelection = GetBoolArg("-blockclusters", DEFAULT_BLOCK_CLUSTERS);
 }
 
 void BlockAssembler::resetBlock()
@@ -156,9 +158,18 @@ std::unique_ptr<CBlockTemplate> BlockAssembler::CreateNewBlock(const CScript& sc
                        : pblock->GetBlockTime();
 
     addPriorityTxs();
+    int64_t nTimePriority = GetTimeMicros();
+    LogPrint("bench", "CreateNewBlock() priority: %.2fms (%u txs)\n", 0.001 * (nTimePriority - nTimeStart), nBlockTx);
+
     int nPackagesSelected = 0;
     int nDescendantsUpdated = 0;
-    addPackageTxs(nPackagesSelected, nDescendantsUpdated);
+    int nClustersSelected = 0;
+    int nChunksSelected = 0;
+    if (fClusterSelection) {
+        addClusterTxs(nClustersSelected, nChunksSelected);
+    } else {
+        addPackageTxs(nPackagesSelected, nDescendantsUpdated);
+    }
 
     int64_t nTime1 = GetTimeMicros();
 
@@ -192,7 +203,11 @@ std::unique_ptr<CBlockTemplate> BlockAssembler::CreateNewBlock(const CScript& sc
     }
     int64_t nTime2 = GetTimeMicros();
 
-    LogPrint("bench", "CreateNewBlock() packages: %.2fms (%d packages, %d updated descendants), validity: %.2fms (total %.2fms)\n", 0.001 * (nTime1 - nTimeStart), nPackagesSelected, nDescendantsUpdated, 0.001 * (nTime2 - nTime1), 0.001 * (nTime2 - nTimeStart));
+    if (fClusterSelection) {
+        LogPrint("bench", "CreateNewBlock() clusters: %.2fms (%d clusters, %d chunks), validity: %.2fms (total %.2fms)\n", 0.001 * (nTime1 - nTimeStart), nClustersSelected, nChunksSelected, 0.001 * (nTime2 - nTime1), 0.001 * (nTime2 - nTimeStart));
+    } else {
+        LogPrint("bench", "CreateNewBlock() packages: %.2fms (%d packages, %d updated descendants), validity: %.2fms (total %.2fms)\n", 0.001 * (nTime1 - nTimeStart), nPackagesSelected, nDescendantsUpdated, 0.001 * (nTime2 - nTime1), 0.001 * (nTime2 - nTimeStart));
+    }
 
     return std::move(pblocktemplate);
 }
@@ -501,6 +516,313 @@ void BlockAssembler::addPackageTxs(int &nPackagesSelected, int &nDescendantsUpda
     }
 }
 
+namespace {
+
+/** Linearization state of one transaction of a cluster. */
+struct ClusterTx
+{
+    CTxMemPool::txiter iter;
+    std::vector<size_t> vParents;
+    std::vector<size_t> vChildren;
+    // Totals over the ancestors (including itself) that are not linearized yet
+    CAmount nModFeesWithAncestors;
+    uint64_t nSizeWithAncestors;
+    bool fDone;
+};
+
+/** Orders cluster transactions by remaining ancestor feerate, highest first. */
+class CompareClusterTxByAncestorFee
+{
+    const std::vector<ClusterTx>& vTx;
+public:
+    CompareClusterTxByAncestorFee(const std::vector<ClusterTx>& vTxIn) : vTx(vTxIn) {}
+
+    bool operator()(size_t a, size_t b) const
+    {
+        double f1 = (double)vTx[a].nModFeesWithAncestors * vTx[b].nSizeWithAncestors;
+        double f2 = (double)vTx[b].nModFeesWithAncestors * vTx[a].nSizeWithAncestors;
+        if (f1 == f2) {
+            return CTxMemPool::CompareIteratorByHash()(vTx[a].iter, vTx[b].iter);
+        }
+        return f1 > f2;
+    }
+};
+
+// Append the not yet linearized ancestors of n (including n) to vAncestors,
+// parents before children.
+void CollectClusterAncestors(const std::vector<ClusterTx>& vTx, size_t n, std::vector<bool>& vSeen, std::vector<size_t>& vAncestors)
+{
+    if (vTx[n].fDone || vSeen[n])
+        return;
+    vSeen[n] = true;
+    for (size_t parent : vTx[n].vParents) {
+        CollectClusterAncestors(vTx, parent, vSeen, vAncestors);
+    }
+    vAncestors.push_back(n);
+}
+
+void CollectClusterDescendants(const std::vector<ClusterTx>& vTx, size_t n, std::vector<bool>& vSeen, std::vector<size_t>& vDescendants)
+{
+    for (size_t child : vTx[n].vChildren) {
+        if (vTx[child].fDone || vSeen[child])
+            continue;
+        vSeen[child] = true;
+        vDescendants.push_back(child);
+        CollectClusterDescendants(vTx, child, vSeen, vDescendants);
+    }
+}
+
+bool ChunkFeeRateHigher(const CTxMemPoolChunk& a, const CTxMemPoolChunk& b)
+{
+    return (double)a.nModFees * b.nSize > (double)b.nModFees * a.nSize;
+}
+
+// Append a transaction to a linearization being split into chunks of
+// non-increasing feerate, merging any run of transactions into its
+// predecessor when that raises the predecessor's feerate (i.e. when
+// descendants pay for their ancestors).
+void AppendToChunks(std::vector<CTxMemPoolChunk>& vChunks, CTxMemPool::txiter it)
+{
+    vChunks.emplace_back();
+    vChunks.back().Add(it);
+    while (vChunks.size() > 1 && ChunkFeeRateHigher(vChunks.back(), vChunks[vChunks.size() - 2])) {
+        CTxMemPoolChunk& prev = vChunks[vChunks.size() - 2];
+        for (CTxMemPool::txiter itChunk : vChunks.back().vTx) {
+            prev.Add(itChunk);
+        }
+        vChunks.pop_back();
+    }
+}
+
+// Linearize a cluster by repeatedly picking the remaining transaction with
+// the highest ancestor feerate together with its remaining ancestors, and
+// split the result into chunks. Each pick only touches the picked
+// transactions and their descendants, which the mempool's descendant limit
+// keeps small; clusters beyond MAX_CLUSTER_LINEARIZATION_SIZE, which wide
+// and shallow ones reach within the default limits, are chunked in
+// topological order instead.
+void LinearizeCluster(std::vector<ClusterTx>& vTx, std::vector<CTxMemPoolChunk>& vChunks)
+{
+    vChunks.clear();
+    if (vTx.size() > MAX_CLUSTER_LINEARIZATION_SIZE) {
+        // A transaction always has more in-mempool ancestors than any of its
+        // parents, so this order is valid for block inclusion.
+        std::vector<CTxMemPool::txiter> vOrder;
+        for (const ClusterTx& ctx : vTx) {
+            vOrder.push_back(ctx.iter);
+        }
+        std::sort(vOrder.begin(), vOrder.end(), [](CTxMemPool::txiter a, CTxMemPool::txiter b) {
+            if (a->GetCountWithAncestors() != b->GetCountWithAncestors())
+                return a->GetCountWithAncestors() < b->GetCountWithAncestors();
+            return CTxMemPool::CompareIteratorByHash()(a, b);
+        });
+        for (CTxMemPool::txiter it : vOrder) {
+            AppendToChunks(vChunks, it);
+        }
+        return;
+    }
+
+    // vSeen is reset through the lists it was set for, so that no pick
+    // costs time proportional to the size of the cluster.
+    std::vector<bool> vSeen(vTx.size());
+    for (size_t i = 0; i < vTx.size(); i++) {
+        std::vector<size_t> vAncestors;
+        CollectClusterAncestors(vTx, i, vSeen, vAncestors);
+        vTx[i].nModFeesWithAncestors = 0;
+        vTx[i].nSizeWithAncestors = 0;
+        for (size_t a : vAncestors) {
+            vTx[i].nModFeesWithAncestors += vTx[a].iter->GetModifiedFee();
+            vTx[i].nSizeWithAncestors += vTx[a].iter->GetTxSize();
+            vSeen[a] = false;
+        }
+    }
+
+    CompareClusterTxByAncestorFee comparer(vTx);
+    std::set<size_t, CompareClusterTxByAncestorFee> setCandidates(comparer);
+    for (size_t i = 0; i < vTx.size(); i++) {
+        setCandidates.insert(i);
+    }
+
+    while (!setCandidates.empty()) {
+        std::vector<size_t> vSelected;
+        CollectClusterAncestors(vTx, *setCandidates.begin(), vSeen, vSelected);
+
+        for (size_t n : vSelected) {
+            setCandidates.erase(n);
+            vTx[n].fDone = true;
+            vSeen[n] = false;
+        }
+        for (size_t n : vSelected) {
+            std::vector<size_t> vDescendants;
+            CollectClusterDescendants(vTx, n, vSeen, vDescendants);
+            for (size_t d : vDescendants) {
+                setCandidates.erase(d);
+                vTx[d].nModFeesWithAncestors -= vTx[n].iter->GetModifiedFee();
+                vTx[d].nSizeWithAncestors -= vTx[n].iter->GetTxSize();
+                setCandidates.insert(d);
+                vSeen[d] = false;
+            }
+        }
+
+        for (size_t n : vSelected) {
+            AppendToChunks(vChunks, vTx[n].iter);
+        }
+    }
+}
+
+size_t FindClusterRoot(std::vector<size_t>& vRoot, size_t n)
+{
+    while (vRoot[n] != n) {
+        vRoot[n] = vRoot[vRoot[n]];
+        n = vRoot[n];
+    }
+    return n;
+}
+
+/** Orders clusters by the feerate of their next chunk, lowest first, for use
+ *  in a priority queue. */
+class CompareClusterByNextChunk
+{
+    const std::vector<std::vector<CTxMemPoolChunk> >& vClusters;
+    const std::vector<size_t>& vNext;
+public:
+    CompareClusterByNextChunk(const std::vector<std::vector<CTxMemPoolChunk> >& vClustersIn, const std::vector<size_t>& vNextIn) :
+        vClusters(vClustersIn), vNext(vNextIn) {}
+
+    bool operator()(size_t a, size_t b) const
+    {
+        const CTxMemPoolChunk& chunkA = vClusters[a][vNext[a]];
+        const CTxMemPoolChunk& chunkB = vClusters[b][vNext[b]];
+        if (ChunkFeeRateHigher(chunkB, chunkA))
+            return true;
+        if (ChunkFeeRateHigher(chunkA, chunkB))
+            return false;
+        return CTxMemPool::CompareIteratorByHash()(chunkB.vTx.front(), chunkA.vTx.front());
+    }
+};
+
+} // anon namespace
+
+void LinearizeMempoolClusters(const CTxMemPool& pool, const CTxMemPool::setEntries& setExclude, std::vector<std::vector<CTxMemPoolChunk> >& vClusters)
+{
+    std::map<CTxMemPool::txiter, size_t, CompareCTxMemPoolIter> mapIndex;
+    std::vector<CTxMemPool::txiter> vEntries;
+    for (CTxMemPool::txiter it = pool.mapTx.begin(); it != pool.mapTx.end(); ++it) {
+        if (setExclude.count(it))
+            continue;
+        mapIndex.insert(std::make_pair(it, vEntries.size()));
+        vEntries.push_back(it);
+    }
+
+    // Union-find over spending relationships
+    std::vector<size_t> vRoot(vEntries.size());
+    for (size_t i = 0; i < vEntries.size(); i++) {
+        vRoot[i] = i;
+    }
+    for (size_t i = 0; i < vEntries.size(); i++) {
+        BOOST_FOREACH(CTxMemPool::txiter parent, pool.GetMemPoolParents(vEntries[i])) {
+            std::map<CTxMemPool::txiter, size_t, CompareCTxMemPoolIter>::const_iterator mi = mapIndex.find(parent);
+            if (mi == mapIndex.end())
+                continue;
+            vRoot[FindClusterRoot(vRoot, i)] = FindClusterRoot(vRoot, mi->second);
+        }
+    }
+
+    // Assign each entry a position within its cluster
+    std::map<size_t, size_t> mapCluster;
+    std::vector<std::vector<ClusterTx> > vClusterTxs;
+    std::vector<size_t> vLocal(vEntries.size());
+    for (size_t i = 0; i < vEntries.size(); i++) {
+        size_t root = FindClusterRoot(vRoot, i);
+        std::map<size_t, size_t>::iterator ci = mapCluster.find(root);
+        if (ci == mapCluster.end()) {
+            ci = mapCluster.insert(std::make_pair(root, vClusterTxs.size())).first;
+            vClusterTxs.emplace_back();
+        }
+        std::vector<ClusterTx>& cluster = vClusterTxs[ci->second];
+        vLocal[i] = cluster.size();
+        cluster.emplace_back();
+        cluster.back().iter = vEntries[i];
+        cluster.back().fDone = false;
+    }
+    for (size_t i = 0; i < vEntries.size(); i++) {
+        std::vector<ClusterTx>& cluster = vClusterTxs[mapCluster[FindClusterRoot(vRoot, i)]];
+        BOOST_FOREACH(CTxMemPool::txiter parent, pool.GetMemPoolParents(vEntries[i])) {
+            std::map<CTxMemPool::txiter, size_t, CompareCTxMemPoolIter>::const_iterator mi = mapIndex.find(parent);
+            if (mi == mapIndex.end())
+                continue;
+            cluster[vLocal[i]].vParents.push_back(vLocal[mi->second]);
+            cluster[vLocal[mi->second]].vChildren.push_back(vLocal[i]);
+        }
+    }
+
+    vClusters.clear();
+    vClusters.resize(vClusterTxs.size());
+    for (size_t i = 0; i < vClusterTxs.size(); i++) {
+        LinearizeCluster(vClusterTxs[i], vClusters[i]);
+    }
+}
+
+// This transaction selection algorithm linearizes every mempool cluster (a
+// maximal set of transactions connected by spending relationships) on its
+// own, and then merges the resulting chunks of all clusters greedily by
+// feerate. Unlike addPackageTxs, it never has to revisit the ancestor
+// state of descendants as transactions are added to the block.
+void BlockAssembler::addClusterTxs(int &nClustersSelected, int &nChunksSelected)
+{
+    std::vector<std::vector<CTxMemPoolChunk> > vClusters;
+    LinearizeMempoolClusters(mempool, inBlock, vClusters);
+
+    std::vector<size_t> vNext(vClusters.size(), 0);
+    CompareClusterByNextChunk comparer(vClusters, vNext);
+    std::priority_queue<size_t, std::vector<size_t>, CompareClusterByNextChunk> queue(comparer);
+    for (size_t i = 0; i < vClusters.size(); i++) {
+        if (!vClusters[i].empty())
+            queue.push(i);
+    }
+
+    // Same heuristic as in addPackageTxs to finish quickly when the block
+    // is close to full.
+    const int64_t MAX_CONSECUTIVE_FAILURES = 1000;
+    int64_t nConsecutiveFailed = 0;
+
+    while (!queue.empty()) {
+        size_t nCluster = queue.top();
+        queue.pop();
+        const CTxMemPoolChunk& chunk = vClusters[nCluster][vNext[nCluster]];
+
+        if (chunk.nModFees < blockMinFeeRate.GetFee(chunk.nSize)) {
+            // Everything else we might consider has a lower fee rate
+            return;
+        }
+
+        // Later chunks of the cluster may depend on a chunk that does not
+        // fit, so the rest of the cluster is dropped along with it.
+        if (!TestPackage(chunk.nSize, chunk.nSigOpCount) ||
+                !TestPackageTransactions(CTxMemPool::setEntries(chunk.vTx.begin(), chunk.vTx.end()))) {
+            ++nConsecutiveFailed;
+
+            if (nConsecutiveFailed > MAX_CONSECUTIVE_FAILURES && nBlockSize >
+                    nBlockMaxSize - 1000) {
+                // Give up if we're close to full and haven't succeeded in a while
+                break;
+            }
+            continue;
+        }
+
+        nConsecutiveFailed = 0;
+        for (CTxMemPool::txiter it : chunk.vTx) {
+            AddToBlock(it);
+        }
+
+        if (vNext[nCluster] == 0)
+            ++nClustersSelected;
+        ++nChunksSelected;
+        if (++vNext[nCluster] < vClusters[nCluster].size())
+            queue.push(nCluster);
+    }
+}
+
 void BlockAssembler::addPriorityTxs()
 {
     // How much of the block should be dedicated to high-priority transactions,
@@ -512,30 +834,38 @@ void BlockAssembler::addPriorityTxs()
         return;
     }
 
-    // This vector will be sorted into a priority queue:
+    // The coin_age_priority index is re-keyed for this height by the first
+    // template after the tip changed; later ones find it up to date.
+    mempool.UpdatePriorities(nHeight);
+    CTxMemPool::indexed_transaction_set::index<coin_age_priority>::type::iterator mi = mempool.mapTx.get<coin_age_priority>().begin();
+
+    // Transactions that had to wait for an in-mempool parent are requeued
+    // here and merged with the walk of the index.
     std::vector<TxCoinAgePriority> vecPriority;
     TxCoinAgePriorityCompare pricomparer;
     std::map<CTxMemPool::txiter, double, CTxMemPool::CompareIteratorByHash> waitPriMap;
     typedef std::map<CTxMemPool::txiter, double, CTxMemPool::CompareIteratorByHash>::iterator waitPriIter;
     double actualPriority = -1;
 
-    vecPriority.reserve(mempool.mapTx.size());
-    for (CTxMemPool::indexed_transaction_set::iterator mi = mempool.mapTx.begin();
-         mi != mempool.mapTx.end(); ++mi)
-    {
-        double dPriority = mi->GetPriority(nHeight);
-        CAmount dummy;
-        mempool.ApplyDeltas(mi->GetTx().GetHash(), dPriority, dummy);
-        vecPriority.push_back(TxCoinAgePriority(dPriority, mi));
-    }
-    std::make_heap(vecPriority.begin(), vecPriority.end(), pricomparer);
-
     CTxMemPool::txiter iter;
-    while (!vecPriority.empty() && !blockFinished) { // add a tx from priority queue to fill the blockprioritysize
-        iter = vecPriority.front().second;
-        actualPriority = vecPriority.front().first;
-        std::pop_heap(vecPriority.begin(), vecPriority.end(), pricomparer);
-        vecPriority.pop_back();
+    while ((mi != mempool.mapTx.get<coin_age_priority>().end() || !vecPriority.empty()) && !blockFinished) { // add a tx from priority queue to fill the blockprioritysize
+        bool fUseIndex = true;
+        if (mi == mempool.mapTx.get<coin_age_priority>().end()) {
+            fUseIndex = false;
+        } else if (!vecPriority.empty()) {
+            TxCoinAgePriority indexEntry(mi->GetCachedPriority(), mempool.mapTx.project<0>(mi));
+            fUseIndex = !pricomparer(indexEntry, vecPriority.front());
+        }
+        if (fUseIndex) {
+            iter = mempool.mapTx.project<0>(mi);
+            actualPriority = mi->GetCachedPriority();
+            ++mi;
+        } else {
+            iter = vecPriority.front().second;
+            actualPriority = vecPriority.front().first;
+            std::pop_heap(vecPriority.begin(), vecPriority.end(), pricomparer);
+            vecPriority.pop_back();
+        }
 
         // If tx already in block, skip
         if (inBlock.count(iter)) {
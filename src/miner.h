@@ -23,6 +23,13 @@ class CWallet;
 namespace Consensus { struct Params; };
 
 static const bool DEFAULT_PRINTPRIORITY = false;
+/** Default for -blockclusters, select transactions by linearized mempool clusters */
+static const bool DEFAULT_BLOCK_CLUSTERS = false;
+/** Clusters with more transactions than this are not linearized by ancestor
+ *  feerate, but chunked in the mempool's topological order. The ancestor and
+ *  descendant limits do not bound cluster size: transactions that each spend
+ *  two of a row of parents form a cluster of any size under default policy. */
+static const size_t MAX_CLUSTER_LINEARIZATION_SIZE = 500;
 
 struct CBlockTemplate
 {
@@ -129,6 +136,33 @@ struct update_for_parent_inclusion
     CTxMemPool::txiter iter;
 };
 
+/** A run of transactions from one mempool cluster that is added to a block
+ *  as a unit. The transactions are in an order valid for block inclusion,
+ *  and the chunks of a cluster have non-increasing feerates. */
+struct CTxMemPoolChunk
+{
+    std::vector<CTxMemPool::txiter> vTx;
+    CAmount nModFees;
+    uint64_t nSize;
+    int64_t nSigOpCount;
+
+    CTxMemPoolChunk() : nModFees(0), nSize(0), nSigOpCount(0) {}
+
+    void Add(CTxMemPool::txiter it)
+    {
+        vTx.push_back(it);
+        nModFees += it->GetModifiedFee();
+        nSize += it->GetTxSize();
+        nSigOpCount += it->GetSigOpCount();
+    }
+};
+
+/** Partition the mempool, minus the entries in setExclude (which must be
+ *  closed under ancestors), into clusters of transactions connected by
+ *  spending relationships, and linearize each cluster into chunks.
+ *  Requires pool.cs. */
+void LinearizeMempoolClusters(const CTxMemPool& pool, const CTxMemPool::setEntries& setExclude, std::vector<std::vector<CTxMemPoolChunk> >& vClusters);
+
 /** Generate a new block, without valid proof-of-work */
 class BlockAssembler
 {
@@ -158,6 +192,9 @@ private:
     int lastFewTxs;
     bool blockFinished;
 
+    // Select transactions with addClusterTxs instead of addPackageTxs
+    bool fClusterSelection;
+
 public:
     BlockAssembler(const CChainParams& chainparams);
     /** Construct a new block template with coinbase to scriptPubKeyIn */
@@ -177,6 +214,10 @@ private:
       * Increments nPackagesSelected / nDescendantsUpdated with corresponding
       * statistics from the package selection (for logging statistics). */
     void addPackageTxs(int &nPackagesSelected, int &nDescendantsUpdated);
+    /** Add transactions by merging the linearized chunks of all mempool
+      * clusters in order of feerate. Increments nClustersSelected /
+      * nChunksSelected for logging. */
+    void addClusterTxs(int &nClustersSelected, int &nChunksSelected);
 
     // helper function for addPriorityTxs
     /** Test if tx will still "fit" in the block */
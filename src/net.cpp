@@ -19,6 +19,7 @@
 #include "primitives/transaction.h"
 #include "netbase.h"
 #include "scheduler.h"
+#include "txreconciliation.h"
 #include "ui_interface.h"
 #include "utilstrencodings.h"
 
@@ -26,6 +27,11 @@
 #include <string.h>
 #else
 #include <fcntl.h>
+#include <sys/uio.h>
+#endif
+
+#ifdef USE_EPOLL
+#include <sys/epoll.h>
 #endif
 
 #ifdef USE_UPNP
@@ -361,7 +367,7 @@ CNode* CConnman::ConnectNode(CAddress addrConnect, const char *pszDest, bool fCo
     if (pszDest ? ConnectSocketByName(addrConnect, hSocket, pszDest, Params().GetDefaultPort(), nConnectTimeout, &proxyConnectionFailed) :
                   ConnectSocket(addrConnect, hSocket, nConnectTimeout, &proxyConnectionFailed))
     {
-        if (!IsSelectableSocket(hSocket)) {
+        if (!socketEvents->IsSupportedSocket(hSocket)) {
             LogPrintf("Cannot create connection: non-selectable socket created (fd >= FD_SETSIZE ?)\n");
             CloseSocket(hSocket);
             return NULL;
@@ -634,6 +640,10 @@ void CNode::copyStats(CNodeStats &stats)
         LOCK(cs_filter);
         X(fRelayTxes);
     }
+    {
+        LOCK(cs_inventory);
+        stats.fTxReconciliation = txReconciliation != nullptr;
+    }
     X(nLastSend);
     X(nLastRecv);
     X(nTimeConnected);
@@ -651,11 +661,25 @@ void CNode::copyStats(CNodeStats &stats)
         LOCK(cs_vSend);
         X(mapSendBytesPerMsgCmd);
         X(nSendBytes);
+        stats.nSendBufferSize = nSendSize;
     }
     {
         LOCK(cs_vRecv);
         X(mapRecvBytesPerMsgCmd);
         X(nRecvBytes);
+        stats.nRecvBufferSize = 0;
+        stats.nRecvSpilledSize = 0;
+        for (const CNetMessage& msg : vRecvMsg) {
+            stats.nRecvBufferSize += msg.GetBufferedSize();
+            stats.nRecvSpilledSize += msg.GetSpilledSize();
+        }
+    }
+    {
+        LOCK(cs_vProcessMsg);
+        for (const CNetMessage& msg : vProcessMsg) {
+            stats.nRecvBufferSize += msg.GetBufferedSize();
+            stats.nRecvSpilledSize += msg.GetSpilledSize();
+        }
     }
     X(fWhitelisted);
 
@@ -681,7 +705,7 @@ void CNode::copyStats(CNodeStats &stats)
 }
 #undef X
 
-bool CNode::ReceiveMsgBytes(const char *pch, unsigned int nBytes, bool& complete)
+bool CNode::ReceiveMsgBytes(const char *pch, unsigned int nBytes, unsigned int nSpillSize, bool& complete)
 {
     complete = false;
     int64_t nTimeMicros = GetTimeMicros();
@@ -693,7 +717,7 @@ bool CNode::ReceiveMsgBytes(const char *pch, unsigned int nBytes, bool& complete
         // get current incomplete message, or create a new one
         if (vRecvMsg.empty() ||
             vRecvMsg.back().complete())
-            vRecvMsg.push_back(CNetMessage(Params().MessageStart(), SER_NETWORK, INIT_PROTO_VERSION));
+            vRecvMsg.push_back(CNetMessage(Params().MessageStart(), SER_NETWORK, INIT_PROTO_VERSION, nSpillSize));
 
         CNetMessage& msg = vRecvMsg.back();
 
@@ -785,6 +809,10 @@ int CNetMessage::readHeader(const char *pch, unsigned int nBytes)
     if (hdr.nMessageSize > MAX_SIZE)
             return -1;
 
+    // only block payloads are worth spilling to disk
+    if (hdr.GetCommand() != NetMsgType::BLOCK)
+        nSpillSize = 0;
+
     // switch state to reading message data
     in_data = true;
 
@@ -796,18 +824,48 @@ int CNetMessage::readData(const char *pch, unsigned int nBytes)
     unsigned int nRemaining = hdr.nMessageSize - nDataPos;
     unsigned int nCopy = std::min(nRemaining, nBytes);
 
-    if (vRecv.size() < nDataPos + nCopy) {
-        // Allocate up to 256 KiB ahead, but never more than the total message size.
-        vRecv.resize(std::min(hdr.nMessageSize, nDataPos + nCopy + 256 * 1024));
+    hasher.Write((const unsigned char*)pch, nCopy);
+
+    if (!fileSpill && nSpillSize > 0 && nDataPos + nCopy > nSpillSize) {
+        // Move what was received so far to a temporary file, and append the
+        // rest there, to keep large payloads out of memory until processed.
+        // Without a temporary file, keep receiving into memory.
+        FILE* file = tmpfile();
+        if (file) {
+            fileSpill.reset(file, fclose);
+            if (nDataPos > 0 && fwrite(&vRecv[0], 1, nDataPos, file) != nDataPos)
+                return -1;
+            vRecv = CDataStream(vRecv.GetType(), vRecv.GetVersion());
+        }
     }
 
-    hasher.Write((const unsigned char*)pch, nCopy);
-    memcpy(&vRecv[nDataPos], pch, nCopy);
+    if (fileSpill) {
+        if (fwrite(pch, 1, nCopy, fileSpill.get()) != nCopy)
+            return -1;
+    } else {
+        if (vRecv.size() < nDataPos + nCopy) {
+            // Allocate up to 256 KiB ahead, but never more than the total message size.
+            vRecv.resize(std::min(hdr.nMessageSize, nDataPos + nCopy + 256 * 1024));
+        }
+        memcpy(&vRecv[nDataPos], pch, nCopy);
+    }
     nDataPos += nCopy;
 
     return nCopy;
 }
 
+bool CNetMessage::LoadSpilledData()
+{
+    if (!fileSpill)
+        return true;
+    std::shared_ptr<FILE> file;
+    file.swap(fileSpill);
+    vRecv.resize(nDataPos);
+    if (fseek(file.get(), 0, SEEK_SET) != 0)
+        return false;
+    return nDataPos == 0 || fread(&vRecv[0], 1, nDataPos, file.get()) == nDataPos;
+}
+
 const uint256& CNetMessage::GetMessageHash() const
 {
     assert(complete());
@@ -831,27 +889,59 @@ size_t CConnman::SocketSendData(CNode *pnode) const
     size_t nSentSize = 0;
 
     while (it != pnode->vSendMsg.end()) {
-        const auto &data = *it;
-        assert(data.size() > pnode->nSendOffset);
-        int nBytes = 0;
+        assert((*it)->size() > pnode->nSendOffset);
+#ifndef WIN32
+        // Hand the kernel as many queued buffers as possible at once: the
+        // header and payload of a message, and the messages queued after it.
+        struct iovec vIov[MAX_SEND_IOV];
+        int nIov = 0;
+        size_t nGathered = 0;
+        for (auto itGather = it; itGather != pnode->vSendMsg.end() && nIov < MAX_SEND_IOV; ++itGather, ++nIov) {
+            const std::vector<unsigned char>& data = **itGather;
+            size_t nOffset = itGather == it ? pnode->nSendOffset : 0;
+            vIov[nIov].iov_base = const_cast<unsigned char*>(data.data()) + nOffset;
+            vIov[nIov].iov_len = data.size() - nOffset;
+            nGathered += vIov[nIov].iov_len;
+        }
+        struct msghdr msg;
+        memset(&msg, 0, sizeof(msg));
+        msg.msg_iov = vIov;
+        msg.msg_iovlen = nIov;
+#else
+        const std::vector<unsigned char>& data = **it;
+        size_t nGathered = data.size() - pnode->nSendOffset;
+#endif
+        ssize_t nBytes = 0;
         {
             LOCK(pnode->cs_hSocket);
             if (pnode->hSocket == INVALID_SOCKET)
                 break;
-            nBytes = send(pnode->hSocket, reinterpret_cast<const char*>(data.data()) + pnode->nSendOffset, data.size() - pnode->nSendOffset, MSG_NOSIGNAL | MSG_DONTWAIT);
+#ifndef WIN32
+            nBytes = sendmsg(pnode->hSocket, &msg, MSG_NOSIGNAL | MSG_DONTWAIT);
+#else
+            nBytes = send(pnode->hSocket, reinterpret_cast<const char*>(data.data()) + pnode->nSendOffset, nGathered, MSG_NOSIGNAL | MSG_DONTWAIT);
+#endif
         }
         if (nBytes > 0) {
             pnode->nLastSend = GetSystemTimeInSeconds();
             pnode->nSendBytes += nBytes;
-            pnode->nSendOffset += nBytes;
             nSentSize += nBytes;
-            if (pnode->nSendOffset == data.size()) {
+            // Drop the buffers that were sent completely
+            size_t nLeft = nBytes;
+            while (nLeft > 0) {
+                size_t nRemaining = (*it)->size() - pnode->nSendOffset;
+                if (nLeft < nRemaining) {
+                    pnode->nSendOffset += nLeft;
+                    break;
+                }
+                nLeft -= nRemaining;
                 pnode->nSendOffset = 0;
-                pnode->nSendSize -= data.size();
-                pnode->fPauseSend = pnode->nSendSize > nSendBufferMaxSize;
+                pnode->nSendSize -= (*it)->size();
                 it++;
-            } else {
-                // could not send full message; stop sending more
+            }
+            pnode->fPauseSend = pnode->nSendSize > nSendBufferMaxSize;
+            if ((size_t)nBytes < nGathered) {
+                // could not send everything; stop sending more
                 break;
             }
         } else {
@@ -1060,7 +1150,7 @@ void CConnman::AcceptConnection(const ListenSocket& hListenSocket) {
         return;
     }
 
-    if (!IsSelectableSocket(hSocket))
+    if (!socketEvents->IsSupportedSocket(hSocket))
     {
         LogPrintf("connection from %s dropped: non-selectable socket\n", addr.ToString());
         CloseSocket(hSocket);
@@ -1110,6 +1200,210 @@ void CConnman::AcceptConnection(const ListenSocket& hListenSocket) {
     }
 }
 
+CSocketEvents::CSocketEvents(Mode modeIn) : mode(SOCKETEVENTS_SELECT)
+{
+#ifdef USE_EPOLL
+    hEpoll = -1;
+    nRound = 0;
+    if (modeIn == SOCKETEVENTS_EPOLL) {
+        hEpoll = epoll_create1(EPOLL_CLOEXEC);
+        if (hEpoll == -1)
+            LogPrintf("epoll_create1 failed with error %s, falling back to select()\n", NetworkErrorString(errno));
+        else
+            mode = SOCKETEVENTS_EPOLL;
+    }
+#endif
+}
+
+CSocketEvents::~CSocketEvents()
+{
+#ifdef USE_EPOLL
+    if (hEpoll != -1)
+        close(hEpoll);
+#endif
+}
+
+bool CSocketEvents::ParseMode(const std::string& strMode, Mode& modeOut)
+{
+    if (strMode == "select") {
+        modeOut = SOCKETEVENTS_SELECT;
+        return true;
+    }
+#ifdef USE_EPOLL
+    if (strMode == "epoll") {
+        modeOut = SOCKETEVENTS_EPOLL;
+        return true;
+    }
+#endif
+    return false;
+}
+
+std::string CSocketEvents::GetModes()
+{
+#ifdef USE_EPOLL
+    return "select, epoll";
+#else
+    return "select";
+#endif
+}
+
+void CSocketEvents::Watch(SOCKET hSocket, int64_t nOwner, bool fRecv, bool fSend)
+{
+    WatchedSocket watched;
+    watched.hSocket = hSocket;
+    watched.nOwner = nOwner;
+    watched.fRecv = fRecv;
+    watched.fSend = fSend;
+    vWatched.push_back(watched);
+}
+
+bool CSocketEvents::Wait(int64_t nTimeout, std::set<SOCKET>& setRecv, std::set<SOCKET>& setSend, std::set<SOCKET>& setError)
+{
+    bool ret;
+#ifdef USE_EPOLL
+    if (mode == SOCKETEVENTS_EPOLL)
+        ret = WaitEpoll(nTimeout, setRecv, setSend, setError);
+    else
+#endif
+        ret = WaitSelect(nTimeout, setRecv, setSend, setError);
+    if (!ret) {
+        BOOST_FOREACH(const WatchedSocket& watched, vWatched)
+            setRecv.insert(watched.hSocket);
+    }
+    vWatched.clear();
+    return ret;
+}
+
+bool CSocketEvents::WaitSelect(int64_t nTimeout, std::set<SOCKET>& setRecv, std::set<SOCKET>& setSend, std::set<SOCKET>& setError)
+{
+    struct timeval timeout;
+    timeout.tv_sec  = nTimeout / 1000;
+    timeout.tv_usec = (nTimeout % 1000) * 1000;
+
+    fd_set fdsetRecv;
+    fd_set fdsetSend;
+    fd_set fdsetError;
+    FD_ZERO(&fdsetRecv);
+    FD_ZERO(&fdsetSend);
+    FD_ZERO(&fdsetError);
+    SOCKET hSocketMax = 0;
+    bool have_fds = false;
+
+    BOOST_FOREACH(const WatchedSocket& watched, vWatched) {
+#ifndef WIN32
+        // Descriptors that fit in an fd_set are guaranteed unless epoll is compiled in
+        if (watched.hSocket >= FD_SETSIZE)
+            continue;
+#endif
+        FD_SET(watched.hSocket, &fdsetError);
+        hSocketMax = std::max(hSocketMax, watched.hSocket);
+        have_fds = true;
+        if (watched.fSend)
+            FD_SET(watched.hSocket, &fdsetSend);
+        else if (watched.fRecv)
+            FD_SET(watched.hSocket, &fdsetRecv);
+    }
+
+    int nSelect = select(have_fds ? hSocketMax + 1 : 0,
+                         &fdsetRecv, &fdsetSend, &fdsetError, &timeout);
+    if (nSelect == SOCKET_ERROR) {
+        if (have_fds) {
+            int nErr = WSAGetLastError();
+            LogPrintf("socket select error %s\n", NetworkErrorString(nErr));
+        }
+        return false;
+    }
+
+    BOOST_FOREACH(const WatchedSocket& watched, vWatched) {
+#ifndef WIN32
+        if (watched.hSocket >= FD_SETSIZE)
+            continue;
+#endif
+        if (FD_ISSET(watched.hSocket, &fdsetRecv))
+            setRecv.insert(watched.hSocket);
+        if (FD_ISSET(watched.hSocket, &fdsetSend))
+            setSend.insert(watched.hSocket);
+        if (FD_ISSET(watched.hSocket, &fdsetError))
+            setError.insert(watched.hSocket);
+    }
+    return true;
+}
+
+#ifdef USE_EPOLL
+bool CSocketEvents::WaitEpoll(int64_t nTimeout, std::set<SOCKET>& setRecv, std::set<SOCKET>& setSend, std::set<SOCKET>& setError)
+{
+    // Bring the kernel's interest list in line with this round's, touching
+    // only sockets that are new, reused by another connection, or changed
+    nRound++;
+    BOOST_FOREACH(const WatchedSocket& watched, vWatched) {
+        uint32_t events = 0;
+        if (watched.fSend)
+            events = EPOLLOUT;
+        else if (watched.fRecv)
+            events = EPOLLIN;
+
+        std::map<SOCKET, RegisteredSocket>::iterator it = mapRegistered.find(watched.hSocket);
+        if (it != mapRegistered.end() && it->second.nOwner == watched.nOwner && it->second.events == events) {
+            it->second.nRound = nRound;
+            continue;
+        }
+
+        struct epoll_event event;
+        memset(&event, 0, sizeof(event));
+        event.events = events;
+        event.data.fd = watched.hSocket;
+        // A descriptor that was closed has already left the epoll set, while
+        // one that is still registered under an old owner has to be modified
+        int op = it == mapRegistered.end() ? EPOLL_CTL_ADD : EPOLL_CTL_MOD;
+        if (epoll_ctl(hEpoll, op, watched.hSocket, &event) == -1) {
+            op = (errno == EEXIST) ? EPOLL_CTL_MOD : (errno == ENOENT ? EPOLL_CTL_ADD : -1);
+            if (op == -1 || epoll_ctl(hEpoll, op, watched.hSocket, &event) == -1) {
+                LogPrintf("epoll_ctl failed for socket %d with error %s\n", watched.hSocket, NetworkErrorString(errno));
+                if (it != mapRegistered.end())
+                    mapRegistered.erase(it);
+                continue;
+            }
+        }
+        RegisteredSocket& registered = mapRegistered[watched.hSocket];
+        registered.nOwner = watched.nOwner;
+        registered.events = events;
+        registered.nRound = nRound;
+    }
+    // Sockets no longer watched are normally closed already, in which case
+    // the kernel has removed them and this fails harmlessly
+    std::map<SOCKET, RegisteredSocket>::iterator it = mapRegistered.begin();
+    while (it != mapRegistered.end()) {
+        if (it->second.nRound != nRound) {
+            epoll_ctl(hEpoll, EPOLL_CTL_DEL, it->first, NULL);
+            mapRegistered.erase(it++);
+        } else {
+            ++it;
+        }
+    }
+
+    // Sockets not reported in this round stay ready for the next one
+    struct epoll_event vEvents[MAX_SOCKET_EVENTS];
+    int nEvents = epoll_wait(hEpoll, vEvents, MAX_SOCKET_EVENTS, nTimeout);
+    if (nEvents == -1) {
+        if (errno == EINTR)
+            return true;
+        LogPrintf("epoll_wait error %s\n", NetworkErrorString(errno));
+        return false;
+    }
+
+    for (int i = 0; i < nEvents; i++) {
+        const struct epoll_event& event = vEvents[i];
+        if (event.events & EPOLLIN)
+            setRecv.insert(event.data.fd);
+        if (event.events & EPOLLOUT)
+            setSend.insert(event.data.fd);
+        if (event.events & (EPOLLERR | EPOLLHUP))
+            setError.insert(event.data.fd);
+    }
+    return true;
+}
+#endif
+
 void CConnman::ThreadSocketHandler()
 {
     unsigned int nPrevNodeCount = 0;
@@ -1179,23 +1473,8 @@ void CConnman::ThreadSocketHandler()
         //
         // Find which sockets have data to receive
         //
-        struct timeval timeout;
-        timeout.tv_sec  = 0;
-        timeout.tv_usec = 50000; // frequency to poll pnode->vSend
-
-        fd_set fdsetRecv;
-        fd_set fdsetSend;
-        fd_set fdsetError;
-        FD_ZERO(&fdsetRecv);
-        FD_ZERO(&fdsetSend);
-        FD_ZERO(&fdsetError);
-        SOCKET hSocketMax = 0;
-        bool have_fds = false;
-
         BOOST_FOREACH(const ListenSocket& hListenSocket, vhListenSocket) {
-            FD_SET(hListenSocket.socket, &fdsetRecv);
-            hSocketMax = std::max(hSocketMax, hListenSocket.socket);
-            have_fds = true;
+            socketEvents->Watch(hListenSocket.socket, -1, true, false);
         }
 
         {
@@ -1224,37 +1503,20 @@ void CConnman::ThreadSocketHandler()
                 if (pnode->hSocket == INVALID_SOCKET)
                     continue;
 
-                FD_SET(pnode->hSocket, &fdsetError);
-                hSocketMax = std::max(hSocketMax, pnode->hSocket);
-                have_fds = true;
-
-                if (select_send) {
-                    FD_SET(pnode->hSocket, &fdsetSend);
-                    continue;
-                }
-                if (select_recv) {
-                    FD_SET(pnode->hSocket, &fdsetRecv);
-                }
+                socketEvents->Watch(pnode->hSocket, pnode->GetId(), select_recv, select_send);
             }
         }
 
-        int nSelect = select(have_fds ? hSocketMax + 1 : 0,
-                             &fdsetRecv, &fdsetSend, &fdsetError, &timeout);
+        std::set<SOCKET> setRecv;
+        std::set<SOCKET> setSend;
+        std::set<SOCKET> setError;
+        bool fWaited = socketEvents->Wait(SOCKET_EVENTS_TIMEOUT, setRecv, setSend, setError);
         if (interruptNet)
             return;
 
-        if (nSelect == SOCKET_ERROR)
+        if (!fWaited)
         {
-            if (have_fds)
-            {
-                int nErr = WSAGetLastError();
-                LogPrintf("socket select error %s\n", NetworkErrorString(nErr));
-                for (unsigned int i = 0; i <= hSocketMax; i++)
-                    FD_SET(i, &fdsetRecv);
-            }
-            FD_ZERO(&fdsetSend);
-            FD_ZERO(&fdsetError);
-            if (!interruptNet.sleep_for(std::chrono::milliseconds(timeout.tv_usec/1000)))
+            if (!interruptNet.sleep_for(std::chrono::milliseconds(SOCKET_EVENTS_TIMEOUT)))
                 return;
         }
 
@@ -1263,7 +1525,7 @@ void CConnman::ThreadSocketHandler()
         //
         BOOST_FOREACH(const ListenSocket& hListenSocket, vhListenSocket)
         {
-            if (hListenSocket.socket != INVALID_SOCKET && FD_ISSET(hListenSocket.socket, &fdsetRecv))
+            if (hListenSocket.socket != INVALID_SOCKET && setRecv.count(hListenSocket.socket))
             {
                 AcceptConnection(hListenSocket);
             }
@@ -1294,9 +1556,9 @@ void CConnman::ThreadSocketHandler()
                 LOCK(pnode->cs_hSocket);
                 if (pnode->hSocket == INVALID_SOCKET)
                     continue;
-                recvSet = FD_ISSET(pnode->hSocket, &fdsetRecv);
-                sendSet = FD_ISSET(pnode->hSocket, &fdsetSend);
-                errorSet = FD_ISSET(pnode->hSocket, &fdsetError);
+                recvSet = setRecv.count(pnode->hSocket) > 0;
+                sendSet = setSend.count(pnode->hSocket) > 0;
+                errorSet = setError.count(pnode->hSocket) > 0;
             }
             if (recvSet || errorSet)
             {
@@ -1314,18 +1576,20 @@ void CConnman::ThreadSocketHandler()
                         if (nBytes > 0)
                         {
                             bool notify = false;
-                            if (!pnode->ReceiveMsgBytes(pchBuf, nBytes, notify))
+                            if (!pnode->ReceiveMsgBytes(pchBuf, nBytes, nRecvSpillSize, notify))
                                 pnode->CloseSocketDisconnect();
                             RecordBytesRecv(nBytes);
                             if (notify) {
-                                size_t nSizeAdded = 0;
-                                auto it(pnode->vRecvMsg.begin());
-                                for (; it != pnode->vRecvMsg.end(); ++it) {
-                                    if (!it->complete())
-                                        break;
-                                    nSizeAdded += it->vRecv.size() + CMessageHeader::HEADER_SIZE;
-                                }
                                 {
+                                    // cs_vRecv keeps copyStats from seeing messages move
+                                    LOCK(pnode->cs_vRecv);
+                                    size_t nSizeAdded = 0;
+                                    auto it(pnode->vRecvMsg.begin());
+                                    for (; it != pnode->vRecvMsg.end(); ++it) {
+                                        if (!it->complete())
+                                            break;
+                                        nSizeAdded += it->hdr.nMessageSize + CMessageHeader::HEADER_SIZE;
+                                    }
                                     LOCK(pnode->cs_vProcessMsg);
                                     pnode->vProcessMsg.splice(pnode->vProcessMsg.end(), pnode->vRecvMsg, pnode->vRecvMsg.begin(), it);
                                     pnode->nProcessQueueSize += nSizeAdded;
@@ -1988,8 +2252,16 @@ void CConnman::ThreadMessageHandler()
 
         BOOST_FOREACH(CNode* pnode, vNodesCopy)
         {
-            if (pnode->fDisconnect)
+            if (pnode->fDisconnect || pnode->fMessageWorkQueued)
+                continue;
+
+            // Hand read-only requests to the message workers. The node is
+            // skipped here until they are done with it, which keeps its
+            // messages (and responses) in order.
+            if (nMessageThreads > 0 && GetNodeSignals().HasConcurrentMessages(pnode)) {
+                QueueMessageWork(pnode);
                 continue;
+            }
 
             // Receive messages
             bool fMoreNodeWork = GetNodeSignals().ProcessMessages(pnode, *this, flagInterruptMsgProc);
@@ -2020,6 +2292,42 @@ void CConnman::ThreadMessageHandler()
     }
 }
 
+void CConnman::QueueMessageWork(CNode* pnode)
+{
+    pnode->AddRef();
+    pnode->fMessageWorkQueued = true;
+    {
+        std::lock_guard<std::mutex> lock(mutexMessageWork);
+        vMessageWork.push_back(pnode);
+    }
+    condMessageWork.notify_one();
+}
+
+void CConnman::ThreadMessageWorker()
+{
+    while (!flagInterruptMsgProc)
+    {
+        CNode* pnode;
+        {
+            std::unique_lock<std::mutex> lock(mutexMessageWork);
+            condMessageWork.wait(lock, [this] { return flagInterruptMsgProc || !vMessageWork.empty(); });
+            if (flagInterruptMsgProc)
+                return;
+            pnode = vMessageWork.front();
+            vMessageWork.pop_front();
+        }
+
+        GetNodeSignals().ProcessConcurrentMessages(pnode, *this, flagInterruptMsgProc);
+        pnode->fMessageWorkQueued = false;
+        {
+            LOCK(cs_vNodes);
+            pnode->Release();
+        }
+        // Let the message handler send responses and pick up any remaining work
+        WakeMessageHandler();
+    }
+}
+
 
 
 
@@ -2203,12 +2511,15 @@ CConnman::CConnman(uint64_t nSeed0In, uint64_t nSeed1In) : nSeed0(nSeed0In), nSe
     nLastNodeId = 0;
     nSendBufferMaxSize = 0;
     nReceiveFloodSize = 0;
+    nRecvSpillSize = 0;
     semOutbound = NULL;
     semAddnode = NULL;
     nMaxConnections = 0;
     nMaxOutbound = 0;
     nMaxAddnode = 0;
     nBestHeight = 0;
+    socketEventsMode = CSocketEvents::SOCKETEVENTS_SELECT;
+    nMessageThreads = 0;
     clientInterface = NULL;
     flagInterruptMsgProc = false;
 }
@@ -2234,10 +2545,14 @@ bool CConnman::Start(CScheduler& scheduler, std::string& strNodeError, Options c
 
     nSendBufferMaxSize = connOptions.nSendBufferMaxSize;
     nReceiveFloodSize = connOptions.nReceiveFloodSize;
+    nRecvSpillSize = connOptions.nRecvSpillSize;
 
     nMaxOutboundLimit = connOptions.nMaxOutboundLimit;
     nMaxOutboundTimeframe = connOptions.nMaxOutboundTimeframe;
 
+    socketEventsMode = connOptions.socketEventsMode;
+    nMessageThreads = connOptions.nMessageThreads;
+
     SetBestHeight(connOptions.nBestHeight);
 
     clientInterface = connOptions.uiInterface;
@@ -2300,6 +2615,8 @@ bool CConnman::Start(CScheduler& scheduler, std::string& strNodeError, Options c
     }
 
     // Send and receive from sockets, accept connections
+    socketEvents.reset(new CSocketEvents(socketEventsMode));
+    LogPrintf("Using %s for socket events\n", socketEvents->GetMode() == CSocketEvents::SOCKETEVENTS_EPOLL ? "epoll" : "select");
     threadSocketHandler = std::thread(&TraceThread<std::function<void()> >, "net", std::function<void()>(std::bind(&CConnman::ThreadSocketHandler, this)));
 
     if (!GetBoolArg("-dnsseed", true))
@@ -2316,6 +2633,8 @@ bool CConnman::Start(CScheduler& scheduler, std::string& strNodeError, Options c
 
     // Process messages
     threadMessageHandler = std::thread(&TraceThread<std::function<void()> >, "msghand", std::function<void()>(std::bind(&CConnman::ThreadMessageHandler, this)));
+    for (int i = 0; i < nMessageThreads; i++)
+        threadMessageWorkers.push_back(std::thread(&TraceThread<std::function<void()> >, "msgwork", std::function<void()>(std::bind(&CConnman::ThreadMessageWorker, this))));
 
     // Dump network addresses
     scheduler.scheduleEvery(boost::bind(&CConnman::DumpData, this), DUMP_ADDRESSES_INTERVAL);
@@ -2345,6 +2664,10 @@ void CConnman::Interrupt()
         flagInterruptMsgProc = true;
     }
     condMsgProc.notify_all();
+    {
+        std::lock_guard<std::mutex> lock(mutexMessageWork);
+    }
+    condMessageWork.notify_all();
 
     interruptNet();
     InterruptSocks5(true);
@@ -2366,6 +2689,11 @@ void CConnman::Stop()
 {
     if (threadMessageHandler.joinable())
         threadMessageHandler.join();
+    for (std::thread& threadMessageWorker : threadMessageWorkers)
+        if (threadMessageWorker.joinable())
+            threadMessageWorker.join();
+    threadMessageWorkers.clear();
+    vMessageWork.clear();
     if (threadOpenConnections.joinable())
         threadOpenConnections.join();
     if (threadOpenAddedConnections.joinable())
@@ -2399,6 +2727,7 @@ void CConnman::Stop()
     vNodes.clear();
     vNodesDisconnected.clear();
     vhListenSocket.clear();
+    socketEvents.reset();
     delete semOutbound;
     semOutbound = NULL;
     delete semAddnode;
@@ -2687,6 +3016,7 @@ CNode::CNode(NodeId idIn, ServiceFlags nLocalServicesIn, int nMyStartingHeightIn
     nStartingHeight = -1;
     filterInventoryKnown.reset();
     fSendMempool = false;
+    nTxReconciliationSalt = 0;
     fGetAddr = false;
     nNextLocalAddrSend = 0;
     nNextAddrSend = 0;
@@ -2707,6 +3037,7 @@ CNode::CNode(NodeId idIn, ServiceFlags nLocalServicesIn, int nMyStartingHeightIn
     nextSendTimeFeeFilter = 0;
     fPauseRecv = false;
     fPauseSend = false;
+    fMessageWorkQueued = false;
     nProcessQueueSize = 0;
 
     BOOST_FOREACH(const std::string &msg, getAllNetMessageTypes())
@@ -2766,20 +3097,32 @@ bool CConnman::NodeFullyConnected(const CNode* pnode)
     return pnode && pnode->fSuccessfullyConnected && !pnode->fDisconnect;
 }
 
-void CConnman::PushMessage(CNode* pnode, CSerializedNetMsg&& msg)
+CSharedNetMsg::CSharedNetMsg(CSerializedNetMsg&& msg)
+    : command(std::move(msg.command))
 {
-    size_t nMessageSize = msg.data.size();
-    size_t nTotalSize = nMessageSize + CMessageHeader::HEADER_SIZE;
-    LogPrint("net", "sending %s (%d bytes) peer=%d\n",  SanitizeString(msg.command.c_str()), nMessageSize, pnode->id);
-
     std::vector<unsigned char> serializedHeader;
     serializedHeader.reserve(CMessageHeader::HEADER_SIZE);
-    uint256 hash = Hash(msg.data.data(), msg.data.data() + nMessageSize);
-    CMessageHeader hdr(Params().MessageStart(), msg.command.c_str(), nMessageSize);
+    uint256 hash = Hash(msg.data.data(), msg.data.data() + msg.data.size());
+    CMessageHeader hdr(Params().MessageStart(), command.c_str(), msg.data.size());
     memcpy(hdr.pchChecksum, hash.begin(), CMessageHeader::CHECKSUM_SIZE);
 
     CVectorWriter{SER_NETWORK, INIT_PROTO_VERSION, serializedHeader, 0, hdr};
 
+    header = std::make_shared<const std::vector<unsigned char>>(std::move(serializedHeader));
+    data = std::make_shared<const std::vector<unsigned char>>(std::move(msg.data));
+}
+
+void CConnman::PushMessage(CNode* pnode, CSerializedNetMsg&& msg)
+{
+    PushMessage(pnode, CSharedNetMsg(std::move(msg)));
+}
+
+void CConnman::PushMessage(CNode* pnode, const CSharedNetMsg& msg)
+{
+    size_t nMessageSize = msg.data->size();
+    size_t nTotalSize = nMessageSize + CMessageHeader::HEADER_SIZE;
+    LogPrint("net", "sending %s (%d bytes) peer=%d\n",  SanitizeString(msg.command.c_str()), nMessageSize, pnode->id);
+
     size_t nBytesSent = 0;
     {
         LOCK(pnode->cs_vSend);
@@ -2791,9 +3134,9 @@ void CConnman::PushMessage(CNode* pnode, CSerializedNetMsg&& msg)
 
         if (pnode->nSendSize > nSendBufferMaxSize)
             pnode->fPauseSend = true;
-        pnode->vSendMsg.push_back(std::move(serializedHeader));
+        pnode->vSendMsg.push_back(msg.header);
         if (nMessageSize)
-            pnode->vSendMsg.push_back(std::move(msg.data));
+            pnode->vSendMsg.push_back(msg.data);
 
         // If write queue empty, attempt "optimistic write"
         if (optimisticSend == true)
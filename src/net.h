@@ -23,6 +23,8 @@
 
 #include <atomic>
 #include <deque>
+#include <map>
+#include <set>
 #include <stdint.h>
 #include <thread>
 #include <memory>
@@ -64,6 +66,8 @@ static const unsigned int MAX_ADDR_TO_SEND = 1000;
 /* TODO: FIXME: Argentum Once the headers size limit is deployed sufficiently in the network,
    we may want to lower this again if it seems useful.  */
 static const unsigned int MAX_PROTOCOL_MESSAGE_LENGTH = 32 * 1024 * 1024;
+/** Maximum number of queued send buffers handed to the kernel in one sendmsg() call */
+static const int MAX_SEND_IOV = 64;
 /** Maximum length of strSubVer in `version` message */
 static const unsigned int MAX_SUBVERSION_LENGTH = 256;
 /** Maximum number of automatic outgoing nodes */
@@ -93,13 +97,30 @@ static const bool DEFAULT_BLOCKSONLY = false;
 
 static const bool DEFAULT_FORCEDNSSEED = false;
 static const size_t DEFAULT_MAXRECEIVEBUFFER = 5 * 1000;
+/** Default for -recvspillsize, in units of 1000 bytes */
+static const size_t DEFAULT_RECVSPILLSIZE = 1000;
 static const size_t DEFAULT_MAXSENDBUFFER    = 1 * 1000;
+/** -msgthreads default: number of threads serving read-only peer requests next to the message handler */
+static const int DEFAULT_MESSAGE_THREADS = 0;
+/** Maximum number of message worker threads */
+static const int MAX_MESSAGE_THREADS = 16;
 
 static const ServiceFlags REQUIRED_SERVICES = NODE_NETWORK;
 
 // NOTE: When adjusting this, update rpcnet:setban's help ("24h")
 static const unsigned int DEFAULT_MISBEHAVING_BANTIME = 60 * 60 * 24;  // Default 24-hour ban
 
+/** -socketevents default */
+#ifdef USE_EPOLL
+static const char* const DEFAULT_SOCKETEVENTS = "epoll";
+#else
+static const char* const DEFAULT_SOCKETEVENTS = "select";
+#endif
+/** Maximum time to wait for socket readiness before polling for new data to send (in milliseconds). */
+static const int64_t SOCKET_EVENTS_TIMEOUT = 50;
+/** Maximum number of ready sockets reported by one epoll wait. */
+static const int MAX_SOCKET_EVENTS = 1024;
+
 typedef int64_t NodeId;
 
 struct AddedNodeInfo
@@ -112,8 +133,82 @@ struct AddedNodeInfo
 
 class CTransaction;
 class CNodeStats;
+class CTxReconciliationState;
 class CClientUIInterface;
 
+/**
+ * Socket readiness notification for CConnman::ThreadSocketHandler.
+ *
+ * Every round the caller declares the sockets it wants to receive on, and
+ * those it has queued data to send on (so that sockets are only polled for
+ * writing when there is something to write), and then waits for any of them
+ * to become ready. The select() backend rebuilds its descriptor sets every
+ * round and cannot handle descriptors beyond FD_SETSIZE. The epoll backend
+ * keeps sockets registered with the kernel across rounds and only issues
+ * system calls for sockets whose interest changed.
+ */
+class CSocketEvents
+{
+public:
+    enum Mode {
+        SOCKETEVENTS_SELECT,
+        SOCKETEVENTS_EPOLL,
+    };
+
+    /** Falls back to select() if the requested backend is not available. */
+    explicit CSocketEvents(Mode modeIn);
+    ~CSocketEvents();
+
+    Mode GetMode() const { return mode; }
+    /** Whether hSocket can be watched in the mode actually in use. */
+    bool IsSupportedSocket(SOCKET hSocket) const { return mode == SOCKETEVENTS_EPOLL || IsSelectableSocket(hSocket); }
+
+    /**
+     * Watch a socket in the next Wait(). nOwner identifies the connection
+     * using the socket, so that a descriptor reused by a new connection is
+     * recognized as such. Sockets are always watched for errors.
+     */
+    void Watch(SOCKET hSocket, int64_t nOwner, bool fRecv, bool fSend);
+    /**
+     * Wait up to nTimeout milliseconds for any watched socket to become ready
+     * and clear the watch list. Returns false if waiting failed, in which case
+     * all watched sockets are reported in setRecv.
+     */
+    bool Wait(int64_t nTimeout, std::set<SOCKET>& setRecv, std::set<SOCKET>& setSend, std::set<SOCKET>& setError);
+
+    static bool ParseMode(const std::string& strMode, Mode& modeOut);
+    static std::string GetModes();
+
+private:
+    struct WatchedSocket
+    {
+        SOCKET hSocket;
+        int64_t nOwner;
+        bool fRecv;
+        bool fSend;
+    };
+
+    Mode mode;
+    std::vector<WatchedSocket> vWatched;
+
+    bool WaitSelect(int64_t nTimeout, std::set<SOCKET>& setRecv, std::set<SOCKET>& setSend, std::set<SOCKET>& setError);
+#ifdef USE_EPOLL
+    struct RegisteredSocket
+    {
+        int64_t nOwner;
+        uint32_t events;
+        uint64_t nRound; //!< Last round the socket was watched in
+    };
+
+    int hEpoll;
+    uint64_t nRound;
+    //! Sockets registered with hEpoll
+    std::map<SOCKET, RegisteredSocket> mapRegistered;
+
+    bool WaitEpoll(int64_t nTimeout, std::set<SOCKET>& setRecv, std::set<SOCKET>& setSend, std::set<SOCKET>& setError);
+#endif
+};
+
 struct CSerializedNetMsg
 {
     CSerializedNetMsg() = default;
@@ -127,6 +222,26 @@ struct CSerializedNetMsg
     std::string command;
 };
 
+/** Refcounted serialized data, queued for sending without being copied */
+typedef std::shared_ptr<const std::vector<unsigned char>> CSendBufferRef;
+
+/**
+ * A message whose header and payload were serialized only once. It can be
+ * pushed to any number of peers, whose send queues all reference the same
+ * buffers (e.g. a new block, or a transaction every peer asks for).
+ */
+struct CSharedNetMsg
+{
+    CSharedNetMsg() {}
+    explicit CSharedNetMsg(CSerializedNetMsg&& msg);
+
+    bool IsNull() const { return !data; }
+
+    std::string command;
+    CSendBufferRef header;
+    CSendBufferRef data;
+};
+
 
 class CConnman
 {
@@ -151,8 +266,11 @@ public:
         CClientUIInterface* uiInterface = nullptr;
         unsigned int nSendBufferMaxSize = 0;
         unsigned int nReceiveFloodSize = 0;
+        unsigned int nRecvSpillSize = 0;
         uint64_t nMaxOutboundTimeframe = 0;
         uint64_t nMaxOutboundLimit = 0;
+        CSocketEvents::Mode socketEventsMode = CSocketEvents::SOCKETEVENTS_SELECT;
+        int nMessageThreads = 0;
     };
     CConnman(uint64_t seed0, uint64_t seed1);
     ~CConnman();
@@ -168,6 +286,7 @@ public:
     bool ForNode(NodeId id, std::function<bool(CNode* pnode)> func);
 
     void PushMessage(CNode* pnode, CSerializedNetMsg&& msg);
+    void PushMessage(CNode* pnode, const CSharedNetMsg& msg);
 
     template<typename Callable>
     void ForEachNode(Callable&& func)
@@ -306,6 +425,8 @@ private:
     void ProcessOneShot();
     void ThreadOpenConnections();
     void ThreadMessageHandler();
+    void ThreadMessageWorker();
+    void QueueMessageWork(CNode* pnode);
     void AcceptConnection(const ListenSocket& hListenSocket);
     void ThreadSocketHandler();
     void ThreadDNSAddressSeed();
@@ -362,8 +483,11 @@ private:
 
     unsigned int nSendBufferMaxSize;
     unsigned int nReceiveFloodSize;
+    unsigned int nRecvSpillSize;
 
     std::vector<ListenSocket> vhListenSocket;
+    CSocketEvents::Mode socketEventsMode;
+    std::unique_ptr<CSocketEvents> socketEvents;
     std::atomic<bool> fNetworkActive;
     banmap_t setBanned;
     CCriticalSection cs_setBanned;
@@ -404,6 +528,12 @@ private:
     std::mutex mutexMsgProc;
     std::atomic<bool> flagInterruptMsgProc;
 
+    /** Nodes whose next requests are handed to the message worker threads */
+    int nMessageThreads;
+    std::deque<CNode*> vMessageWork;
+    std::condition_variable condMessageWork;
+    std::mutex mutexMessageWork;
+
     CThreadInterrupt interruptNet;
 
     std::thread threadDNSAddressSeed;
@@ -411,6 +541,7 @@ private:
     std::thread threadOpenAddedConnections;
     std::thread threadOpenConnections;
     std::thread threadMessageHandler;
+    std::vector<std::thread> threadMessageWorkers;
 };
 extern std::unique_ptr<CConnman> g_connman;
 void Discover(boost::thread_group& threadGroup);
@@ -437,6 +568,8 @@ struct CombinerAll
 struct CNodeSignals
 {
     boost::signals2::signal<bool (CNode*, CConnman&, std::atomic<bool>&), CombinerAll> ProcessMessages;
+    boost::signals2::signal<bool (CNode*), CombinerAll> HasConcurrentMessages;
+    boost::signals2::signal<bool (CNode*, CConnman&, std::atomic<bool>&), CombinerAll> ProcessConcurrentMessages;
     boost::signals2::signal<bool (CNode*, CConnman&, std::atomic<bool>&), CombinerAll> SendMessages;
     boost::signals2::signal<void (CNode*, CConnman&)> InitializeNode;
     boost::signals2::signal<void (NodeId, bool&)> FinalizeNode;
@@ -497,6 +630,7 @@ public:
     NodeId nodeid;
     ServiceFlags nServices;
     bool fRelayTxes;
+    bool fTxReconciliation;
     int64_t nLastSend;
     int64_t nLastRecv;
     int64_t nTimeConnected;
@@ -511,6 +645,9 @@ public:
     mapMsgCmdSize mapSendBytesPerMsgCmd;
     uint64_t nRecvBytes;
     mapMsgCmdSize mapRecvBytesPerMsgCmd;
+    uint64_t nSendBufferSize;
+    uint64_t nRecvBufferSize;
+    uint64_t nRecvSpilledSize;
     bool fWhitelisted;
     double dPingTime;
     double dPingWait;
@@ -526,6 +663,12 @@ class CNetMessage {
 private:
     mutable CHash256 hasher;
     mutable uint256 data_hash;
+
+    //! Payload size past which a block payload is written to fileSpill instead of vRecv, 0 for never
+    unsigned int nSpillSize;
+    //! Temporary file holding the payload received so far, once spilled
+    std::shared_ptr<FILE> fileSpill;
+
 public:
     bool in_data;                   // parsing header (false) or data (true)
 
@@ -538,7 +681,7 @@ public:
 
     int64_t nTime;                  // time (in microseconds) of message receipt.
 
-    CNetMessage(const CMessageHeader::MessageStartChars& pchMessageStartIn, int nTypeIn, int nVersionIn) : hdrbuf(nTypeIn, nVersionIn), hdr(pchMessageStartIn), vRecv(nTypeIn, nVersionIn) {
+    CNetMessage(const CMessageHeader::MessageStartChars& pchMessageStartIn, int nTypeIn, int nVersionIn, unsigned int nSpillSizeIn = 0) : nSpillSize(nSpillSizeIn), hdrbuf(nTypeIn, nVersionIn), hdr(pchMessageStartIn), vRecv(nTypeIn, nVersionIn) {
         hdrbuf.resize(24);
         in_data = false;
         nHdrPos = 0;
@@ -563,6 +706,14 @@ public:
 
     int readHeader(const char *pch, unsigned int nBytes);
     int readData(const char *pch, unsigned int nBytes);
+
+    //! Bytes of the message held in memory
+    size_t GetBufferedSize() const { return hdrbuf.size() + vRecv.size(); }
+    //! Bytes of the payload held in a temporary file
+    size_t GetSpilledSize() const { return fileSpill ? nDataPos : 0; }
+
+    //! Read a payload that was spilled to a temporary file back into vRecv
+    bool LoadSpilledData();
 };
 
 
@@ -578,7 +729,7 @@ public:
     size_t nSendSize; // total size of all vSendMsg entries
     size_t nSendOffset; // offset inside the first vSendMsg already sent
     uint64_t nSendBytes;
-    std::deque<std::vector<unsigned char>> vSendMsg;
+    std::deque<CSendBufferRef> vSendMsg;
     CCriticalSection cs_vSend;
     CCriticalSection cs_hSocket;
     CCriticalSection cs_vRecv;
@@ -628,6 +779,9 @@ public:
     const uint64_t nKeyedNetGroup;
     std::atomic_bool fPauseRecv;
     std::atomic_bool fPauseSend;
+    // Whether a message worker owns this node's message processing, in which
+    // case the message handler thread leaves it alone
+    std::atomic_bool fMessageWorkQueued;
 protected:
 
     mapMsgCmdSize mapSendBytesPerMsgCmd;
@@ -663,6 +817,11 @@ public:
     std::vector<uint256> vBlockHashesToAnnounce;
     // Used for BIP35 mempool sending, also protected by cs_inventory
     bool fSendMempool;
+    // Transaction announcement reconciliation, set up if both sides sent sendtxrcncl
+    // Also protected by cs_inventory
+    std::unique_ptr<CTxReconciliationState> txReconciliation;
+    // Salt of the sendtxrcncl message we sent, or 0 if none was sent
+    uint64_t nTxReconciliationSalt;
 
     // Last time a "MEMPOOL" request was serviced.
     std::atomic<int64_t> timeLastMempoolReq;
@@ -728,7 +887,7 @@ public:
         return nRefCount;
     }
 
-    bool ReceiveMsgBytes(const char *pch, unsigned int nBytes, bool& complete);
+    bool ReceiveMsgBytes(const char *pch, unsigned int nBytes, unsigned int nSpillSize, bool& complete);
 
     void SetRecvVersion(int nVersionIn)
     {
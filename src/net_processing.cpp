@@ -8,6 +8,7 @@
 #include "addrman.h"
 #include "arith_uint256.h"
 #include "blockencodings.h"
+#include "blockfilterindex.h"
 #include "chainparams.h"
 #include "consensus/validation.h"
 #include "hash.h"
@@ -24,12 +25,14 @@
 #include "random.h"
 #include "tinyformat.h"
 #include "txmempool.h"
+#include "txreconciliation.h"
 #include "ui_interface.h"
 #include "util.h"
 #include "utilmoneystr.h"
 #include "utilstrencodings.h"
 #include "validationinterface.h"
 
+#include <boost/bind.hpp>
 #include <boost/thread.hpp>
 
 #if defined(NDEBUG)
@@ -59,8 +62,10 @@ void EraseOrphansFor(NodeId peer) EXCLUSIVE_LOCKS_REQUIRED(cs_main);
 
 static size_t vExtraTxnForCompactIt = 0;
 static std::vector<std::pair<uint256, CTransactionRef>> vExtraTxnForCompact GUARDED_BY(cs_main);
+static CompactBlockStats cmpctStatsTotal GUARDED_BY(cs_main);
 
 static const uint64_t RANDOMIZER_ID_ADDRESS_RELAY = 0x3cac0035b5866b90ULL; // SHA256("main address relay")[0:8]
+static const uint64_t RANDOMIZER_ID_TX_FLOOD = 0x8b5f2a10e6d7c343ULL; // SHA256("tx flood")[0:8]
 
 // Internal stuff
 namespace {
@@ -105,6 +110,7 @@ namespace {
         const CBlockIndex* pindex;                               //!< Optional.
         bool fValidatedHeaders;                                  //!< Whether this block has validated headers at the time of request.
         std::unique_ptr<PartiallyDownloadedBlock> partialBlock;  //!< Optional, used for CMPCTBLOCK downloads
+        int64_t nTimeRequested;                                  //!< When the block was requested (in microseconds).
     };
     std::map<uint256, std::pair<NodeId, std::list<QueuedBlock>::iterator> > mapBlocksInFlight;
 
@@ -117,8 +123,20 @@ namespace {
     /** Number of peers from which we're downloading blocks. */
     int nPeersWithValidatedDownloads = 0;
 
+    /** Number of outbound peers we reconcile transaction announcements with. */
+    int nOutboundReconPeers = 0;
+
+    /** Moving average of the size of blocks downloaded with getdata, 0 until the first one. Protected by cs_main. */
+    double dAvgBlockSize = 0;
+
+    /** A relayed transaction, and its tx message once a peer asked for it */
+    struct CRelayedTx {
+        CTransactionRef tx;
+        CSharedNetMsg msg;
+    };
+
     /** Relay map, protected by cs_main. */
-    typedef std::map<uint256, CTransactionRef> MapRelay;
+    typedef std::map<uint256, CRelayedTx> MapRelay;
     MapRelay mapRelay;
     /** Expiration-time ordered list of (expire time, relay map entry) pairs, protected by cs_main). */
     std::deque<std::pair<int64_t, MapRelay::iterator>> vRelayExpiration;
@@ -192,6 +210,12 @@ struct CNodeState {
      * otherwise: whether this peer sends non-witnesses in cmpctblocks/blocktxns.
      */
     bool fSupportsDesiredCmpctVersion;
+    //! How fast this peer delivers the blocks we request.
+    CBlockDownloadStats blockDownload;
+    //! How well we reconstructed the compact blocks this peer sent us.
+    CompactBlockStats cmpctStats;
+    //! Whether this is an outbound peer we reconcile transaction announcements with.
+    bool fTxReconciliationOutbound;
 
     CNodeState(CAddress addrIn, std::string addrNameIn) : address(addrIn), name(addrNameIn) {
         fCurrentlyConnected = false;
@@ -212,6 +236,7 @@ struct CNodeState {
         fPreferHeaderAndIDs = false;
         fProvidesHeaderAndIDs = false;
         fSupportsDesiredCmpctVersion = false;
+        fTxReconciliationOutbound = false;
     }
 };
 
@@ -226,6 +251,22 @@ CNodeState *State(NodeId pnode) {
     return &it->second;
 }
 
+// nTxRequested is the number of transactions asked for with getblocktxn,
+// which is only sent for blocks we are downloading from this peer.
+// Requires cs_main.
+void UpdateCompactBlockStats(CNodeState* state, const PartiallyDownloadedBlock& partialBlock, bool fReconstructed, size_t nTxRequested)
+{
+    for (CompactBlockStats* stats : {&state->cmpctStats, &cmpctStatsTotal}) {
+        stats->nBlocks++;
+        if (fReconstructed)
+            stats->nReconstructed++;
+        stats->nTxPrefilled += partialBlock.GetPrefilledCount();
+        stats->nTxFromMempool += partialBlock.GetMempoolCount() - partialBlock.GetExtraCount();
+        stats->nTxFromExtraPool += partialBlock.GetExtraCount();
+        stats->nTxRequested += nTxRequested;
+    }
+}
+
 void UpdatePreferredDownload(CNode* node, CNodeState* state)
 {
     nPreferredDownload -= state->fPreferredDownload;
@@ -290,6 +331,7 @@ void FinalizeNode(NodeId nodeid, bool& fUpdateConnectionTime) {
     nPreferredDownload -= state->fPreferredDownload;
     nPeersWithValidatedDownloads -= (state->nBlocksInFlightValidHeaders != 0);
     assert(nPeersWithValidatedDownloads >= 0);
+    nOutboundReconPeers -= state->fTxReconciliationOutbound;
 
     mapNodeState.erase(nodeid);
 
@@ -298,6 +340,7 @@ void FinalizeNode(NodeId nodeid, bool& fUpdateConnectionTime) {
         assert(mapBlocksInFlight.empty());
         assert(nPreferredDownload == 0);
         assert(nPeersWithValidatedDownloads == 0);
+        assert(nOutboundReconPeers == 0);
     }
 }
 
@@ -344,7 +387,7 @@ bool MarkBlockAsInFlight(NodeId nodeid, const uint256& hash, const Consensus::Pa
     MarkBlockAsReceived(hash);
 
     std::list<QueuedBlock>::iterator it = state->vBlocksInFlight.insert(state->vBlocksInFlight.end(),
-            {hash, pindex, pindex != NULL, std::unique_ptr<PartiallyDownloadedBlock>(pit ? new PartiallyDownloadedBlock(&mempool) : NULL)});
+            {hash, pindex, pindex != NULL, std::unique_ptr<PartiallyDownloadedBlock>(pit ? new PartiallyDownloadedBlock(&mempool) : NULL), GetTimeMicros()});
     state->nBlocksInFlight++;
     state->nBlocksInFlightValidHeaders += it->fValidatedHeaders;
     if (state->nBlocksInFlight == 1) {
@@ -360,6 +403,21 @@ bool MarkBlockAsInFlight(NodeId nodeid, const uint256& hash, const Consensus::Pa
     return true;
 }
 
+// Requires cs_main.
+// Learn from a block of nSize bytes that nodeid delivered at nTimeReceived.
+// Must be called before MarkBlockAsReceived.
+void UpdateBlockDownloadStats(NodeId nodeid, const uint256& hash, size_t nSize, int64_t nTimeReceived) {
+    std::map<uint256, std::pair<NodeId, std::list<QueuedBlock>::iterator> >::iterator itInFlight = mapBlocksInFlight.find(hash);
+    if (itInFlight == mapBlocksInFlight.end() || itInFlight->second.first != nodeid)
+        return;
+    State(nodeid)->blockDownload.Update(itInFlight->second.second->nTimeRequested, nSize, nTimeReceived);
+
+    if (dAvgBlockSize == 0)
+        dAvgBlockSize = nSize;
+    else
+        dAvgBlockSize += BLOCK_DOWNLOAD_AVG_WEIGHT * (nSize - dAvgBlockSize);
+}
+
 /** Check whether the last unknown block a peer advertised is not yet known. */
 void ProcessBlockAvailability(NodeId nodeid) {
     CNodeState *state = State(nodeid);
@@ -460,8 +518,9 @@ const CBlockIndex* LastCommonAncestor(const CBlockIndex* pa, const CBlockIndex*
 }
 
 /** Update pindexLastCommonBlock and add not-in-flight missing successors to vBlocks, until it has
- *  at most count entries. */
-void FindNextBlocksToDownload(NodeId nodeid, unsigned int count, std::vector<const CBlockIndex*>& vBlocks, NodeId& nodeStaller, const Consensus::Params& consensusParams) {
+ *  at most count entries. If the download window is blocked by another peer, nodeStaller and
+ *  pindexStalling are set to that peer and the block it has in flight. */
+void FindNextBlocksToDownload(NodeId nodeid, unsigned int count, std::vector<const CBlockIndex*>& vBlocks, NodeId& nodeStaller, const CBlockIndex*& pindexStalling, const Consensus::Params& consensusParams) {
     if (count == 0)
         return;
 
@@ -497,6 +556,7 @@ void FindNextBlocksToDownload(NodeId nodeid, unsigned int count, std::vector<con
     int nWindowEnd = state->pindexLastCommonBlock->nHeight + BLOCK_DOWNLOAD_WINDOW;
     int nMaxHeight = std::min<int>(state->pindexBestKnownBlock->nHeight, nWindowEnd + 1);
     NodeId waitingfor = -1;
+    const CBlockIndex* pindexWaitingFor = NULL;
     while (pindexWalk->nHeight < nMaxHeight) {
         // Read up to 128 (or more, if more blocks than that are needed) successors of pindexWalk (towards
         // pindexBestKnownBlock) into vToFetch. We fetch 128, because CBlockIndex::GetAncestor may be as expensive
@@ -528,6 +588,7 @@ void FindNextBlocksToDownload(NodeId nodeid, unsigned int count, std::vector<con
                     if (vBlocks.size() == 0 && waitingfor != nodeid) {
                         // We aren't able to fetch anything, but we would be if the download window was one larger.
                         nodeStaller = waitingfor;
+                        pindexStalling = pindexWaitingFor;
                     }
                     return;
                 }
@@ -538,6 +599,7 @@ void FindNextBlocksToDownload(NodeId nodeid, unsigned int count, std::vector<con
             } else if (waitingfor == -1) {
                 // This is the first already-in-flight block.
                 waitingfor = mapBlocksInFlight[pindex->GetBlockHash()].first;
+                pindexWaitingFor = pindex;
             }
         }
     }
@@ -545,6 +607,51 @@ void FindNextBlocksToDownload(NodeId nodeid, unsigned int count, std::vector<con
 
 } // anon namespace
 
+void CBlockDownloadStats::Update(int64_t nTimeRequested, size_t nSize, int64_t nTimeReceived)
+{
+    if (nTimeRequested < nLastReceived) {
+        // The block was queued behind the previous one, so the time since
+        // that one arrived was spent transferring this block.
+        double dSample = nSize * 1000000.0 / std::max<int64_t>(nTimeReceived - nLastReceived, 1);
+        if (dBytesPerSec == 0)
+            dBytesPerSec = dSample;
+        else
+            dBytesPerSec += BLOCK_DOWNLOAD_AVG_WEIGHT * (dSample - dBytesPerSec);
+    } else {
+        // Nothing else was being delivered: the wait consisted of latency
+        // and the transfer itself.
+        int64_t nTransfer = dBytesPerSec > 0 ? nSize * 1000000.0 / dBytesPerSec : 0;
+        int64_t nSample = std::max<int64_t>(nTimeReceived - nTimeRequested - nTransfer, 0);
+        if (nLastReceived == 0)
+            nLatency = nSample;
+        else
+            nLatency += BLOCK_DOWNLOAD_AVG_WEIGHT * (nSample - nLatency);
+    }
+    nLastReceived = nTimeReceived;
+}
+
+int CBlockDownloadStats::GetMaxBlocksInFlight(double dAvgBlockSize) const
+{
+    if (dBytesPerSec == 0 || dAvgBlockSize == 0)
+        return INITIAL_BLOCKS_IN_TRANSIT_PER_PEER;
+    double dSeconds = nLatency / 1000000.0 + BLOCK_DOWNLOAD_QUEUE_TIME;
+    double dBlocks = dBytesPerSec * dSeconds / dAvgBlockSize;
+    return std::max<int>(MIN_BLOCKS_IN_TRANSIT_PER_PEER, std::min<double>(dBlocks + 1, MAX_BLOCKS_IN_TRANSIT_PER_PEER));
+}
+
+int64_t CBlockDownloadStats::GetExpectedDeliveryTime(double dAvgBlockSize, int nQueued) const
+{
+    if (dBytesPerSec == 0 || dAvgBlockSize == 0)
+        return -1;
+    return nLatency + (int64_t)((nQueued + 1) * dAvgBlockSize * 1000000.0 / dBytesPerSec);
+}
+
+bool CBlockDownloadStats::ShouldTakeOver(const CBlockDownloadStats& statsStaller, int64_t nTimeOutstanding, double dAvgBlockSize) const
+{
+    int64_t nExpected = GetExpectedDeliveryTime(dAvgBlockSize, 0);
+    return nExpected >= 0 && dBytesPerSec > statsStaller.dBytesPerSec && nTimeOutstanding > 2 * nExpected;
+}
+
 bool GetNodeStateStats(NodeId nodeid, CNodeStateStats &stats) {
     LOCK(cs_main);
     CNodeState *state = State(nodeid);
@@ -557,12 +664,28 @@ bool GetNodeStateStats(NodeId nodeid, CNodeStateStats &stats) {
         if (queue.pindex)
             stats.vHeightInFlight.push_back(queue.pindex->nHeight);
     }
+    stats.nMaxBlocksInFlight = state->blockDownload.GetMaxBlocksInFlight(dAvgBlockSize);
+    stats.dBlockBytesPerSec = state->blockDownload.dBytesPerSec;
+    stats.nBlockLatency = state->blockDownload.nLatency;
+    stats.cmpctStats = state->cmpctStats;
     return true;
 }
 
+void GetCompactBlockStats(CompactBlockStats &stats, size_t &nExtraTxn) {
+    LOCK(cs_main);
+    stats = cmpctStatsTotal;
+    nExtraTxn = 0;
+    for (const auto& extra : vExtraTxnForCompact) {
+        if (extra.second)
+            nExtraTxn++;
+    }
+}
+
 void RegisterNodeSignals(CNodeSignals& nodeSignals)
 {
     nodeSignals.ProcessMessages.connect(&ProcessMessages);
+    nodeSignals.HasConcurrentMessages.connect(&HasConcurrentMessages);
+    nodeSignals.ProcessConcurrentMessages.connect(&ProcessConcurrentMessages);
     nodeSignals.SendMessages.connect(&SendMessages);
     nodeSignals.InitializeNode.connect(&InitializeNode);
     nodeSignals.FinalizeNode.connect(&FinalizeNode);
@@ -571,6 +694,8 @@ void RegisterNodeSignals(CNodeSignals& nodeSignals)
 void UnregisterNodeSignals(CNodeSignals& nodeSignals)
 {
     nodeSignals.ProcessMessages.disconnect(&ProcessMessages);
+    nodeSignals.HasConcurrentMessages.disconnect(&HasConcurrentMessages);
+    nodeSignals.ProcessConcurrentMessages.disconnect(&ProcessConcurrentMessages);
     nodeSignals.SendMessages.disconnect(&SendMessages);
     nodeSignals.InitializeNode.disconnect(&InitializeNode);
     nodeSignals.FinalizeNode.disconnect(&FinalizeNode);
@@ -581,7 +706,7 @@ void UnregisterNodeSignals(CNodeSignals& nodeSignals)
 // mapOrphanTransactions
 //
 
-void AddToCompactExtraTransactions(const CTransactionRef& tx)
+void AddToCompactExtraTransactions(const CTransactionRef& tx) EXCLUSIVE_LOCKS_REQUIRED(cs_main)
 {
     size_t max_extra_txn = GetArg("-blockreconstructionextratxn", DEFAULT_BLOCK_RECONSTRUCTION_EXTRA_TXN);
     if (max_extra_txn <= 0)
@@ -728,8 +853,27 @@ void Misbehaving(NodeId pnode, int howmuch)
 //
 
 PeerLogicValidation::PeerLogicValidation(CConnman* connmanIn) : connman(connmanIn) {
+    fPreValidationRelay = GetBoolArg("-cmpctprerelay", DEFAULT_CMPCTBLOCK_PRERELAY);
+
     // Initialize global variables that cannot be constructed at startup.
     recentRejects.reset(new CRollingBloomFilter(120000, 0.000001));
+
+    mempool.NotifyEntryRemoved.connect(boost::bind(&PeerLogicValidation::MempoolEntryRemoved, this, _1, _2));
+}
+
+PeerLogicValidation::~PeerLogicValidation() {
+    mempool.NotifyEntryRemoved.disconnect(boost::bind(&PeerLogicValidation::MempoolEntryRemoved, this, _1, _2));
+}
+
+void PeerLogicValidation::MempoolEntryRemoved(CTransactionRef tx, MemPoolRemovalReason reason) {
+    // Transactions evicted by mempool limiting may still be mined by miners
+    // running with larger mempools, keep them around for block reconstruction.
+    // Mempool limiting only happens from AcceptToMemoryPool and block
+    // connection/disconnection, which hold cs_main.
+    if (reason == MemPoolRemovalReason::SIZELIMIT || reason == MemPoolRemovalReason::EXPIRY) {
+        AssertLockHeld(cs_main);
+        AddToCompactExtraTransactions(tx);
+    }
 }
 
 void PeerLogicValidation::SyncTransaction(const CTransaction& tx, const CBlockIndex* pindex, int nPosInBlock) {
@@ -764,10 +908,28 @@ static CCriticalSection cs_most_recent_block;
 static std::shared_ptr<const CBlock> most_recent_block;
 static std::shared_ptr<const CBlockHeaderAndShortTxIDs> most_recent_compact_block;
 static uint256 most_recent_block_hash;
+//! cmpctblock message of most_recent_compact_block, pushed to every peer announced to
+static CSharedNetMsg most_recent_compact_block_msg;
+//! block message of most_recent_block, serialized when the first peer requests it
+static CSharedNetMsg most_recent_block_msg;
+
+/** Get the shared block message of the most recent block, if hash is that block */
+static bool GetRecentBlockMessage(const uint256& hash, const CNetMsgMaker& msgMaker, CSharedNetMsg& msg)
+{
+    LOCK(cs_most_recent_block);
+    if (!most_recent_block || most_recent_block_hash != hash)
+        return false;
+    if (most_recent_block_msg.IsNull())
+        most_recent_block_msg = CSharedNetMsg(msgMaker.Make(NetMsgType::BLOCK, *most_recent_block));
+    msg = most_recent_block_msg;
+    return true;
+}
 
 void PeerLogicValidation::NewPoWValidBlock(const CBlockIndex *pindex, const std::shared_ptr<const CBlock>& pblock) {
     std::shared_ptr<const CBlockHeaderAndShortTxIDs> pcmpctblock = std::make_shared<const CBlockHeaderAndShortTxIDs>(*pblock);
     const CNetMsgMaker msgMaker(PROTOCOL_VERSION);
+    // The message is the same for every peer, serialize it only once.
+    const CSharedNetMsg msgCmpctBlock(msgMaker.Make(NetMsgType::CMPCTBLOCK, *pcmpctblock));
 
     LOCK(cs_main);
 
@@ -783,10 +945,18 @@ void PeerLogicValidation::NewPoWValidBlock(const CBlockIndex *pindex, const std:
         most_recent_block_hash = hashBlock;
         most_recent_block = pblock;
         most_recent_compact_block = pcmpctblock;
+        most_recent_compact_block_msg = msgCmpctBlock;
+        most_recent_block_msg = CSharedNetMsg();
     }
 
-    connman->ForEachNode([this, &pcmpctblock, pindex, &msgMaker, &hashBlock](CNode* pnode) {
-        // TODO: Avoid the repeated-serialization here
+    // Without pre-validation relay, SendMessages announces the block (using
+    // most_recent_compact_block_msg) once it has been connected.
+    if (!fPreValidationRelay)
+        return;
+
+    int nAnnounced = 0;
+
+    connman->ForEachNode([this, &msgCmpctBlock, &nAnnounced, pindex, &hashBlock](CNode* pnode) {
         if (pnode->nVersion < INVALID_CB_NO_BAN_VERSION || pnode->fDisconnect)
             return;
         ProcessBlockAvailability(pnode->GetId());
@@ -798,10 +968,12 @@ void PeerLogicValidation::NewPoWValidBlock(const CBlockIndex *pindex, const std:
 
             LogPrint("net", "%s sending header-and-ids %s to peer=%d\n", "PeerLogicValidation::NewPoWValidBlock",
                     hashBlock.ToString(), pnode->id);
-            connman->PushMessage(pnode, msgMaker.Make(NetMsgType::CMPCTBLOCK, *pcmpctblock));
+            connman->PushMessage(pnode, msgCmpctBlock);
             state.pindexBestHeaderSent = pindex;
+            nAnnounced++;
         }
     });
+    LogPrint("cmpctblock", "Announced block %s to %d high-bandwidth peers before connecting it\n", hashBlock.ToString(), nAnnounced);
 }
 
 void PeerLogicValidation::UpdatedBlockTip(const CBlockIndex *pindexNew, const CBlockIndex *pindexFork, bool fInitialDownload) {
@@ -835,6 +1007,52 @@ void PeerLogicValidation::UpdatedBlockTip(const CBlockIndex *pindexNew, const CB
     nTimeBestReceived = GetTime();
 }
 
+// Pushdata indexes of recently filtered-requested blocks, oldest first
+static std::deque<std::shared_ptr<const CBlockPushdataIndex> > recentPushdataIndexes; // Protected by cs_main
+// Recently connected blocks, which SPV peers mostly ask for, so that their
+// indexes can be built without reading them back from disk
+static std::deque<std::shared_ptr<const CBlock> > recentConnectedBlocks; // Protected by cs_main
+
+/** Get the pushdata index of a block we have the data of, building it on the first request */
+static std::shared_ptr<const CBlockPushdataIndex> GetPushdataIndex(const CBlockIndex* pindex, const Consensus::Params& consensusParams)
+{
+    AssertLockHeld(cs_main);
+    const uint256 hash = pindex->GetBlockHash();
+    for (const auto& index : recentPushdataIndexes)
+        if (index->hashBlock == hash)
+            return index;
+
+    std::shared_ptr<const CBlock> pblock;
+    for (const auto& pblockRecent : recentConnectedBlocks) {
+        if (pblockRecent->GetHash() == hash) {
+            pblock = pblockRecent;
+            break;
+        }
+    }
+    if (!pblock) {
+        std::shared_ptr<CBlock> pblockRead = std::make_shared<CBlock>();
+        if (!ReadBlockFromDisk(*pblockRead, pindex, consensusParams))
+            assert(!"cannot load block from disk");
+        pblock = pblockRead;
+    }
+    std::shared_ptr<const CBlockPushdataIndex> index = std::make_shared<const CBlockPushdataIndex>(pblock);
+    recentPushdataIndexes.push_back(index);
+    if (recentPushdataIndexes.size() > MAX_PUSHDATA_INDEX_CACHE)
+        recentPushdataIndexes.pop_front();
+    return index;
+}
+
+void PeerLogicValidation::BlockConnected(const std::shared_ptr<const CBlock>& pblock, const CBlockIndex *pindex) {
+    // Only keep a reference to the block here: its index is built by the
+    // first filtered request for it, outside of block connection.
+    if (!(connman->GetLocalServices() & NODE_BLOOM) || IsInitialBlockDownload())
+        return;
+    LOCK(cs_main);
+    recentConnectedBlocks.push_back(pblock);
+    if (recentConnectedBlocks.size() > MAX_PUSHDATA_INDEX_CACHE)
+        recentConnectedBlocks.pop_front();
+}
+
 void PeerLogicValidation::BlockChecked(const CBlock& block, const CValidationState& state) {
     LOCK(cs_main);
 
@@ -914,6 +1132,15 @@ static void RelayTransaction(const CTransaction& tx, CConnman& connman)
     });
 }
 
+/** Announce the transactions a reconciliation round left to announce, in inv messages of at most MAX_INV_SZ */
+static void PushTxInvs(CNode* pnode, const std::vector<CInv>& vInv, const CNetMsgMaker& msgMaker, CConnman& connman)
+{
+    for (size_t i = 0; i < vInv.size(); i += MAX_INV_SZ) {
+        std::vector<CInv> vInvChunk(vInv.begin() + i, vInv.begin() + std::min<size_t>(i + MAX_INV_SZ, vInv.size()));
+        connman.PushMessage(pnode, msgMaker.Make(NetMsgType::INV, vInvChunk));
+    }
+}
+
 static void RelayAddress(const CAddress& addr, bool fReachable, CConnman& connman)
 {
     unsigned int nRelayNodes = fReachable ? 2 : 1; // limited relaying of addresses outside our network(s)
@@ -1020,12 +1247,22 @@ void static ProcessGetData(CNode* pfrom, const Consensus::Params& consensusParam
                 // it's available before trying to send.
                 if (send && (mi->second->nStatus & BLOCK_HAVE_DATA))
                 {
-                    // Send block from disk
+                    // Send block from disk, filtered blocks from the block's pushdata index,
+                    // and the most recent block from the message shared by all peers
                     CBlock block;
-                    if (!ReadBlockFromDisk(block, (*mi).second, consensusParams))
+                    std::shared_ptr<const CBlockPushdataIndex> pushdataIndex;
+                    CSharedNetMsg msgRecentBlock;
+                    if (inv.type == MSG_FILTERED_BLOCK)
+                        pushdataIndex = GetPushdataIndex(mi->second, consensusParams);
+                    else if (!(inv.type == MSG_BLOCK && GetRecentBlockMessage(inv.hash, msgMaker, msgRecentBlock)) &&
+                             !ReadBlockFromDisk(block, (*mi).second, consensusParams))
                         assert(!"cannot load block from disk");
-                    if (inv.type == MSG_BLOCK)
-                        connman.PushMessage(pfrom, msgMaker.Make(NetMsgType::BLOCK, block));
+                    if (inv.type == MSG_BLOCK) {
+                        if (!msgRecentBlock.IsNull())
+                            connman.PushMessage(pfrom, msgRecentBlock);
+                        else
+                            connman.PushMessage(pfrom, msgMaker.Make(NetMsgType::BLOCK, block));
+                    }
                     else if (inv.type == MSG_FILTERED_BLOCK)
                     {
                         bool sendMerkleBlock = false;
@@ -1034,7 +1271,7 @@ void static ProcessGetData(CNode* pfrom, const Consensus::Params& consensusParam
                             LOCK(pfrom->cs_filter);
                             if (pfrom->pfilter) {
                                 sendMerkleBlock = true;
-                                merkleBlock = CMerkleBlock(block, *pfrom->pfilter);
+                                merkleBlock = CMerkleBlock(*pushdataIndex, *pfrom->pfilter);
                             }
                         }
                         if (sendMerkleBlock) {
@@ -1047,7 +1284,7 @@ void static ProcessGetData(CNode* pfrom, const Consensus::Params& consensusParam
                             // however we MUST always provide at least what the remote peer needs
                             typedef std::pair<unsigned int, uint256> PairType;
                             BOOST_FOREACH(PairType& pair, merkleBlock.vMatchedTxn)
-                                connman.PushMessage(pfrom, msgMaker.Make(NetMsgType::TX, *block.vtx[pair.first]));
+                                connman.PushMessage(pfrom, msgMaker.Make(NetMsgType::TX, *pushdataIndex->block->vtx[pair.first]));
                         }
                         // else
                             // no response
@@ -1086,7 +1323,10 @@ void static ProcessGetData(CNode* pfrom, const Consensus::Params& consensusParam
                 auto mi = mapRelay.find(inv.hash);
                 int nSendFlags = 0;
                 if (mi != mapRelay.end()) {
-                    connman.PushMessage(pfrom, msgMaker.Make(nSendFlags, NetMsgType::TX, *mi->second));
+                    // Serialized once for all peers requesting it
+                    if (mi->second.msg.IsNull())
+                        mi->second.msg = CSharedNetMsg(msgMaker.Make(nSendFlags, NetMsgType::TX, *mi->second.tx));
+                    connman.PushMessage(pfrom, mi->second.msg);
                     push = true;
                 } else if (pfrom->timeLastMempoolReq) {
                     auto txinfo = mempool.info(inv.hash);
@@ -1146,6 +1386,130 @@ inline void static SendBlockTransactions(const CBlock& block, const BlockTransac
     connman.PushMessage(pfrom, msgMaker.Make(nSendFlags, NetMsgType::BLOCKTXN, resp));
 }
 
+/**
+ * Validate a BIP 157 request for the filters of the blocks from nStartHeight
+ * up to stopHash, of which there may be at most nMaxHeightDiff + 1. Peers
+ * making invalid requests are disconnected; requests for blocks not indexed
+ * yet are ignored.
+ */
+static bool PrepareBlockFilterRequest(CNode* pfrom, uint8_t nFilterType, uint32_t nStartHeight, const uint256& stopHash, uint32_t nMaxHeightDiff, const CBlockIndex*& pindexStop)
+{
+    const bool fSupported = (pfrom->GetLocalServices() & NODE_COMPACT_FILTERS) && g_blockfilterindex &&
+                            nFilterType == g_blockfilterindex->GetFilterType();
+    if (!fSupported) {
+        LogPrint("net", "peer %d requested unsupported block filter type: %d\n", pfrom->GetId(), nFilterType);
+        pfrom->fDisconnect = true;
+        return false;
+    }
+
+    {
+        LOCK(cs_main);
+        BlockMap::const_iterator it = mapBlockIndex.find(stopHash);
+        // Only serve filters of blocks we would serve themselves
+        if (it == mapBlockIndex.end() || !it->second->IsValid(BLOCK_VALID_SCRIPTS)) {
+            LogPrint("net", "peer %d requested invalid block hash: %s\n", pfrom->GetId(), stopHash.ToString());
+            pfrom->fDisconnect = true;
+            return false;
+        }
+        pindexStop = it->second;
+    }
+
+    const uint32_t nStopHeight = pindexStop->nHeight;
+    if (nStartHeight > nStopHeight) {
+        LogPrint("net", "peer %d sent invalid getcfilters/getcfheaders with start height %d and stop height %d\n",
+                 pfrom->GetId(), nStartHeight, nStopHeight);
+        pfrom->fDisconnect = true;
+        return false;
+    }
+    if (nStopHeight - nStartHeight >= nMaxHeightDiff) {
+        LogPrint("net", "peer %d requested too many cfilters/cfheaders: %d / %d\n",
+                 pfrom->GetId(), nStopHeight - nStartHeight + 1, nMaxHeightDiff);
+        pfrom->fDisconnect = true;
+        return false;
+    }
+    return true;
+}
+
+static void ProcessGetCFilters(CNode* pfrom, CDataStream& vRecv, CConnman& connman)
+{
+    uint8_t nFilterType;
+    uint32_t nStartHeight;
+    uint256 stopHash;
+    vRecv >> nFilterType >> nStartHeight >> stopHash;
+
+    const CBlockIndex* pindexStop;
+    if (!PrepareBlockFilterRequest(pfrom, nFilterType, nStartHeight, stopHash, MAX_GETCFILTERS_SIZE, pindexStop))
+        return;
+
+    std::vector<BlockFilter> vFilters;
+    if (!g_blockfilterindex->LookupFilterRange(nStartHeight, pindexStop, vFilters)) {
+        LogPrint("net", "Failed to find block filter in index: filter_type=%s, start_height=%d, stop_hash=%s\n",
+                 BlockFilterTypeName(g_blockfilterindex->GetFilterType()), nStartHeight, stopHash.ToString());
+        return;
+    }
+
+    const CNetMsgMaker msgMaker(pfrom->GetSendVersion());
+    for (const BlockFilter& filter : vFilters)
+        connman.PushMessage(pfrom, msgMaker.Make(NetMsgType::CFILTER, filter));
+}
+
+static void ProcessGetCFHeaders(CNode* pfrom, CDataStream& vRecv, CConnman& connman)
+{
+    uint8_t nFilterType;
+    uint32_t nStartHeight;
+    uint256 stopHash;
+    vRecv >> nFilterType >> nStartHeight >> stopHash;
+
+    const CBlockIndex* pindexStop;
+    if (!PrepareBlockFilterRequest(pfrom, nFilterType, nStartHeight, stopHash, MAX_GETCFHEADERS_SIZE, pindexStop))
+        return;
+
+    uint256 prevHeader;
+    if (nStartHeight > 0) {
+        const CBlockIndex* pindexPrev = pindexStop->GetAncestor(nStartHeight - 1);
+        if (!g_blockfilterindex->LookupFilterHeader(pindexPrev, prevHeader)) {
+            LogPrint("net", "Failed to find block filter header in index: filter_type=%s, block_hash=%s\n",
+                     BlockFilterTypeName(g_blockfilterindex->GetFilterType()), pindexPrev->GetBlockHash().ToString());
+            return;
+        }
+    }
+
+    std::vector<uint256> vFilterHashes;
+    if (!g_blockfilterindex->LookupFilterHashRange(nStartHeight, pindexStop, vFilterHashes)) {
+        LogPrint("net", "Failed to find block filter hashes in index: filter_type=%s, start_height=%d, stop_hash=%s\n",
+                 BlockFilterTypeName(g_blockfilterindex->GetFilterType()), nStartHeight, stopHash.ToString());
+        return;
+    }
+
+    const CNetMsgMaker msgMaker(pfrom->GetSendVersion());
+    connman.PushMessage(pfrom, msgMaker.Make(NetMsgType::CFHEADERS, nFilterType, pindexStop->GetBlockHash(), prevHeader, vFilterHashes));
+}
+
+static void ProcessGetCFCheckPt(CNode* pfrom, CDataStream& vRecv, CConnman& connman)
+{
+    uint8_t nFilterType;
+    uint256 stopHash;
+    vRecv >> nFilterType >> stopHash;
+
+    const CBlockIndex* pindexStop;
+    if (!PrepareBlockFilterRequest(pfrom, nFilterType, 0, stopHash, std::numeric_limits<uint32_t>::max(), pindexStop))
+        return;
+
+    std::vector<uint256> vHeaders(pindexStop->nHeight / CFCHECKPT_INTERVAL);
+    const CBlockIndex* pindex = pindexStop;
+    for (int i = vHeaders.size() - 1; i >= 0; i--) {
+        pindex = pindex->GetAncestor((i + 1) * CFCHECKPT_INTERVAL);
+        if (!g_blockfilterindex->LookupFilterHeader(pindex, vHeaders[i])) {
+            LogPrint("net", "Failed to find block filter header in index: filter_type=%s, block_hash=%s\n",
+                     BlockFilterTypeName(g_blockfilterindex->GetFilterType()), pindex->GetBlockHash().ToString());
+            return;
+        }
+    }
+
+    const CNetMsgMaker msgMaker(pfrom->GetSendVersion());
+    connman.PushMessage(pfrom, msgMaker.Make(NetMsgType::CFCHECKPT, nFilterType, pindexStop->GetBlockHash(), vHeaders));
+}
+
 bool static ProcessMessage(CNode* pfrom, const std::string& strCommand, CDataStream& vRecv, int64_t nTimeReceived, const CChainParams& chainparams, CConnman& connman, const std::atomic<bool>& interruptMsgProc)
 {
     LogPrint("net", "received: %s (%u bytes) peer=%d\n", SanitizeString(strCommand), vRecv.size(), pfrom->id);
@@ -1274,6 +1638,13 @@ bool static ProcessMessage(CNode* pfrom, const std::string& strCommand, CDataStr
         if (pfrom->fInbound)
             PushNodeVersion(pfrom, connman, GetAdjustedTime());
 
+        // Offer to reconcile transaction announcements instead of flooding them, to
+        // peers that know the message: older ones would take it as sent before verack
+        if (nVersion >= TXRECONCILIATION_PROTO_VERSION && fRelay && ::fRelayTxes && GetBoolArg("-txreconciliation", DEFAULT_TXRECONCILIATION)) {
+            pfrom->nTxReconciliationSalt = 1 + GetRand(std::numeric_limits<uint64_t>::max());
+            connman.PushMessage(pfrom, CNetMsgMaker(INIT_PROTO_VERSION).Make(NetMsgType::SENDTXRCNCL, TXRECONCILIATION_VERSION, pfrom->nTxReconciliationSalt));
+        }
+
         connman.PushMessage(pfrom, CNetMsgMaker(INIT_PROTO_VERSION).Make(NetMsgType::VERACK));
 
         pfrom->nServices = nServices;
@@ -1396,6 +1767,28 @@ bool static ProcessMessage(CNode* pfrom, const std::string& strCommand, CDataStr
         pfrom->fSuccessfullyConnected = true;
     }
 
+    else if (strCommand == NetMsgType::SENDTXRCNCL && !pfrom->fSuccessfullyConnected)
+    {
+        uint32_t nReconVersion;
+        uint64_t nRemoteSalt;
+        vRecv >> nReconVersion >> nRemoteSalt;
+        // Only used if we offered it as well
+        if (pfrom->nTxReconciliationSalt != 0 && nReconVersion >= TXRECONCILIATION_VERSION) {
+            {
+                LOCK(pfrom->cs_inventory);
+                pfrom->txReconciliation.reset(new CTxReconciliationState(!pfrom->fInbound, pfrom->nTxReconciliationSalt, nRemoteSalt));
+                pfrom->txReconciliation->nNextRequest = GetTimeMicros() + RECON_REQUEST_INTERVAL * 1000000;
+                pfrom->txReconciliation->nRoundTimeout = GetTimeMicros() + RECON_RESPONSE_TIMEOUT * 1000000;
+            }
+            if (!pfrom->fInbound) {
+                LOCK(cs_main);
+                State(pfrom->GetId())->fTxReconciliationOutbound = true;
+                nOutboundReconPeers++;
+            }
+            LogPrint("net", "reconciling transaction announcements with peer=%d\n", pfrom->id);
+        }
+    }
+
     else if (!pfrom->fSuccessfullyConnected)
     {
         // Must have a verack message before anything else
@@ -2031,6 +2424,7 @@ bool static ProcessMessage(CNode* pfrom, const std::string& strCommand, CDataStr
                     if (!partialBlock.IsTxAvailable(i))
                         req.indexes.push_back(i);
                 }
+                UpdateCompactBlockStats(nodestate, partialBlock, req.indexes.empty(), req.indexes.size());
                 if (req.indexes.empty()) {
                     // Dirty hack to jump to BLOCKTXN code (TODO: move message handling into their own functions)
                     BlockTransactions txn;
@@ -2053,6 +2447,16 @@ bool static ProcessMessage(CNode* pfrom, const std::string& strCommand, CDataStr
                     // TODO: don't ignore failures
                     return true;
                 }
+                // Missing transactions are not requested here; the block
+                // comes from wherever it is in flight from instead.
+                bool fTxMissing = false;
+                for (size_t i = 0; i < cmpctblock.BlockTxCount(); i++) {
+                    if (!tempBlock.IsTxAvailable(i)) {
+                        fTxMissing = true;
+                        break;
+                    }
+                }
+                UpdateCompactBlockStats(nodestate, tempBlock, !fTxMissing, 0);
                 std::vector<CTransactionRef> dummy;
                 status = tempBlock.FillBlock(*pblock, dummy);
                 if (status == READ_STATUS_OK) {
@@ -2327,6 +2731,7 @@ bool static ProcessMessage(CNode* pfrom, const std::string& strCommand, CDataStr
     else if (strCommand == NetMsgType::BLOCK && !fImporting && !fReindex) // Ignore blocks received while importing
     {
         std::shared_ptr<CBlock> pblock = std::make_shared<CBlock>();
+        const size_t nSize = vRecv.size();
         vRecv >> *pblock;
 
         LogPrint("net", "received block %s peer=%d\n", pblock->GetHash().ToString(), pfrom->id);
@@ -2341,6 +2746,7 @@ bool static ProcessMessage(CNode* pfrom, const std::string& strCommand, CDataStr
             LOCK(cs_main);
             // Also always process if we requested the block explicitly, as we may
             // need it even though it is not a candidate for a new best tip.
+            UpdateBlockDownloadStats(pfrom->GetId(), hash, nSize, nTimeReceived);
             forceProcessing |= MarkBlockAsReceived(hash);
             // mapBlockSource is only used for sending reject messages and DoS scores,
             // so the race between here and cs_main in ProcessNewBlock is fine.
@@ -2402,6 +2808,24 @@ bool static ProcessMessage(CNode* pfrom, const std::string& strCommand, CDataStr
     }
 
 
+    else if (strCommand == NetMsgType::GETCFILTERS)
+    {
+        ProcessGetCFilters(pfrom, vRecv, connman);
+    }
+
+
+    else if (strCommand == NetMsgType::GETCFHEADERS)
+    {
+        ProcessGetCFHeaders(pfrom, vRecv, connman);
+    }
+
+
+    else if (strCommand == NetMsgType::GETCFCHECKPT)
+    {
+        ProcessGetCFCheckPt(pfrom, vRecv, connman);
+    }
+
+
     else if (strCommand == NetMsgType::PING)
     {
         if (pfrom->nVersion > BIP0031_VERSION)
@@ -2550,6 +2974,111 @@ bool static ProcessMessage(CNode* pfrom, const std::string& strCommand, CDataStr
         }
     }
 
+    else if (strCommand == NetMsgType::REQRECON)
+    {
+        uint32_t nRemoteSize;
+        vRecv >> nRemoteSize;
+
+        CTxSketch sketch;
+        {
+            LOCK(pfrom->cs_inventory);
+            CTxReconciliationState* recon = pfrom->txReconciliation.get();
+            if (!recon || recon->fInitiator || recon->fRoundInProgress) {
+                LOCK(cs_main);
+                Misbehaving(pfrom->GetId(), 10);
+                return false;
+            }
+            sketch = recon->GetSketch(CTxReconciliationState::EstimateCapacity(recon->setToReconcile.size(), nRemoteSize));
+            // Keep the sketched set around until the peer tells which transactions it is missing
+            for (const uint256& hash : recon->setToReconcile)
+                recon->mapSnapshot[recon->GetShortID(hash)] = hash;
+            recon->setToReconcile.clear();
+            recon->fRoundInProgress = true;
+            recon->nRoundTimeout = GetTimeMicros() + RECON_RESPONSE_TIMEOUT * 1000000;
+        }
+        connman.PushMessage(pfrom, msgMaker.Make(NetMsgType::SKETCH, sketch));
+    }
+
+    else if (strCommand == NetMsgType::SKETCH)
+    {
+        CTxSketch sketchRemote;
+        vRecv >> sketchRemote;
+
+        std::vector<CInv> vInv;
+        std::vector<uint32_t> vMissing;
+        bool fSuccess = false;
+        {
+            LOCK(pfrom->cs_inventory);
+            CTxReconciliationState* recon = pfrom->txReconciliation.get();
+            if (!recon || !recon->fInitiator || !recon->fRoundInProgress || sketchRemote.GetCapacity() > MAX_SKETCH_CAPACITY) {
+                LOCK(cs_main);
+                Misbehaving(pfrom->GetId(), 10);
+                return false;
+            }
+            std::map<uint32_t, uint256> mapLocal;
+            for (const uint256& hash : recon->setToReconcile)
+                mapLocal[recon->GetShortID(hash)] = hash;
+
+            // The combined sketch holds the short ids only one side has
+            CTxSketch sketch = recon->GetSketch(sketchRemote.GetCapacity());
+            sketch.Merge(sketchRemote);
+            std::vector<uint32_t> vDifference;
+            fSuccess = sketch.Decode(vDifference);
+            if (fSuccess) {
+                for (uint32_t nShortID : vDifference) {
+                    std::map<uint32_t, uint256>::const_iterator it = mapLocal.find(nShortID);
+                    if (it != mapLocal.end())
+                        vInv.push_back(CInv(MSG_TX, it->second));
+                    else
+                        vMissing.push_back(nShortID);
+                }
+            } else {
+                // Too many differences: fall back to announcing everything, both ways
+                for (const uint256& hash : recon->setToReconcile)
+                    vInv.push_back(CInv(MSG_TX, hash));
+            }
+            LogPrint("net", "reconciliation with peer=%d %s: %u local, %u remote transactions to announce\n", pfrom->id,
+                fSuccess ? "succeeded" : "failed", vInv.size(), vMissing.size());
+            recon->setToReconcile.clear();
+            recon->fRoundInProgress = false;
+            recon->nNextRequest = GetTimeMicros() + RECON_REQUEST_INTERVAL * 1000000;
+        }
+        connman.PushMessage(pfrom, msgMaker.Make(NetMsgType::RECONCILDIFF, fSuccess, vMissing));
+        PushTxInvs(pfrom, vInv, msgMaker, connman);
+    }
+
+    else if (strCommand == NetMsgType::RECONCILDIFF)
+    {
+        bool fSuccess;
+        std::vector<uint32_t> vMissing;
+        vRecv >> fSuccess >> vMissing;
+
+        std::vector<CInv> vInv;
+        {
+            LOCK(pfrom->cs_inventory);
+            CTxReconciliationState* recon = pfrom->txReconciliation.get();
+            if (!recon || recon->fInitiator || !recon->fRoundInProgress) {
+                LOCK(cs_main);
+                Misbehaving(pfrom->GetId(), 10);
+                return false;
+            }
+            if (fSuccess) {
+                for (uint32_t nShortID : vMissing) {
+                    std::map<uint32_t, uint256>::const_iterator it = recon->mapSnapshot.find(nShortID);
+                    if (it != recon->mapSnapshot.end())
+                        vInv.push_back(CInv(MSG_TX, it->second));
+                }
+            } else {
+                for (const std::pair<const uint32_t, uint256>& entry : recon->mapSnapshot)
+                    vInv.push_back(CInv(MSG_TX, entry.second));
+            }
+            recon->mapSnapshot.clear();
+            recon->fRoundInProgress = false;
+            recon->nRoundTimeout = GetTimeMicros() + RECON_RESPONSE_TIMEOUT * 1000000;
+        }
+        PushTxInvs(pfrom, vInv, msgMaker, connman);
+    }
+
     else if (strCommand == NetMsgType::NOTFOUND) {
         // We do not care about the NOTFOUND message, but logging an Unknown Command
         // message would be undesirable as we transmit it ourselves.
@@ -2595,7 +3124,35 @@ static bool SendRejectsAndCheckIfBanned(CNode* pnode, CConnman& connman)
     return false;
 }
 
-bool ProcessMessages(CNode* pfrom, CConnman& connman, const std::atomic<bool>& interruptMsgProc)
+// Requests that only touch the requesting node's own state, or shared state
+// under the locks they take themselves, and can therefore be processed on a
+// message worker thread. Note that getaddr is not one of them: addresses
+// relayed by other nodes are pushed into the same vAddrToSend/addrKnown
+// without a lock.
+static bool IsConcurrentMessage(const std::string& strCommand)
+{
+    return strCommand == NetMsgType::GETDATA ||
+           strCommand == NetMsgType::GETHEADERS ||
+           strCommand == NetMsgType::GETBLOCKS ||
+           strCommand == NetMsgType::GETBLOCKTXN ||
+           strCommand == NetMsgType::MEMPOOL ||
+           strCommand == NetMsgType::GETCFILTERS ||
+           strCommand == NetMsgType::GETCFHEADERS ||
+           strCommand == NetMsgType::GETCFCHECKPT ||
+           strCommand == NetMsgType::PING;
+}
+
+bool HasConcurrentMessages(CNode* pfrom)
+{
+    if (!pfrom->fSuccessfullyConnected || pfrom->fDisconnect || pfrom->fPauseSend)
+        return false;
+    LOCK(pfrom->cs_vProcessMsg);
+    if (pfrom->vProcessMsg.empty())
+        return !pfrom->vRecvGetData.empty();
+    return IsConcurrentMessage(pfrom->vProcessMsg.front().hdr.GetCommand());
+}
+
+static bool ProcessMessagesInternal(CNode* pfrom, CConnman& connman, const std::atomic<bool>& interruptMsgProc, bool fConcurrentOnly)
 {
     const CChainParams& chainparams = Params();
     //
@@ -2626,9 +3183,12 @@ bool ProcessMessages(CNode* pfrom, CConnman& connman, const std::atomic<bool>& i
             LOCK(pfrom->cs_vProcessMsg);
             if (pfrom->vProcessMsg.empty())
                 return false;
+            // Leave anything else for the message handler thread
+            if (fConcurrentOnly && !IsConcurrentMessage(pfrom->vProcessMsg.front().hdr.GetCommand()))
+                return true;
             // Just take one message
             msgs.splice(msgs.begin(), pfrom->vProcessMsg, pfrom->vProcessMsg.begin());
-            pfrom->nProcessQueueSize -= msgs.front().vRecv.size() + CMessageHeader::HEADER_SIZE;
+            pfrom->nProcessQueueSize -= msgs.front().hdr.nMessageSize + CMessageHeader::HEADER_SIZE;
             pfrom->fPauseRecv = pfrom->nProcessQueueSize > connman.GetReceiveFloodSize();
             fMoreWork = !pfrom->vProcessMsg.empty();
         }
@@ -2666,6 +3226,12 @@ bool ProcessMessages(CNode* pfrom, CConnman& connman, const std::atomic<bool>& i
             return fMoreWork;
         }
 
+        // Read a block payload that was spilled to disk while it was received
+        if (!msg.LoadSpilledData()) {
+            LogPrintf("PROCESSMESSAGE: failed to read spilled %s message (%u bytes) peer=%d\n", SanitizeString(strCommand), nMessageSize, pfrom->id);
+            return fMoreWork;
+        }
+
         // Process message
         bool fRet = false;
         try
@@ -2715,6 +3281,16 @@ bool ProcessMessages(CNode* pfrom, CConnman& connman, const std::atomic<bool>& i
     return fMoreWork;
 }
 
+bool ProcessMessages(CNode* pfrom, CConnman& connman, const std::atomic<bool>& interruptMsgProc)
+{
+    return ProcessMessagesInternal(pfrom, connman, interruptMsgProc, false);
+}
+
+bool ProcessConcurrentMessages(CNode* pfrom, CConnman& connman, const std::atomic<bool>& interruptMsgProc)
+{
+    return ProcessMessagesInternal(pfrom, connman, interruptMsgProc, true);
+}
+
 class CompareInvMempoolOrder
 {
     CTxMemPool *mp;
@@ -2732,6 +3308,23 @@ public:
     }
 };
 
+/**
+ * Whether to announce a transaction to a reconciling peer right away rather
+ * than in the next reconciliation round: it is flooded to about
+ * RECON_OUTBOUND_FLOOD_PEERS of the outbound ones, so it still propagates
+ * quickly, and reconciled with all others.
+ */
+static bool IsTxFloodTarget(const CNode* pnode, const uint256& hash, const CConnman& connman)
+{
+    AssertLockHeld(cs_main);
+    if (pnode->fInbound)
+        return false;
+    if (nOutboundReconPeers <= RECON_OUTBOUND_FLOOD_PEERS)
+        return true;
+    uint64_t nHash = connman.GetDeterministicRandomizer(RANDOMIZER_ID_TX_FLOOD).Write(hash.GetCheapHash()).Write(pnode->GetId()).Finalize();
+    return nHash % nOutboundReconPeers < RECON_OUTBOUND_FLOOD_PEERS;
+}
+
 bool SendMessages(CNode* pto, CConnman& connman, const std::atomic<bool>& interruptMsgProc)
 {
     const Consensus::Params& consensusParams = Params().GetConsensus();
@@ -2928,8 +3521,7 @@ bool SendMessages(CNode* pto, CConnman& connman, const std::atomic<bool>& interr
                     {
                         LOCK(cs_most_recent_block);
                         if (most_recent_block_hash == pBestIndex->GetBlockHash()) {
-                            CBlockHeaderAndShortTxIDs cmpctblock(*most_recent_block);
-                            connman.PushMessage(pto, msgMaker.Make(nSendFlags, NetMsgType::CMPCTBLOCK, cmpctblock));
+                            connman.PushMessage(pto, most_recent_compact_block_msg);
                             fGotBlockFromCache = true;
                         }
                     }
@@ -3052,11 +3644,20 @@ bool SendMessages(CNode* pto, CConnman& connman, const std::atomic<bool>& interr
 
             // Determine transactions to relay
             if (fSendTrickle) {
-                // Produce a vector with all candidates for sending
+                // Produce a vector with all candidates for sending, dropping the
+                // ones the peer already knows about, looked up all at once.
+                std::vector<uint256> vCandidates(pto->setInventoryTxToSend.begin(), pto->setInventoryTxToSend.end());
+                std::vector<bool> vKnown;
+                pto->filterInventoryKnown.contains(vCandidates, vKnown);
                 std::vector<std::set<uint256>::iterator> vInvTx;
                 vInvTx.reserve(pto->setInventoryTxToSend.size());
-                for (std::set<uint256>::iterator it = pto->setInventoryTxToSend.begin(); it != pto->setInventoryTxToSend.end(); it++) {
-                    vInvTx.push_back(it);
+                size_t nCandidate = 0;
+                for (std::set<uint256>::iterator it = pto->setInventoryTxToSend.begin(); it != pto->setInventoryTxToSend.end(); nCandidate++) {
+                    if (vKnown[nCandidate]) {
+                        it = pto->setInventoryTxToSend.erase(it);
+                    } else {
+                        vInvTx.push_back(it++);
+                    }
                 }
                 CAmount filterrate = 0;
                 {
@@ -3079,10 +3680,6 @@ bool SendMessages(CNode* pto, CConnman& connman, const std::atomic<bool>& interr
                     uint256 hash = *it;
                     // Remove it from the to-be-sent set
                     pto->setInventoryTxToSend.erase(it);
-                    // Check if not in the filter already
-                    if (pto->filterInventoryKnown.contains(hash)) {
-                        continue;
-                    }
                     // Not in the mempool anymore? don't bother sending it.
                     auto txinfo = mempool.info(hash);
                     if (!txinfo.tx) {
@@ -3092,9 +3689,15 @@ bool SendMessages(CNode* pto, CConnman& connman, const std::atomic<bool>& interr
                         continue;
                     }
                     if (pto->pfilter && !pto->pfilter->IsRelevantAndUpdate(*txinfo.tx)) continue;
-                    // Send
-                    vInv.push_back(CInv(MSG_TX, hash));
-                    nRelayedTransactions++;
+                    if (pto->txReconciliation && pto->txReconciliation->setToReconcile.size() < MAX_RECON_SET_SIZE &&
+                        !IsTxFloodTarget(pto, hash, connman)) {
+                        // Leave it to the next reconciliation round, unless too many are waiting for it already
+                        pto->txReconciliation->setToReconcile.insert(hash);
+                    } else {
+                        // Send
+                        vInv.push_back(CInv(MSG_TX, hash));
+                        nRelayedTransactions++;
+                    }
                     {
                         // Expire old relay messages
                         while (!vRelayExpiration.empty() && vRelayExpiration.front().first < nNow)
@@ -3103,7 +3706,9 @@ bool SendMessages(CNode* pto, CConnman& connman, const std::atomic<bool>& interr
                             vRelayExpiration.pop_front();
                         }
 
-                        auto ret = mapRelay.insert(std::make_pair(hash, std::move(txinfo.tx)));
+                        CRelayedTx relayed;
+                        relayed.tx = std::move(txinfo.tx);
+                        auto ret = mapRelay.insert(std::make_pair(hash, std::move(relayed)));
                         if (ret.second) {
                             vRelayExpiration.push_back(std::make_pair(nNow + 15 * 60 * 1000000, ret.first));
                         }
@@ -3119,6 +3724,27 @@ bool SendMessages(CNode* pto, CConnman& connman, const std::atomic<bool>& interr
         if (!vInv.empty())
             connman.PushMessage(pto, msgMaker.Make(NetMsgType::INV, vInv));
 
+        //
+        // Message: reqrecon
+        //
+        {
+            LOCK(pto->cs_inventory);
+            CTxReconciliationState* recon = pto->txReconciliation.get();
+            std::vector<uint256> vExpired;
+            if (recon && recon->ExpireRound(nNow, vExpired)) {
+                LogPrint("net", "reconciliation with peer=%d timed out, announcing %u transactions\n", pto->id, vExpired.size());
+                std::vector<CInv> vInvExpired;
+                for (const uint256& hash : vExpired)
+                    vInvExpired.push_back(CInv(MSG_TX, hash));
+                PushTxInvs(pto, vInvExpired, msgMaker, connman);
+            }
+            if (recon && recon->fInitiator && !recon->fRoundInProgress && recon->nNextRequest < nNow) {
+                connman.PushMessage(pto, msgMaker.Make(NetMsgType::REQRECON, (uint32_t)recon->setToReconcile.size()));
+                recon->fRoundInProgress = true;
+                recon->nRoundTimeout = nNow + RECON_RESPONSE_TIMEOUT * 1000000;
+            }
+        }
+
         // Detect whether we're stalling
         nNow = GetTimeMicros();
         if (state.nStallingSince && state.nStallingSince < nNow - 1000000 * BLOCK_STALLING_TIMEOUT) {
@@ -3150,10 +3776,12 @@ bool SendMessages(CNode* pto, CConnman& connman, const std::atomic<bool>& interr
         // Message: getdata (blocks)
         //
         std::vector<CInv> vGetData;
-        if (!pto->fClient && (fFetch || !IsInitialBlockDownload()) && state.nBlocksInFlight < MAX_BLOCKS_IN_TRANSIT_PER_PEER) {
+        const int nMaxBlocksInFlight = state.blockDownload.GetMaxBlocksInFlight(dAvgBlockSize);
+        if (!pto->fClient && (fFetch || !IsInitialBlockDownload()) && state.nBlocksInFlight < nMaxBlocksInFlight) {
             std::vector<const CBlockIndex*> vToDownload;
             NodeId staller = -1;
-            FindNextBlocksToDownload(pto->GetId(), MAX_BLOCKS_IN_TRANSIT_PER_PEER - state.nBlocksInFlight, vToDownload, staller, consensusParams);
+            const CBlockIndex* pindexStalling = NULL;
+            FindNextBlocksToDownload(pto->GetId(), nMaxBlocksInFlight - state.nBlocksInFlight, vToDownload, staller, pindexStalling, consensusParams);
             BOOST_FOREACH(const CBlockIndex *pindex, vToDownload) {
                 uint32_t nFetchFlags = GetFetchFlags(pto, pindex->pprev, consensusParams);
                 vGetData.push_back(CInv(MSG_BLOCK | nFetchFlags, pindex->GetBlockHash()));
@@ -3162,7 +3790,17 @@ bool SendMessages(CNode* pto, CConnman& connman, const std::atomic<bool>& interr
                     pindex->nHeight, pto->id);
             }
             if (state.nBlocksInFlight == 0 && staller != -1) {
-                if (State(staller)->nStallingSince == 0) {
+                // The window is blocked by a block in flight from another peer. If that peer
+                // is slower than us and has been at it for over twice the time we expect to
+                // take, request the block from us instead of waiting for the stall timeout.
+                const QueuedBlock& stallingBlock = *mapBlocksInFlight[pindexStalling->GetBlockHash()].second;
+                if (state.blockDownload.ShouldTakeOver(State(staller)->blockDownload, nNow - stallingBlock.nTimeRequested, dAvgBlockSize)) {
+                    uint32_t nFetchFlags = GetFetchFlags(pto, pindexStalling->pprev, consensusParams);
+                    vGetData.push_back(CInv(MSG_BLOCK | nFetchFlags, pindexStalling->GetBlockHash()));
+                    MarkBlockAsInFlight(pto->GetId(), pindexStalling->GetBlockHash(), consensusParams, pindexStalling);
+                    LogPrint("net", "Re-requesting stalled block %s (%d) peer=%d from faster peer=%d\n", pindexStalling->GetBlockHash().ToString(),
+                        pindexStalling->nHeight, staller, pto->id);
+                } else if (State(staller)->nStallingSince == 0) {
                     State(staller)->nStallingSince = nNow;
                     LogPrint("net", "Stall started peer=%d\n", staller);
                 }
@@ -7,16 +7,23 @@
 #define BITCOIN_NET_PROCESSING_H
 
 #include "net.h"
+#include "primitives/transaction.h"
 #include "validationinterface.h"
 
+enum class MemPoolRemovalReason;
+
 /** Default for -maxorphantx, maximum number of orphan transactions kept in memory */
 static const unsigned int DEFAULT_MAX_ORPHAN_TRANSACTIONS = 100;
 /** Expiration time for orphan transactions in seconds */
 static const int64_t ORPHAN_TX_EXPIRE_TIME = 20 * 60;
 /** Minimum time between orphan transactions expire time checks in seconds */
 static const int64_t ORPHAN_TX_EXPIRE_INTERVAL = 5 * 60;
-/** Default number of orphan+recently-replaced txn to keep around for block reconstruction */
+/** Default number of orphan, rejected, replaced and evicted txn to keep around for block reconstruction */
 static const unsigned int DEFAULT_BLOCK_RECONSTRUCTION_EXTRA_TXN = 100;
+/** Default for -cmpctprerelay, announcing new blocks to high-bandwidth peers before they are connected */
+static const bool DEFAULT_CMPCTBLOCK_PRERELAY = true;
+/** Number of recently connected blocks, and of pushdata indexes, kept around to serve filtered block requests from */
+static const unsigned int MAX_PUSHDATA_INDEX_CACHE = 16;
 
 /** Register with a network node to receive its signals */
 void RegisterNodeSignals(CNodeSignals& nodeSignals);
@@ -26,14 +33,67 @@ void UnregisterNodeSignals(CNodeSignals& nodeSignals);
 class PeerLogicValidation : public CValidationInterface {
 private:
     CConnman* connman;
+    //! Whether NewPoWValidBlock announces blocks before ConnectBlock (-cmpctprerelay)
+    bool fPreValidationRelay;
+
+    void MempoolEntryRemoved(CTransactionRef tx, MemPoolRemovalReason reason);
 
 public:
     PeerLogicValidation(CConnman* connmanIn);
+    ~PeerLogicValidation();
 
     virtual void SyncTransaction(const CTransaction& tx, const CBlockIndex* pindex, int nPosInBlock);
     virtual void UpdatedBlockTip(const CBlockIndex *pindexNew, const CBlockIndex *pindexFork, bool fInitialDownload);
     virtual void BlockChecked(const CBlock& block, const CValidationState& state);
     virtual void NewPoWValidBlock(const CBlockIndex *pindex, const std::shared_ptr<const CBlock>& pblock);
+    virtual void BlockConnected(const std::shared_ptr<const CBlock>& pblock, const CBlockIndex *pindex);
+};
+
+/** Outcome of compact block reconstructions, per peer and in total */
+struct CompactBlockStats {
+    //! Compact blocks we tried to reconstruct
+    uint64_t nBlocks;
+    //! ...of which needed no getblocktxn round trip
+    uint64_t nReconstructed;
+    uint64_t nTxPrefilled;
+    //! Transactions found in the mempool
+    uint64_t nTxFromMempool;
+    //! Transactions found in the extra transaction pool only
+    uint64_t nTxFromExtraPool;
+    //! Transactions we had to request with getblocktxn
+    uint64_t nTxRequested;
+
+    CompactBlockStats() : nBlocks(0), nReconstructed(0), nTxPrefilled(0), nTxFromMempool(0), nTxFromExtraPool(0), nTxRequested(0) {}
+};
+
+/** Weight of a new sample in the moving averages of block download speed */
+static const double BLOCK_DOWNLOAD_AVG_WEIGHT = 0.125;
+
+/** How fast a peer delivers the blocks we request from it */
+struct CBlockDownloadStats {
+    //! Moving average of the rate at which requested blocks are delivered (bytes per second), 0 if unknown.
+    double dBytesPerSec;
+    //! Moving average of the time taken to start delivering a requested block (in microseconds).
+    int64_t nLatency;
+    //! When the last requested block was received (in microseconds).
+    int64_t nLastReceived;
+
+    CBlockDownloadStats() : dBytesPerSec(0), nLatency(0), nLastReceived(0) {}
+
+    /** Learn from a block of nSize bytes requested at nTimeRequested and received at nTimeReceived. */
+    void Update(int64_t nTimeRequested, size_t nSize, int64_t nTimeReceived);
+    /**
+     * Number of blocks to keep requested: enough to cover the latency plus
+     * BLOCK_DOWNLOAD_QUEUE_TIME seconds of transfer at the measured speed.
+     */
+    int GetMaxBlocksInFlight(double dAvgBlockSize) const;
+    /** Expected time (in microseconds) to deliver one more block on top of nQueued, or -1 if unknown. */
+    int64_t GetExpectedDeliveryTime(double dAvgBlockSize, int nQueued) const;
+    /**
+     * Whether a block outstanding for nTimeOutstanding microseconds from a
+     * slower peer should be requested from this one instead.
+     */
+    bool ShouldTakeOver(const CBlockDownloadStats& statsStaller, int64_t nTimeOutstanding, double dAvgBlockSize) const;
 };
 
 struct CNodeStateStats {
@@ -41,15 +101,34 @@ struct CNodeStateStats {
     int nSyncHeight;
     int nCommonHeight;
     std::vector<int> vHeightInFlight;
+    int nMaxBlocksInFlight;
+    double dBlockBytesPerSec;
+    int64_t nBlockLatency;
+    CompactBlockStats cmpctStats;
 };
 
 /** Get statistics from node state */
 bool GetNodeStateStats(NodeId nodeid, CNodeStateStats &stats);
+/** Get compact block reconstruction statistics summed over all peers, and the extra transaction pool size */
+void GetCompactBlockStats(CompactBlockStats &stats, size_t &nExtraTxn);
 /** Increase a node's misbehavior score. */
 void Misbehaving(NodeId nodeid, int howmuch);
 
 /** Process protocol messages received from a given node */
 bool ProcessMessages(CNode* pfrom, CConnman& connman, const std::atomic<bool>& interrupt);
+/**
+ * Whether the next unit of work for a node only consists of requests that
+ * can be served concurrently with other nodes' messages, see
+ * ProcessConcurrentMessages().
+ */
+bool HasConcurrentMessages(CNode* pfrom);
+/**
+ * Like ProcessMessages(), but only serve outstanding getdata requests and
+ * process the next message if it is a request that reads shared state under
+ * its own locks (getdata, getheaders, getblocks, getblocktxn, mempool, ping).
+ * Anything else is left for ProcessMessages() on the message handler thread.
+ */
+bool ProcessConcurrentMessages(CNode* pfrom, CConnman& connman, const std::atomic<bool>& interrupt);
 /**
  * Send queued protocol messages to be sent to a give node.
  *
@@ -440,6 +440,10 @@ bool static ConnectSocketDirectly(const CService &addrConnect, SOCKET& hSocketRe
         // WSAEINVAL is here because some legacy version of winsock uses it
         if (nErr == WSAEINPROGRESS || nErr == WSAEWOULDBLOCK || nErr == WSAEINVAL)
         {
+            if (!IsSelectableSocket(hSocket)) {
+                CloseSocket(hSocket);
+                return error("ConnectSocketDirectly: non-selectable socket created (fd >= FD_SETSIZE ?)");
+            }
             struct timeval timeout = MillisToTimeval(nTimeout);
             fd_set fdset;
             FD_ZERO(&fdset);
@@ -11,6 +11,16 @@
 #include <string.h>
 
 #include <iterator>
+#include <stdexcept>
+
+/** Storage of prevectors beyond their direct allocation, on the heap. Other
+ *  storages provide the same static functions, sizes being in bytes.
+ */
+struct prevector_heap {
+    static void* allocate(size_t size) { return malloc(size); }
+    static void* reallocate(void* p, size_t old_size, size_t size) { return realloc(p, size); }
+    static void deallocate(void* p, size_t size) { free(p); }
+};
 
 #pragma pack(push, 1)
 /** Implements a drop-in replacement for std::vector<T> which stores up to N
@@ -30,8 +40,10 @@
  *
  *  The data type T must be movable by memmove/realloc(). Once we switch to C++,
  *  move constructors can be used instead.
+ *
+ *  The indirect allocations are made by Storage, see prevector_heap.
  */
-template<unsigned int N, typename T, typename Size = uint32_t, typename Diff = int32_t>
+template<unsigned int N, typename T, typename Size = uint32_t, typename Diff = int32_t, typename Storage = prevector_heap>
 class prevector {
 public:
     typedef Size size_type;
@@ -163,10 +175,11 @@ private:
         if (new_capacity <= N) {
             if (!is_direct()) {
                 T* indirect = indirect_ptr(0);
+                size_t indirect_size = ((size_t)sizeof(T)) * _union.capacity;
                 T* src = indirect;
                 T* dst = direct_ptr(0);
                 memcpy(dst, src, size() * sizeof(T));
-                free(indirect);
+                Storage::deallocate(indirect, indirect_size);
                 _size -= N + 1;
             }
         } else {
@@ -174,11 +187,11 @@ private:
                 /* FIXME: Because malloc/realloc here won't call new_handler if allocation fails, assert
                     success. These should instead use an allocator or new/delete so that handlers
                     are called as necessary, but performance would be slightly degraded by doing so. */
-                _union.indirect = static_cast<char*>(realloc(_union.indirect, ((size_t)sizeof(T)) * new_capacity));
+                _union.indirect = static_cast<char*>(Storage::reallocate(_union.indirect, ((size_t)sizeof(T)) * _union.capacity, ((size_t)sizeof(T)) * new_capacity));
                 assert(_union.indirect);
                 _union.capacity = new_capacity;
             } else {
-                char* new_indirect = static_cast<char*>(malloc(((size_t)sizeof(T)) * new_capacity));
+                char* new_indirect = static_cast<char*>(Storage::allocate(((size_t)sizeof(T)) * new_capacity));
                 assert(new_indirect);
                 T* src = direct_ptr(0);
                 T* dst = reinterpret_cast<T*>(new_indirect);
@@ -244,7 +257,7 @@ public:
         }
     }
 
-    prevector(const prevector<N, T, Size, Diff>& other) : _size(0) {
+    prevector(const prevector<N, T, Size, Diff, Storage>& other) : _size(0) {
         change_capacity(other.size());
         const_iterator it = other.begin();
         while (it != other.end()) {
@@ -254,11 +267,11 @@ public:
         }
     }
 
-    prevector(prevector<N, T, Size, Diff>&& other) : _size(0) {
+    prevector(prevector<N, T, Size, Diff, Storage>&& other) : _size(0) {
         swap(other);
     }
 
-    prevector& operator=(const prevector<N, T, Size, Diff>& other) {
+    prevector& operator=(const prevector<N, T, Size, Diff, Storage>& other) {
         if (&other == this) {
             return *this;
         }
@@ -273,7 +286,7 @@ public:
         return *this;
     }
 
-    prevector& operator=(prevector<N, T, Size, Diff>&& other) {
+    prevector& operator=(prevector<N, T, Size, Diff, Storage>&& other) {
         swap(other);
         return *this;
     }
@@ -312,6 +325,20 @@ public:
         return *item_ptr(pos);
     }
 
+    T& at(size_type pos) {
+        if (pos >= size()) {
+            throw std::out_of_range("prevector::at");
+        }
+        return *item_ptr(pos);
+    }
+
+    const T& at(size_type pos) const {
+        if (pos >= size()) {
+            throw std::out_of_range("prevector::at");
+        }
+        return *item_ptr(pos);
+    }
+
     void resize(size_type new_size) {
         if (size() > new_size) {
             erase(item_ptr(new_size), end());
@@ -426,7 +453,7 @@ public:
         return *item_ptr(size() - 1);
     }
 
-    void swap(prevector<N, T, Size, Diff>& other) {
+    void swap(prevector<N, T, Size, Diff, Storage>& other) {
         std::swap(_union, other._union);
         std::swap(_size, other._size);
     }
@@ -434,12 +461,12 @@ public:
     ~prevector() {
         clear();
         if (!is_direct()) {
-            free(_union.indirect);
+            Storage::deallocate(_union.indirect, ((size_t)sizeof(T)) * _union.capacity);
             _union.indirect = NULL;
         }
     }
 
-    bool operator==(const prevector<N, T, Size, Diff>& other) const {
+    bool operator==(const prevector<N, T, Size, Diff, Storage>& other) const {
         if (other.size() != size()) {
             return false;
         }
@@ -456,11 +483,11 @@ public:
         return true;
     }
 
-    bool operator!=(const prevector<N, T, Size, Diff>& other) const {
+    bool operator!=(const prevector<N, T, Size, Diff, Storage>& other) const {
         return !(*this == other);
     }
 
-    bool operator<(const prevector<N, T, Size, Diff>& other) const {
+    bool operator<(const prevector<N, T, Size, Diff, Storage>& other) const {
         if (size() < other.size()) {
             return true;
         }
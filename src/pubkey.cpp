@@ -6,6 +6,7 @@
 
 #include <secp256k1.h>
 #include <secp256k1_recovery.h>
+#include <secp256k1_batch.h>
 
 namespace
 {
@@ -165,6 +166,10 @@ static int ecdsa_signature_parse_der_lax(const secp256k1_context* ctx, secp256k1
 }
 
 bool CPubKey::Verify(const uint256 &hash, const std::vector<unsigned char>& vchSig) const {
+    return Verify(hash, vchSig.data(), vchSig.size());
+}
+
+bool CPubKey::Verify(const uint256 &hash, const unsigned char* pchSig, size_t nSigLen) const {
     if (!IsValid())
         return false;
     secp256k1_pubkey pubkey;
@@ -172,10 +177,10 @@ bool CPubKey::Verify(const uint256 &hash, const std::vector<unsigned char>& vchS
     if (!secp256k1_ec_pubkey_parse(secp256k1_context_verify, &pubkey, &(*this)[0], size())) {
         return false;
     }
-    if (vchSig.size() == 0) {
+    if (nSigLen == 0) {
         return false;
     }
-    if (!ecdsa_signature_parse_der_lax(secp256k1_context_verify, &sig, &vchSig[0], vchSig.size())) {
+    if (!ecdsa_signature_parse_der_lax(secp256k1_context_verify, &sig, pchSig, nSigLen)) {
         return false;
     }
     /* libsecp256k1's ECDSA verification requires lower-S signatures, which have
@@ -273,13 +278,39 @@ bool CExtPubKey::Derive(CExtPubKey &out, unsigned int _nChild) const {
 }
 
 /* static */ bool CPubKey::CheckLowS(const std::vector<unsigned char>& vchSig) {
+    return CheckLowS(vchSig.data(), vchSig.size());
+}
+
+/* static */ bool CPubKey::CheckLowS(const unsigned char* pchSig, size_t nSize) {
     secp256k1_ecdsa_signature sig;
-    if (!ecdsa_signature_parse_der_lax(secp256k1_context_verify, &sig, &vchSig[0], vchSig.size())) {
+    if (!ecdsa_signature_parse_der_lax(secp256k1_context_verify, &sig, pchSig, nSize)) {
         return false;
     }
     return (!secp256k1_ecdsa_signature_normalize(secp256k1_context_verify, NULL, &sig));
 }
 
+/* static */ bool CPubKey::VerifyBatch(const CPubKeySignature* pSigs, size_t nCount) {
+    std::vector<secp256k1_pubkey> vPubKeys(nCount);
+    std::vector<secp256k1_ecdsa_signature> vParsedSigs(nCount);
+    std::vector<const secp256k1_pubkey*> vpPubKeys(nCount);
+    std::vector<const secp256k1_ecdsa_signature*> vpSigs(nCount);
+    std::vector<const unsigned char*> vpHashes(nCount);
+    for (size_t i = 0; i < nCount; i++) {
+        const CPubKeySignature& sig = pSigs[i];
+        if (!sig.pubkey.IsValid() || !secp256k1_ec_pubkey_parse(secp256k1_context_verify, &vPubKeys[i], sig.pubkey.begin(), sig.pubkey.size())) {
+            return false;
+        }
+        if (sig.vchSig.size() == 0 || !ecdsa_signature_parse_der_lax(secp256k1_context_verify, &vParsedSigs[i], &sig.vchSig[0], sig.vchSig.size())) {
+            return false;
+        }
+        secp256k1_ecdsa_signature_normalize(secp256k1_context_verify, &vParsedSigs[i], &vParsedSigs[i]);
+        vpPubKeys[i] = &vPubKeys[i];
+        vpSigs[i] = &vParsedSigs[i];
+        vpHashes[i] = sig.hash.begin();
+    }
+    return secp256k1_ecdsa_verify_batch(secp256k1_context_verify, vpSigs.data(), vpHashes.data(), vpPubKeys.data(), nCount);
+}
+
 /* static */ int ECCVerifyHandle::refcount = 0;
 
 ECCVerifyHandle::ECCVerifyHandle()
@@ -35,6 +35,8 @@ public:
 
 typedef uint256 ChainCode;
 
+struct CPubKeySignature;
+
 /** An encapsulated public key. */
 class CPubKey
 {
@@ -174,11 +176,19 @@ public:
      * If this public key is not fully valid, the return value will be false.
      */
     bool Verify(const uint256& hash, const std::vector<unsigned char>& vchSig) const;
+    bool Verify(const uint256& hash, const unsigned char* pchSig, size_t nSigLen) const;
 
     /**
      * Check whether a signature is normalized (lower-S).
      */
     static bool CheckLowS(const std::vector<unsigned char>& vchSig);
+    static bool CheckLowS(const unsigned char* pchSig, size_t nSize);
+
+    /**
+     * Verify nCount DER signatures, with the same rules as Verify. Cheaper
+     * than verifying them one by one, but only tells whether all are valid.
+     */
+    static bool VerifyBatch(const CPubKeySignature* pSigs, size_t nCount);
 
     //! Recover a public key from a compact signature.
     bool RecoverCompact(const uint256& hash, const std::vector<unsigned char>& vchSig);
@@ -190,6 +200,16 @@ public:
     bool Derive(CPubKey& pubkeyChild, ChainCode &ccChild, unsigned int nChild, const ChainCode& cc) const;
 };
 
+/** A DER signature of a hash by a public key, for CPubKey::VerifyBatch */
+struct CPubKeySignature
+{
+    CPubKey pubkey;
+    uint256 hash;
+    std::vector<unsigned char> vchSig;
+
+    CPubKeySignature(const CPubKey& pubkeyIn, const uint256& hashIn, const std::vector<unsigned char>& vchSigIn) : pubkey(pubkeyIn), hash(hashIn), vchSig(vchSigIn) {}
+};
+
 struct CExtPubKey {
     unsigned char nDepth;
     unsigned char vchFingerprint[4];
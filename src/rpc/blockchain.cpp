@@ -4,6 +4,7 @@
 // file COPYING or http://www.opensource.org/licenses/mit-license.php.
 
 #include "amount.h"
+#include "blockfilterindex.h"
 #include "chain.h"
 #include "chainparams.h"
 #include "checkpoints.h"
@@ -14,6 +15,7 @@
 #include "policy/policy.h"
 #include "primitives/transaction.h"
 #include "rpc/server.h"
+#include "script/sigcache.h"
 #include "streams.h"
 #include "sync.h"
 #include "txmempool.h"
@@ -1457,6 +1459,60 @@ struct CompareBlocksByHeight
     }
 };
 
+UniValue getblockfilter(const JSONRPCRequest& request)
+{
+    if (request.fHelp || request.params.size() < 1 || request.params.size() > 2)
+        throw runtime_error(
+            "getblockfilter \"blockhash\" ( \"filtertype\" )\n"
+            "\nRetrieve a BIP 157 content filter for a particular block.\n"
+            "\nArguments:\n"
+            "1. \"blockhash\"       (string, required) The hash of the block\n"
+            "2. \"filtertype\"      (string, optional, default=\"basic\") The type name of the filter\n"
+            "\nResult:\n"
+            "{\n"
+            "  \"filter\" : \"hex\",   (string) the hex-encoded filter data\n"
+            "  \"header\" : \"hex\"    (string) the hex-encoded filter header\n"
+            "}\n"
+            "\nExamples:\n"
+            + HelpExampleCli("getblockfilter", "\"00000000c937983704a73af28acdec37b049d214adbda81d7e2a3dd146f6ed09\" \"basic\"")
+            + HelpExampleRpc("getblockfilter", "\"00000000c937983704a73af28acdec37b049d214adbda81d7e2a3dd146f6ed09\", \"basic\"")
+        );
+
+    uint256 hash(uint256S(request.params[0].get_str()));
+    std::string strFilterType = "basic";
+    if (request.params.size() > 1)
+        strFilterType = request.params[1].get_str();
+
+    BlockFilterType filterType;
+    if (!BlockFilterTypeByName(strFilterType, filterType))
+        throw JSONRPCError(RPC_INVALID_ADDRESS_OR_KEY, "Unknown filtertype");
+    if (!g_blockfilterindex || g_blockfilterindex->GetFilterType() != filterType)
+        throw JSONRPCError(RPC_MISC_ERROR, "Index is not enabled for filtertype " + strFilterType);
+
+    const CBlockIndex* pblockindex;
+    {
+        LOCK(cs_main);
+        BlockMap::const_iterator it = mapBlockIndex.find(hash);
+        if (it == mapBlockIndex.end())
+            throw JSONRPCError(RPC_INVALID_ADDRESS_OR_KEY, "Block not found");
+        pblockindex = it->second;
+    }
+
+    BlockFilter filter;
+    uint256 header;
+    if (!g_blockfilterindex->LookupFilter(pblockindex, filter) || !g_blockfilterindex->LookupFilterHeader(pblockindex, header)) {
+        int nBestHeight = g_blockfilterindex->GetBestHeight();
+        if (nBestHeight < pblockindex->nHeight)
+            throw JSONRPCError(RPC_MISC_ERROR, strprintf("Filter not found. Block filters are still in the process of being indexed (at height %d).", nBestHeight));
+        throw JSONRPCError(RPC_MISC_ERROR, "Filter not found. Only blocks connected to the active chain are indexed.");
+    }
+
+    UniValue ret(UniValue::VOBJ);
+    ret.push_back(Pair("filter", HexStr(filter.GetEncodedFilter())));
+    ret.push_back(Pair("header", header.GetHex()));
+    return ret;
+}
+
 UniValue getchaintips(const JSONRPCRequest& request)
 {
     if (request.fHelp || request.params.size() != 0)
@@ -1595,6 +1651,42 @@ UniValue getmempoolinfo(const JSONRPCRequest& request)
     return mempoolInfoToJSON();
 }
 
+UniValue getsigcacheinfo(const JSONRPCRequest& request)
+{
+    if (request.fHelp || request.params.size() != 0)
+        throw runtime_error(
+            "getsigcacheinfo\n"
+            "\nReturns statistics of the signature cache since startup, to size -maxsigcachesize with.\n"
+            "\nResult:\n"
+            "{\n"
+            "  \"size\": xxxxx,               (numeric) Signatures in the cache\n"
+            "  \"capacity\": xxxxx,           (numeric) Signatures the cache can hold\n"
+            "  \"usage\": xxxxx,              (numeric) Memory usage of the cache in bytes\n"
+            "  \"hits\": xxxxx,               (numeric) Lookups of signatures found in the cache\n"
+            "  \"misses\": xxxxx,             (numeric) Lookups of signatures not found in the cache\n"
+            "  \"hitrate\": x.xxx,            (numeric) Fraction of lookups that were hits\n"
+            "  \"inserts\": xxxxx,            (numeric) Verified signatures added to the cache\n"
+            "  \"evictions\": xxxxx           (numeric) Signatures dropped from the full cache before they were used\n"
+            "}\n"
+            "\nExamples:\n"
+            + HelpExampleCli("getsigcacheinfo", "")
+            + HelpExampleRpc("getsigcacheinfo", "")
+        );
+
+    SignatureCacheStats stats = GetSignatureCacheStats();
+    UniValue ret(UniValue::VOBJ);
+    ret.push_back(Pair("size", (uint64_t)stats.nEntries));
+    ret.push_back(Pair("capacity", (uint64_t)stats.nCapacity));
+    ret.push_back(Pair("usage", (uint64_t)(stats.nCapacity * sizeof(uint256))));
+    ret.push_back(Pair("hits", stats.nHits));
+    ret.push_back(Pair("misses", stats.nMisses));
+    const uint64_t nLookups = stats.nHits + stats.nMisses;
+    ret.push_back(Pair("hitrate", nLookups == 0 ? 0.0 : (double)stats.nHits / nLookups));
+    ret.push_back(Pair("inserts", stats.nInserts));
+    ret.push_back(Pair("evictions", stats.nEvictions));
+    return ret;
+}
+
 UniValue preciousblock(const JSONRPCRequest& request)
 {
     if (request.fHelp || request.params.size() != 1)
@@ -1754,6 +1846,7 @@ static const CRPCCommand commands[] =
     { "blockchain",         "getblock",               &getblock,               true,  {"blockhash","verbose"} },
     { "blockchain",         "getblockhash",           &getblockhash,           true,  {"height"} },
     { "blockchain",         "getblockheader",         &getblockheader,         true,  {"blockhash","verbose"} },
+    { "blockchain",         "getblockfilter",         &getblockfilter,         true,  {"blockhash","filtertype"} },
     { "blockchain",         "getchaintips",           &getchaintips,           true,  {} },
     { "blockchain",         "getdifficulty",          &getdifficulty,          true,  {"algo","height","next"} },
     { "blockchain",         "getmempoolancestors",    &getmempoolancestors,    true,  {"txid","verbose"} },
@@ -1761,6 +1854,7 @@ static const CRPCCommand commands[] =
     { "blockchain",         "getmempoolentry",        &getmempoolentry,        true,  {"txid"} },
     { "blockchain",         "getmempoolinfo",         &getmempoolinfo,         true,  {} },
     { "blockchain",         "getrawmempool",          &getrawmempool,          true,  {"verbose"} },
+    { "blockchain",         "getsigcacheinfo",        &getsigcacheinfo,        true,  {} },
     { "blockchain",         "gettxout",               &gettxout,               true,  {"txid","n","include_mempool"} },
     { "blockchain",         "gettxoutsetinfo",        &gettxoutsetinfo,        true,  {} },
     { "blockchain",         "pruneblockchain",        &pruneblockchain,        true,  {"height"} },
@@ -67,6 +67,18 @@ UniValue ping(const JSONRPCRequest& request)
     return NullUniValue;
 }
 
+static UniValue CompactBlockStatsToJSON(const CompactBlockStats& stats)
+{
+    UniValue obj(UniValue::VOBJ);
+    obj.push_back(Pair("blocks", stats.nBlocks));
+    obj.push_back(Pair("reconstructed", stats.nReconstructed));
+    obj.push_back(Pair("txprefilled", stats.nTxPrefilled));
+    obj.push_back(Pair("txmempool", stats.nTxFromMempool));
+    obj.push_back(Pair("txextrapool", stats.nTxFromExtraPool));
+    obj.push_back(Pair("txrequested", stats.nTxRequested));
+    return obj;
+}
+
 UniValue getpeerinfo(const JSONRPCRequest& request)
 {
     if (request.fHelp || request.params.size() != 0)
@@ -81,10 +93,14 @@ UniValue getpeerinfo(const JSONRPCRequest& request)
             "    \"addrlocal\":\"ip:port\",   (string) local address\n"
             "    \"services\":\"xxxxxxxxxxxxxxxx\",   (string) The services offered\n"
             "    \"relaytxes\":true|false,    (boolean) Whether peer has asked us to relay transactions to it\n"
+            "    \"txreconciliation\":true|false, (boolean) Whether transaction announcements are reconciled with the peer instead of flooded\n"
             "    \"lastsend\": ttt,           (numeric) The time in seconds since epoch (Jan 1 1970 GMT) of the last send\n"
             "    \"lastrecv\": ttt,           (numeric) The time in seconds since epoch (Jan 1 1970 GMT) of the last receive\n"
             "    \"bytessent\": n,            (numeric) The total bytes sent\n"
             "    \"bytesrecv\": n,            (numeric) The total bytes received\n"
+            "    \"sendbuffer\": n,           (numeric) The bytes queued for sending\n"
+            "    \"recvbuffer\": n,           (numeric) The bytes held in memory by messages being received or waiting to be processed\n"
+            "    \"recvspilled\": n,          (numeric) The bytes of received block messages held in temporary files\n"
             "    \"conntime\": ttt,           (numeric) The connection time in seconds since epoch (Jan 1 1970 GMT)\n"
             "    \"timeoffset\": ttt,         (numeric) The time offset in seconds\n"
             "    \"pingtime\": n,             (numeric) ping time (if available)\n"
@@ -102,6 +118,17 @@ UniValue getpeerinfo(const JSONRPCRequest& request)
             "       n,                        (numeric) The heights of blocks we're currently asking from this peer\n"
             "       ...\n"
             "    ],\n"
+            "    \"inflightlimit\": n,       (numeric) How many blocks we are willing to have in flight from this peer\n"
+            "    \"blockbytespersec\": n,    (numeric) Measured speed at which this peer delivers requested blocks, 0 if unknown\n"
+            "    \"blocklatency\": n,        (numeric) Measured delay in seconds before this peer starts delivering a requested block\n"
+            "    \"compactblocks\": {         (json object) Reconstruction of compact blocks received from this peer\n"
+            "       \"blocks\": n,              (numeric) Compact blocks we tried to reconstruct\n"
+            "       \"reconstructed\": n,       (numeric) ...of which needed no getblocktxn round trip\n"
+            "       \"txprefilled\": n,         (numeric) Transactions prefilled by the peer\n"
+            "       \"txmempool\": n,           (numeric) Transactions found in the mempool\n"
+            "       \"txextrapool\": n,         (numeric) Transactions found in the extra transaction pool only\n"
+            "       \"txrequested\": n          (numeric) Transactions requested with getblocktxn\n"
+            "    },\n"
             "    \"whitelisted\": true|false, (boolean) Whether the peer is whitelisted\n"					
             "    \"bytessent_per_msg\": {\n"
             "       \"addr\": n,              (numeric) The total bytes sent aggregated by message type\n"
@@ -137,10 +164,14 @@ UniValue getpeerinfo(const JSONRPCRequest& request)
             obj.push_back(Pair("addrlocal", stats.addrLocal));
         obj.push_back(Pair("services", strprintf("%016x", stats.nServices)));
         obj.push_back(Pair("relaytxes", stats.fRelayTxes));
+        obj.push_back(Pair("txreconciliation", stats.fTxReconciliation));
         obj.push_back(Pair("lastsend", stats.nLastSend));
         obj.push_back(Pair("lastrecv", stats.nLastRecv));
         obj.push_back(Pair("bytessent", stats.nSendBytes));
         obj.push_back(Pair("bytesrecv", stats.nRecvBytes));
+        obj.push_back(Pair("sendbuffer", stats.nSendBufferSize));
+        obj.push_back(Pair("recvbuffer", stats.nRecvBufferSize));
+        obj.push_back(Pair("recvspilled", stats.nRecvSpilledSize));
         obj.push_back(Pair("conntime", stats.nTimeConnected));
         obj.push_back(Pair("timeoffset", stats.nTimeOffset));
         if (stats.dPingTime > 0.0)
@@ -166,6 +197,10 @@ UniValue getpeerinfo(const JSONRPCRequest& request)
                 heights.push_back(height);
             }
             obj.push_back(Pair("inflight", heights));
+            obj.push_back(Pair("inflightlimit", statestats.nMaxBlocksInFlight));
+            obj.push_back(Pair("blockbytespersec", (int64_t)statestats.dBlockBytesPerSec));
+            obj.push_back(Pair("blocklatency", statestats.nBlockLatency / 1000000.0));
+            obj.push_back(Pair("compactblocks", CompactBlockStatsToJSON(statestats.cmpctStats)));
         }
         obj.push_back(Pair("whitelisted", stats.fWhitelisted));
 
@@ -427,6 +462,16 @@ UniValue getnetworkinfo(const JSONRPCRequest& request)
             "  }\n"
             "  ,...\n"
             "  ]\n"
+            "  \"compactblocks\": {                   (json object) reconstruction of compact blocks received from all peers\n"
+            "    \"blocks\": n,                       (numeric) compact blocks we tried to reconstruct\n"
+            "    \"reconstructed\": n,                (numeric) ...of which needed no getblocktxn round trip\n"
+            "    \"txprefilled\": n,                  (numeric) transactions prefilled by peers\n"
+            "    \"txmempool\": n,                    (numeric) transactions found in the mempool\n"
+            "    \"txextrapool\": n,                  (numeric) transactions found in the extra transaction pool only\n"
+            "    \"txrequested\": n,                  (numeric) transactions requested with getblocktxn\n"
+            "    \"extrapoolsize\": n,                (numeric) transactions currently in the extra transaction pool\n"
+            "    \"extrapoolhitrate\": x.xxx          (numeric) fraction of transactions missing from the mempool that the extra pool provided\n"
+            "  },\n"
             "  \"warnings\": \"...\"                    (string) any network warnings\n"
             "}\n"
             "\nExamples:\n"
@@ -463,6 +508,14 @@ UniValue getnetworkinfo(const JSONRPCRequest& request)
         }
     }
     obj.push_back(Pair("localaddresses", localAddresses));
+    CompactBlockStats cmpctStats;
+    size_t nExtraTxn;
+    GetCompactBlockStats(cmpctStats, nExtraTxn);
+    UniValue cmpctObj = CompactBlockStatsToJSON(cmpctStats);
+    cmpctObj.push_back(Pair("extrapoolsize", (uint64_t)nExtraTxn));
+    uint64_t nTxNotInMempool = cmpctStats.nTxFromExtraPool + cmpctStats.nTxRequested;
+    cmpctObj.push_back(Pair("extrapoolhitrate", nTxNotInMempool ? (double)cmpctStats.nTxFromExtraPool / nTxNotInMempool : 0.0));
+    obj.push_back(Pair("compactblocks", cmpctObj));
     obj.push_back(Pair("warnings",       GetWarnings("statusbar")));
     return obj;
 }
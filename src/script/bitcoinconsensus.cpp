@@ -10,6 +10,12 @@
 #include "script/interpreter.h"
 #include "version.h"
 
+#include <algorithm>
+#include <atomic>
+#include <system_error>
+#include <thread>
+#include <vector>
+
 namespace {
 
 /** A class that deserializes a single CTransaction one time. */
@@ -68,6 +74,22 @@ struct ECCryptoClosure
 };
 
 ECCryptoClosure instance_of_eccryptoclosure;
+
+/** Joins the threads verifying a transaction's inputs however the calling thread leaves its scope */
+class ThreadJoiner
+{
+public:
+    explicit ThreadJoiner(std::vector<std::thread>& threadsIn) : m_threads(threadsIn) {}
+
+    ~ThreadJoiner()
+    {
+        for (std::thread& thread : m_threads)
+            if (thread.joinable())
+                thread.join();
+    }
+private:
+    std::vector<std::thread>& m_threads;
+};
 }
 
 /** Check that all specified flags are part of the libconsensus interface. */
@@ -122,6 +144,60 @@ int bitcoinconsensus_verify_script(const unsigned char *scriptPubKey, unsigned i
     return ::verify_script(scriptPubKey, scriptPubKeyLen, am, txTo, txToLen, nIn, flags, err);
 }
 
+int bitcoinconsensus_verify_transaction(const unsigned char* const* scriptPubKeys, const unsigned int* scriptPubKeyLens, const int64_t* amounts,
+                                        const unsigned char *txTo        , unsigned int txToLen,
+                                        unsigned int nInputs, unsigned int flags, unsigned int nThreads,
+                                        int* results, bitcoinconsensus_error* err)
+{
+    if (!verify_flags(flags)) {
+        return set_error(err, bitcoinconsensus_ERR_INVALID_FLAGS);
+    }
+    if (amounts == NULL && (flags & bitcoinconsensus_SCRIPT_FLAGS_VERIFY_WITNESS)) {
+        return set_error(err, bitcoinconsensus_ERR_AMOUNT_REQUIRED);
+    }
+    try {
+        TxInputStream stream(SER_NETWORK, PROTOCOL_VERSION, txTo, txToLen);
+        CTransaction tx(deserialize, stream);
+        if (nInputs != tx.vin.size())
+            return set_error(err, bitcoinconsensus_ERR_TX_INDEX);
+        if (GetSerializeSize(tx, SER_NETWORK, PROTOCOL_VERSION) != txToLen)
+            return set_error(err, bitcoinconsensus_ERR_TX_SIZE_MISMATCH);
+
+        // Regardless of the verification result, the tx did not error.
+        set_error(err, bitcoinconsensus_ERR_OK);
+
+        PrecomputedTransactionData txdata(tx);
+        std::atomic<unsigned int> nNext(0);
+        auto verify_inputs = [&]() {
+            for (unsigned int nIn = nNext++; nIn < nInputs; nIn = nNext++) {
+                // An exception must not leave a thread, and an input that could not be verified is invalid
+                try {
+                    const CScript scriptPubKey(scriptPubKeys[nIn], scriptPubKeys[nIn] + scriptPubKeyLens[nIn]);
+                    const CAmount amount = amounts ? amounts[nIn] : 0;
+                    results[nIn] = VerifyScript(tx.vin[nIn].scriptSig, scriptPubKey, flags, TransactionSignatureChecker(&tx, nIn, amount, txdata), NULL);
+                } catch (const std::exception&) {
+                    results[nIn] = 0;
+                }
+            }
+        };
+        std::vector<std::thread> threads;
+        threads.reserve(std::min(nThreads, nInputs));
+        {
+            ThreadJoiner joiner(threads);
+            try {
+                for (unsigned int i = 1; i < std::min(nThreads, nInputs); i++)
+                    threads.emplace_back(verify_inputs);
+            } catch (const std::system_error&) {
+                // The threads that did start share the inputs with this one
+            }
+            verify_inputs();
+        }
+        return std::all_of(results, results + nInputs, [](int result) { return result == 1; });
+    } catch (const std::exception&) {
+        return set_error(err, bitcoinconsensus_ERR_TX_DESERIALIZE); // Error deserializing
+    }
+}
+
 unsigned int bitcoinconsensus_version()
 {
     // Just use the API version for now
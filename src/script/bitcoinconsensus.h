@@ -72,6 +72,21 @@ EXPORT_SYMBOL int bitcoinconsensus_verify_script_with_amount(const unsigned char
                                     const unsigned char *txTo        , unsigned int txToLen,
                                     unsigned int nIn, unsigned int flags, bitcoinconsensus_error* err);
 
+/// Returns 1 if all nInputs inputs of the serialized transaction pointed to
+/// by txTo correctly spend their previous outputs under the additional
+/// constraints specified by flags: input i spends the scriptPubKey of
+/// scriptPubKeyLens[i] bytes pointed to by scriptPubKeys[i], of amounts[i]
+/// (amounts can be NULL unless WITNESS is used).
+/// The transaction is deserialized once, and its inputs are verified on up
+/// to nThreads threads, the calling one included. results, an array of
+/// nInputs entries, is set to 1 for each input that verifies and 0 for the
+/// others.
+/// If not NULL, err will contain an error/success code for the operation
+EXPORT_SYMBOL int bitcoinconsensus_verify_transaction(const unsigned char* const* scriptPubKeys, const unsigned int* scriptPubKeyLens, const int64_t* amounts,
+                                                      const unsigned char *txTo        , unsigned int txToLen,
+                                                      unsigned int nInputs, unsigned int flags, unsigned int nThreads,
+                                                      int* results, bitcoinconsensus_error* err);
+
 EXPORT_SYMBOL unsigned int bitcoinconsensus_version();
 
 #ifdef __cplusplus
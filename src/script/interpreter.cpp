@@ -11,6 +11,7 @@
 #include "crypto/sha256.h"
 #include "pubkey.h"
 #include "script/script.h"
+#include "streams.h"
 #include "uint256.h"
 
 using namespace std;
@@ -33,9 +34,148 @@ inline bool set_error(ScriptError* ret, const ScriptError serror)
     return false;
 }
 
+//! Bytes of the arena in the frame of the verification using it
+static const size_t SCRIPT_ARENA_DIRECT_SIZE = 4096;
+//! Least bytes the arena takes from the heap when it runs out
+static const size_t SCRIPT_ARENA_CHUNK_SIZE = 65536;
+
+/**
+ * Memory of the stacks of one script verification. Blocks are taken in
+ * order, and only the last one is given back or resized in place; the rest
+ * is released at once when the verification is done. Standard scripts fit
+ * in the direct bytes, so evaluating them does not touch the heap.
+ */
+class ScriptArena
+{
+private:
+    //! Chunks taken from the heap, linked through their first bytes
+    struct Chunk {
+        Chunk* pprev;
+    };
+
+    unsigned char direct[SCRIPT_ARENA_DIRECT_SIZE];
+    Chunk* pchunks;
+    unsigned char* pos;
+    unsigned char* end;
+    unsigned char* plast;
+
+    static size_t Align(size_t size) { return (size + sizeof(void*) - 1) & ~(sizeof(void*) - 1); }
+
+public:
+    ScriptArena() : pchunks(NULL), pos(direct), end(direct + sizeof(direct)), plast(NULL) {}
+    ScriptArena(const ScriptArena&) = delete;
+    ScriptArena& operator=(const ScriptArena&) = delete;
+
+    ~ScriptArena()
+    {
+        while (pchunks) {
+            Chunk* pprev = pchunks->pprev;
+            free(pchunks);
+            pchunks = pprev;
+        }
+    }
+
+    void* Allocate(size_t size)
+    {
+        size = Align(size);
+        if (size > (size_t)(end - pos)) {
+            const size_t nChunkSize = sizeof(Chunk) + std::max(size, SCRIPT_ARENA_CHUNK_SIZE);
+            Chunk* chunk = static_cast<Chunk*>(malloc(nChunkSize));
+            assert(chunk);
+            chunk->pprev = pchunks;
+            pchunks = chunk;
+            pos = reinterpret_cast<unsigned char*>(chunk) + sizeof(Chunk);
+            end = reinterpret_cast<unsigned char*>(chunk) + nChunkSize;
+        }
+        plast = pos;
+        pos += size;
+        return plast;
+    }
+
+    void* Reallocate(void* p, size_t old_size, size_t size)
+    {
+        if (p == plast && size <= (size_t)(end - plast)) {
+            pos = plast + Align(size);
+            return p;
+        }
+        if (size <= old_size)
+            return p;
+        void* pnew = Allocate(size);
+        memcpy(pnew, p, old_size);
+        return pnew;
+    }
+
+    void Deallocate(void* p)
+    {
+        if (p == plast) {
+            pos = plast;
+            plast = NULL;
+        }
+    }
+};
+
+//! The arena of the verification running on this thread, if any
+thread_local ScriptArena* pscriptarena = NULL;
+
+/** Makes its arena the current one of the thread while in scope */
+class ScriptArenaScope
+{
+private:
+    ScriptArena arena;
+    ScriptArena* pprev;
+
+public:
+    ScriptArenaScope() : pprev(pscriptarena) { pscriptarena = &arena; }
+    ~ScriptArenaScope() { pscriptarena = pprev; }
+};
+
+/** prevector storage in the current arena, which must outlive the prevectors */
+struct ScriptArenaStorage
+{
+    static void* allocate(size_t size) { return pscriptarena->Allocate(size); }
+    static void* reallocate(void* p, size_t old_size, size_t size) { return pscriptarena->Reallocate(p, old_size, size); }
+    static void deallocate(void* p, size_t size) { pscriptarena->Deallocate(p); }
+};
+
+/** Data pushed by a script, within the script */
+struct PushData
+{
+    const unsigned char* pbegin;
+    const unsigned char* pend;
+    opcodetype opcode;
+
+    const unsigned char* data() const { return pbegin; }
+    size_t size() const { return pend - pbegin; }
+    unsigned char operator[](size_t pos) const { return pbegin[pos]; }
+    valtype vch() const { return valtype(pbegin, pend); }
+};
+
+/** GetOp, giving the data pushed as a range of the script, empty for other opcodes */
+bool GetScriptOp(const CScript& script, CScript::const_iterator& pc, opcodetype& opcodeRet, PushData& pushRet)
+{
+    const CScript::const_iterator pstart = pc;
+    if (!script.GetOp(pc, opcodeRet))
+        return false;
+    const int nHeaderSize = opcodeRet == OP_PUSHDATA1 ? 2 : opcodeRet == OP_PUSHDATA2 ? 3 : opcodeRet == OP_PUSHDATA4 ? 5 : 1;
+    pushRet.pbegin = script.data() + (pstart - script.begin()) + nHeaderSize;
+    pushRet.pend = script.data() + (pc - script.begin());
+    pushRet.opcode = opcodeRet;
+    return true;
+}
+
 } // anon namespace
 
-bool CastToBool(const valtype& vch)
+//! Stack elements up to the size of a signature are stored directly
+static const unsigned int STACK_ELEMENT_DIRECT_SIZE = 75;
+//! The elements of a standard spend are stored directly in the stack
+static const unsigned int STACK_DIRECT_ELEMENTS = 8;
+
+/** The stacks EvalScript works on, which only use memory of the current arena */
+typedef prevector<STACK_ELEMENT_DIRECT_SIZE, unsigned char, uint32_t, int32_t, ScriptArenaStorage> stackvaltype;
+typedef prevector<STACK_DIRECT_ELEMENTS, stackvaltype, uint32_t, int32_t, ScriptArenaStorage> stacktype;
+
+template <typename T>
+bool static CastToBool(const T& vch)
 {
     for (unsigned int i = 0; i < vch.size(); i++)
     {
@@ -50,20 +190,59 @@ bool CastToBool(const valtype& vch)
     return false;
 }
 
+bool CastToBool(const valtype& vch)
+{
+    return CastToBool<valtype>(vch);
+}
+
 /**
  * Script is a stack machine (like Forth) that evaluates a predicate
  * returning a bool indicating valid or not.  There are no loops.
  */
 #define stacktop(i)  (stack.at(stack.size()+(i)))
 #define altstacktop(i)  (altstack.at(altstack.size()+(i)))
-static inline void popstack(vector<valtype>& stack)
+template <typename T>
+static inline void popstack(T& stack)
 {
     if (stack.empty())
         throw runtime_error("popstack(): stack empty");
     stack.pop_back();
 }
 
-bool static IsCompressedOrUncompressedPubKey(const valtype &vchPubKey) {
+static inline void pushnum(stacktype& stack, const CScriptNum& bn)
+{
+    stack.push_back(stackvaltype());
+    bn.getvch(stack.back());
+}
+
+/**
+ * Subset of script starting at the most recent codeseparator, without the
+ * signatures in [pbeginsigs, pendsigs) in pre-segwit scripts. Unless there
+ * is a codeseparator or one of the signatures in script, that is script
+ * itself and nothing is copied into scriptCodeRet.
+ */
+static const CScript& GetScriptCode(const CScript& script, CScript::const_iterator pbegincodehash, const stackvaltype* pbeginsigs, const stackvaltype* pendsigs, SigVersion sigversion, CScript& scriptCodeRet)
+{
+    bool fDropSigs = false;
+    if (sigversion == SIGVERSION_BASE) {
+        for (const stackvaltype* psig = pbeginsigs; psig != pendsigs; psig++)
+            if (std::search(pbegincodehash, script.end(), psig->begin(), psig->end()) != script.end())
+                fDropSigs = true;
+    }
+    if (pbegincodehash == script.begin() && !fDropSigs)
+        return script;
+
+    scriptCodeRet = CScript(pbegincodehash, script.end());
+    // Drop the signatures, topmost first, in pre-segwit scripts but not segwit scripts
+    for (const stackvaltype* psig = pendsigs; fDropSigs && psig != pbeginsigs;) {
+        --psig;
+        scriptCodeRet.FindAndDelete(CScript(valtype(psig->begin(), psig->end())));
+    }
+    return scriptCodeRet;
+}
+
+template <typename T>
+bool static IsCompressedOrUncompressedPubKey(const T &vchPubKey) {
     if (vchPubKey.size() < 33) {
         //  Non-canonical public key: too short
         return false;
@@ -85,7 +264,8 @@ bool static IsCompressedOrUncompressedPubKey(const valtype &vchPubKey) {
     return true;
 }
 
-bool static IsCompressedPubKey(const valtype &vchPubKey) {
+template <typename T>
+bool static IsCompressedPubKey(const T &vchPubKey) {
     if (vchPubKey.size() != 33) {
         //  Non-canonical public key: invalid length for compressed key
         return false;
@@ -107,7 +287,8 @@ bool static IsCompressedPubKey(const valtype &vchPubKey) {
  *
  * This function is consensus-critical since BIP66.
  */
-bool static IsValidSignatureEncoding(const std::vector<unsigned char> &sig) {
+template <typename T>
+bool static IsValidSignatureEncoding(const T &sig) {
     // Format: 0x30 [total-length] 0x02 [R-length] [R] 0x02 [S-length] [S] [sighash]
     // * total-length: 1-byte length descriptor of everything that follows,
     //   excluding the sighash byte.
@@ -172,18 +353,19 @@ bool static IsValidSignatureEncoding(const std::vector<unsigned char> &sig) {
     return true;
 }
 
-bool static IsLowDERSignature(const valtype &vchSig, ScriptError* serror) {
+template <typename T>
+bool static IsLowDERSignature(const T &vchSig, ScriptError* serror) {
     if (!IsValidSignatureEncoding(vchSig)) {
         return set_error(serror, SCRIPT_ERR_SIG_DER);
     }
-    std::vector<unsigned char> vchSigCopy(vchSig.begin(), vchSig.begin() + vchSig.size() - 1);
-    if (!CPubKey::CheckLowS(vchSigCopy)) {
+    if (!CPubKey::CheckLowS(vchSig.data(), vchSig.size() - 1)) {
         return set_error(serror, SCRIPT_ERR_SIG_HIGH_S);
     }
     return true;
 }
 
-bool static IsDefinedHashtypeSignature(const valtype &vchSig) {
+template <typename T>
+bool static IsDefinedHashtypeSignature(const T &vchSig) {
     if (vchSig.size() == 0) {
         return false;
     }
@@ -194,7 +376,8 @@ bool static IsDefinedHashtypeSignature(const valtype &vchSig) {
     return true;
 }
 
-bool CheckSignatureEncoding(const vector<unsigned char> &vchSig, unsigned int flags, ScriptError* serror) {
+template <typename T>
+bool static CheckSignatureEncoding(const T &vchSig, unsigned int flags, ScriptError* serror) {
     // Empty signature. Not strictly DER encoded, but allowed to provide a
     // compact way to provide an invalid signature for use with CHECK(MULTI)SIG
     if (vchSig.size() == 0) {
@@ -211,7 +394,12 @@ bool CheckSignatureEncoding(const vector<unsigned char> &vchSig, unsigned int fl
     return true;
 }
 
-bool static CheckPubKeyEncoding(const valtype &vchPubKey, unsigned int flags, const SigVersion &sigversion, ScriptError* serror) {
+bool CheckSignatureEncoding(const vector<unsigned char> &vchSig, unsigned int flags, ScriptError* serror) {
+    return CheckSignatureEncoding<valtype>(vchSig, flags, serror);
+}
+
+template <typename T>
+bool static CheckPubKeyEncoding(const T &vchPubKey, unsigned int flags, const SigVersion &sigversion, ScriptError* serror) {
     if ((flags & SCRIPT_VERIFY_STRICTENC) != 0 && !IsCompressedOrUncompressedPubKey(vchPubKey)) {
         return set_error(serror, SCRIPT_ERR_PUBKEYTYPE);
     }
@@ -224,7 +412,8 @@ bool static CheckPubKeyEncoding(const valtype &vchPubKey, unsigned int flags, co
     return true;
 }
 
-bool static CheckMinimalPush(const valtype& data, opcodetype opcode) {
+template <typename T>
+bool static CheckMinimalPush(const T& data, opcodetype opcode) {
     if (data.size() == 0) {
         // Could have used OP_0.
         return opcode == OP_0;
@@ -247,23 +436,23 @@ bool static CheckMinimalPush(const valtype& data, opcodetype opcode) {
     return true;
 }
 
-bool EvalScript(vector<vector<unsigned char> >& stack, const CScript& script, unsigned int flags, const BaseSignatureChecker& checker, SigVersion sigversion, ScriptError* serror)
+static bool EvalScript(stacktype& stack, const CScript& script, unsigned int flags, const BaseSignatureChecker& checker, SigVersion sigversion, ScriptError* serror)
 {
     static const CScriptNum bnZero(0);
     static const CScriptNum bnOne(1);
     static const CScriptNum bnFalse(0);
     static const CScriptNum bnTrue(1);
-    static const valtype vchFalse(0);
-    static const valtype vchZero(0);
-    static const valtype vchTrue(1, 1);
+    static const stackvaltype vchFalse;
+    static const stackvaltype vchZero;
+    static const stackvaltype vchTrue(1U, (unsigned char)1);
 
     CScript::const_iterator pc = script.begin();
     CScript::const_iterator pend = script.end();
     CScript::const_iterator pbegincodehash = script.begin();
     opcodetype opcode;
-    valtype vchPushValue;
-    vector<bool> vfExec;
-    vector<valtype> altstack;
+    PushData vchPushValue;
+    prevector<16, bool, uint32_t, int32_t, ScriptArenaStorage> vfExec;
+    stacktype altstack;
     set_error(serror, SCRIPT_ERR_UNKNOWN_ERROR);
     if (script.size() > MAX_SCRIPT_SIZE)
         return set_error(serror, SCRIPT_ERR_SCRIPT_SIZE);
@@ -279,7 +468,7 @@ bool EvalScript(vector<vector<unsigned char> >& stack, const CScript& script, un
             //
             // Read instruction
             //
-            if (!script.GetOp(pc, opcode, vchPushValue))
+            if (!GetScriptOp(script, pc, opcode, vchPushValue))
                 return set_error(serror, SCRIPT_ERR_BAD_OPCODE);
             if (vchPushValue.size() > MAX_SCRIPT_ELEMENT_SIZE)
                 return set_error(serror, SCRIPT_ERR_PUSH_SIZE);
@@ -309,7 +498,7 @@ bool EvalScript(vector<vector<unsigned char> >& stack, const CScript& script, un
                 if (fRequireMinimal && !CheckMinimalPush(vchPushValue, opcode)) {
                     return set_error(serror, SCRIPT_ERR_MINIMALDATA);
                 }
-                stack.push_back(vchPushValue);
+                stack.push_back(stackvaltype(vchPushValue.pbegin, vchPushValue.pend));
             } else if (fExec || (OP_IF <= opcode && opcode <= OP_ENDIF))
             switch (opcode)
             {
@@ -336,7 +525,7 @@ bool EvalScript(vector<vector<unsigned char> >& stack, const CScript& script, un
                 {
                     // ( -- value)
                     CScriptNum bn((int)opcode - (int)(OP_1 - 1));
-                    stack.push_back(bn.getvch());
+                    pushnum(stack, bn);
                     // The result of these opcodes should always be the minimal way to push the data
                     // they push, so no need for a CheckMinimalPush here.
                 }
@@ -445,7 +634,7 @@ bool EvalScript(vector<vector<unsigned char> >& stack, const CScript& script, un
                     {
                         if (stack.size() < 1)
                             return set_error(serror, SCRIPT_ERR_UNBALANCED_CONDITIONAL);
-                        valtype& vch = stacktop(-1);
+                        stackvaltype& vch = stacktop(-1);
                         if (flags & SCRIPT_VERIFY_MINIMALIF) {
                             if (vch.size() > 1)
                                 return set_error(serror, SCRIPT_ERR_MINIMALIF);
@@ -534,8 +723,8 @@ bool EvalScript(vector<vector<unsigned char> >& stack, const CScript& script, un
                     // (x1 x2 -- x1 x2 x1 x2)
                     if (stack.size() < 2)
                         return set_error(serror, SCRIPT_ERR_INVALID_STACK_OPERATION);
-                    valtype vch1 = stacktop(-2);
-                    valtype vch2 = stacktop(-1);
+                    stackvaltype vch1 = stacktop(-2);
+                    stackvaltype vch2 = stacktop(-1);
                     stack.push_back(vch1);
                     stack.push_back(vch2);
                 }
@@ -546,9 +735,9 @@ bool EvalScript(vector<vector<unsigned char> >& stack, const CScript& script, un
                     // (x1 x2 x3 -- x1 x2 x3 x1 x2 x3)
                     if (stack.size() < 3)
                         return set_error(serror, SCRIPT_ERR_INVALID_STACK_OPERATION);
-                    valtype vch1 = stacktop(-3);
-                    valtype vch2 = stacktop(-2);
-                    valtype vch3 = stacktop(-1);
+                    stackvaltype vch1 = stacktop(-3);
+                    stackvaltype vch2 = stacktop(-2);
+                    stackvaltype vch3 = stacktop(-1);
                     stack.push_back(vch1);
                     stack.push_back(vch2);
                     stack.push_back(vch3);
@@ -560,8 +749,8 @@ bool EvalScript(vector<vector<unsigned char> >& stack, const CScript& script, un
                     // (x1 x2 x3 x4 -- x1 x2 x3 x4 x1 x2)
                     if (stack.size() < 4)
                         return set_error(serror, SCRIPT_ERR_INVALID_STACK_OPERATION);
-                    valtype vch1 = stacktop(-4);
-                    valtype vch2 = stacktop(-3);
+                    stackvaltype vch1 = stacktop(-4);
+                    stackvaltype vch2 = stacktop(-3);
                     stack.push_back(vch1);
                     stack.push_back(vch2);
                 }
@@ -572,8 +761,8 @@ bool EvalScript(vector<vector<unsigned char> >& stack, const CScript& script, un
                     // (x1 x2 x3 x4 x5 x6 -- x3 x4 x5 x6 x1 x2)
                     if (stack.size() < 6)
                         return set_error(serror, SCRIPT_ERR_INVALID_STACK_OPERATION);
-                    valtype vch1 = stacktop(-6);
-                    valtype vch2 = stacktop(-5);
+                    stackvaltype vch1 = stacktop(-6);
+                    stackvaltype vch2 = stacktop(-5);
                     stack.erase(stack.end()-6, stack.end()-4);
                     stack.push_back(vch1);
                     stack.push_back(vch2);
@@ -595,7 +784,7 @@ bool EvalScript(vector<vector<unsigned char> >& stack, const CScript& script, un
                     // (x - 0 | x x)
                     if (stack.size() < 1)
                         return set_error(serror, SCRIPT_ERR_INVALID_STACK_OPERATION);
-                    valtype vch = stacktop(-1);
+                    stackvaltype vch = stacktop(-1);
                     if (CastToBool(vch))
                         stack.push_back(vch);
                 }
@@ -605,7 +794,7 @@ bool EvalScript(vector<vector<unsigned char> >& stack, const CScript& script, un
                 {
                     // -- stacksize
                     CScriptNum bn(stack.size());
-                    stack.push_back(bn.getvch());
+                    pushnum(stack, bn);
                 }
                 break;
 
@@ -623,7 +812,7 @@ bool EvalScript(vector<vector<unsigned char> >& stack, const CScript& script, un
                     // (x -- x x)
                     if (stack.size() < 1)
                         return set_error(serror, SCRIPT_ERR_INVALID_STACK_OPERATION);
-                    valtype vch = stacktop(-1);
+                    stackvaltype vch = stacktop(-1);
                     stack.push_back(vch);
                 }
                 break;
@@ -642,7 +831,7 @@ bool EvalScript(vector<vector<unsigned char> >& stack, const CScript& script, un
                     // (x1 x2 -- x1 x2 x1)
                     if (stack.size() < 2)
                         return set_error(serror, SCRIPT_ERR_INVALID_STACK_OPERATION);
-                    valtype vch = stacktop(-2);
+                    stackvaltype vch = stacktop(-2);
                     stack.push_back(vch);
                 }
                 break;
@@ -658,7 +847,7 @@ bool EvalScript(vector<vector<unsigned char> >& stack, const CScript& script, un
                     popstack(stack);
                     if (n < 0 || n >= (int)stack.size())
                         return set_error(serror, SCRIPT_ERR_INVALID_STACK_OPERATION);
-                    valtype vch = stacktop(-n-1);
+                    stackvaltype vch = stacktop(-n-1);
                     if (opcode == OP_ROLL)
                         stack.erase(stack.end()-n-1);
                     stack.push_back(vch);
@@ -691,7 +880,7 @@ bool EvalScript(vector<vector<unsigned char> >& stack, const CScript& script, un
                     // (x1 x2 -- x2 x1 x2)
                     if (stack.size() < 2)
                         return set_error(serror, SCRIPT_ERR_INVALID_STACK_OPERATION);
-                    valtype vch = stacktop(-1);
+                    stackvaltype vch = stacktop(-1);
                     stack.insert(stack.end()-2, vch);
                 }
                 break;
@@ -703,7 +892,7 @@ bool EvalScript(vector<vector<unsigned char> >& stack, const CScript& script, un
                     if (stack.size() < 1)
                         return set_error(serror, SCRIPT_ERR_INVALID_STACK_OPERATION);
                     CScriptNum bn(stacktop(-1).size());
-                    stack.push_back(bn.getvch());
+                    pushnum(stack, bn);
                 }
                 break;
 
@@ -718,8 +907,8 @@ bool EvalScript(vector<vector<unsigned char> >& stack, const CScript& script, un
                     // (x1 x2 - bool)
                     if (stack.size() < 2)
                         return set_error(serror, SCRIPT_ERR_INVALID_STACK_OPERATION);
-                    valtype& vch1 = stacktop(-2);
-                    valtype& vch2 = stacktop(-1);
+                    stackvaltype& vch1 = stacktop(-2);
+                    stackvaltype& vch2 = stacktop(-1);
                     bool fEqual = (vch1 == vch2);
                     // OP_NOTEQUAL is disabled because it would be too easy to say
                     // something like n != 1 and have some wiseguy pass in 1 with extra
@@ -765,7 +954,7 @@ bool EvalScript(vector<vector<unsigned char> >& stack, const CScript& script, un
                     default:            assert(!"invalid opcode"); break;
                     }
                     popstack(stack);
-                    stack.push_back(bn.getvch());
+                    pushnum(stack, bn);
                 }
                 break;
 
@@ -814,7 +1003,7 @@ bool EvalScript(vector<vector<unsigned char> >& stack, const CScript& script, un
                     }
                     popstack(stack);
                     popstack(stack);
-                    stack.push_back(bn.getvch());
+                    pushnum(stack, bn);
 
                     if (opcode == OP_NUMEQUALVERIFY)
                     {
@@ -855,8 +1044,9 @@ bool EvalScript(vector<vector<unsigned char> >& stack, const CScript& script, un
                     // (in -- hash)
                     if (stack.size() < 1)
                         return set_error(serror, SCRIPT_ERR_INVALID_STACK_OPERATION);
-                    valtype& vch = stacktop(-1);
-                    valtype vchHash((opcode == OP_RIPEMD160 || opcode == OP_SHA1 || opcode == OP_HASH160) ? 20 : 32);
+                    stackvaltype& vch = stacktop(-1);
+                    stackvaltype vchHash;
+                    vchHash.resize((opcode == OP_RIPEMD160 || opcode == OP_SHA1 || opcode == OP_HASH160) ? 20 : 32);
                     if (opcode == OP_RIPEMD160)
                         CRIPEMD160().Write(vch.data(), vch.size()).Finalize(vchHash.data());
                     else if (opcode == OP_SHA1)
@@ -886,22 +1076,18 @@ bool EvalScript(vector<vector<unsigned char> >& stack, const CScript& script, un
                     if (stack.size() < 2)
                         return set_error(serror, SCRIPT_ERR_INVALID_STACK_OPERATION);
 
-                    valtype& vchSig    = stacktop(-2);
-                    valtype& vchPubKey = stacktop(-1);
+                    stackvaltype& vchSig    = stacktop(-2);
+                    stackvaltype& vchPubKey = stacktop(-1);
 
                     // Subset of script starting at the most recent codeseparator
-                    CScript scriptCode(pbegincodehash, pend);
-
-                    // Drop the signature in pre-segwit scripts but not segwit scripts
-                    if (sigversion == SIGVERSION_BASE) {
-                        scriptCode.FindAndDelete(CScript(vchSig));
-                    }
+                    CScript scriptCodeCopy;
+                    const CScript& scriptCode = GetScriptCode(script, pbegincodehash, &vchSig, &vchSig + 1, sigversion, scriptCodeCopy);
 
                     if (!CheckSignatureEncoding(vchSig, flags, serror) || !CheckPubKeyEncoding(vchPubKey, flags, sigversion, serror)) {
                         //serror is set
                         return false;
                     }
-                    bool fSuccess = checker.CheckSig(vchSig, vchPubKey, scriptCode, sigversion);
+                    bool fSuccess = checker.CheckSig(vchSig.data(), vchSig.size(), vchPubKey.data(), vchPubKey.size(), scriptCode, sigversion);
 
                     if (!fSuccess && (flags & SCRIPT_VERIFY_NULLFAIL) && vchSig.size())
                         return set_error(serror, SCRIPT_ERR_SIG_NULLFAIL);
@@ -951,22 +1137,15 @@ bool EvalScript(vector<vector<unsigned char> >& stack, const CScript& script, un
                         return set_error(serror, SCRIPT_ERR_INVALID_STACK_OPERATION);
 
                     // Subset of script starting at the most recent codeseparator
-                    CScript scriptCode(pbegincodehash, pend);
-
-                    // Drop the signature in pre-segwit scripts but not segwit scripts
-                    for (int k = 0; k < nSigsCount; k++)
-                    {
-                        valtype& vchSig = stacktop(-isig-k);
-                        if (sigversion == SIGVERSION_BASE) {
-                            scriptCode.FindAndDelete(CScript(vchSig));
-                        }
-                    }
+                    CScript scriptCodeCopy;
+                    const stackvaltype* pendsigs = stack.data() + stack.size() - isig + 1;
+                    const CScript& scriptCode = GetScriptCode(script, pbegincodehash, pendsigs - nSigsCount, pendsigs, sigversion, scriptCodeCopy);
 
                     bool fSuccess = true;
                     while (fSuccess && nSigsCount > 0)
                     {
-                        valtype& vchSig    = stacktop(-isig);
-                        valtype& vchPubKey = stacktop(-ikey);
+                        stackvaltype& vchSig    = stacktop(-isig);
+                        stackvaltype& vchPubKey = stacktop(-ikey);
 
                         // Note how this makes the exact order of pubkey/signature evaluation
                         // distinguishable by CHECKMULTISIG NOT if the STRICTENC flag is set.
@@ -977,7 +1156,9 @@ bool EvalScript(vector<vector<unsigned char> >& stack, const CScript& script, un
                         }
 
                         // Check signature
-                        bool fOk = checker.CheckSig(vchSig, vchPubKey, scriptCode, sigversion);
+                        // Once as many keys as signatures are left, each signature must match its key
+                        bool fOk = nSigsCount < nKeysCount ? checker.CheckSigCandidate(vchSig.data(), vchSig.size(), vchPubKey.data(), vchPubKey.size(), scriptCode, sigversion)
+                                                           : checker.CheckSig(vchSig.data(), vchSig.size(), vchPubKey.data(), vchPubKey.size(), scriptCode, sigversion);
 
                         if (fOk) {
                             isig++;
@@ -1047,6 +1228,19 @@ bool EvalScript(vector<vector<unsigned char> >& stack, const CScript& script, un
     return set_success(serror);
 }
 
+bool EvalScript(vector<vector<unsigned char> >& stack, const CScript& script, unsigned int flags, const BaseSignatureChecker& checker, SigVersion sigversion, ScriptError* serror)
+{
+    ScriptArenaScope arena;
+    stacktype stackEval;
+    for (const valtype& vch : stack)
+        stackEval.push_back(stackvaltype(vch.begin(), vch.end()));
+    bool fSuccess = EvalScript(stackEval, script, flags, checker, sigversion, serror);
+    stack.clear();
+    for (const stackvaltype& vch : stackEval)
+        stack.push_back(valtype(vch.begin(), vch.end()));
+    return fSuccess;
+}
+
 namespace {
 
 /**
@@ -1168,13 +1362,45 @@ uint256 GetOutputsHash(const CTransaction& txTo) {
     return ss.GetHash();
 }
 
+/** Size of an input in PrecomputedTransactionData::vBlankedInputs */
+const size_t BLANKED_INPUT_SIZE = 32 + 4 + 1 + 4;
+
+/** Offset of nSequence in a blanked input */
+const size_t BLANKED_INPUT_SEQUENCE = 32 + 4 + 1;
+
 } // anon namespace
 
 PrecomputedTransactionData::PrecomputedTransactionData(const CTransaction& txTo)
 {
-    hashPrevouts = GetPrevoutHash(txTo);
-    hashSequence = GetSequenceHash(txTo);
-    hashOutputs = GetOutputsHash(txTo);
+    // Serialize the inputs and outputs once, and hash all the inputs once,
+    // keeping the hasher state before each of them
+    vBlankedInputs.reserve(txTo.vin.size() * BLANKED_INPUT_SIZE);
+    CVectorWriter inputs(SER_GETHASH, 0, vBlankedInputs, 0);
+    for (const CTxIn& txin : txTo.vin) {
+        inputs << txin.prevout << CScriptBase() << txin.nSequence;
+    }
+    CVectorWriter outputs(SER_GETHASH, 0, vOutputs, 0);
+    for (const CTxOut& txout : txTo.vout) {
+        outputs << txout;
+    }
+
+    CHashWriter ss(SER_GETHASH, 0);
+    ss << txTo.nVersion;
+    WriteCompactSize(ss, txTo.vin.size());
+    vMidstates.reserve(txTo.vin.size());
+    for (size_t n = 0; n < txTo.vin.size(); n++) {
+        vMidstates.push_back(ss);
+        ss.write((const char*)&vBlankedInputs[n * BLANKED_INPUT_SIZE], BLANKED_INPUT_SIZE);
+    }
+
+    CHashWriter ssPrevouts(SER_GETHASH, 0), ssSequence(SER_GETHASH, 0);
+    for (size_t n = 0; n < txTo.vin.size(); n++) {
+        ssPrevouts.write((const char*)&vBlankedInputs[n * BLANKED_INPUT_SIZE], 32 + 4);
+        ssSequence.write((const char*)&vBlankedInputs[n * BLANKED_INPUT_SIZE + BLANKED_INPUT_SEQUENCE], 4);
+    }
+    hashPrevouts = ssPrevouts.GetHash();
+    hashSequence = ssSequence.GetHash();
+    hashOutputs = Hash(vOutputs.begin(), vOutputs.end());
 }
 
 uint256 SignatureHash(const CScript& scriptCode, const CTransaction& txTo, unsigned int nIn, int nHashType, const CAmount& amount, SigVersion sigversion, const PrecomputedTransactionData* cache)
@@ -1241,33 +1467,70 @@ uint256 SignatureHash(const CScript& scriptCode, const CTransaction& txTo, unsig
     // Wrapper to serialize only the necessary parts of the transaction being signed
     CTransactionSignatureSerializer txTmp(txTo, scriptCode, nIn, nHashType);
 
+    // With SIGHASH_ALL, resume from the state after the preceding inputs and
+    // append the serialized remainder of the transaction
+    if (cache && !(nHashType & SIGHASH_ANYONECANPAY) && (nHashType & 0x1f) != SIGHASH_SINGLE && (nHashType & 0x1f) != SIGHASH_NONE) {
+        assert(cache->vMidstates.size() == txTo.vin.size());
+        CHashWriter ss(cache->vMidstates[nIn]);
+        ss << txTo.vin[nIn].prevout;
+        txTmp.SerializeScriptCode(ss);
+        ss << txTo.vin[nIn].nSequence;
+        const size_t nOffset = (nIn + 1) * BLANKED_INPUT_SIZE;
+        if (nOffset < cache->vBlankedInputs.size())
+            ss.write((const char*)&cache->vBlankedInputs[nOffset], cache->vBlankedInputs.size() - nOffset);
+        WriteCompactSize(ss, txTo.vout.size());
+        if (!cache->vOutputs.empty())
+            ss.write((const char*)cache->vOutputs.data(), cache->vOutputs.size());
+        ss << txTo.nLockTime << nHashType;
+        return ss.GetHash();
+    }
+
     // Serialize and hash
     CHashWriter ss(SER_GETHASH, 0);
     ss << txTmp << nHashType;
     return ss.GetHash();
 }
 
-bool TransactionSignatureChecker::VerifySignature(const std::vector<unsigned char>& vchSig, const CPubKey& pubkey, const uint256& sighash) const
+bool TransactionSignatureChecker::VerifySignature(const unsigned char* pchSig, size_t nSigLen, const CPubKey& pubkey, const uint256& sighash) const
 {
-    return pubkey.Verify(sighash, vchSig);
+    return pubkey.Verify(sighash, pchSig, nSigLen);
 }
 
 bool TransactionSignatureChecker::CheckSig(const vector<unsigned char>& vchSigIn, const vector<unsigned char>& vchPubKey, const CScript& scriptCode, SigVersion sigversion) const
 {
-    CPubKey pubkey(vchPubKey);
+    return CheckSig(vchSigIn.data(), vchSigIn.size(), vchPubKey.data(), vchPubKey.size(), scriptCode, sigversion, false);
+}
+
+bool TransactionSignatureChecker::CheckSigCandidate(const vector<unsigned char>& vchSigIn, const vector<unsigned char>& vchPubKey, const CScript& scriptCode, SigVersion sigversion) const
+{
+    return CheckSig(vchSigIn.data(), vchSigIn.size(), vchPubKey.data(), vchPubKey.size(), scriptCode, sigversion, true);
+}
+
+bool TransactionSignatureChecker::CheckSig(const unsigned char* pchSig, size_t nSigLen, const unsigned char* pchPubKey, size_t nPubKeyLen, const CScript& scriptCode, SigVersion sigversion) const
+{
+    return CheckSig(pchSig, nSigLen, pchPubKey, nPubKeyLen, scriptCode, sigversion, false);
+}
+
+bool TransactionSignatureChecker::CheckSigCandidate(const unsigned char* pchSig, size_t nSigLen, const unsigned char* pchPubKey, size_t nPubKeyLen, const CScript& scriptCode, SigVersion sigversion) const
+{
+    return CheckSig(pchSig, nSigLen, pchPubKey, nPubKeyLen, scriptCode, sigversion, true);
+}
+
+bool TransactionSignatureChecker::CheckSig(const unsigned char* pchSig, size_t nSigLen, const unsigned char* pchPubKey, size_t nPubKeyLen, const CScript& scriptCode, SigVersion sigversion, bool fCandidate) const
+{
+    CPubKey pubkey(pchPubKey, pchPubKey + nPubKeyLen);
     if (!pubkey.IsValid())
         return false;
 
     // Hash type is one byte tacked on to the end of the signature
-    vector<unsigned char> vchSig(vchSigIn);
-    if (vchSig.empty())
+    if (nSigLen == 0)
         return false;
-    int nHashType = vchSig.back();
-    vchSig.pop_back();
+    int nHashType = pchSig[nSigLen - 1];
+    nSigLen--;
 
     uint256 sighash = SignatureHash(scriptCode, *txTo, nIn, nHashType, amount, sigversion, this->txdata);
 
-    if (!VerifySignature(vchSig, pubkey, sighash))
+    if (!(fCandidate ? VerifyCandidateSignature(pchSig, nSigLen, pubkey, sighash) : VerifySignature(pchSig, nSigLen, pubkey, sighash)))
         return false;
 
     return true;
@@ -1355,16 +1618,173 @@ bool TransactionSignatureChecker::CheckSequence(const CScriptNum& nSequence) con
     return true;
 }
 
+namespace {
+
+/** Most pushes in the scriptSig of a standard spend: the dummy, 16 signatures and the redeem script */
+static const int MAX_STANDARD_PUSHES = 18;
+
+/**
+ * Parse a script consisting of data pushes only (not OP_1NEGATE or OP_1 to
+ * OP_16), as EvalScript would push them. Returns false if there are more
+ * than nMax or EvalScript would fail on them.
+ */
+bool GetPushes(const CScript& script, unsigned int flags, PushData* pushes, int nMax, int& nPushes)
+{
+    if (script.size() > MAX_SCRIPT_SIZE)
+        return false;
+    nPushes = 0;
+    CScript::const_iterator pc = script.begin();
+    while (pc < script.end()) {
+        if (nPushes == nMax)
+            return false;
+        PushData& push = pushes[nPushes++];
+        if (!GetScriptOp(script, pc, push.opcode, push) || push.opcode > OP_PUSHDATA4)
+            return false;
+        if (push.size() > MAX_SCRIPT_ELEMENT_SIZE)
+            return false;
+        if ((flags & SCRIPT_VERIFY_MINIMALDATA) && !CheckMinimalPush(push, push.opcode))
+            return false;
+    }
+    return true;
+}
+
+bool MatchHash160(const PushData& data, const unsigned char* phash)
+{
+    unsigned char hash[20];
+    CHash160().Write(data.pbegin, data.size()).Finalize(hash);
+    return std::equal(hash, hash + 20, phash);
+}
+
+/**
+ * OP_DUP OP_HASH160 <pubkey hash> OP_EQUALVERIFY OP_CHECKSIG, spent by
+ * <sig> <pubkey>
+ */
+bool VerifyPayToPubKeyHash(const CScript& scriptSig, const CScript& scriptPubKey, unsigned int flags, const BaseSignatureChecker& checker)
+{
+    PushData pushes[2];
+    int nPushes;
+    if (!GetPushes(scriptSig, flags, pushes, 2, nPushes) || nPushes != 2)
+        return false;
+    if (!MatchHash160(pushes[1], scriptPubKey.data() + 3))
+        return false;
+
+    const PushData& sig = pushes[0];
+    const PushData& pubkey = pushes[1];
+    if (!CheckSignatureEncoding(sig, flags, NULL) || !CheckPubKeyEncoding(pubkey, flags, SIGVERSION_BASE, NULL))
+        return false;
+    // The signature is only dropped from the script code if it is the
+    // push of 20 bytes there: no other push starts at an opcode boundary.
+    if (sig.size() == 20) {
+        CScript scriptCode(scriptPubKey);
+        scriptCode.FindAndDelete(CScript(sig.vch()));
+        return checker.CheckSig(sig.data(), sig.size(), pubkey.data(), pubkey.size(), scriptCode, SIGVERSION_BASE);
+    }
+    return checker.CheckSig(sig.data(), sig.size(), pubkey.data(), pubkey.size(), scriptPubKey, SIGVERSION_BASE);
+}
+
+/**
+ * OP_HASH160 <script hash> OP_EQUAL, spent by OP_0 <sig>... <redeem script>
+ * with the redeem script OP_m <pubkey>... OP_n OP_CHECKMULTISIG
+ */
+bool VerifyPayToScriptHashMultisig(const CScript& scriptSig, const CScript& scriptPubKey, unsigned int flags, const BaseSignatureChecker& checker)
+{
+    if (!(flags & SCRIPT_VERIFY_P2SH))
+        return false;
+    PushData pushes[MAX_STANDARD_PUSHES];
+    int nPushes;
+    if (!GetPushes(scriptSig, flags, pushes, MAX_STANDARD_PUSHES, nPushes) || nPushes < 3)
+        return false;
+    if (!MatchHash160(pushes[nPushes - 1], scriptPubKey.data() + 2))
+        return false;
+
+    const CScript redeemScript(pushes[nPushes - 1].pbegin, pushes[nPushes - 1].pend);
+    CScript::const_iterator pc = redeemScript.begin();
+    opcodetype opcode;
+    if (!redeemScript.GetOp(pc, opcode) || opcode < OP_1 || opcode > OP_16)
+        return false;
+    const int nRequired = CScript::DecodeOP_N(opcode);
+    PushData keys[16];
+    int nKeys = 0;
+    while (true) {
+        PushData key;
+        if (!GetScriptOp(redeemScript, pc, opcode, key))
+            return false;
+        if (opcode == OP_0 || opcode >= OP_PUSHDATA1 || nKeys == 16)
+            break;
+        keys[nKeys] = key;
+        if ((flags & SCRIPT_VERIFY_MINIMALDATA) && !CheckMinimalPush(keys[nKeys], opcode))
+            return false;
+        nKeys++;
+    }
+    if (nKeys < nRequired || opcode != CScript::EncodeOP_N(nKeys))
+        return false;
+    if (!redeemScript.GetOp(pc, opcode) || opcode != OP_CHECKMULTISIG || pc != redeemScript.end())
+        return false;
+
+    // The dummy, the signatures and whatever lies below them, which only
+    // CLEANSTACK forbids
+    const int nSigsBegin = nPushes - 1 - nRequired;
+    if (nSigsBegin < 1)
+        return false;
+    if ((flags & SCRIPT_VERIFY_CLEANSTACK) && nSigsBegin != 1)
+        return false;
+    if ((flags & SCRIPT_VERIFY_NULLDUMMY) && pushes[nSigsBegin - 1].size() != 0)
+        return false;
+
+    CScript scriptCode(redeemScript);
+    for (int k = nRequired - 1; k >= 0; k--)
+        scriptCode.FindAndDelete(CScript(pushes[nSigsBegin + k].vch()));
+
+    // Match the signatures to the keys from the last ones down, as
+    // OP_CHECKMULTISIG does
+    int isig = nRequired - 1;
+    int ikey = nKeys - 1;
+    while (isig >= 0) {
+        if (isig > ikey)
+            return false;
+        const PushData& sig = pushes[nSigsBegin + isig];
+        const PushData& pubkey = keys[ikey];
+        if (!CheckSignatureEncoding(sig, flags, NULL) || !CheckPubKeyEncoding(pubkey, flags, SIGVERSION_BASE, NULL))
+            return false;
+        if (isig < ikey ? checker.CheckSigCandidate(sig.data(), sig.size(), pubkey.data(), pubkey.size(), scriptCode, SIGVERSION_BASE)
+                        : checker.CheckSig(sig.data(), sig.size(), pubkey.data(), pubkey.size(), scriptCode, SIGVERSION_BASE))
+            isig--;
+        ikey--;
+    }
+    return true;
+}
+
+} // anon namespace
+
+bool VerifyStandardScript(const CScript& scriptSig, const CScript& scriptPubKey, unsigned int flags, const BaseSignatureChecker& checker)
+{
+    const CScript::const_iterator pk = scriptPubKey.begin();
+    if (scriptPubKey.size() == 25 && pk[0] == OP_DUP && pk[1] == OP_HASH160 && pk[2] == 20 && pk[23] == OP_EQUALVERIFY && pk[24] == OP_CHECKSIG)
+        return VerifyPayToPubKeyHash(scriptSig, scriptPubKey, flags, checker);
+    if (scriptPubKey.IsPayToScriptHash())
+        return VerifyPayToScriptHashMultisig(scriptSig, scriptPubKey, flags, checker);
+    return false;
+}
+
 bool VerifyScript(const CScript &scriptSig, const CScript &scriptPubKey,
                   unsigned int flags, const BaseSignatureChecker &checker,
                   ScriptError *serror) {
+    if (VerifyStandardScript(scriptSig, scriptPubKey, flags, checker))
+        return set_success(serror);
+    return VerifyScriptGeneric(scriptSig, scriptPubKey, flags, checker, serror);
+}
+
+bool VerifyScriptGeneric(const CScript &scriptSig, const CScript &scriptPubKey,
+                         unsigned int flags, const BaseSignatureChecker &checker,
+                         ScriptError *serror) {
     set_error(serror, SCRIPT_ERR_UNKNOWN_ERROR);
 
     if ((flags & SCRIPT_VERIFY_SIGPUSHONLY) != 0 && !scriptSig.IsPushOnly()) {
         return set_error(serror, SCRIPT_ERR_SIG_PUSHONLY);
     }
 
-    vector<vector<unsigned char> > stack, stackCopy;
+    ScriptArenaScope arena;
+    stacktype stack, stackCopy;
     if (!EvalScript(stack, scriptSig, flags, checker, SIGVERSION_BASE, serror))
         // serror is set
         return false;
@@ -1386,15 +1806,15 @@ bool VerifyScript(const CScript &scriptSig, const CScript &scriptPubKey,
             return set_error(serror, SCRIPT_ERR_SIG_PUSHONLY);
 
         // Restore stack.
-        swap(stack, stackCopy);
+        stack.swap(stackCopy);
 
         // stack cannot be empty here, because if it was the
         // P2SH  HASH <> EQUAL  scriptPubKey would be evaluated with
         // an empty stack and the EvalScript above would return false.
         assert(!stack.empty());
 
-        const valtype& pubKeySerialized = stack.back();
-        CScript pubKey2(pubKeySerialized.begin(), pubKeySerialized.end());
+        const stackvaltype& pubKeySerialized = stack.back();
+        CScript pubKey2(pubKeySerialized.data(), pubKeySerialized.data() + pubKeySerialized.size());
         popstack(stack);
 
         if (!EvalScript(stack, pubKey2, flags, checker, SIGVERSION_BASE, serror))
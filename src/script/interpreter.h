@@ -6,6 +6,7 @@
 #ifndef BITCOIN_SCRIPT_INTERPRETER_H
 #define BITCOIN_SCRIPT_INTERPRETER_H
 
+#include "hash.h"
 #include "script_error.h"
 #include "primitives/transaction.h"
 
@@ -106,10 +107,21 @@ enum
 
 bool CheckSignatureEncoding(const std::vector<unsigned char> &vchSig, unsigned int flags, ScriptError* serror);
 
+/**
+ * Data about a transaction shared by the signature checks of all its inputs,
+ * so each of them needs not serialize and hash the whole transaction again.
+ */
 struct PrecomputedTransactionData
 {
     uint256 hashPrevouts, hashSequence, hashOutputs;
 
+    /** Serialized inputs as in SIGHASH_ALL signature hashes: prevout, empty script and nSequence */
+    std::vector<unsigned char> vBlankedInputs;
+    /** Serialized outputs */
+    std::vector<unsigned char> vOutputs;
+    /** SIGHASH_ALL signature hash states for each input, after all the preceding inputs */
+    std::vector<CHashWriter> vMidstates;
+
     PrecomputedTransactionData(const CTransaction& tx);
 };
 
@@ -129,6 +141,31 @@ public:
         return false;
     }
 
+    /**
+     * CheckSig for a CHECKMULTISIG signature tried against a key it need not
+     * belong to, while more keys than signatures are left: a mismatch does
+     * not fail the script, so the result has to be a real one.
+     */
+    virtual bool CheckSigCandidate(const std::vector<unsigned char>& scriptSig, const std::vector<unsigned char>& vchPubKey, const CScript& scriptCode, SigVersion sigversion) const
+    {
+        return CheckSig(scriptSig, vchPubKey, scriptCode, sigversion);
+    }
+
+    /**
+     * CheckSig and CheckSigCandidate on the signature and public key as
+     * ranges of memory, which the interpreter passes its stack elements as
+     * without copying them.
+     */
+    virtual bool CheckSig(const unsigned char* pchSig, size_t nSigLen, const unsigned char* pchPubKey, size_t nPubKeyLen, const CScript& scriptCode, SigVersion sigversion) const
+    {
+        return CheckSig(std::vector<unsigned char>(pchSig, pchSig + nSigLen), std::vector<unsigned char>(pchPubKey, pchPubKey + nPubKeyLen), scriptCode, sigversion);
+    }
+
+    virtual bool CheckSigCandidate(const unsigned char* pchSig, size_t nSigLen, const unsigned char* pchPubKey, size_t nPubKeyLen, const CScript& scriptCode, SigVersion sigversion) const
+    {
+        return CheckSigCandidate(std::vector<unsigned char>(pchSig, pchSig + nSigLen), std::vector<unsigned char>(pchPubKey, pchPubKey + nPubKeyLen), scriptCode, sigversion);
+    }
+
     virtual bool CheckLockTime(const CScriptNum& nLockTime) const
     {
          return false;
@@ -150,13 +187,24 @@ private:
     const CAmount amount;
     const PrecomputedTransactionData* txdata;
 
+    bool CheckSig(const unsigned char* pchSig, size_t nSigLen, const unsigned char* pchPubKey, size_t nPubKeyLen, const CScript& scriptCode, SigVersion sigversion, bool fCandidate) const;
+
 protected:
-    virtual bool VerifySignature(const std::vector<unsigned char>& vchSig, const CPubKey& vchPubKey, const uint256& sighash) const;
+    //! Verify the DER signature pchSig[0..nSigLen), without its hash type byte
+    virtual bool VerifySignature(const unsigned char* pchSig, size_t nSigLen, const CPubKey& vchPubKey, const uint256& sighash) const;
+    //! VerifySignature for CheckSigCandidate
+    virtual bool VerifyCandidateSignature(const unsigned char* pchSig, size_t nSigLen, const CPubKey& vchPubKey, const uint256& sighash) const
+    {
+        return VerifySignature(pchSig, nSigLen, vchPubKey, sighash);
+    }
 
 public:
     TransactionSignatureChecker(const CTransaction* txToIn, unsigned int nInIn, const CAmount& amountIn) : txTo(txToIn), nIn(nInIn), amount(amountIn), txdata(NULL) {}
     TransactionSignatureChecker(const CTransaction* txToIn, unsigned int nInIn, const CAmount& amountIn, const PrecomputedTransactionData& txdataIn) : txTo(txToIn), nIn(nInIn), amount(amountIn), txdata(&txdataIn) {}
     bool CheckSig(const std::vector<unsigned char>& scriptSig, const std::vector<unsigned char>& vchPubKey, const CScript& scriptCode, SigVersion sigversion) const;
+    bool CheckSigCandidate(const std::vector<unsigned char>& scriptSig, const std::vector<unsigned char>& vchPubKey, const CScript& scriptCode, SigVersion sigversion) const;
+    bool CheckSig(const unsigned char* pchSig, size_t nSigLen, const unsigned char* pchPubKey, size_t nPubKeyLen, const CScript& scriptCode, SigVersion sigversion) const;
+    bool CheckSigCandidate(const unsigned char* pchSig, size_t nSigLen, const unsigned char* pchPubKey, size_t nPubKeyLen, const CScript& scriptCode, SigVersion sigversion) const;
     bool CheckLockTime(const CScriptNum& nLockTime) const;
     bool CheckSequence(const CScriptNum& nSequence) const;
 };
@@ -173,4 +221,14 @@ public:
 bool EvalScript(std::vector<std::vector<unsigned char> >& stack, const CScript& script, unsigned int flags, const BaseSignatureChecker& checker, SigVersion sigversion, ScriptError* error = NULL);
 bool VerifyScript(const CScript& scriptSig, const CScript& scriptPubKey, unsigned int flags, const BaseSignatureChecker& checker, ScriptError* serror = NULL);
 
+/**
+ * Verify a pay-to-pubkey-hash or pay-to-script-hash multisig spend in the
+ * standard form directly, without running EvalScript on a stack. Returns
+ * true only if VerifyScript succeeds; false if the spend does not match a
+ * template or fails, which VerifyScript then evaluates generically.
+ */
+bool VerifyStandardScript(const CScript& scriptSig, const CScript& scriptPubKey, unsigned int flags, const BaseSignatureChecker& checker);
+/** VerifyScript without the templates of VerifyStandardScript */
+bool VerifyScriptGeneric(const CScript& scriptSig, const CScript& scriptPubKey, unsigned int flags, const BaseSignatureChecker& checker, ScriptError* serror = NULL);
+
 #endif // BITCOIN_SCRIPT_INTERPRETER_H
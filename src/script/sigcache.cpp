@@ -12,35 +12,22 @@
 #include "util.h"
 
 #include "cuckoocache.h"
+#include <atomic>
 #include <boost/thread.hpp>
 
 namespace {
 
-/**
- * We're hashing a nonce into the entries themselves, so we don't need extra
- * blinding in the set hash computation.
- *
- * This may exhibit platform endian dependent behavior but because these are
- * nonced hashes (random) and this state is only ever used locally it is safe.
- * All that matters is local consistency.
- */
-class SignatureCacheHasher
-{
-public:
-    template <uint8_t hash_select>
-    uint32_t operator()(const uint256& key) const
-    {
-        static_assert(hash_select <8, "SignatureCacheHasher only has 8 hashes available.");
-        uint32_t u;
-        std::memcpy(&u, key.begin()+4*hash_select, 4);
-        return u;
-    }
-};
+//! The signature cache is split in 2^SIGCACHE_SHARD_BITS independently locked shards
+static const int SIGCACHE_SHARD_BITS = 4;
+static const int SIGCACHE_SHARDS = 1 << SIGCACHE_SHARD_BITS;
 
 /**
  * Valid signature cache, to avoid doing expensive ECDSA signature checking
  * twice for every transaction (once when accepted into memory pool, and
  * again when accepted into the block chain)
+ *
+ * Split in shards with a lock each, so that the script check threads and
+ * mempool acceptance rarely wait for each other.
  */
 class CSignatureCache
 {
@@ -48,8 +35,28 @@ private:
      //! Entries are SHA256(nonce || signature hash || public key || signature):
     uint256 nonce;
     typedef CuckooCache::cache<uint256, SignatureCacheHasher> map_type;
-    map_type setValid;
-    boost::shared_mutex cs_sigcache;
+
+    struct Shard
+    {
+        map_type setValid;
+        boost::shared_mutex cs_sigcache;
+        std::atomic<uint64_t> nHits;
+        std::atomic<uint64_t> nMisses;
+        std::atomic<uint64_t> nInserts;
+
+        Shard() : nHits(0), nMisses(0), nInserts(0) {}
+    };
+    Shard shards[SIGCACHE_SHARDS];
+
+    Shard& GetShard(const uint256& entry)
+    {
+        // CuckooCache::compute_hashes masks the words SignatureCacheHasher
+        // reads with hash_mask, which leaves their top bits unused unless a
+        // shard holds 2^28 entries, so they are free to pick a shard with.
+        uint32_t u;
+        std::memcpy(&u, entry.begin(), 4);
+        return shards[u >> (32 - SIGCACHE_SHARD_BITS)];
+    }
 
 public:
     CSignatureCache()
@@ -58,26 +65,53 @@ public:
     }
 
     void
-    ComputeEntry(uint256& entry, const uint256 &hash, const std::vector<unsigned char>& vchSig, const CPubKey& pubkey)
+    ComputeEntry(uint256& entry, const uint256 &hash, const unsigned char* pchSig, size_t nSigLen, const CPubKey& pubkey)
     {
-        CSHA256().Write(nonce.begin(), 32).Write(hash.begin(), 32).Write(&pubkey[0], pubkey.size()).Write(&vchSig[0], vchSig.size()).Finalize(entry.begin());
+        CSHA256().Write(nonce.begin(), 32).Write(hash.begin(), 32).Write(&pubkey[0], pubkey.size()).Write(pchSig, nSigLen).Finalize(entry.begin());
     }
 
     bool
     Get(const uint256& entry, const bool erase)
     {
-        boost::shared_lock<boost::shared_mutex> lock(cs_sigcache);
-        return setValid.contains(entry, erase);
+        Shard& shard = GetShard(entry);
+        bool fFound;
+        {
+            boost::shared_lock<boost::shared_mutex> lock(shard.cs_sigcache);
+            fFound = shard.setValid.contains(entry, erase);
+        }
+        (fFound ? shard.nHits : shard.nMisses).fetch_add(1, std::memory_order_relaxed);
+        return fFound;
     }
 
     void Set(uint256& entry)
     {
-        boost::unique_lock<boost::shared_mutex> lock(cs_sigcache);
-        setValid.insert(entry);
+        Shard& shard = GetShard(entry);
+        boost::unique_lock<boost::shared_mutex> lock(shard.cs_sigcache);
+        shard.setValid.insert(entry);
+        shard.nInserts.fetch_add(1, std::memory_order_relaxed);
     }
-    uint32_t setup_bytes(size_t n)
+
+    size_t setup_bytes(size_t n)
     {
-        return setValid.setup_bytes(n);
+        size_t nElems = 0;
+        for (Shard& shard : shards)
+            nElems += shard.setValid.setup_bytes(n / SIGCACHE_SHARDS);
+        return nElems;
+    }
+
+    SignatureCacheStats GetStats()
+    {
+        SignatureCacheStats stats;
+        for (Shard& shard : shards) {
+            boost::shared_lock<boost::shared_mutex> lock(shard.cs_sigcache);
+            stats.nHits += shard.nHits;
+            stats.nMisses += shard.nMisses;
+            stats.nInserts += shard.nInserts;
+            stats.nEvictions += shard.setValid.evicted();
+            stats.nEntries += shard.setValid.count_live();
+            stats.nCapacity += shard.setValid.capacity();
+        }
+        return stats;
     }
 };
 
@@ -94,22 +128,68 @@ static CSignatureCache signatureCache;
 void InitSignatureCache()
 {
     // nMaxCacheSize is unsigned. If -maxsigcachesize is set to zero,
-    // setup_bytes creates the minimum possible cache (2 elements).
-    size_t nMaxCacheSize = std::min(std::max((int64_t)0, GetArg("-maxsigcachesize", DEFAULT_MAX_SIG_CACHE_SIZE)), MAX_MAX_SIG_CACHE_SIZE) * ((size_t) 1 << 20);
+    // setup_bytes creates the minimum possible cache (2 elements per shard).
+    // The signature and script execution caches share -maxsigcachesize.
+    size_t nMaxCacheSize = std::min(std::max((int64_t)0, GetArg("-maxsigcachesize", DEFAULT_MAX_SIG_CACHE_SIZE) / 2), MAX_MAX_SIG_CACHE_SIZE) * ((size_t) 1 << 20);
     size_t nElems = signatureCache.setup_bytes(nMaxCacheSize);
     LogPrintf("Using %zu MiB out of %zu requested for signature cache, able to store %zu elements\n",
             (nElems*sizeof(uint256)) >>20, nMaxCacheSize>>20, nElems);
 }
 
-bool CachingTransactionSignatureChecker::VerifySignature(const std::vector<unsigned char>& vchSig, const CPubKey& pubkey, const uint256& sighash) const
+SignatureCacheStats GetSignatureCacheStats()
+{
+    return signatureCache.GetStats();
+}
+
+bool CachingTransactionSignatureChecker::VerifySignature(const unsigned char* pchSig, size_t nSigLen, const CPubKey& pubkey, const uint256& sighash) const
+{
+    return VerifySignature(pchSig, nSigLen, pubkey, sighash, batch);
+}
+
+bool CachingTransactionSignatureChecker::VerifyCandidateSignature(const unsigned char* pchSig, size_t nSigLen, const CPubKey& pubkey, const uint256& sighash) const
+{
+    return VerifySignature(pchSig, nSigLen, pubkey, sighash, NULL);
+}
+
+bool CachingTransactionSignatureChecker::VerifySignature(const unsigned char* pchSig, size_t nSigLen, const CPubKey& pubkey, const uint256& sighash, CSignatureBatch* batchIn) const
 {
     uint256 entry;
-    signatureCache.ComputeEntry(entry, sighash, vchSig, pubkey);
+    signatureCache.ComputeEntry(entry, sighash, pchSig, nSigLen, pubkey);
     if (signatureCache.Get(entry, !store))
         return true;
-    if (!TransactionSignatureChecker::VerifySignature(vchSig, pubkey, sighash))
+    if (batchIn) {
+        batchIn->Add(CPubKeySignature(pubkey, sighash, std::vector<unsigned char>(pchSig, pchSig + nSigLen)), entry, store);
+        return true;
+    }
+    if (!TransactionSignatureChecker::VerifySignature(pchSig, nSigLen, pubkey, sighash))
         return false;
     if (store)
         signatureCache.Set(entry);
     return true;
 }
+
+void CSignatureBatch::Add(const CPubKeySignature& sig, const uint256& entry, bool store)
+{
+    vSigs.push_back(sig);
+    vEntries.push_back(entry);
+    vStore.push_back(store);
+}
+
+void CSignatureBatch::Truncate(size_t nSize)
+{
+    vSigs.erase(vSigs.begin() + nSize, vSigs.end());
+    vEntries.resize(nSize);
+    vStore.resize(nSize);
+}
+
+bool CSignatureBatch::Verify(size_t nBegin, size_t nEnd)
+{
+    if (nBegin == nEnd)
+        return true;
+    if (!CPubKey::VerifyBatch(&vSigs[nBegin], nEnd - nBegin))
+        return false;
+    for (size_t i = nBegin; i < nEnd; i++)
+        if (vStore[i])
+            signatureCache.Set(vEntries[i]);
+    return true;
+}
@@ -6,8 +6,10 @@
 #ifndef BITCOIN_SCRIPT_SIGCACHE_H
 #define BITCOIN_SCRIPT_SIGCACHE_H
 
+#include "pubkey.h"
 #include "script/interpreter.h"
 
+#include <cstring>
 #include <vector>
 
 // DoS prevention: limit cache size to 32MB (over 1000000 entries on 64-bit
@@ -17,19 +19,96 @@ static const unsigned int DEFAULT_MAX_SIG_CACHE_SIZE = 40;
 // Maximum sig cache size allowed
 static const int64_t MAX_MAX_SIG_CACHE_SIZE = 16384;
 
-class CPubKey;
+/**
+ * We're hashing a nonce into the entries themselves, so we don't need extra
+ * blinding in the set hash computation.
+ *
+ * This may exhibit platform endian dependent behavior but because these are
+ * nonced hashes (random) and this state is only ever used locally it is safe.
+ * All that matters is local consistency.
+ */
+class SignatureCacheHasher
+{
+public:
+    template <uint8_t hash_select>
+    uint32_t operator()(const uint256& key) const
+    {
+        static_assert(hash_select <8, "SignatureCacheHasher only has 8 hashes available.");
+        uint32_t u;
+        std::memcpy(&u, key.begin()+4*hash_select, 4);
+        return u;
+    }
+};
+
+/**
+ * Signatures deferred by CachingTransactionSignatureChecker, to be verified
+ * together with CPubKey::VerifyBatch. They only enter the signature cache
+ * once verified. Only signatures that must be valid for their script to
+ * succeed are deferred: a batch that fails has every script with a
+ * signature in it run again with its signatures checked one by one, so it
+ * costs about twice the serial verification.
+ */
+class CSignatureBatch
+{
+private:
+    std::vector<CPubKeySignature> vSigs;
+    //! Signature cache entries of vSigs, and whether to store them
+    std::vector<uint256> vEntries;
+    std::vector<bool> vStore;
+
+public:
+    void Add(const CPubKeySignature& sig, const uint256& entry, bool store);
+
+    size_t size() const { return vSigs.size(); }
+
+    //! Forget the signatures added after the first nSize
+    void Truncate(size_t nSize);
+
+    //! Verify the signatures nBegin to nEnd (exclusive) together, caching them if all are valid
+    bool Verify(size_t nBegin, size_t nEnd);
+    bool Verify() { return Verify(0, size()); }
+
+    void clear() { Truncate(0); }
+};
 
 class CachingTransactionSignatureChecker : public TransactionSignatureChecker
 {
 private:
     bool store;
+    CSignatureBatch* batch;
+
+    bool VerifySignature(const unsigned char* pchSig, size_t nSigLen, const CPubKey& vchPubKey, const uint256& sighash, CSignatureBatch* batchIn) const;
 
 public:
-    CachingTransactionSignatureChecker(const CTransaction* txToIn, unsigned int nInIn, const CAmount& amount, bool storeIn, PrecomputedTransactionData& txdataIn) : TransactionSignatureChecker(txToIn, nInIn, amount, txdataIn), store(storeIn) {}
+    /**
+     * With a batch, signatures missing from the cache are added to it and
+     * assumed valid: the script's result only holds once the batch verifies.
+     * CHECKMULTISIG signatures tried against keys they may not belong to are
+     * verified right away, or would fail the batch.
+     */
+    CachingTransactionSignatureChecker(const CTransaction* txToIn, unsigned int nInIn, const CAmount& amount, bool storeIn, PrecomputedTransactionData& txdataIn, CSignatureBatch* batchIn = NULL) : TransactionSignatureChecker(txToIn, nInIn, amount, txdataIn), store(storeIn), batch(batchIn) {}
 
-    bool VerifySignature(const std::vector<unsigned char>& vchSig, const CPubKey& vchPubKey, const uint256& sighash) const;
+    bool VerifySignature(const unsigned char* pchSig, size_t nSigLen, const CPubKey& vchPubKey, const uint256& sighash) const;
+    bool VerifyCandidateSignature(const unsigned char* pchSig, size_t nSigLen, const CPubKey& vchPubKey, const uint256& sighash) const;
 };
 
 void InitSignatureCache();
 
+struct SignatureCacheStats
+{
+    //! Lookups that found, and did not find, the signature
+    uint64_t nHits;
+    uint64_t nMisses;
+    uint64_t nInserts;
+    //! Valid signatures dropped for lack of room
+    uint64_t nEvictions;
+    //! Signatures kept, out of the number of slots
+    size_t nEntries;
+    size_t nCapacity;
+
+    SignatureCacheStats() : nHits(0), nMisses(0), nInserts(0), nEvictions(0), nEntries(0), nCapacity(0) {}
+};
+
+SignatureCacheStats GetSignatureCacheStats();
+
 #endif // BITCOIN_SCRIPT_SIGCACHE_H
@@ -0,0 +1,39 @@
+#ifndef _SECP256K1_BATCH_
+# define _SECP256K1_BATCH_
+
+# include "secp256k1.h"
+
+# ifdef __cplusplus
+extern "C" {
+# endif
+
+/** Verify several ECDSA signatures at once.
+ *
+ *  Returns: 1: all signatures are correct
+ *           0: at least one signature is incorrect or unparseable, without
+ *              telling which; use secp256k1_ecdsa_verify to find out
+ *  Args:    ctx:     a secp256k1 context object, initialized for verification.
+ *  In:      sigs:    array of n pointers to the signatures being verified
+ *           msg32s:  array of n pointers to the 32-byte messages signed
+ *           pubkeys: array of n pointers to the public keys to verify with
+ *           n:       the number of signatures (0 succeeds)
+ *
+ *  Each signature is held to the same rules as secp256k1_ecdsa_verify,
+ *  including the lower-S form. ECDSA signatures do not commit to the full R
+ *  point, so their curve multiplications cannot be combined; the saving comes
+ *  from computing the inverses of all the s values with a single modular
+ *  inversion.
+ */
+SECP256K1_API SECP256K1_WARN_UNUSED_RESULT int secp256k1_ecdsa_verify_batch(
+  const secp256k1_context* ctx,
+  const secp256k1_ecdsa_signature * const *sigs,
+  const unsigned char * const *msg32s,
+  const secp256k1_pubkey * const *pubkeys,
+  size_t n
+) SECP256K1_ARG_NONNULL(1);
+
+# ifdef __cplusplus
+}
+# endif
+
+#endif
@@ -0,0 +1,66 @@
+/**********************************************************************
+ * Copyright (c) 2017 The Bitcoin Core developers                     *
+ * Distributed under the MIT software license, see the accompanying   *
+ * file COPYING or http://www.opensource.org/licenses/mit-license.php.*
+ **********************************************************************/
+
+#ifndef _SECP256K1_MODULE_BATCH_MAIN_
+#define _SECP256K1_MODULE_BATCH_MAIN_
+
+#include "include/secp256k1_batch.h"
+
+/** Signatures whose s values are inverted together, bounding the stack used */
+#define SECP256K1_BATCH_CHUNK 64
+
+int secp256k1_ecdsa_verify_batch(const secp256k1_context* ctx, const secp256k1_ecdsa_signature * const *sigs, const unsigned char * const *msg32s, const secp256k1_pubkey * const *pubkeys, size_t n) {
+    secp256k1_scalar r[SECP256K1_BATCH_CHUNK], s[SECP256K1_BATCH_CHUNK], prod[SECP256K1_BATCH_CHUNK];
+    secp256k1_scalar inv, sn, m;
+    secp256k1_ge q;
+    size_t i, j, len;
+    VERIFY_CHECK(ctx != NULL);
+    ARG_CHECK(secp256k1_ecmult_context_is_built(&ctx->ecmult_ctx));
+    ARG_CHECK(n == 0 || sigs != NULL);
+    ARG_CHECK(n == 0 || msg32s != NULL);
+    ARG_CHECK(n == 0 || pubkeys != NULL);
+
+    for (i = 0; i < n; i += len) {
+        len = n - i < SECP256K1_BATCH_CHUNK ? n - i : SECP256K1_BATCH_CHUNK;
+
+        /* prod[j] = s[0] * ... * s[j] */
+        for (j = 0; j < len; j++) {
+            ARG_CHECK(sigs[i + j] != NULL);
+            secp256k1_ecdsa_signature_load(ctx, &r[j], &s[j], sigs[i + j]);
+            if (secp256k1_scalar_is_zero(&s[j]) || secp256k1_scalar_is_high(&s[j])) {
+                return 0;
+            }
+            if (j == 0) {
+                prod[0] = s[0];
+            } else {
+                secp256k1_scalar_mul(&prod[j], &prod[j - 1], &s[j]);
+            }
+        }
+
+        /* The group order is prime, so the product of non-zero values is
+         * invertible. Walking back, inv is the inverse of prod[j], from which
+         * the inverse of s[j] is inv * prod[j - 1]. */
+        secp256k1_scalar_inverse_var(&inv, &prod[len - 1]);
+        for (j = len; j-- > 0; ) {
+            if (j == 0) {
+                sn = inv;
+            } else {
+                secp256k1_scalar_mul(&sn, &inv, &prod[j - 1]);
+                secp256k1_scalar_mul(&inv, &inv, &s[j]);
+            }
+            ARG_CHECK(msg32s[i + j] != NULL);
+            ARG_CHECK(pubkeys[i + j] != NULL);
+            secp256k1_scalar_set_b32(&m, msg32s[i + j], NULL);
+            if (!secp256k1_pubkey_load(ctx, &q, pubkeys[i + j]) ||
+                !secp256k1_ecdsa_sig_verify_inv(&ctx->ecmult_ctx, &r[j], &sn, &q, &m)) {
+                return 0;
+            }
+        }
+    }
+    return 1;
+}
+
+#endif
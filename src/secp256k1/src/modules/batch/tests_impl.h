@@ -0,0 +1,78 @@
+/**********************************************************************
+ * Copyright (c) 2017 The Bitcoin Core developers                     *
+ * Distributed under the MIT software license, see the accompanying   *
+ * file COPYING or http://www.opensource.org/licenses/mit-license.php.*
+ **********************************************************************/
+
+#ifndef _SECP256K1_MODULE_BATCH_TESTS_
+#define _SECP256K1_MODULE_BATCH_TESTS_
+
+#define BATCH_TEST_MAX 150
+
+void test_ecdsa_verify_batch(size_t n) {
+    secp256k1_ecdsa_signature sig[BATCH_TEST_MAX];
+    unsigned char msg[BATCH_TEST_MAX][32];
+    secp256k1_pubkey pubkey[BATCH_TEST_MAX];
+    const secp256k1_ecdsa_signature *psig[BATCH_TEST_MAX];
+    const unsigned char *pmsg[BATCH_TEST_MAX];
+    const secp256k1_pubkey *ppubkey[BATCH_TEST_MAX];
+    secp256k1_scalar r, s;
+    unsigned char saved;
+    size_t i, bad;
+
+    for (i = 0; i < n; i++) {
+        unsigned char privkey[32];
+        secp256k1_scalar key, m;
+        random_scalar_order_test(&key);
+        random_scalar_order_test(&m);
+        secp256k1_scalar_get_b32(privkey, &key);
+        secp256k1_scalar_get_b32(msg[i], &m);
+        CHECK(secp256k1_ec_pubkey_create(ctx, &pubkey[i], privkey) == 1);
+        CHECK(secp256k1_ecdsa_sign(ctx, &sig[i], msg[i], privkey, NULL, NULL) == 1);
+        psig[i] = &sig[i];
+        pmsg[i] = msg[i];
+        ppubkey[i] = &pubkey[i];
+    }
+    CHECK(secp256k1_ecdsa_verify_batch(ctx, psig, pmsg, ppubkey, n) == 1);
+    if (n == 0) {
+        return;
+    }
+
+    /* A wrong message anywhere, including across chunks, fails the batch */
+    bad = secp256k1_rand_int(n);
+    saved = msg[bad][0];
+    msg[bad][0] ^= 1;
+    CHECK(secp256k1_ecdsa_verify(ctx, &sig[bad], msg[bad], &pubkey[bad]) == 0);
+    CHECK(secp256k1_ecdsa_verify_batch(ctx, psig, pmsg, ppubkey, n) == 0);
+    msg[bad][0] = saved;
+
+    /* So does a signature by another key */
+    bad = secp256k1_rand_int(n);
+    ppubkey[bad] = &pubkey[(bad + 1) % n];
+    CHECK(secp256k1_ecdsa_verify_batch(ctx, psig, pmsg, ppubkey, n) == (n == 1));
+    ppubkey[bad] = &pubkey[bad];
+
+    /* ...and the high-S form of a valid signature, as with secp256k1_ecdsa_verify */
+    bad = secp256k1_rand_int(n);
+    secp256k1_ecdsa_signature_load(ctx, &r, &s, &sig[bad]);
+    secp256k1_scalar_negate(&s, &s);
+    secp256k1_ecdsa_signature_save(&sig[bad], &r, &s);
+    CHECK(secp256k1_ecdsa_verify(ctx, &sig[bad], msg[bad], &pubkey[bad]) == 0);
+    CHECK(secp256k1_ecdsa_verify_batch(ctx, psig, pmsg, ppubkey, n) == 0);
+    secp256k1_scalar_negate(&s, &s);
+    secp256k1_ecdsa_signature_save(&sig[bad], &r, &s);
+    CHECK(secp256k1_ecdsa_verify_batch(ctx, psig, pmsg, ppubkey, n) == 1);
+}
+
+void run_batch_tests(void) {
+    int i;
+    test_ecdsa_verify_batch(0);
+    test_ecdsa_verify_batch(1);
+    test_ecdsa_verify_batch(SECP256K1_BATCH_CHUNK);
+    test_ecdsa_verify_batch(BATCH_TEST_MAX);
+    for (i = 0; i < count; i++) {
+        test_ecdsa_verify_batch(1 + secp256k1_rand_int(BATCH_TEST_MAX));
+    }
+}
+
+#endif
@@ -417,6 +417,46 @@ BOOST_AUTO_TEST_CASE(addrman_getaddr)
     BOOST_CHECK(addrman.size() == 2007);
 }
 
+BOOST_AUTO_TEST_CASE(addrman_getaddr_snapshot)
+{
+    CAddrManTest addrman;
+
+    // Set addrman addr placement to be deterministic.
+    addrman.MakeDeterministic();
+
+    int64_t nStart = GetTime();
+    SetMockTime(nStart);
+    CNetAddr source = ResolveIP("252.2.2.2");
+
+    for (unsigned int i = 1; i <= 100; i++) {
+        CAddress addr = CAddress(ResolveService("250." + boost::to_string(i) + ".1.1"), NODE_NONE);
+        addr.nTime = nStart;
+        addrman.Add(addr, source);
+    }
+    size_t nSize = addrman.size();
+    std::vector<CAddress> vAddr = addrman.GetAddr();
+    BOOST_CHECK_EQUAL(vAddr.size(), nSize * 23 / 100);
+    BOOST_CHECK_EQUAL(std::set<CAddress>(vAddr.begin(), vAddr.end()).size(), vAddr.size());
+
+    // A few more addresses are not returned until the snapshot is republished
+    for (unsigned int i = 1; i <= 5; i++) {
+        CAddress addr = CAddress(ResolveService("251." + boost::to_string(i) + ".1.1"), NODE_NONE);
+        addr.nTime = nStart;
+        addrman.Add(addr, source);
+    }
+    BOOST_CHECK(addrman.size() > nSize);
+    vAddr = addrman.GetAddr();
+    BOOST_CHECK_EQUAL(vAddr.size(), nSize * 23 / 100);
+    for (const CAddress& addr : vAddr)
+        BOOST_CHECK(addr.GetByte(3) == 250);
+
+    SetMockTime(nStart + ADDRMAN_SNAPSHOT_INTERVAL);
+    vAddr = addrman.GetAddr();
+    BOOST_CHECK_EQUAL(vAddr.size(), addrman.size() * 23 / 100);
+
+    SetMockTime(0);
+}
+
 
 BOOST_AUTO_TEST_CASE(caddrinfo_get_tried_bucket)
 {
@@ -0,0 +1,131 @@
+// Copyright (c) 2017 The Bitcoin Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "blockfilter.h"
+#include "hash.h"
+#include "primitives/block.h"
+#include "script/script.h"
+#include "streams.h"
+#include "undo.h"
+#include "version.h"
+#include "test/test_bitcoin.h"
+#include "test/test_random.h"
+
+#include <boost/test/unit_test.hpp>
+
+BOOST_FIXTURE_TEST_SUITE(blockfilter_tests, BasicTestingSetup)
+
+static GCSFilter::Element RandomElement()
+{
+    GCSFilter::Element element(32);
+    for (unsigned char& c : element)
+        c = insecure_rand();
+    return element;
+}
+
+BOOST_AUTO_TEST_CASE(gcsfilter_test)
+{
+    GCSFilter::ElementSet included, excluded;
+    for (int i = 0; i < 100; i++) {
+        included.insert(RandomElement());
+        excluded.insert(RandomElement());
+    }
+
+    GCSFilter filter(0, 0, 10, 1 << 10, included);
+    BOOST_CHECK_EQUAL(filter.GetN(), 100);
+    for (const GCSFilter::Element& element : included)
+        BOOST_CHECK(filter.Match(element));
+    BOOST_CHECK(filter.MatchAny(included));
+
+    // False positives happen at a rate of about 1/M
+    int nFalsePositives = 0;
+    for (const GCSFilter::Element& element : excluded)
+        nFalsePositives += filter.Match(element);
+    BOOST_CHECK(nFalsePositives < 10);
+    BOOST_CHECK_EQUAL(filter.MatchAny(excluded), nFalsePositives > 0);
+
+    // Decoding gives the same filter
+    GCSFilter decoded(0, 0, 10, 1 << 10, filter.GetEncoded());
+    BOOST_CHECK_EQUAL(decoded.GetN(), 100);
+    BOOST_CHECK(decoded.GetEncoded() == filter.GetEncoded());
+    for (const GCSFilter::Element& element : included)
+        BOOST_CHECK(decoded.Match(element));
+
+    // ...but with another key, the elements end up elsewhere
+    GCSFilter rekeyed(1, 0, 10, 1 << 10, filter.GetEncoded());
+    int nRekeyedMatches = 0;
+    for (const GCSFilter::Element& element : included)
+        nRekeyedMatches += rekeyed.Match(element);
+    BOOST_CHECK(nRekeyedMatches < 10);
+
+    // Truncated encodings are rejected
+    std::vector<unsigned char> vTruncated(filter.GetEncoded().begin(), filter.GetEncoded().end() - 10);
+    BOOST_CHECK_THROW(GCSFilter(0, 0, 10, 1 << 10, vTruncated), std::ios_base::failure);
+}
+
+BOOST_AUTO_TEST_CASE(gcsfilter_empty)
+{
+    GCSFilter filter(0, 0, 10, 1 << 10, GCSFilter::ElementSet());
+    BOOST_CHECK_EQUAL(filter.GetN(), 0);
+    BOOST_CHECK(filter.GetEncoded() == std::vector<unsigned char>(1, 0));
+    BOOST_CHECK(!filter.Match(RandomElement()));
+    BOOST_CHECK(GCSFilter().GetEncoded() == filter.GetEncoded());
+}
+
+BOOST_AUTO_TEST_CASE(blockfilter_basic_test)
+{
+    CScript included1 = CScript() << OP_DUP << OP_HASH160 << std::vector<unsigned char>(20, 1) << OP_EQUALVERIFY << OP_CHECKSIG;
+    CScript included2 = CScript() << std::vector<unsigned char>(33, 2) << OP_CHECKSIG;
+    CScript includedSpent = CScript() << OP_HASH160 << std::vector<unsigned char>(20, 3) << OP_EQUAL;
+    CScript excludedReturn = CScript() << OP_RETURN << std::vector<unsigned char>(4, 4);
+    CScript excludedScriptSig = CScript() << std::vector<unsigned char>(72, 5);
+
+    CMutableTransaction coinbase;
+    coinbase.vin.resize(1);
+    coinbase.vout.emplace_back(100, included1);
+    coinbase.vout.emplace_back(0, excludedReturn);
+    coinbase.vout.emplace_back(0, CScript());
+
+    CMutableTransaction tx;
+    tx.vin.emplace_back(COutPoint(GetRandHash(), 0), excludedScriptSig);
+    tx.vout.emplace_back(100, included2);
+
+    CBlock block;
+    block.vtx.push_back(MakeTransactionRef(coinbase));
+    block.vtx.push_back(MakeTransactionRef(tx));
+
+    CBlockUndo blockUndo;
+    blockUndo.vtxundo.resize(1);
+    blockUndo.vtxundo[0].vprevout.emplace_back(CTxOut(100, includedSpent), false, 1, 1);
+
+    GCSFilter::ElementSet elements = BasicFilterElements(block, blockUndo);
+    BOOST_CHECK_EQUAL(elements.size(), 3);
+
+    BlockFilter filter(BASIC_FILTER, block, blockUndo);
+    BOOST_CHECK(filter.GetBlockHash() == block.GetHash());
+    const GCSFilter& gcs = filter.GetFilter();
+    BOOST_CHECK(gcs.Match(GCSFilter::Element(included1.begin(), included1.end())));
+    BOOST_CHECK(gcs.Match(GCSFilter::Element(included2.begin(), included2.end())));
+    BOOST_CHECK(gcs.Match(GCSFilter::Element(includedSpent.begin(), includedSpent.end())));
+    BOOST_CHECK(!gcs.Match(GCSFilter::Element(excludedReturn.begin(), excludedReturn.end())));
+    BOOST_CHECK(!gcs.Match(GCSFilter::Element(excludedScriptSig.begin(), excludedScriptSig.end())));
+
+    // Round trip as sent in cfilter messages
+    CDataStream stream(SER_NETWORK, PROTOCOL_VERSION);
+    stream << filter;
+    BlockFilter filter2;
+    stream >> filter2;
+    BOOST_CHECK_EQUAL(filter2.GetFilterType(), filter.GetFilterType());
+    BOOST_CHECK(filter2.GetBlockHash() == filter.GetBlockHash());
+    BOOST_CHECK(filter2.GetEncodedFilter() == filter.GetEncodedFilter());
+
+    // Headers chain the filter hashes
+    const std::vector<unsigned char>& vEncoded = filter.GetEncodedFilter();
+    uint256 filterHash = Hash(vEncoded.begin(), vEncoded.end());
+    BOOST_CHECK(filter.GetHash() == filterHash);
+    uint256 prevHeader = GetRandHash();
+    BOOST_CHECK(filter.ComputeHeader(prevHeader) == Hash(filterHash.begin(), filterHash.end(), prevHeader.begin(), prevHeader.end()));
+}
+
+BOOST_AUTO_TEST_SUITE_END()
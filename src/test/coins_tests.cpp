@@ -873,4 +873,38 @@ BOOST_AUTO_TEST_CASE(ccoins_write)
                     CheckWriteCoins(parent_value, child_value, parent_value, parent_flags, child_flags, parent_flags);
 }
 
+BOOST_AUTO_TEST_CASE(ccoins_add_fetched)
+{
+    CCoinsViewTest base;
+    CCoinsViewCacheTest cache(&base);
+    uint256 txid1 = GetRandHash();
+    uint256 txid2 = GetRandHash();
+
+    // Coins fetched beforehand are added as if read from the base now
+    CCoins coins1;
+    coins1.vout.resize(1);
+    coins1.vout[0].nValue = VALUE1;
+    cache.AddFetchedCoins(txid1, coins1);
+    BOOST_CHECK(cache.HaveCoinsInCache(txid1));
+    BOOST_CHECK_EQUAL(cache.AccessCoins(txid1)->vout[0].nValue, VALUE1);
+
+    // But never replace what the cache has
+    {
+        CCoinsModifier modifier = cache.ModifyCoins(txid2);
+        modifier->vout.resize(1);
+        modifier->vout[0].nValue = VALUE2;
+    }
+    CCoins coins2;
+    coins2.vout.resize(1);
+    coins2.vout[0].nValue = VALUE1;
+    cache.AddFetchedCoins(txid2, coins2);
+    BOOST_CHECK_EQUAL(cache.AccessCoins(txid2)->vout[0].nValue, VALUE2);
+
+    // Fetched coins are not dirty: flushing leaves the base without them
+    cache.SelfTest();
+    BOOST_CHECK(cache.Flush());
+    BOOST_CHECK(!base.HaveCoins(txid1));
+    BOOST_CHECK(base.HaveCoins(txid2));
+}
+
 BOOST_AUTO_TEST_SUITE_END()
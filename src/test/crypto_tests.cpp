@@ -9,6 +9,7 @@
 #include "crypto/sha512.h"
 #include "crypto/hmac_sha256.h"
 #include "crypto/hmac_sha512.h"
+#include "hash.h"
 #include "utilstrencodings.h"
 #include "test/test_bitcoin.h"
 #include "test/test_random.h"
@@ -255,6 +256,40 @@ BOOST_AUTO_TEST_CASE(sha256_testvectors) {
     TestSHA256(test1, "a316d55510b49662420f49d145d42fb83f31ef8dc016aa4e32df049991a91e26");
 }
 
+static const int SHA256_IMPLEMENTATIONS[] = {SHA256_GENERIC, SHA256_USE_SSE41, SHA256_USE_AVX2, SHA256_USE_SHANI, SHA256_USE_ALL};
+
+BOOST_AUTO_TEST_CASE(sha256_implementations) {
+    // Each implementation this machine supports must agree with the generic one,
+    // for multi-block writes as well as for batches of 64-byte double hashes
+    std::vector<unsigned char> data(64 * 33);
+    for (unsigned char& c : data)
+        c = insecure_rand();
+    SHA256AutoDetect(SHA256_GENERIC);
+    std::vector<unsigned char> expected(CSHA256::OUTPUT_SIZE);
+    CSHA256().Write(data.data(), data.size()).Finalize(expected.data());
+
+    for (int nAllowed : SHA256_IMPLEMENTATIONS) {
+        BOOST_TEST_MESSAGE("Using the '" << SHA256AutoDetect(nAllowed) << "' SHA256 implementation");
+        std::vector<unsigned char> hash(CSHA256::OUTPUT_SIZE);
+        CSHA256().Write(data.data(), 7).Write(data.data() + 7, data.size() - 7).Finalize(hash.data());
+        BOOST_CHECK(hash == expected);
+
+        for (size_t blocks = 0; blocks <= 32; blocks++) {
+            std::vector<unsigned char> out(32 * blocks), outExpected(32 * blocks);
+            for (size_t i = 0; i < blocks; i++)
+                CHash256().Write(data.data() + 64 * i, 64).Finalize(outExpected.data() + 32 * i);
+            SHA256D64(out.data(), data.data(), blocks);
+            BOOST_CHECK(out == outExpected);
+
+            // In place, as the merkle root computation uses it
+            std::vector<unsigned char> inout(data.begin(), data.begin() + 64 * blocks);
+            SHA256D64(inout.data(), inout.data(), blocks);
+            BOOST_CHECK(std::equal(outExpected.begin(), outExpected.end(), inout.begin()));
+        }
+    }
+    SHA256AutoDetect();
+}
+
 BOOST_AUTO_TEST_CASE(sha512_testvectors) {
     TestSHA512("",
                "cf83e1357eefb8bdf1542850d66d8007d620e4050b5715dc83f4a921d36ce9ce"
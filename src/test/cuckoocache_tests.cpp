@@ -391,4 +391,40 @@ BOOST_AUTO_TEST_CASE(cuckoocache_generations)
     test_cache_generations<CuckooCache::cache<uint256, uint256Hasher>>();
 }
 
+/* Test that the live element count and eviction count follow inserts and
+ * erases.
+ */
+BOOST_AUTO_TEST_CASE(cuckoocache_stats)
+{
+    insecure_rand = FastRandomContext(true);
+    CuckooCache::cache<uint256, uint256Hasher> cc{};
+    uint32_t size = cc.setup(1 << 10);
+    BOOST_CHECK_EQUAL(cc.capacity(), size);
+    BOOST_CHECK_EQUAL(cc.count_live(), 0U);
+
+    std::vector<uint256> hashes(size / 2);
+    for (uint256& h : hashes) {
+        insecure_GetRandHash(h);
+        cc.insert(h);
+    }
+    BOOST_CHECK_EQUAL(cc.count_live(), hashes.size());
+    BOOST_CHECK_EQUAL(cc.evicted(), 0U);
+
+    for (size_t i = 0; i < hashes.size(); i += 2)
+        cc.contains(hashes[i], true);
+    BOOST_CHECK_EQUAL(cc.count_live(), hashes.size() / 2);
+
+    // Overfilling a cache drops live elements; aging makes room in all but
+    // the smallest ones most of the time
+    CuckooCache::cache<uint256, uint256Hasher> small{};
+    BOOST_CHECK_EQUAL(small.setup(2), 2U);
+    uint256 h;
+    for (int i = 0; i < 8; ++i) {
+        insecure_GetRandHash(h);
+        small.insert(h);
+    }
+    BOOST_CHECK(small.evicted() > 0);
+    BOOST_CHECK(small.count_live() <= 2);
+}
+
 BOOST_AUTO_TEST_SUITE_END();
@@ -5,6 +5,7 @@
 #include "hash.h"
 #include "utilstrencodings.h"
 #include "test/test_bitcoin.h"
+#include "test/test_random.h"
 
 #include <vector>
 
@@ -45,6 +46,32 @@ BOOST_AUTO_TEST_CASE(murmurhash3)
 #undef T
 }
 
+BOOST_AUTO_TEST_CASE(murmurhash3_multi)
+{
+    // The multi-seed and multi-key variants must agree with MurmurHash3()
+    // for every data length, including tails of 1-3 bytes.
+    std::vector<unsigned char> vData[4];
+    for (size_t nLen = 0; nLen <= 40; nLen++) {
+        for (int i = 0; i < 4; i++) {
+            vData[i].resize(nLen);
+            for (size_t j = 0; j < nLen; j++)
+                vData[i][j] = insecure_rand();
+        }
+
+        unsigned int vSeeds[7], vHashes[7];
+        for (int i = 0; i < 7; i++)
+            vSeeds[i] = insecure_rand();
+        CMurmurHash3Seeds(vData[0].data(), nLen).Hash(vSeeds, 7, vHashes);
+        for (int i = 0; i < 7; i++)
+            BOOST_CHECK_EQUAL(vHashes[i], MurmurHash3(vSeeds[i], vData[0]));
+
+        const unsigned char* vKeys[4] = {vData[0].data(), vData[1].data(), vData[2].data(), vData[3].data()};
+        MurmurHash3x4(vSeeds[0], vKeys, nLen, vHashes);
+        for (int i = 0; i < 4; i++)
+            BOOST_CHECK_EQUAL(vHashes[i], MurmurHash3(vSeeds[0], vData[i]));
+    }
+}
+
 /*
    SipHash-2-4 output with
    k = 00 01 02 ...
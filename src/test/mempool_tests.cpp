@@ -430,6 +430,55 @@ BOOST_AUTO_TEST_CASE(MempoolAncestorIndexingTest)
 }
 
 
+BOOST_AUTO_TEST_CASE(MempoolPriorityIndexingTest)
+{
+    CTxMemPool pool(CFeeRate(0));
+    TestMemPoolEntryHelper entry;
+
+    /* higher entry priority, but no in-chain inputs to age */
+    CMutableTransaction tx1 = CMutableTransaction();
+    tx1.vout.resize(1);
+    tx1.vout[0].scriptPubKey = CScript() << OP_11 << OP_EQUAL;
+    tx1.vout[0].nValue = 10 * COIN;
+    pool.addUnchecked(tx1.GetHash(), entry.Priority(10.0).Height(1).FromTx(tx1));
+
+    /* lower entry priority, aging with its in-chain inputs */
+    CMutableTransaction tx2 = CMutableTransaction();
+    tx2.vout.resize(1);
+    tx2.vout[0].scriptPubKey = CScript() << OP_11 << OP_EQUAL;
+    tx2.vout[0].nValue = 1 * COIN;
+    pool.addUnchecked(tx2.GetHash(), entry.Priority(5.0).Height(1).FromTx(tx2, &pool));
+
+    std::vector<std::string> sortedOrder;
+    sortedOrder.push_back(tx1.GetHash().ToString());
+    sortedOrder.push_back(tx2.GetHash().ToString());
+    CheckSort<coin_age_priority>(pool, sortedOrder);
+
+    /* connecting a block leaves the index alone; it is re-keyed for the
+       next height when a template is assembled */
+    std::vector<CTransactionRef> vtx;
+    pool.removeForBlock(vtx, 1);
+    CheckSort<coin_age_priority>(pool, sortedOrder);
+    pool.UpdatePriorities(2);
+    BOOST_CHECK_EQUAL(pool.mapTx.find(tx2.GetHash())->GetCachedPriority(), pool.mapTx.find(tx2.GetHash())->GetPriority(2));
+    std::swap(sortedOrder[0], sortedOrder[1]);
+    CheckSort<coin_age_priority>(pool, sortedOrder);
+
+    /* priority deltas are applied to the index, including for later arrivals */
+    pool.PrioritiseTransaction(tx1.GetHash(), tx1.GetHash().ToString(), 1e12, 0);
+    std::swap(sortedOrder[0], sortedOrder[1]);
+    CheckSort<coin_age_priority>(pool, sortedOrder);
+
+    CMutableTransaction tx3 = CMutableTransaction();
+    tx3.vout.resize(1);
+    tx3.vout[0].scriptPubKey = CScript() << OP_11 << OP_EQUAL;
+    tx3.vout[0].nValue = 3 * COIN;
+    pool.PrioritiseTransaction(tx3.GetHash(), tx3.GetHash().ToString(), 1e13, 0);
+    pool.addUnchecked(tx3.GetHash(), entry.Priority(0.0).FromTx(tx3));
+    sortedOrder.insert(sortedOrder.begin(), tx3.GetHash().ToString());
+    CheckSort<coin_age_priority>(pool, sortedOrder);
+}
+
 BOOST_AUTO_TEST_CASE(MempoolSizeLimitTest)
 {
     CTxMemPool pool(CFeeRate(1000));
@@ -0,0 +1,181 @@
+// Copyright (c) 2017 The Bitcoin Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "mempooljournal.h"
+#include "txmempool.h"
+#include "util.h"
+
+#include "test/test_bitcoin.h"
+
+#include <boost/filesystem.hpp>
+#include <boost/test/unit_test.hpp>
+
+BOOST_FIXTURE_TEST_SUITE(mempooljournal_tests, TestingSetup)
+
+static CMutableTransaction MakeTx(int n)
+{
+    CMutableTransaction tx;
+    tx.vin.resize(1);
+    tx.vin[0].scriptSig = CScript() << n;
+    tx.vout.resize(1);
+    tx.vout[0].scriptPubKey = CScript() << OP_11 << OP_EQUAL;
+    tx.vout[0].nValue = 1000 * n;
+    return tx;
+}
+
+BOOST_AUTO_TEST_CASE(MempoolJournalReplay)
+{
+    CTxMemPool pool(CFeeRate(0));
+    TestMemPoolEntryHelper entry;
+    boost::filesystem::path path = GetDataDir() / "mempool.journal";
+
+    CMempoolJournal journal(pool, path);
+    BOOST_CHECK(journal.Open());
+
+    CMutableTransaction tx1 = MakeTx(1), tx2 = MakeTx(2), tx3 = MakeTx(3), tx4 = MakeTx(4);
+    pool.addUnchecked(tx1.GetHash(), entry.Time(100).FromTx(tx1));
+    pool.addUnchecked(tx2.GetHash(), entry.Time(200).FromTx(tx2));
+    journal.Flush();
+    pool.addUnchecked(tx3.GetHash(), entry.Time(300).FromTx(tx3));
+    pool.removeRecursive(tx2);
+    journal.Flush();
+
+    // Deltas for transactions not in the pool are recorded on close
+    pool.PrioritiseTransaction(tx4.GetHash(), tx4.GetHash().ToString(), 0, 5000);
+    journal.Close();
+
+    std::vector<TxMempoolInfo> vEntries;
+    std::map<uint256, CAmount> mapDeltas;
+    BOOST_CHECK(ReadMempoolJournal(path, vEntries, mapDeltas));
+    BOOST_CHECK_EQUAL(vEntries.size(), 2);
+    BOOST_CHECK(vEntries[0].tx->GetHash() == tx1.GetHash());
+    BOOST_CHECK_EQUAL(vEntries[0].nTime, 100);
+    BOOST_CHECK(vEntries[1].tx->GetHash() == tx3.GetHash());
+    BOOST_CHECK_EQUAL(vEntries[1].nTime, 300);
+    BOOST_CHECK_EQUAL(mapDeltas.size(), 1);
+    BOOST_CHECK_EQUAL(mapDeltas[tx4.GetHash()], 5000);
+
+    // A torn record at the end of the file is ignored
+    FILE* file = fopen(path.string().c_str(), "ab");
+    BOOST_CHECK(file != NULL);
+    const unsigned char garbage[] = {CMempoolJournal::RECORD_ADD, 0xfd, 0x00, 0x10, 0x42};
+    fwrite(garbage, 1, sizeof(garbage), file);
+    fclose(file);
+    BOOST_CHECK(ReadMempoolJournal(path, vEntries, mapDeltas));
+    BOOST_CHECK_EQUAL(vEntries.size(), 2);
+}
+
+BOOST_AUTO_TEST_CASE(MempoolJournalCompact)
+{
+    CTxMemPool pool(CFeeRate(0));
+    TestMemPoolEntryHelper entry;
+    boost::filesystem::path path = GetDataDir() / "mempool.journal";
+
+    CMempoolJournal journal(pool, path);
+    BOOST_CHECK(journal.Open());
+    BOOST_CHECK_EQUAL(journal.GetRecordCount(), 1);
+
+    for (int i = 1; i <= 20; i++) {
+        CMutableTransaction tx = MakeTx(i);
+        pool.addUnchecked(tx.GetHash(), entry.Time(i).FromTx(tx));
+        if (i % 2 == 0)
+            pool.removeRecursive(tx);
+    }
+    journal.Flush();
+    BOOST_CHECK_EQUAL(journal.GetRecordCount(), 1 + 10 + 10);
+
+    // Compaction leaves one record per live transaction plus the deltas
+    BOOST_CHECK(journal.Compact());
+    BOOST_CHECK_EQUAL(journal.GetRecordCount(), 10 + 1);
+
+    CMutableTransaction tx = MakeTx(21);
+    pool.addUnchecked(tx.GetHash(), entry.Time(21).FromTx(tx));
+    journal.Close();
+
+    std::vector<TxMempoolInfo> vEntries;
+    std::map<uint256, CAmount> mapDeltas;
+    BOOST_CHECK(ReadMempoolJournal(path, vEntries, mapDeltas));
+    BOOST_CHECK_EQUAL(vEntries.size(), 11);
+    BOOST_CHECK(vEntries.back().tx->GetHash() == tx.GetHash());
+    BOOST_CHECK(mapDeltas.empty());
+}
+
+// Replays a journal into pool the way LoadMempoolJournal does, minus the
+// validation the test transactions would not pass.
+static void ReloadMempoolJournal(CTxMemPool& pool, const boost::filesystem::path& path)
+{
+    std::vector<TxMempoolInfo> vEntries;
+    std::map<uint256, CAmount> mapDeltas;
+    BOOST_CHECK(ReadMempoolJournal(path, vEntries, mapDeltas));
+    TestMemPoolEntryHelper entry;
+    for (const TxMempoolInfo& info : vEntries) {
+        if (info.nFeeDelta)
+            SetMempoolJournalDelta(pool, info.tx->GetHash(), info.nFeeDelta);
+        pool.addUnchecked(info.tx->GetHash(), entry.Fee(1000).Time(info.nTime).FromTx(*info.tx));
+    }
+    for (const auto& i : mapDeltas)
+        SetMempoolJournalDelta(pool, i.first, i.second);
+}
+
+BOOST_AUTO_TEST_CASE(MempoolJournalDeltasSurviveRestarts)
+{
+    TestMemPoolEntryHelper entry;
+    boost::filesystem::path path = GetDataDir() / "mempool.journal";
+    CMutableTransaction tx1 = MakeTx(1), tx2 = MakeTx(2);
+
+    {
+        CTxMemPool pool(CFeeRate(0));
+        CMempoolJournal journal(pool, path);
+        BOOST_CHECK(journal.Open());
+        pool.PrioritiseTransaction(tx1.GetHash(), tx1.GetHash().ToString(), 0, 5000);
+        pool.addUnchecked(tx1.GetHash(), entry.Fee(1000).Time(100).FromTx(tx1));
+        pool.PrioritiseTransaction(tx2.GetHash(), tx2.GetHash().ToString(), 0, 3000);
+        journal.Close();
+    }
+
+    // Neither the delta of the pooled transaction nor that of the one not
+    // in the pool may grow from one restart to the next.
+    for (int i = 0; i < 2; i++) {
+        CTxMemPool pool(CFeeRate(0));
+        ReloadMempoolJournal(pool, path);
+        BOOST_CHECK_EQUAL(pool.size(), 1);
+        BOOST_CHECK_EQUAL(pool.mapTx.find(tx1.GetHash())->GetModifiedFee(), 6000);
+        pool.addUnchecked(tx2.GetHash(), entry.Fee(1000).Time(200).FromTx(tx2));
+        BOOST_CHECK_EQUAL(pool.mapTx.find(tx2.GetHash())->GetModifiedFee(), 4000);
+        pool.removeRecursive(tx2);
+
+        CMempoolJournal journal(pool, path);
+        BOOST_CHECK(journal.Open());
+        journal.Close();
+    }
+}
+
+BOOST_AUTO_TEST_CASE(MempoolJournalDeltasAfterAdd)
+{
+    TestMemPoolEntryHelper entry;
+    boost::filesystem::path path = GetDataDir() / "mempool.journal";
+    CMutableTransaction tx1 = MakeTx(1), tx2 = MakeTx(2);
+
+    {
+        CTxMemPool pool(CFeeRate(0));
+        CMempoolJournal journal(pool, path);
+        BOOST_CHECK(journal.Open());
+        pool.PrioritiseTransaction(tx1.GetHash(), tx1.GetHash().ToString(), 0, 5000);
+        pool.addUnchecked(tx1.GetHash(), entry.Fee(1000).Time(100).FromTx(tx1));
+        pool.addUnchecked(tx2.GetHash(), entry.Fee(1000).Time(200).FromTx(tx2));
+        journal.Flush();
+        // Prioritised after their additions were written
+        pool.PrioritiseTransaction(tx1.GetHash(), tx1.GetHash().ToString(), 0, 2000);
+        pool.PrioritiseTransaction(tx2.GetHash(), tx2.GetHash().ToString(), 0, 3000);
+        journal.Close();
+    }
+
+    CTxMemPool pool(CFeeRate(0));
+    ReloadMempoolJournal(pool, path);
+    BOOST_CHECK_EQUAL(pool.size(), 2);
+    BOOST_CHECK_EQUAL(pool.mapTx.find(tx1.GetHash())->GetModifiedFee(), 8000);
+    BOOST_CHECK_EQUAL(pool.mapTx.find(tx2.GetHash())->GetModifiedFee(), 4000);
+}
+
+BOOST_AUTO_TEST_SUITE_END()
@@ -492,7 +492,159 @@ BOOST_AUTO_TEST_CASE(CreateNewBlock_validity)
 
     TestPackageSelection(chainparams, scriptPubKey, txFirst);
 
+    // Cluster based selection must agree on the same packages
+    mempool.clear();
+    ForceSetArg("-blockclusters", "1");
+    TestPackageSelection(chainparams, scriptPubKey, txFirst);
+    ForceSetArg("-blockclusters", "0");
+
     fCheckpointsEnabled = true;
 }
 
+BOOST_AUTO_TEST_CASE(MempoolClusterLinearization)
+{
+    CTxMemPool pool(CFeeRate(0));
+    TestMemPoolEntryHelper entry;
+
+    // A free parent with a high and a low fee child, and an unrelated
+    // medium fee transaction.
+    CMutableTransaction txParent;
+    txParent.vin.resize(1);
+    txParent.vin[0].scriptSig = CScript() << OP_1;
+    txParent.vout.resize(2);
+    txParent.vout[0].nValue = txParent.vout[1].nValue = 10 * COIN;
+    pool.addUnchecked(txParent.GetHash(), entry.Fee(0).FromTx(txParent));
+
+    CMutableTransaction txHigh;
+    txHigh.vin.resize(1);
+    txHigh.vin[0].prevout = COutPoint(txParent.GetHash(), 0);
+    txHigh.vout.resize(1);
+    txHigh.vout[0].nValue = 10 * COIN - 30000;
+    pool.addUnchecked(txHigh.GetHash(), entry.Fee(30000).FromTx(txHigh));
+
+    CMutableTransaction txLow = txHigh;
+    txLow.vin[0].prevout = COutPoint(txParent.GetHash(), 1);
+    txLow.vout[0].nValue = 10 * COIN - 1000;
+    pool.addUnchecked(txLow.GetHash(), entry.Fee(1000).FromTx(txLow));
+
+    CMutableTransaction txOther;
+    txOther.vin.resize(1);
+    txOther.vin[0].scriptSig = CScript() << OP_2;
+    txOther.vout.resize(1);
+    txOther.vout[0].nValue = 10 * COIN;
+    pool.addUnchecked(txOther.GetHash(), entry.Fee(10000).FromTx(txOther));
+
+    LOCK(pool.cs);
+    std::vector<std::vector<CTxMemPoolChunk> > vClusters;
+    LinearizeMempoolClusters(pool, CTxMemPool::setEntries(), vClusters);
+    BOOST_CHECK_EQUAL(vClusters.size(), 2);
+
+    const std::vector<CTxMemPoolChunk>& family = vClusters[0].size() == 2 ? vClusters[0] : vClusters[1];
+    const std::vector<CTxMemPoolChunk>& other = vClusters[0].size() == 2 ? vClusters[1] : vClusters[0];
+    BOOST_CHECK_EQUAL(family.size(), 2);
+    BOOST_CHECK_EQUAL(family[0].vTx.size(), 2);
+    BOOST_CHECK(family[0].vTx[0]->GetTx().GetHash() == txParent.GetHash());
+    BOOST_CHECK(family[0].vTx[1]->GetTx().GetHash() == txHigh.GetHash());
+    BOOST_CHECK_EQUAL(family[0].nModFees, 30000);
+    BOOST_CHECK_EQUAL(family[1].vTx.size(), 1);
+    BOOST_CHECK(family[1].vTx[0]->GetTx().GetHash() == txLow.GetHash());
+    BOOST_CHECK_EQUAL(other.size(), 1);
+    BOOST_CHECK(other[0].vTx[0]->GetTx().GetHash() == txOther.GetHash());
+
+    // Entries already in the block are left out of the clusters
+    CTxMemPool::setEntries setExclude;
+    setExclude.insert(pool.mapTx.find(txParent.GetHash()));
+    setExclude.insert(pool.mapTx.find(txHigh.GetHash()));
+    LinearizeMempoolClusters(pool, setExclude, vClusters);
+    BOOST_CHECK_EQUAL(vClusters.size(), 2);
+    BOOST_CHECK_EQUAL(vClusters[0].size() + vClusters[1].size(), 2);
+}
+
+BOOST_AUTO_TEST_CASE(MempoolClusterLinearizationLimit)
+{
+    CTxMemPool pool(CFeeRate(0));
+    TestMemPoolEntryHelper entry;
+
+    // A chain too long to be linearized by ancestor feerate, whose fees
+    // rise towards its end, is still chunked in a valid order.
+    CMutableTransaction tx;
+    tx.vin.resize(1);
+    tx.vin[0].scriptSig = CScript() << OP_1;
+    tx.vout.resize(1);
+    tx.vout[0].nValue = 10 * COIN;
+    std::vector<uint256> vHashes;
+    for (size_t i = 0; i < MAX_CLUSTER_LINEARIZATION_SIZE + 10; i++) {
+        pool.addUnchecked(tx.GetHash(), entry.Fee(i * 10).FromTx(tx));
+        vHashes.push_back(tx.GetHash());
+        tx.vin[0].prevout = COutPoint(tx.GetHash(), 0);
+        tx.vin[0].scriptSig = CScript();
+    }
+
+    LOCK(pool.cs);
+    std::vector<std::vector<CTxMemPoolChunk> > vClusters;
+    LinearizeMempoolClusters(pool, CTxMemPool::setEntries(), vClusters);
+    BOOST_CHECK_EQUAL(vClusters.size(), 1);
+    std::vector<uint256> vLinearized;
+    for (size_t i = 0; i < vClusters[0].size(); i++) {
+        if (i > 0)
+            BOOST_CHECK(vClusters[0][i].nModFees * vClusters[0][i - 1].nSize <= vClusters[0][i - 1].nModFees * vClusters[0][i].nSize);
+        for (CTxMemPool::txiter it : vClusters[0][i].vTx)
+            vLinearized.push_back(it->GetTx().GetHash());
+    }
+    BOOST_CHECK(vLinearized == vHashes);
+}
+
+BOOST_AUTO_TEST_CASE(MempoolClusterLinearizationLimitDefaultPolicy)
+{
+    CTxMemPool pool(CFeeRate(0));
+    TestMemPoolEntryHelper entry;
+
+    // A row of parents without fees, each pair of neighbours spent by a child
+    // paying a high fee, grows beyond the limit while no transaction comes
+    // close to the default ancestor and descendant limits.
+    const size_t nParents = MAX_CLUSTER_LINEARIZATION_SIZE / 2 + 10;
+    std::vector<uint256> vParents;
+    for (size_t i = 0; i < nParents; i++) {
+        CMutableTransaction parent;
+        parent.vin.resize(1);
+        parent.vin[0].scriptSig = CScript() << OP_1 << (int64_t)i;
+        parent.vout.resize(2);
+        parent.vout[0].nValue = parent.vout[1].nValue = COIN;
+        pool.addUnchecked(parent.GetHash(), entry.Fee(0).FromTx(parent));
+        vParents.push_back(parent.GetHash());
+    }
+    for (size_t i = 0; i + 1 < nParents; i++) {
+        CMutableTransaction child;
+        child.vin.resize(2);
+        child.vin[0].prevout = COutPoint(vParents[i], 1);
+        child.vin[1].prevout = COutPoint(vParents[i + 1], 0);
+        child.vout.resize(1);
+        child.vout[0].nValue = COIN;
+        pool.addUnchecked(child.GetHash(), entry.Fee(100000).FromTx(child));
+    }
+
+    LOCK(pool.cs);
+    BOOST_CHECK(pool.size() > MAX_CLUSTER_LINEARIZATION_SIZE);
+    for (CTxMemPool::txiter it = pool.mapTx.begin(); it != pool.mapTx.end(); it++) {
+        BOOST_CHECK(it->GetCountWithAncestors() <= DEFAULT_ANCESTOR_LIMIT);
+        BOOST_CHECK(it->GetCountWithDescendants() <= DEFAULT_DESCENDANT_LIMIT);
+    }
+
+    std::vector<std::vector<CTxMemPoolChunk> > vClusters;
+    LinearizeMempoolClusters(pool, CTxMemPool::setEntries(), vClusters);
+    BOOST_CHECK_EQUAL(vClusters.size(), 1);
+    std::vector<uint256> vLinearized;
+    for (const CTxMemPoolChunk& chunk : vClusters[0])
+        for (CTxMemPool::txiter it : chunk.vTx)
+            vLinearized.push_back(it->GetTx().GetHash());
+    BOOST_CHECK_EQUAL(vLinearized.size(), pool.size());
+
+    // By ancestor feerate a child would come first, with its two parents;
+    // in topological order all parents come before any child.
+    std::sort(vParents.begin(), vParents.end());
+    std::vector<uint256> vFirst(vLinearized.begin(), vLinearized.begin() + nParents);
+    std::sort(vFirst.begin(), vFirst.end());
+    BOOST_CHECK(vFirst == vParents);
+}
+
 BOOST_AUTO_TEST_SUITE_END()
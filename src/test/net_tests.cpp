@@ -9,6 +9,7 @@
 #include "serialize.h"
 #include "streams.h"
 #include "net.h"
+#include "netmessagemaker.h"
 #include "netbase.h"
 #include "chainparams.h"
 
@@ -172,4 +173,190 @@ BOOST_AUTO_TEST_CASE(cnode_simple_test)
     BOOST_CHECK(pnode2->fFeeler == false);
 }
 
+static std::vector<unsigned char> SerializeMessage(const std::string& strCommand, const std::vector<unsigned char>& vPayload)
+{
+    CSerializedNetMsg msg;
+    msg.command = strCommand;
+    msg.data = vPayload;
+    CSharedNetMsg msgShared(std::move(msg));
+    std::vector<unsigned char> vMessage(msgShared.header->begin(), msgShared.header->end());
+    vMessage.insert(vMessage.end(), vPayload.begin(), vPayload.end());
+    return vMessage;
+}
+
+BOOST_AUTO_TEST_CASE(cnetmessage_spill)
+{
+    std::vector<unsigned char> vPayload(5000);
+    for (size_t i = 0; i < vPayload.size(); i++)
+        vPayload[i] = i * 7;
+
+    // Block payloads past the spill size go to a temporary file
+    const std::vector<unsigned char> vBlock = SerializeMessage(NetMsgType::BLOCK, vPayload);
+    CNetMessage msg(Params().MessageStart(), SER_NETWORK, INIT_PROTO_VERSION, 1000);
+    const char* pch = (const char*)vBlock.data();
+    unsigned int nBytes = vBlock.size();
+    while (nBytes > 0) {
+        int handled = msg.in_data ? msg.readData(pch, std::min(nBytes, 300U)) : msg.readHeader(pch, std::min(nBytes, 300U));
+        BOOST_REQUIRE(handled > 0);
+        pch += handled;
+        nBytes -= handled;
+    }
+    BOOST_CHECK(msg.complete());
+    BOOST_CHECK_EQUAL(msg.GetSpilledSize(), vPayload.size());
+    BOOST_CHECK(msg.GetBufferedSize() < 1000);
+    uint256 hash = Hash(vPayload.begin(), vPayload.end());
+    BOOST_CHECK(msg.GetMessageHash() == hash);
+    BOOST_CHECK(msg.LoadSpilledData());
+    BOOST_CHECK_EQUAL(msg.GetSpilledSize(), 0);
+    BOOST_CHECK(std::vector<unsigned char>(msg.vRecv.begin(), msg.vRecv.end()) == vPayload);
+
+    // Other messages, and all messages below the spill size, stay in memory
+    in_addr ipv4Addr;
+    ipv4Addr.s_addr = 0xa0b0c001;
+    CAddress addr = CAddress(CService(ipv4Addr, 7777), NODE_NETWORK);
+    std::unique_ptr<CNode> pnode(new CNode(0, NODE_NETWORK, 0, INVALID_SOCKET, addr, 0, 0, "", false));
+    const std::vector<unsigned char> vTx = SerializeMessage(NetMsgType::TX, vPayload);
+    bool fComplete;
+    BOOST_CHECK(pnode->ReceiveMsgBytes((const char*)vTx.data(), vTx.size(), 1000, fComplete));
+    BOOST_CHECK(fComplete);
+    BOOST_CHECK(pnode->ReceiveMsgBytes((const char*)vBlock.data(), vBlock.size() - 1, 1000, fComplete));
+    BOOST_CHECK(!fComplete);
+    CNodeStats stats;
+    pnode->copyStats(stats);
+    BOOST_CHECK_EQUAL(stats.nRecvSpilledSize, vPayload.size() - 1);
+    BOOST_CHECK(stats.nRecvBufferSize >= vPayload.size() && stats.nRecvBufferSize < vPayload.size() + 1000);
+    BOOST_CHECK(pnode->ReceiveMsgBytes((const char*)vBlock.data() + vBlock.size() - 1, 1, 0, fComplete));
+    BOOST_CHECK(fComplete);
+}
+
+#ifndef WIN32
+static void CheckSocketEvents(CSocketEvents::Mode mode)
+{
+    CSocketEvents events(mode);
+    BOOST_CHECK(events.GetMode() == mode);
+
+    int sockets[2];
+    BOOST_REQUIRE(socketpair(AF_UNIX, SOCK_STREAM, 0, sockets) == 0);
+    std::set<SOCKET> setRecv, setSend, setError;
+
+    // Nothing to receive yet
+    events.Watch(sockets[0], 1, true, false);
+    BOOST_CHECK(events.Wait(0, setRecv, setSend, setError));
+    BOOST_CHECK(setRecv.empty() && setSend.empty() && setError.empty());
+
+    BOOST_CHECK_EQUAL(send(sockets[1], "x", 1, 0), 1);
+    events.Watch(sockets[0], 1, true, false);
+    BOOST_CHECK(events.Wait(0, setRecv, setSend, setError));
+    BOOST_CHECK(setRecv.count(sockets[0]));
+
+    // Watching for sending replaces watching for receiving
+    setRecv.clear();
+    events.Watch(sockets[0], 1, true, true);
+    BOOST_CHECK(events.Wait(0, setRecv, setSend, setError));
+    BOOST_CHECK(setRecv.empty());
+    BOOST_CHECK(setSend.count(sockets[0]));
+
+    // A descriptor reused by another connection is picked up again
+    close(sockets[0]);
+    close(sockets[1]);
+    BOOST_REQUIRE(socketpair(AF_UNIX, SOCK_STREAM, 0, sockets) == 0);
+    BOOST_CHECK_EQUAL(send(sockets[1], "x", 1, 0), 1);
+    setSend.clear();
+    events.Watch(sockets[0], 2, true, false);
+    BOOST_CHECK(events.Wait(0, setRecv, setSend, setError));
+    BOOST_CHECK(setRecv.count(sockets[0]));
+
+    // A closed peer is reported
+    close(sockets[1]);
+    setRecv.clear();
+    events.Watch(sockets[0], 2, false, false);
+    BOOST_CHECK(events.Wait(0, setRecv, setSend, setError));
+    BOOST_CHECK(setError.count(sockets[0]) || mode == CSocketEvents::SOCKETEVENTS_SELECT);
+    close(sockets[0]);
+}
+
+BOOST_AUTO_TEST_CASE(socket_events)
+{
+    CSocketEvents::Mode mode;
+    BOOST_CHECK(CSocketEvents::ParseMode("select", mode));
+    BOOST_CHECK(mode == CSocketEvents::SOCKETEVENTS_SELECT);
+    BOOST_CHECK(!CSocketEvents::ParseMode("poll", mode));
+
+    CheckSocketEvents(CSocketEvents::SOCKETEVENTS_SELECT);
+#ifdef USE_EPOLL
+    BOOST_CHECK(CSocketEvents::ParseMode("epoll", mode));
+    BOOST_CHECK(mode == CSocketEvents::SOCKETEVENTS_EPOLL);
+    CheckSocketEvents(CSocketEvents::SOCKETEVENTS_EPOLL);
+#endif
+}
+
+static std::vector<unsigned char> ReceiveAll(int hSocket, size_t nSize)
+{
+    std::vector<unsigned char> vData(nSize);
+    size_t nReceived = 0;
+    while (nReceived < nSize) {
+        ssize_t nBytes = recv(hSocket, vData.data() + nReceived, nSize - nReceived, MSG_DONTWAIT);
+        if (nBytes <= 0)
+            break;
+        nReceived += nBytes;
+    }
+    vData.resize(nReceived);
+    return vData;
+}
+
+BOOST_AUTO_TEST_CASE(shared_message_send)
+{
+    in_addr ipv4Addr;
+    ipv4Addr.s_addr = 0xa0b0c001;
+    CAddress addr = CAddress(CService(ipv4Addr, 7777), NODE_NETWORK);
+
+    int sockets1[2], sockets2[2];
+    BOOST_REQUIRE(socketpair(AF_UNIX, SOCK_STREAM, 0, sockets1) == 0);
+    BOOST_REQUIRE(socketpair(AF_UNIX, SOCK_STREAM, 0, sockets2) == 0);
+    CConnman connman(0x1337, 0x1337);
+    std::unique_ptr<CNode> pnode1(new CNode(0, NODE_NETWORK, 0, sockets1[0], addr, 0, 0, "", false));
+    std::unique_ptr<CNode> pnode2(new CNode(1, NODE_NETWORK, 0, sockets2[0], addr, 1, 1, "", false));
+
+    // The header carries the command, size and checksum of the payload
+    CSerializedNetMsg msgBlock;
+    msgBlock.command = NetMsgType::BLOCK;
+    msgBlock.data.resize(20000);
+    for (size_t i = 0; i < msgBlock.data.size(); i++)
+        msgBlock.data[i] = i;
+    const std::vector<unsigned char> vPayload = msgBlock.data;
+    const CSharedNetMsg msgShared(std::move(msgBlock));
+    BOOST_CHECK_EQUAL(msgShared.header->size(), CMessageHeader::HEADER_SIZE);
+    CMessageHeader hdr(Params().MessageStart());
+    CDataStream(*msgShared.header, SER_NETWORK, PROTOCOL_VERSION) >> hdr;
+    BOOST_CHECK(hdr.IsValid(Params().MessageStart()));
+    BOOST_CHECK_EQUAL(hdr.GetCommand(), NetMsgType::BLOCK);
+    BOOST_CHECK_EQUAL(hdr.nMessageSize, vPayload.size());
+    uint256 hash = Hash(vPayload.begin(), vPayload.end());
+    BOOST_CHECK(memcmp(hdr.pchChecksum, hash.begin(), CMessageHeader::CHECKSUM_SIZE) == 0);
+
+    // Both peers are sent the same buffers, along with a message of their own
+    std::vector<unsigned char> vExpected(msgShared.header->begin(), msgShared.header->end());
+    vExpected.insert(vExpected.end(), vPayload.begin(), vPayload.end());
+    for (CNode* pnode : {pnode1.get(), pnode2.get()}) {
+        connman.PushMessage(pnode, msgShared);
+        connman.PushMessage(pnode, CNetMsgMaker(PROTOCOL_VERSION).Make(NetMsgType::PING, (uint64_t)pnode->GetId()));
+        BOOST_CHECK(pnode->vSendMsg.empty());
+        BOOST_CHECK_EQUAL(pnode->nSendSize, 0);
+    }
+    BOOST_CHECK_EQUAL(msgShared.data.use_count(), 1);
+
+    std::vector<unsigned char> vReceived1 = ReceiveAll(sockets1[1], vExpected.size() + CMessageHeader::HEADER_SIZE + 8);
+    std::vector<unsigned char> vReceived2 = ReceiveAll(sockets2[1], vExpected.size() + CMessageHeader::HEADER_SIZE + 8);
+    BOOST_REQUIRE_EQUAL(vReceived1.size(), vExpected.size() + CMessageHeader::HEADER_SIZE + 8);
+    BOOST_REQUIRE_EQUAL(vReceived2.size(), vReceived1.size());
+    BOOST_CHECK(std::equal(vExpected.begin(), vExpected.end(), vReceived1.begin()));
+    BOOST_CHECK(std::equal(vExpected.begin(), vExpected.end(), vReceived2.begin()));
+    BOOST_CHECK_EQUAL(vReceived1.back(), 0);
+    BOOST_CHECK_EQUAL(vReceived2[vReceived2.size() - 8], 1);
+
+    close(sockets1[1]);
+    close(sockets2[1]);
+}
+#endif
+
 BOOST_AUTO_TEST_SUITE_END()
@@ -51,6 +51,8 @@ BOOST_AUTO_TEST_CASE(pmt_test1)
         std::vector<uint256> vTxid(nTx, uint256());
         for (unsigned int j=0; j<nTx; j++)
             vTxid[j] = block.vtx[j]->GetHash();
+        std::vector<uint256> vTree = CPartialMerkleTree::CalcTreeLevels(vTxid);
+        BOOST_CHECK(vTree.back() == merkleRoot1);
         int nHeight = 1, nTx_ = nTx;
         while (nTx_ > 1) {
             nTx_ = (nTx_+1)/2;
@@ -76,6 +78,11 @@ BOOST_AUTO_TEST_CASE(pmt_test1)
             CDataStream ss(SER_NETWORK, PROTOCOL_VERSION);
             ss << pmt1;
 
+            // building it from the precomputed tree levels gives the same result
+            CDataStream ssLevels(SER_NETWORK, PROTOCOL_VERSION);
+            ssLevels << CPartialMerkleTree(nTx, vTree, vMatch);
+            BOOST_CHECK(ss.str() == ssLevels.str());
+
             // verify CPartialMerkleTree's size guarantees
             unsigned int n = std::min<unsigned int>(nTx, 1 + vMatchTxid1.size()*nHeight);
             BOOST_CHECK(ss.size() <= 10 + (258*n+7)/8);
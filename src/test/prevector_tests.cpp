@@ -266,4 +266,37 @@ BOOST_AUTO_TEST_CASE(PrevectorTestInt)
     }
 }
 
+/** Heap storage keeping track of the bytes it holds */
+struct prevector_counting_storage {
+    static size_t nBytes;
+    static void* allocate(size_t size) { nBytes += size; return malloc(size); }
+    static void* reallocate(void* p, size_t old_size, size_t size) { nBytes += size - old_size; return realloc(p, size); }
+    static void deallocate(void* p, size_t size) { nBytes -= size; free(p); }
+};
+size_t prevector_counting_storage::nBytes = 0;
+
+BOOST_AUTO_TEST_CASE(PrevectorStorage)
+{
+    typedef prevector<8, int, uint32_t, int32_t, prevector_counting_storage> counted_prevector;
+    {
+        counted_prevector v;
+        for (int i = 0; i < 8; i++)
+            v.push_back(i);
+        BOOST_CHECK_EQUAL(prevector_counting_storage::nBytes, 0U);
+        v.push_back(8);
+        BOOST_CHECK_EQUAL(prevector_counting_storage::nBytes, v.capacity() * sizeof(int));
+        v.reserve(100);
+        BOOST_CHECK_EQUAL(prevector_counting_storage::nBytes, 100 * sizeof(int));
+        counted_prevector w(v);
+        BOOST_CHECK(w == v);
+        BOOST_CHECK_EQUAL(prevector_counting_storage::nBytes, 100 * sizeof(int) + w.capacity() * sizeof(int));
+        v.resize(4);
+        v.shrink_to_fit();
+        BOOST_CHECK_EQUAL(prevector_counting_storage::nBytes, w.capacity() * sizeof(int));
+        BOOST_CHECK_EQUAL(v.at(3), 3);
+        BOOST_CHECK_THROW(v.at(4), std::out_of_range);
+    }
+    BOOST_CHECK_EQUAL(prevector_counting_storage::nBytes, 0U);
+}
+
 BOOST_AUTO_TEST_SUITE_END()
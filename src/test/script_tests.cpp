@@ -161,6 +161,11 @@ void DoTest(const CScript &scriptPubKey, const CScript &scriptSig, int flags,
         std::string(FormatScriptError(err)) + " where " +
             std::string(FormatScriptError((ScriptError_t)scriptError)) +
             " expected: " + message);
+    // The standard templates must agree with the interpreter
+    MutableTransactionSignatureChecker checker(&tx, 0, txCredit.vout[0].nValue);
+    BOOST_CHECK_MESSAGE(VerifyScriptGeneric(scriptSig, scriptPubKey, flags, checker) == expect, message);
+    if (!expect)
+        BOOST_CHECK_MESSAGE(!VerifyStandardScript(scriptSig, scriptPubKey, flags, checker), message);
 #if defined(HAVE_CONSENSUS_LIB)
     CDataStream stream(SER_NETWORK, PROTOCOL_VERSION);
     stream << tx2;
@@ -1739,4 +1744,139 @@ BOOST_AUTO_TEST_CASE(script_FindAndDelete) {
     BOOST_CHECK(s == expect);
 }
 
+BOOST_AUTO_TEST_CASE(script_standard_templates)
+{
+    CKey key1, key2, key3;
+    key1.MakeNewKey(true);
+    key2.MakeNewKey(false);
+    key3.MakeNewKey(true);
+    const unsigned int standardFlags = SCRIPT_VERIFY_P2SH | SCRIPT_VERIFY_STRICTENC | SCRIPT_VERIFY_MINIMALDATA | SCRIPT_VERIFY_NULLDUMMY | SCRIPT_VERIFY_CLEANSTACK | SCRIPT_VERIFY_NULLFAIL;
+
+    // Pay to pubkey hash
+    CScript scriptPubKey = GetScriptForDestination(key1.GetPubKey().GetID());
+    CMutableTransaction txFrom = BuildCreditingTransaction(scriptPubKey);
+    CMutableTransaction txTo = BuildSpendingTransaction(CScript(), txFrom);
+    uint256 hash = SignatureHash(scriptPubKey, txTo, 0, SIGHASH_ALL, 0, SIGVERSION_BASE);
+    std::vector<unsigned char> vchSig;
+    BOOST_CHECK(key1.Sign(hash, vchSig));
+    vchSig.push_back((unsigned char)SIGHASH_ALL);
+    CScript scriptSig = CScript() << vchSig << ToByteVector(key1.GetPubKey());
+    {
+        MutableTransactionSignatureChecker checker(&txTo, 0, txFrom.vout[0].nValue);
+        BOOST_CHECK(VerifyStandardScript(scriptSig, scriptPubKey, standardFlags, checker));
+        BOOST_CHECK(VerifyScriptGeneric(scriptSig, scriptPubKey, standardFlags, checker));
+        // Not the template: left to the interpreter
+        CScript scriptSigExtra = CScript() << OP_0 << vchSig << ToByteVector(key1.GetPubKey());
+        BOOST_CHECK(!VerifyStandardScript(scriptSigExtra, scriptPubKey, standardFlags, checker));
+        CScript scriptSigOtherKey = CScript() << vchSig << ToByteVector(key2.GetPubKey());
+        BOOST_CHECK(!VerifyStandardScript(scriptSigOtherKey, scriptPubKey, standardFlags, checker));
+    }
+    txTo.vout[0].nValue = 2;
+    {
+        MutableTransactionSignatureChecker checker(&txTo, 0, txFrom.vout[0].nValue);
+        BOOST_CHECK(!VerifyStandardScript(scriptSig, scriptPubKey, standardFlags, checker));
+    }
+
+    // Pay to script hash, 2 of 3 multisig
+    std::vector<CPubKey> keys;
+    keys.push_back(key1.GetPubKey());
+    keys.push_back(key2.GetPubKey());
+    keys.push_back(key3.GetPubKey());
+    CScript redeemScript = GetScriptForMultisig(2, keys);
+    scriptPubKey = GetScriptForDestination(CScriptID(redeemScript));
+    txFrom = BuildCreditingTransaction(scriptPubKey);
+    txTo = BuildSpendingTransaction(CScript(), txFrom);
+    MutableTransactionSignatureChecker checker(&txTo, 0, txFrom.vout[0].nValue);
+    std::vector<CKey> signers;
+    signers.push_back(key1);
+    signers.push_back(key3);
+    scriptSig = sign_multisig(redeemScript, signers, txTo) << ToByteVector(redeemScript);
+    BOOST_CHECK(VerifyStandardScript(scriptSig, scriptPubKey, standardFlags, checker));
+    BOOST_CHECK(VerifyScriptGeneric(scriptSig, scriptPubKey, standardFlags, checker));
+
+    // Signatures out of order, a dummy that is not empty, or more than the
+    // dummy below the signatures are for the interpreter to reject
+    std::vector<CKey> signersReversed(signers.rbegin(), signers.rend());
+    CScript scriptSigReversed = sign_multisig(redeemScript, signersReversed, txTo) << ToByteVector(redeemScript);
+    BOOST_CHECK(!VerifyStandardScript(scriptSigReversed, scriptPubKey, standardFlags, checker));
+    BOOST_CHECK(!VerifyScriptGeneric(scriptSigReversed, scriptPubKey, standardFlags, checker));
+
+    CScript scriptSigDummy = sign_multisig(redeemScript, signers, txTo) << ToByteVector(redeemScript);
+    scriptSigDummy[0] = OP_1;
+    BOOST_CHECK(!VerifyStandardScript(scriptSigDummy, scriptPubKey, standardFlags, checker));
+    BOOST_CHECK(!VerifyStandardScript(scriptSigDummy, scriptPubKey, standardFlags & ~SCRIPT_VERIFY_NULLDUMMY & ~SCRIPT_VERIFY_MINIMALDATA, checker));
+    BOOST_CHECK(VerifyScriptGeneric(scriptSigDummy, scriptPubKey, standardFlags & ~SCRIPT_VERIFY_NULLDUMMY & ~SCRIPT_VERIFY_MINIMALDATA, checker));
+
+    CScript scriptSigExtra = CScript() << OP_0;
+    scriptSigExtra.insert(scriptSigExtra.end(), scriptSig.begin(), scriptSig.end());
+    BOOST_CHECK(!VerifyStandardScript(scriptSigExtra, scriptPubKey, standardFlags, checker));
+    BOOST_CHECK(VerifyStandardScript(scriptSigExtra, scriptPubKey, standardFlags & ~SCRIPT_VERIFY_CLEANSTACK, checker));
+    BOOST_CHECK(VerifyScriptGeneric(scriptSigExtra, scriptPubKey, standardFlags & ~SCRIPT_VERIFY_CLEANSTACK, checker));
+
+    // Without P2SH, only the hash is checked, which the templates leave to the interpreter
+    BOOST_CHECK(!VerifyStandardScript(scriptSig, scriptPubKey, 0, checker));
+}
+
+#if defined(HAVE_CONSENSUS_LIB)
+BOOST_AUTO_TEST_CASE(script_libconsensus_verify_transaction)
+{
+    CBasicKeyStore keystore;
+    CKey key;
+    key.MakeNewKey(true);
+    keystore.AddKey(key);
+
+    // Two pay-to-pubkey-hash outputs and an anyone-can-spend one, all spent
+    CMutableTransaction txFrom;
+    txFrom.vout.resize(3);
+    txFrom.vout[0].scriptPubKey = GetScriptForDestination(key.GetPubKey().GetID());
+    txFrom.vout[1].scriptPubKey = txFrom.vout[0].scriptPubKey;
+    txFrom.vout[2].scriptPubKey = CScript() << OP_1;
+    CMutableTransaction txTo;
+    txTo.vin.resize(3);
+    for (unsigned int i = 0; i < txTo.vin.size(); i++)
+        txTo.vin[i].prevout = COutPoint(txFrom.GetHash(), i);
+    txTo.vout.resize(1);
+    BOOST_CHECK(SignSignature(keystore, txFrom, txTo, 0, SIGHASH_ALL));
+    BOOST_CHECK(SignSignature(keystore, txFrom, txTo, 1, SIGHASH_ALL));
+    CDataStream stream(SER_NETWORK, PROTOCOL_VERSION);
+    stream << txTo;
+
+    std::vector<const unsigned char*> scriptPubKeys;
+    std::vector<unsigned int> scriptPubKeyLens;
+    for (const CTxOut& txout : txFrom.vout) {
+        scriptPubKeys.push_back(txout.scriptPubKey.data());
+        scriptPubKeyLens.push_back(txout.scriptPubKey.size());
+    }
+    const unsigned int flags = bitcoinconsensus_SCRIPT_FLAGS_VERIFY_P2SH | bitcoinconsensus_SCRIPT_FLAGS_VERIFY_DERSIG;
+    const unsigned char* txToBegin = (const unsigned char*)&stream[0];
+    int results[3];
+    bitcoinconsensus_error err;
+    for (unsigned int nThreads = 0; nThreads <= 4; nThreads++) {
+        BOOST_CHECK_EQUAL(bitcoinconsensus_verify_transaction(scriptPubKeys.data(), scriptPubKeyLens.data(), NULL, txToBegin, stream.size(), 3, flags, nThreads, results, &err), 1);
+        BOOST_CHECK_EQUAL(err, bitcoinconsensus_ERR_OK);
+        for (int result : results)
+            BOOST_CHECK_EQUAL(result, 1);
+    }
+
+    // The second input's signature does not match another output's script
+    const CScript scriptOther = GetScriptForDestination(CKeyID());
+    scriptPubKeys[1] = scriptOther.data();
+    scriptPubKeyLens[1] = scriptOther.size();
+    BOOST_CHECK_EQUAL(bitcoinconsensus_verify_transaction(scriptPubKeys.data(), scriptPubKeyLens.data(), NULL, txToBegin, stream.size(), 3, flags, 2, results, &err), 0);
+    BOOST_CHECK_EQUAL(err, bitcoinconsensus_ERR_OK);
+    BOOST_CHECK_EQUAL(results[0], 1);
+    BOOST_CHECK_EQUAL(results[1], 0);
+    BOOST_CHECK_EQUAL(results[2], 1);
+
+    BOOST_CHECK_EQUAL(bitcoinconsensus_verify_transaction(scriptPubKeys.data(), scriptPubKeyLens.data(), NULL, txToBegin, stream.size(), 2, flags, 1, results, &err), 0);
+    BOOST_CHECK_EQUAL(err, bitcoinconsensus_ERR_TX_INDEX);
+    BOOST_CHECK_EQUAL(bitcoinconsensus_verify_transaction(scriptPubKeys.data(), scriptPubKeyLens.data(), NULL, txToBegin, stream.size() - 1, 3, flags, 1, results, &err), 0);
+    BOOST_CHECK_EQUAL(err, bitcoinconsensus_ERR_TX_DESERIALIZE);
+    BOOST_CHECK_EQUAL(bitcoinconsensus_verify_transaction(scriptPubKeys.data(), scriptPubKeyLens.data(), NULL, txToBegin, stream.size(), 3, flags | bitcoinconsensus_SCRIPT_FLAGS_VERIFY_WITNESS, 1, results, &err), 0);
+    BOOST_CHECK_EQUAL(err, bitcoinconsensus_ERR_AMOUNT_REQUIRED);
+    BOOST_CHECK_EQUAL(bitcoinconsensus_verify_transaction(scriptPubKeys.data(), scriptPubKeyLens.data(), NULL, txToBegin, stream.size(), 3, 1U << 31, 1, results, &err), 0);
+    BOOST_CHECK_EQUAL(err, bitcoinconsensus_ERR_INVALID_FLAGS);
+}
+#endif
+
 BOOST_AUTO_TEST_SUITE_END()
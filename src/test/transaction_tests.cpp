@@ -454,6 +454,44 @@ BOOST_AUTO_TEST_CASE(test_witness)
     CheckWithFlag(output1, input1, STANDARD_SCRIPT_VERIFY_FLAGS, true);
 }
 
+BOOST_AUTO_TEST_CASE(test_sign_precomputed)
+{
+    // All inputs of a transaction signed with one PrecomputedTransactionData,
+    // as the RPC and the wallet do, verify without it
+    CBasicKeyStore keystore;
+    CKey key;
+    key.MakeNewKey(true);
+    keystore.AddKey(key);
+    const CScript scriptPubKey = GetScriptForDestination(key.GetPubKey().GetID());
+
+    CMutableTransaction mtx;
+    mtx.vin.resize(20);
+    for (unsigned int i = 0; i < mtx.vin.size(); i++) {
+        mtx.vin[i].prevout = COutPoint(GetRandHash(), i);
+        mtx.vin[i].nSequence = i;
+    }
+    mtx.vout.resize(20);
+    for (unsigned int i = 0; i < mtx.vout.size(); i++) {
+        mtx.vout[i].nValue = i * CENT;
+        mtx.vout[i].scriptPubKey = CScript() << OP_TRUE;
+    }
+    mtx.nLockTime = 1234;
+
+    const int hashTypes[] = {SIGHASH_ALL, SIGHASH_NONE, SIGHASH_SINGLE, SIGHASH_ALL | SIGHASH_ANYONECANPAY};
+    const CTransaction txConst(mtx);
+    const PrecomputedTransactionData txdata(txConst);
+    for (unsigned int i = 0; i < mtx.vin.size(); i++) {
+        SignatureData sigdata;
+        BOOST_CHECK(ProduceSignature(TransactionSignatureCreator(&keystore, &txConst, i, 0, hashTypes[i % 4], &txdata), scriptPubKey, sigdata));
+        UpdateTransaction(mtx, i, sigdata);
+    }
+    for (unsigned int i = 0; i < mtx.vin.size(); i++) {
+        ScriptError serror;
+        BOOST_CHECK(VerifyScript(mtx.vin[i].scriptSig, scriptPubKey, STANDARD_SCRIPT_VERIFY_FLAGS, MutableTransactionSignatureChecker(&mtx, i, 0), &serror));
+        BOOST_CHECK_EQUAL(serror, SCRIPT_ERR_OK);
+    }
+}
+
 BOOST_AUTO_TEST_CASE(test_IsStandard)
 {
     LOCK(cs_main);
@@ -0,0 +1,174 @@
+// Copyright (c) 2017 The Bitcoin Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "txreconciliation.h"
+#include "streams.h"
+#include "version.h"
+#include "test/test_bitcoin.h"
+#include "test/test_random.h"
+
+#include <algorithm>
+
+#include <boost/test/unit_test.hpp>
+
+BOOST_FIXTURE_TEST_SUITE(txreconciliation_tests, BasicTestingSetup)
+
+static std::vector<uint32_t> RandomElements(size_t nCount)
+{
+    std::vector<uint32_t> vElements;
+    while (vElements.size() < nCount) {
+        uint32_t nElement = insecure_rand();
+        if (nElement != 0 && std::find(vElements.begin(), vElements.end(), nElement) == vElements.end())
+            vElements.push_back(nElement);
+    }
+    return vElements;
+}
+
+BOOST_AUTO_TEST_CASE(sketch_decode)
+{
+    for (unsigned int nCapacity : {1, 2, 10, 64}) {
+        for (size_t nCount = 0; nCount <= nCapacity; nCount += std::max(1u, nCapacity / 4)) {
+            std::vector<uint32_t> vElements = RandomElements(nCount);
+            CTxSketch sketch(nCapacity);
+            for (uint32_t nElement : vElements)
+                sketch.Add(nElement);
+            std::vector<uint32_t> vDecoded;
+            BOOST_CHECK(sketch.Decode(vDecoded));
+            std::sort(vElements.begin(), vElements.end());
+            std::sort(vDecoded.begin(), vDecoded.end());
+            BOOST_CHECK(vDecoded == vElements);
+        }
+
+        // More elements than the capacity are detected rather than misdecoded,
+        // except with a probability of about 1/c!: small sketches cannot tell
+        if (nCapacity < 10)
+            continue;
+        std::vector<uint32_t> vElements = RandomElements(nCapacity + 1 + insecure_rand() % 8);
+        CTxSketch sketch(nCapacity);
+        for (uint32_t nElement : vElements)
+            sketch.Add(nElement);
+        std::vector<uint32_t> vDecoded;
+        BOOST_CHECK(!sketch.Decode(vDecoded));
+        BOOST_CHECK(vDecoded.empty());
+    }
+}
+
+BOOST_AUTO_TEST_CASE(sketch_merge)
+{
+    // Elements both sets have cancel out
+    std::vector<uint32_t> vShared = RandomElements(100);
+    std::vector<uint32_t> vOnlyA = RandomElements(3);
+    std::vector<uint32_t> vOnlyB = RandomElements(4);
+    CTxSketch sketchA(10), sketchB(10);
+    for (uint32_t nElement : vShared) {
+        sketchA.Add(nElement);
+        sketchB.Add(nElement);
+    }
+    for (uint32_t nElement : vOnlyA)
+        sketchA.Add(nElement);
+    for (uint32_t nElement : vOnlyB)
+        sketchB.Add(nElement);
+
+    // ...also after a round trip as sent in sketch messages
+    CDataStream stream(SER_NETWORK, PROTOCOL_VERSION);
+    stream << sketchB;
+    BOOST_CHECK_EQUAL(stream.size(), 1 + 10 * 4);
+    CTxSketch sketchReceived;
+    stream >> sketchReceived;
+    BOOST_CHECK_EQUAL(sketchReceived.GetCapacity(), 10);
+
+    sketchA.Merge(sketchReceived);
+    std::vector<uint32_t> vDecoded, vExpected(vOnlyA);
+    vExpected.insert(vExpected.end(), vOnlyB.begin(), vOnlyB.end());
+    BOOST_CHECK(sketchA.Decode(vDecoded));
+    std::sort(vDecoded.begin(), vDecoded.end());
+    std::sort(vExpected.begin(), vExpected.end());
+    BOOST_CHECK(vDecoded == vExpected);
+}
+
+BOOST_AUTO_TEST_CASE(reconciliation_state)
+{
+    uint64_t nSaltA = insecure_rand(), nSaltB = insecure_rand();
+    CTxReconciliationState stateA(true, nSaltA, nSaltB), stateB(false, nSaltB, nSaltA), stateC(false, nSaltA, nSaltA + 1);
+
+    // Both sides compute the same short ids, other connections different ones
+    int nSameOtherConnection = 0;
+    for (int i = 0; i < 100; i++) {
+        uint256 txid = GetRandHash();
+        BOOST_CHECK(stateA.GetShortID(txid) != 0);
+        BOOST_CHECK_EQUAL(stateA.GetShortID(txid), stateB.GetShortID(txid));
+        nSameOtherConnection += stateA.GetShortID(txid) == stateC.GetShortID(txid);
+    }
+    BOOST_CHECK(nSameOtherConnection < 2);
+
+    // A reconciliation round: A has one transaction B lacks, B has two A lacks
+    std::vector<uint256> vShared;
+    for (int i = 0; i < 20; i++)
+        vShared.push_back(GetRandHash());
+    stateA.setToReconcile.insert(vShared.begin(), vShared.end());
+    stateB.setToReconcile.insert(vShared.begin(), vShared.end());
+    uint256 txOnlyA = GetRandHash(), txOnlyB1 = GetRandHash(), txOnlyB2 = GetRandHash();
+    stateA.setToReconcile.insert(txOnlyA);
+    stateB.setToReconcile.insert(txOnlyB1);
+    stateB.setToReconcile.insert(txOnlyB2);
+
+    unsigned int nCapacity = CTxReconciliationState::EstimateCapacity(stateB.setToReconcile.size(), stateA.setToReconcile.size());
+    BOOST_CHECK_EQUAL(nCapacity, 1 + 21 / 4 + 1);
+    CTxSketch sketch = stateA.GetSketch(nCapacity);
+    sketch.Merge(stateB.GetSketch(nCapacity));
+    std::vector<uint32_t> vDecoded, vExpected;
+    vExpected.push_back(stateA.GetShortID(txOnlyA));
+    vExpected.push_back(stateA.GetShortID(txOnlyB1));
+    vExpected.push_back(stateA.GetShortID(txOnlyB2));
+    BOOST_CHECK(sketch.Decode(vDecoded));
+    std::sort(vDecoded.begin(), vDecoded.end());
+    std::sort(vExpected.begin(), vExpected.end());
+    BOOST_CHECK(vDecoded == vExpected);
+
+    BOOST_CHECK_EQUAL(CTxReconciliationState::EstimateCapacity(0, 0), 1);
+    BOOST_CHECK_EQUAL(CTxReconciliationState::EstimateCapacity(100000, 0), MAX_SKETCH_CAPACITY);
+}
+
+BOOST_AUTO_TEST_CASE(reconciliation_timeout)
+{
+    const int64_t nTimeout = RECON_RESPONSE_TIMEOUT * 1000000;
+    CTxReconciliationState initiator(true, 1, 2), responder(false, 2, 1);
+    std::vector<uint256> vHashes;
+
+    // An initiator between rounds has nothing to time out
+    initiator.setToReconcile.insert(GetRandHash());
+    BOOST_CHECK(!initiator.ExpireRound(nTimeout * 10, vHashes));
+
+    // A request that is not answered in time gives up the round
+    initiator.fRoundInProgress = true;
+    initiator.nRoundTimeout = 1000 + nTimeout;
+    BOOST_CHECK(!initiator.ExpireRound(1000 + nTimeout, vHashes));
+    BOOST_CHECK(initiator.ExpireRound(1001 + nTimeout, vHashes));
+    BOOST_CHECK_EQUAL(vHashes.size(), 1);
+    BOOST_CHECK(initiator.setToReconcile.empty());
+    BOOST_CHECK(!initiator.fRoundInProgress);
+
+    // A responder gives up both on the sketched set and on the one collected since
+    vHashes.clear();
+    uint256 txSketched = GetRandHash(), txPending = GetRandHash();
+    responder.mapSnapshot[responder.GetShortID(txSketched)] = txSketched;
+    responder.setToReconcile.insert(txPending);
+    responder.fRoundInProgress = true;
+    responder.nRoundTimeout = 1000;
+    BOOST_CHECK(responder.ExpireRound(1001, vHashes));
+    BOOST_CHECK_EQUAL(vHashes.size(), 2);
+    BOOST_CHECK(std::find(vHashes.begin(), vHashes.end(), txSketched) != vHashes.end());
+    BOOST_CHECK(std::find(vHashes.begin(), vHashes.end(), txPending) != vHashes.end());
+    BOOST_CHECK(responder.mapSnapshot.empty() && responder.setToReconcile.empty());
+    BOOST_CHECK(!responder.fRoundInProgress);
+
+    // ... and, once idle, on an initiator that stops requesting
+    vHashes.clear();
+    responder.setToReconcile.insert(txPending);
+    BOOST_CHECK(!responder.ExpireRound(1001 + nTimeout, vHashes));
+    BOOST_CHECK(responder.ExpireRound(1002 + nTimeout, vHashes));
+    BOOST_CHECK_EQUAL(vHashes.size(), 1);
+}
+
+BOOST_AUTO_TEST_SUITE_END()
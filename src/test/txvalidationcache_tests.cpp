@@ -4,11 +4,15 @@
 
 #include "consensus/validation.h"
 #include "key.h"
+#include "keystore.h"
 #include "validation.h"
 #include "miner.h"
+#include "policy/policy.h"
 #include "pubkey.h"
 #include "txmempool.h"
 #include "random.h"
+#include "script/sigcache.h"
+#include "script/sign.h"
 #include "script/standard.h"
 #include "test/test_bitcoin.h"
 #include "utiltime.h"
@@ -84,4 +88,188 @@ BOOST_FIXTURE_TEST_CASE(tx_mempool_block_doublespend, TestChain100Setup)
     BOOST_CHECK_EQUAL(mempool.size(), 0);
 }
 
+BOOST_FIXTURE_TEST_CASE(checkinputs_test, TestingSetup)
+{
+    // Transactions whose scripts all passed are not checked again with the
+    // same flags: CheckInputs then queues no script checks.
+    CBasicKeyStore keystore;
+    CKey key;
+    key.MakeNewKey(true);
+    keystore.AddKey(key);
+
+    CMutableTransaction funding;
+    funding.vin.resize(1);
+    funding.vin[0].prevout = COutPoint(GetRandHash(), 0);
+    funding.vout.resize(2);
+    for (CTxOut& out : funding.vout) {
+        out.nValue = 10 * COIN;
+        out.scriptPubKey = GetScriptForDestination(key.GetPubKey().GetID());
+    }
+    CCoinsViewCache coins(pcoinsTip);
+    coins.ModifyCoins(funding.GetHash())->FromTx(funding, 0);
+
+    std::vector<CTransaction> spends;
+    for (unsigned int n = 0; n < 2; n++) {
+        CMutableTransaction spend;
+        spend.vin.resize(1);
+        spend.vin[0].prevout = COutPoint(funding.GetHash(), n);
+        spend.vout.resize(1);
+        spend.vout[0].nValue = 9 * COIN;
+        spend.vout[0].scriptPubKey = CScript() << OP_TRUE;
+        BOOST_CHECK(SignSignature(keystore, funding, spend, 0, SIGHASH_ALL));
+        spends.push_back(CTransaction(spend));
+    }
+
+    LOCK(cs_main);
+    const unsigned int flags = SCRIPT_VERIFY_P2SH | SCRIPT_VERIFY_DERSIG;
+    CValidationState state;
+    std::vector<CScriptCheck> vChecks;
+
+    // Not cached before a successful inline check asking for it
+    PrecomputedTransactionData txdata0(spends[0]);
+    BOOST_CHECK(CheckInputs(spends[0], state, coins, true, flags, true, false, txdata0));
+    BOOST_CHECK(CheckInputs(spends[0], state, coins, true, flags, true, true, txdata0, &vChecks));
+    BOOST_CHECK_EQUAL(vChecks.size(), 1);
+    vChecks.clear();
+
+    BOOST_CHECK(CheckInputs(spends[0], state, coins, true, flags, true, true, txdata0));
+    BOOST_CHECK(CheckInputs(spends[0], state, coins, true, flags, true, false, txdata0, &vChecks));
+    BOOST_CHECK(vChecks.empty());
+
+    // Only for those flags
+    BOOST_CHECK(CheckInputs(spends[0], state, coins, true, flags | SCRIPT_VERIFY_LOW_S, true, false, txdata0, &vChecks));
+    BOOST_CHECK_EQUAL(vChecks.size(), 1);
+    vChecks.clear();
+
+    // Only for that transaction
+    PrecomputedTransactionData txdata1(spends[1]);
+    BOOST_CHECK(CheckInputs(spends[1], state, coins, true, flags, true, false, txdata1, &vChecks));
+    BOOST_CHECK_EQUAL(vChecks.size(), 1);
+    vChecks.clear();
+
+    // Failing scripts are never cached
+    CMutableTransaction invalid(spends[1]);
+    invalid.vin[0].scriptSig = CScript() << OP_0;
+    CTransaction invalidTx(invalid);
+    PrecomputedTransactionData txdataInvalid(invalidTx);
+    BOOST_CHECK(!CheckInputs(invalidTx, state, coins, true, flags, true, true, txdataInvalid));
+    BOOST_CHECK(!CheckInputs(invalidTx, state, coins, true, flags, true, true, txdataInvalid));
+}
+
+BOOST_FIXTURE_TEST_CASE(batch_verify_test, TestingSetup)
+{
+    // Script checks run with their signatures batched give the same results
+    // as checked one by one, including scripts that need an invalid one.
+    CKey key, otherKey;
+    key.MakeNewKey(true);
+    otherKey.MakeNewKey(true);
+    const int NUM_P2PKH = 8;
+
+    CMutableTransaction funding;
+    funding.vin.resize(1);
+    funding.vin[0].prevout = COutPoint(GetRandHash(), 0);
+    funding.vout.resize(NUM_P2PKH + 1);
+    for (CTxOut& out : funding.vout) {
+        out.nValue = 10 * COIN;
+        out.scriptPubKey = GetScriptForDestination(key.GetPubKey().GetID());
+    }
+    funding.vout[NUM_P2PKH].scriptPubKey = CScript() << ToByteVector(key.GetPubKey()) << OP_CHECKSIG << OP_NOT;
+    const CTransaction fundingTx(funding);
+    CCoinsViewCache coins(pcoinsTip);
+    coins.ModifyCoins(fundingTx.GetHash())->FromTx(fundingTx, 0);
+
+    auto Spend = [&](unsigned int n, const CKey& signer) {
+        CMutableTransaction spend;
+        spend.vin.resize(1);
+        spend.vin[0].prevout = COutPoint(fundingTx.GetHash(), n);
+        spend.vout.resize(1);
+        spend.vout[0].nValue = 9 * COIN;
+        spend.vout[0].scriptPubKey = CScript() << OP_TRUE;
+        const CScript& scriptPubKey = fundingTx.vout[n].scriptPubKey;
+        uint256 hash = SignatureHash(scriptPubKey, spend, 0, SIGHASH_ALL, fundingTx.vout[n].nValue, SIGVERSION_BASE);
+        std::vector<unsigned char> vchSig;
+        BOOST_CHECK(signer.Sign(hash, vchSig));
+        vchSig.push_back((unsigned char)SIGHASH_ALL);
+        spend.vin[0].scriptSig << vchSig;
+        if (n < NUM_P2PKH)
+            spend.vin[0].scriptSig << ToByteVector(key.GetPubKey());
+        return spend;
+    };
+    auto Run = [&](const std::vector<CMutableTransaction>& spends) {
+        LOCK(cs_main);
+        CValidationState state;
+        std::vector<CTransaction> txs;
+        std::vector<PrecomputedTransactionData> txdata;
+        txs.reserve(spends.size());
+        txdata.reserve(spends.size());
+        std::vector<CScriptCheck> vChecks;
+        for (const CMutableTransaction& spend : spends) {
+            txs.emplace_back(spend);
+            txdata.emplace_back(txs.back());
+            BOOST_CHECK(CheckInputs(txs.back(), state, coins, true, SCRIPT_VERIFY_P2SH, false, false, txdata.back(), &vChecks));
+        }
+        return RunChecks(vChecks);
+    };
+
+    std::vector<CMutableTransaction> valid;
+    for (unsigned int n = 0; n < NUM_P2PKH; n++)
+        valid.push_back(Spend(n, key));
+
+    for (bool fBatch : {true, false}) {
+        fBatchVerify = fBatch;
+        BOOST_CHECK(Run(valid));
+
+        // Any invalid signature fails the block
+        for (unsigned int n : {0, 3, NUM_P2PKH - 1}) {
+            std::vector<CMutableTransaction> txs(valid);
+            txs[n] = Spend(n, otherKey);
+            BOOST_CHECK(!Run(txs));
+        }
+
+        // ...unless the script wants it, which fails the batch but not the block
+        std::vector<CMutableTransaction> txs(valid);
+        txs.push_back(Spend(NUM_P2PKH, otherKey));
+        BOOST_CHECK(Run(txs));
+        txs.back() = Spend(NUM_P2PKH, key);
+        BOOST_CHECK(!Run(txs));
+    }
+    fBatchVerify = DEFAULT_BATCH_VERIFY;
+}
+
+BOOST_FIXTURE_TEST_CASE(batch_verify_multisig_test, TestingSetup)
+{
+    // A 1-of-2 multisig spend verifies with a batch whichever key signed it:
+    // only the signature tried against the last key left is deferred.
+    CKey key1, key2;
+    key1.MakeNewKey(true);
+    key2.MakeNewKey(true);
+    CScript redeemScript = GetScriptForMultisig(1, {key1.GetPubKey(), key2.GetPubKey()});
+    CScript scriptPubKey = GetScriptForDestination(CScriptID(redeemScript));
+
+    for (const CKey* signer : {&key1, &key2}) {
+        CMutableTransaction spend;
+        spend.vin.resize(1);
+        spend.vin[0].prevout = COutPoint(GetRandHash(), 0);
+        spend.vout.resize(1);
+        spend.vout[0].scriptPubKey = CScript() << OP_TRUE;
+        uint256 hash = SignatureHash(redeemScript, spend, 0, SIGHASH_ALL, 0, SIGVERSION_BASE);
+        std::vector<unsigned char> vchSig;
+        BOOST_CHECK(signer->Sign(hash, vchSig));
+        vchSig.push_back((unsigned char)SIGHASH_ALL);
+        spend.vin[0].scriptSig = CScript() << OP_0 << vchSig << ToByteVector(redeemScript);
+        const CTransaction tx(spend);
+        PrecomputedTransactionData txdata(tx);
+
+        // Through the multisig template as well as the interpreter
+        for (bool fGeneric : {false, true}) {
+            CSignatureBatch batch;
+            CachingTransactionSignatureChecker checker(&tx, 0, 0, false, txdata, &batch);
+            BOOST_CHECK(fGeneric ? VerifyScriptGeneric(tx.vin[0].scriptSig, scriptPubKey, STANDARD_SCRIPT_VERIFY_FLAGS, checker)
+                                 : VerifyScript(tx.vin[0].scriptSig, scriptPubKey, STANDARD_SCRIPT_VERIFY_FLAGS, checker));
+            BOOST_CHECK(batch.size() <= 1);
+            BOOST_CHECK(batch.Verify());
+        }
+    }
+}
+
 BOOST_AUTO_TEST_SUITE_END()
@@ -41,6 +41,7 @@ static const int64_t nMaxBlockDBCache = 2;
 static const int64_t nMaxBlockDBAndTxIndexCache = 1024;
 //! Max memory allocated to coin DB specific cache (MiB)
 static const int64_t nMaxCoinsDBCache = 8;
+static const int64_t nMaxBlockFilterIndexCache = 1024;
 
 struct CDiskTxPos : public CDiskBlockPos
 {
@@ -37,6 +37,7 @@ CTxMemPoolEntry::CTxMemPoolEntry(const CTransactionRef& _tx, const CAmount& _nFe
     assert(inChainInputValue <= nValueIn);
 
     feeDelta = 0;
+    cachedPriority = entryPriority;
 
     nCountWithAncestors = 1;
     nSizeWithAncestors = GetTxSize();
@@ -71,6 +72,12 @@ void CTxMemPoolEntry::UpdateLockPoints(const LockPoints& lp)
     lockPoints = lp;
 }
 
+void CTxMemPoolEntry::UpdateCachedPriority(unsigned int currentHeight, double dPriorityDelta)
+{
+    // Never age an entry backwards past the height it entered the pool at
+    cachedPriority = GetPriority(std::max(currentHeight, entryHeight)) + dPriorityDelta;
+}
+
 // Update the given tx for any in-mempool descendants.
 // Assumes that setMemPoolChildren is correct for the given tx and all
 // descendants.
@@ -344,7 +351,7 @@ void CTxMemPoolEntry::UpdateAncestorState(int64_t modifySize, CAmount modifyFee,
 }
 
 CTxMemPool::CTxMemPool(const CFeeRate& _minReasonableRelayFee) :
-    nTransactionsUpdated(0)
+    nTransactionsUpdated(0), nPriorityHeight(0)
 {
     _clear(); //lock free clear
 
@@ -399,13 +406,16 @@ bool CTxMemPool::addUnchecked(const uint256& hash, const CTxMemPoolEntry &entry,
     // Update transaction for any feeDelta created by PrioritiseTransaction
     // TODO: refactor so that the fee delta is calculated before inserting
     // into mapTx.
+    double dPriorityDelta = 0;
     std::map<uint256, std::pair<double, CAmount> >::const_iterator pos = mapDeltas.find(hash);
     if (pos != mapDeltas.end()) {
         const std::pair<double, CAmount> &deltas = pos->second;
+        dPriorityDelta = deltas.first;
         if (deltas.second) {
             mapTx.modify(newit, update_fee_delta(deltas.second));
         }
     }
+    mapTx.modify(newit, update_priority(nPriorityHeight, dPriorityDelta));
 
     // Update cachedInnerUsage to include contained transaction's usage.
     // (When we update the entry for in-mempool parents, memory usage will be
@@ -932,6 +942,7 @@ void CTxMemPool::PrioritiseTransaction(const uint256 hash, const std::string str
         txiter it = mapTx.find(hash);
         if (it != mapTx.end()) {
             mapTx.modify(it, update_fee_delta(deltas.second));
+            mapTx.modify(it, update_priority(nPriorityHeight, deltas.first));
             // Now update all ancestors' modified fees with descendants
             setEntries setAncestors;
             uint64_t nNoLimit = std::numeric_limits<uint64_t>::max();
@@ -970,6 +981,22 @@ void CTxMemPool::ClearPrioritisation(const uint256 hash)
     mapDeltas.erase(hash);
 }
 
+void CTxMemPool::UpdatePriorities(unsigned int nHeight)
+{
+    LOCK(cs);
+    if (nHeight == nPriorityHeight)
+        return;
+    nPriorityHeight = nHeight;
+    // Walk the txid index, whose order is unaffected by the modification
+    for (txiter it = mapTx.begin(); it != mapTx.end(); ++it) {
+        double dPriorityDelta = 0;
+        std::map<uint256, std::pair<double, CAmount> >::const_iterator pos = mapDeltas.find(it->GetTx().GetHash());
+        if (pos != mapDeltas.end())
+            dPriorityDelta = pos->second.first;
+        mapTx.modify(it, update_priority(nHeight, dPriorityDelta));
+    }
+}
+
 bool CTxMemPool::HasNoInputsOf(const CTransaction &tx) const
 {
     for (unsigned int i = 0; i < tx.vin.size(); i++)
@@ -998,8 +1025,8 @@ bool CCoinsViewMemPool::HaveCoins(const uint256 &txid) const {
 
 size_t CTxMemPool::DynamicMemoryUsage() const {
     LOCK(cs);
-    // Estimate the overhead of mapTx to be 15 pointers + an allocation, as no exact formula for boost::multi_index_contained is implemented.
-    return memusage::MallocUsage(sizeof(CTxMemPoolEntry) + 15 * sizeof(void*)) * mapTx.size() + memusage::DynamicUsage(mapNextTx) + memusage::DynamicUsage(mapDeltas) + memusage::DynamicUsage(mapLinks) + memusage::DynamicUsage(vTxHashes) + cachedInnerUsage;
+    // Estimate the overhead of mapTx to be 18 pointers + an allocation, as no exact formula for boost::multi_index_contained is implemented.
+    return memusage::MallocUsage(sizeof(CTxMemPoolEntry) + 18 * sizeof(void*)) * mapTx.size() + memusage::DynamicUsage(mapNextTx) + memusage::DynamicUsage(mapDeltas) + memusage::DynamicUsage(mapLinks) + memusage::DynamicUsage(vTxHashes) + cachedInnerUsage;
 }
 
 void CTxMemPool::RemoveStaged(setEntries &stage, bool updateDescendants, MemPoolRemovalReason reason) {
@@ -94,6 +94,7 @@ private:
     bool spendsCoinbase;       //!< keep track of transactions that spend a coinbase
     int64_t sigOpCount;        //!< Total sigop plus P2SH sigops count
     int64_t feeDelta;          //!< Used for determining the priority of the transaction for mining in a block
+    double cachedPriority;     //!< Coin age priority (including any delta) at the mempool's priority height
     LockPoints lockPoints;     //!< Track the height and time at which tx was final
 
     // Information about descendants of this transaction that are in the
@@ -126,6 +127,7 @@ public:
      * from entry priority. Only inputs that were originally in-chain will age.
      */
     double GetPriority(unsigned int currentHeight) const;
+    double GetCachedPriority() const { return cachedPriority; }
     const CAmount& GetFee() const { return nFee; }
     size_t GetTxSize() const { return nTxSize; }
     int64_t GetTime() const { return nTime; }
@@ -144,6 +146,9 @@ public:
     void UpdateFeeDelta(int64_t feeDelta);
     // Update the LockPoints after a reorg
     void UpdateLockPoints(const LockPoints& lp);
+    // Recompute the cached priority at the given height, plus any priority
+    // delta from PrioritiseTransaction
+    void UpdateCachedPriority(unsigned int currentHeight, double dPriorityDelta);
 
     uint64_t GetCountWithDescendants() const { return nCountWithDescendants; }
     uint64_t GetSizeWithDescendants() const { return nSizeWithDescendants; }
@@ -201,6 +206,19 @@ private:
     int64_t feeDelta;
 };
 
+struct update_priority
+{
+    update_priority(unsigned int _nHeight, double _dPriorityDelta) :
+        nHeight(_nHeight), dPriorityDelta(_dPriorityDelta)
+    {}
+
+    void operator() (CTxMemPoolEntry &e) { e.UpdateCachedPriority(nHeight, dPriorityDelta); }
+
+private:
+    unsigned int nHeight;
+    double dPriorityDelta;
+};
+
 struct update_lock_points
 {
     update_lock_points(const LockPoints& _lp) : lp(_lp) { }
@@ -308,11 +326,28 @@ public:
     }
 };
 
+/** \class CompareTxMemPoolEntryByPriority
+ *
+ *  Sort by cached coin age priority in descending order, with ties broken
+ *  by mining score.
+ */
+class CompareTxMemPoolEntryByPriority
+{
+public:
+    bool operator()(const CTxMemPoolEntry& a, const CTxMemPoolEntry& b)
+    {
+        if (a.GetCachedPriority() == b.GetCachedPriority())
+            return CompareTxMemPoolEntryByScore()(a, b);
+        return a.GetCachedPriority() > b.GetCachedPriority();
+    }
+};
+
 // Multi_index tag names
 struct descendant_score {};
 struct entry_time {};
 struct mining_score {};
 struct ancestor_score {};
+struct coin_age_priority {};
 
 class CBlockPolicyEstimator;
 
@@ -362,11 +397,13 @@ enum class MemPoolRemovalReason {
  *
  * CTxMemPool::mapTx, and CTxMemPoolEntry bookkeeping:
  *
- * mapTx is a boost::multi_index that sorts the mempool on 4 criteria:
+ * mapTx is a boost::multi_index that sorts the mempool on 6 criteria:
  * - transaction hash
  * - feerate [we use max(feerate of tx, feerate of tx with all descendants)]
  * - time in mempool
  * - mining score (feerate modified by any fee deltas from PrioritiseTransaction)
+ * - feerate with ancestors
+ * - coin age priority at nPriorityHeight (modified by any priority deltas)
  *
  * Note: the term "descendant" refers to in-mempool transactions that depend on
  * this one, while "ancestor" refers to in-mempool transactions that a given
@@ -426,12 +463,24 @@ enum class MemPoolRemovalReason {
  * the entry as "dirty", and set the feerate for sorting purposes to be equal
  * the feerate of the transaction without any descendants.
  *
+ * Coin age priority:
+ *
+ * Priority grows with the height of the chain, at a different rate for every
+ * transaction, so the coin_age_priority index can only be kept sorted for one
+ * height at a time. CreateNewBlock() re-keys every entry for the height of the
+ * block it assembles (UpdatePriorities()), which only does work for the
+ * first template after the tip changed, and then walks the index instead of
+ * recomputing and sorting the priority of the whole mempool for each
+ * template. Nodes that do not assemble blocks with -blockprioritysize never
+ * pay for the re-keying.
+ *
  */
 class CTxMemPool
 {
 private:
     uint32_t nCheckFrequency; //!< Value n means that n times in 2^32 we check.
     unsigned int nTransactionsUpdated; //!< Used by getblocktemplate to trigger CreateNewBlock() invocation
+    unsigned int nPriorityHeight; //!< Height the coin_age_priority index is keyed for
     CBlockPolicyEstimator* minerPolicyEstimator;
 
     uint64_t totalTxSize;      //!< sum of all mempool tx's virtual sizes.
@@ -475,6 +524,12 @@ public:
                 boost::multi_index::tag<ancestor_score>,
                 boost::multi_index::identity<CTxMemPoolEntry>,
                 CompareTxMemPoolEntryByAncestorFee
+            >,
+            // sorted by coin age priority (for the priority block space)
+            boost::multi_index::ordered_non_unique<
+                boost::multi_index::tag<coin_age_priority>,
+                boost::multi_index::identity<CTxMemPoolEntry>,
+                CompareTxMemPoolEntryByPriority
             >
         >
     > indexed_transaction_set;
@@ -558,6 +613,10 @@ public:
     void ApplyDeltas(const uint256 hash, double &dPriorityDelta, CAmount &nFeeDelta) const;
     void ClearPrioritisation(const uint256 hash);
 
+    /** Re-key the coin_age_priority index for a block at the given height */
+    void UpdatePriorities(unsigned int nHeight);
+    unsigned int GetPriorityHeight() const { AssertLockHeld(cs); return nPriorityHeight; }
+
 public:
     /** Remove a set of transactions from the mempool.
      *  If a transaction is in this set, then all in-mempool descendants must
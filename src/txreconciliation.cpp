@@ -0,0 +1,275 @@
+// Copyright (c) 2017 The Bitcoin Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "txreconciliation.h"
+
+#include "hash.h"
+
+#include <algorithm>
+#include <assert.h>
+
+namespace {
+
+/** GF(2^32) is represented as GF(2)[x] / (x^32 + x^7 + x^3 + x^2 + 1) */
+const uint32_t GF_MODULUS = 0x8D;
+
+uint32_t GFMul(uint32_t a, uint32_t b)
+{
+    uint32_t r = 0;
+    while (b) {
+        if (b & 1)
+            r ^= a;
+        b >>= 1;
+        a = (a << 1) ^ ((a & 0x80000000) ? GF_MODULUS : 0);
+    }
+    return r;
+}
+
+uint32_t GFInv(uint32_t a)
+{
+    // a^(2^32 - 2) = a^2 * a^4 * ... * a^(2^31)
+    uint32_t r = 1;
+    for (int i = 1; i < 32; i++) {
+        a = GFMul(a, a);
+        r = GFMul(r, a);
+    }
+    return r;
+}
+
+/** Polynomial over GF(2^32), lowest degree coefficient first */
+typedef std::vector<uint32_t> Poly;
+
+void Trim(Poly& p)
+{
+    while (!p.empty() && p.back() == 0)
+        p.pop_back();
+}
+
+void MakeMonic(Poly& p)
+{
+    uint32_t inv = GFInv(p.back());
+    for (uint32_t& c : p)
+        c = GFMul(c, inv);
+}
+
+/** Reduce a modulo the monic polynomial m, optionally keeping the quotient */
+void PolyDivMod(Poly& a, const Poly& m, Poly* quotient = NULL)
+{
+    if (quotient)
+        quotient->assign(a.size() >= m.size() ? a.size() - m.size() + 1 : 0, 0);
+    while (a.size() >= m.size()) {
+        const uint32_t c = a.back();
+        const size_t nShift = a.size() - m.size();
+        if (quotient)
+            (*quotient)[nShift] = c;
+        for (size_t i = 0; i < m.size(); i++)
+            a[nShift + i] ^= GFMul(c, m[i]);
+        a.pop_back();
+    }
+    Trim(a);
+}
+
+/** Square p modulo m; squaring is linear in characteristic 2 */
+Poly SqrMod(const Poly& p, const Poly& m)
+{
+    Poly r(p.empty() ? 0 : 2 * p.size() - 1, 0);
+    for (size_t i = 0; i < p.size(); i++)
+        r[2 * i] = GFMul(p[i], p[i]);
+    PolyDivMod(r, m);
+    return r;
+}
+
+/** Monic greatest common divisor */
+Poly Gcd(Poly a, Poly b)
+{
+    Trim(a);
+    Trim(b);
+    while (!b.empty()) {
+        MakeMonic(b);
+        PolyDivMod(a, b);
+        std::swap(a, b);
+    }
+    MakeMonic(a);
+    return a;
+}
+
+/** Tr(a * x) modulo m, for m of degree 2 or more */
+Poly Trace(uint32_t a, const Poly& m)
+{
+    Poly t(2, 0);
+    t[1] = a;
+    Poly r = t;
+    for (int i = 1; i < 32; i++) {
+        t = SqrMod(t, m);
+        if (r.size() < t.size())
+            r.resize(t.size(), 0);
+        for (size_t j = 0; j < t.size(); j++)
+            r[j] ^= t[j];
+    }
+    Trim(r);
+    return r;
+}
+
+/**
+ * Find the roots of a monic polynomial with distinct roots in GF(2^32), by
+ * splitting it on the trace of a * x (Berlekamp's trace algorithm). Taking a
+ * from the basis x^0 .. x^31 guarantees any two roots are separated by one
+ * of them; the ones before nBasis are known not to split p.
+ */
+bool FindRoots(const Poly& p, int nBasis, std::vector<uint32_t>& vRoots)
+{
+    if (p.size() <= 1)
+        return true;
+    if (p.size() == 2) {
+        vRoots.push_back(p[0]);
+        return true;
+    }
+    for (; nBasis < 32; nBasis++) {
+        Poly factor = Gcd(Trace(uint32_t(1) << nBasis, p), p);
+        if (factor.size() > 1 && factor.size() < p.size()) {
+            Poly remainder = p, quotient;
+            PolyDivMod(remainder, factor, &quotient);
+            return FindRoots(factor, nBasis + 1, vRoots) && FindRoots(quotient, nBasis + 1, vRoots);
+        }
+    }
+    return false;
+}
+
+} // anon namespace
+
+void CTxSketch::Add(uint32_t nElement)
+{
+    const uint32_t nSquare = GFMul(nElement, nElement);
+    uint32_t nPower = nElement;
+    for (uint32_t& nSyndrome : vSyndromes) {
+        nSyndrome ^= nPower;
+        nPower = GFMul(nPower, nSquare);
+    }
+}
+
+void CTxSketch::Merge(const CTxSketch& other)
+{
+    assert(other.vSyndromes.size() == vSyndromes.size());
+    for (size_t i = 0; i < vSyndromes.size(); i++)
+        vSyndromes[i] ^= other.vSyndromes[i];
+}
+
+bool CTxSketch::Decode(std::vector<uint32_t>& vElements) const
+{
+    vElements.clear();
+    const size_t nCapacity = vSyndromes.size();
+
+    // Power sums S_1 .. S_2c, the even ones being S_2k = S_k^2
+    std::vector<uint32_t> vSums(2 * nCapacity);
+    for (size_t i = 0; i < vSums.size(); i++)
+        vSums[i] = (i % 2 == 0) ? vSyndromes[i / 2] : GFMul(vSums[i / 2], vSums[i / 2]);
+
+    // Berlekamp-Massey: the shortest recurrence C generating the power sums,
+    // whose reverse has the elements as roots
+    Poly C(1, 1), B(1, 1);
+    size_t L = 0, m = 1;
+    uint32_t b = 1;
+    for (size_t n = 0; n < vSums.size(); n++) {
+        uint32_t d = vSums[n];
+        for (size_t i = 1; i <= L && i < C.size(); i++)
+            d ^= GFMul(C[i], vSums[n - i]);
+        if (d == 0) {
+            m++;
+            continue;
+        }
+        const uint32_t nCoef = GFMul(d, GFInv(b));
+        const Poly T = C;
+        if (C.size() < B.size() + m)
+            C.resize(B.size() + m, 0);
+        for (size_t i = 0; i < B.size(); i++)
+            C[i + m] ^= GFMul(nCoef, B[i]);
+        if (2 * L <= n) {
+            L = n + 1 - L;
+            B = T;
+            b = d;
+            m = 1;
+        } else {
+            m++;
+        }
+    }
+    Trim(C);
+    // Too many differences, or a root at zero (which is not a valid element)
+    if (L > nCapacity || C.size() != L + 1)
+        return false;
+    if (L == 0)
+        return true;
+
+    Poly P(C.rbegin(), C.rend());
+    MakeMonic(P);
+
+    // P must be a product of distinct linear factors: x^(2^32) = x modulo P
+    Poly x(2, 0);
+    x[1] = 1;
+    PolyDivMod(x, P);
+    Poly t = x;
+    for (int i = 0; i < 32; i++)
+        t = SqrMod(t, P);
+    if (t != x)
+        return false;
+
+    if (!FindRoots(P, 0, vElements) || vElements.size() != L) {
+        vElements.clear();
+        return false;
+    }
+
+    // Never return a set that does not reproduce the sketch
+    CTxSketch check(nCapacity);
+    for (uint32_t nElement : vElements)
+        check.Add(nElement);
+    if (check.vSyndromes != vSyndromes) {
+        vElements.clear();
+        return false;
+    }
+    return true;
+}
+
+CTxReconciliationState::CTxReconciliationState(bool fInitiatorIn, uint64_t nLocalSalt, uint64_t nRemoteSalt) :
+    fInitiator(fInitiatorIn), fRoundInProgress(false), nNextRequest(0), nRoundTimeout(0)
+{
+    // Both sides derive the same key, from the salts in ascending order
+    uint256 hash = (CHashWriter(SER_GETHASH, 0) << std::min(nLocalSalt, nRemoteSalt) << std::max(nLocalSalt, nRemoteSalt)).GetHash();
+    k0 = hash.GetUint64(0);
+    k1 = hash.GetUint64(1);
+}
+
+uint32_t CTxReconciliationState::GetShortID(const uint256& txid) const
+{
+    return 1 + SipHashUint256(k0, k1, txid) % 0xFFFFFFFF;
+}
+
+bool CTxReconciliationState::ExpireRound(int64_t nNow, std::vector<uint256>& vHashes)
+{
+    // An initiator between rounds is not waiting for anything
+    if (nNow <= nRoundTimeout || (fInitiator && !fRoundInProgress))
+        return false;
+    for (const std::pair<const uint32_t, uint256>& entry : mapSnapshot)
+        vHashes.push_back(entry.second);
+    vHashes.insert(vHashes.end(), setToReconcile.begin(), setToReconcile.end());
+    mapSnapshot.clear();
+    setToReconcile.clear();
+    fRoundInProgress = false;
+    nNextRequest = nNow + RECON_REQUEST_INTERVAL * 1000000;
+    nRoundTimeout = nNow + RECON_RESPONSE_TIMEOUT * 1000000;
+    return true;
+}
+
+CTxSketch CTxReconciliationState::GetSketch(unsigned int nCapacity) const
+{
+    CTxSketch sketch(nCapacity);
+    for (const uint256& txid : setToReconcile)
+        sketch.Add(GetShortID(txid));
+    return sketch;
+}
+
+unsigned int CTxReconciliationState::EstimateCapacity(size_t nLocalSize, size_t nRemoteSize)
+{
+    const size_t nMin = std::min(nLocalSize, nRemoteSize);
+    const size_t nDiff = std::max(nLocalSize, nRemoteSize) - nMin;
+    return std::min<size_t>(nDiff + nMin * RECON_Q_QUARTERS / 4 + 1, MAX_SKETCH_CAPACITY);
+}
@@ -0,0 +1,118 @@
+// Copyright (c) 2017 The Bitcoin Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#ifndef BITCOIN_TXRECONCILIATION_H
+#define BITCOIN_TXRECONCILIATION_H
+
+#include "serialize.h"
+#include "uint256.h"
+
+#include <map>
+#include <set>
+#include <stdint.h>
+#include <vector>
+
+/** Default for -txreconciliation */
+static const bool DEFAULT_TXRECONCILIATION = false;
+/** Version of the reconciliation protocol sent in sendtxrcncl */
+static const uint32_t TXRECONCILIATION_VERSION = 1;
+/** Interval between two reconciliation rounds with the same peer, in seconds */
+static const int64_t RECON_REQUEST_INTERVAL = 8;
+/** Coefficient q of the set difference estimate |A - B| + q * min(|A|, |B|) + 1, in quarters */
+static const unsigned int RECON_Q_QUARTERS = 1;
+/** Maximum number of differences a sketch may be able to decode */
+static const unsigned int MAX_SKETCH_CAPACITY = 256;
+/** Expected number of outbound reconciling peers a transaction is still flooded to */
+static const int RECON_OUTBOUND_FLOOD_PEERS = 2;
+/** Maximum number of transactions waiting for a round with one peer; any more are announced with inv */
+static const size_t MAX_RECON_SET_SIZE = 3000;
+/** Time in seconds a peer has to take the next step of a round before its transactions are announced with inv */
+static const int64_t RECON_RESPONSE_TIMEOUT = 60;
+
+/**
+ * Sketch of a set of nonzero 32-bit short ids: the odd power sums
+ * s1, s3, ..., s(2c-1) of its elements in GF(2^32) (a PinSketch, as used by
+ * BIP 330). Adding an element twice removes it again, so combining the
+ * sketches of two sets gives the sketch of their symmetric difference, which
+ * can be decoded as long as it has at most c (the capacity) elements.
+ */
+class CTxSketch
+{
+private:
+    std::vector<uint32_t> vSyndromes;
+
+public:
+    explicit CTxSketch(unsigned int nCapacity = 0) : vSyndromes(nCapacity, 0) {}
+
+    unsigned int GetCapacity() const { return vSyndromes.size(); }
+
+    /** Add (or remove) a nonzero element */
+    void Add(uint32_t nElement);
+
+    /** Combine with a sketch of the same capacity into one of the symmetric difference */
+    void Merge(const CTxSketch& other);
+
+    /**
+     * Recover the elements of the sketched set. Fails if it has more elements
+     * than the capacity, in which case no guess is made.
+     */
+    bool Decode(std::vector<uint32_t>& vElements) const;
+
+    ADD_SERIALIZE_METHODS;
+
+    template <typename Stream, typename Operation>
+    inline void SerializationOp(Stream& s, Operation ser_action) {
+        READWRITE(vSyndromes);
+    }
+};
+
+/**
+ * Per-peer state of transaction announcement reconciliation, held by a CNode
+ * once both sides sent sendtxrcncl. Instead of announcing every transaction
+ * with an inv, transactions are collected in setToReconcile; every
+ * RECON_REQUEST_INTERVAL seconds the peer that opened the connection (the
+ * initiator) requests a sketch of the other side's set, combines it with its
+ * own and announces or requests only the transactions in the difference.
+ * Protected by CNode::cs_inventory.
+ */
+class CTxReconciliationState
+{
+private:
+    uint64_t k0, k1;
+
+public:
+    //! Whether we request sketches (we opened the connection) or send them
+    const bool fInitiator;
+
+    //! Transactions to announce to the peer in the next round
+    std::set<uint256> setToReconcile;
+    //! Responder: the set a sketch was sent for, by short id
+    std::map<uint32_t, uint256> mapSnapshot;
+    //! Initiator: a sketch was requested; responder: one was sent, and no reconcildiff was received yet
+    bool fRoundInProgress;
+    //! Initiator: time in microseconds of the next request
+    int64_t nNextRequest;
+    //! Time in microseconds by which the peer has to answer our request (initiator) or make its next one (responder)
+    int64_t nRoundTimeout;
+
+    CTxReconciliationState(bool fInitiatorIn, uint64_t nLocalSalt, uint64_t nRemoteSalt);
+
+    /** Nonzero 32-bit short id of a transaction, salted with both peers' salts */
+    uint32_t GetShortID(const uint256& txid) const;
+
+    /**
+     * Give up on a round the peer did not answer in time: move the
+     * transactions waiting for it into vHashes, to be announced with an inv,
+     * and start over. Returns whether the round was abandoned.
+     */
+    bool ExpireRound(int64_t nNow, std::vector<uint256>& vHashes);
+
+    /** Sketch of setToReconcile */
+    CTxSketch GetSketch(unsigned int nCapacity) const;
+
+    /** Capacity of a sketch to reconcile sets of these sizes */
+    static unsigned int EstimateCapacity(size_t nLocalSize, size_t nRemoteSize);
+};
+
+#endif // BITCOIN_TXRECONCILIATION_H
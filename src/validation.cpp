@@ -13,6 +13,8 @@
 #include "consensus/consensus.h"
 #include "consensus/merkle.h"
 #include "consensus/validation.h"
+#include "crypto/sha256.h"
+#include "cuckoocache.h"
 #include "hash.h"
 #include "init.h"
 #include "policy/fees.h"
@@ -38,6 +40,7 @@
 #include "warnings.h"
 
 #include <atomic>
+#include <list>
 #include <sstream>
 
 #include <boost/algorithm/string/replace.hpp>
@@ -65,6 +68,7 @@ CBlockIndex *pindexBestHeader = NULL;
 CWaitableCriticalSection csBestBlock;
 CConditionVariable cvBlockChange;
 int nScriptCheckThreads = 0;
+bool fBatchVerify = DEFAULT_BATCH_VERIFY;
 std::atomic_bool fImporting(false);
 bool fReindex = false;
 bool fTxIndex = false;
@@ -86,6 +90,7 @@ CAmount maxTxFee = DEFAULT_TRANSACTION_MAXFEE;
 CTxMemPool mempool(::minRelayTxFee);
 
 static void CheckBlockIndex(const Consensus::Params& consensusParams);
+static unsigned int GetBlockScriptFlags(const CBlockIndex* pindexPrev, const CChainParams& chainparams);
 
 /** Constant stuff for coinbase transactions we create: */
 CScript COINBASE_FLAGS;
@@ -773,12 +778,12 @@ bool AcceptToMemoryPoolWorker(CTxMemPool& pool, CValidationState& state, const C
         // Check against previous transactions
         // This is done last to help prevent CPU exhaustion denial-of-service attacks.
         PrecomputedTransactionData txdata(tx);
-        if (!CheckInputs(tx, state, view, true, scriptVerifyFlags, true, txdata)) {
+        if (!CheckInputs(tx, state, view, true, scriptVerifyFlags, true, false, txdata)) {
             return false; // state filled in by CheckInputs
         }
 
-        // Check again against just the consensus-critical mandatory script
-        // verification flags, in case of bugs in the standard flags that cause
+        // Check again against the current block tip's script verification
+        // flags, in case of bugs in the standard flags that cause
         // transactions to pass as valid when they're actually invalid. For
         // instance the STRICTENC flag was incorrectly allowing certain
         // CHECKSIG NOT scripts to pass, even though they were invalid.
@@ -786,10 +791,26 @@ bool AcceptToMemoryPoolWorker(CTxMemPool& pool, CValidationState& state, const C
         // There is a similar check in CreateNewBlock() to prevent creating
         // invalid blocks, however allowing such transactions into the mempool
         // can be exploited as a DoS attack.
-        if (!CheckInputs(tx, state, view, true, MANDATORY_SCRIPT_VERIFY_FLAGS, true, txdata))
+        //
+        // The signatures are all in the signature cache by now, so this is
+        // cheap, and it records the transaction in the script execution cache
+        // under the flags ConnectBlock will use for the next block.
+        unsigned int currentBlockScriptVerifyFlags = GetBlockScriptFlags(chainActive.Tip(), Params());
+        CValidationState stateTip;
+        if (!CheckInputs(tx, stateTip, view, true, currentBlockScriptVerifyFlags, true, true, txdata))
         {
-            return error("%s: BUG! PLEASE REPORT THIS! ConnectInputs failed against MANDATORY but not STANDARD flags %s, %s",
-                __func__, hash.ToString(), FormatStateMessage(state));
+            // With -promiscuousmempoolflags this is expected for flags the
+            // tip enforces and scriptVerifyFlags leaves out
+            if (!(~scriptVerifyFlags & currentBlockScriptVerifyFlags)) {
+                state = stateTip;
+                return error("%s: BUG! PLEASE REPORT THIS! ConnectInputs failed against latest-block but not STANDARD flags %s, %s",
+                    __func__, hash.ToString(), FormatStateMessage(state));
+            }
+            if (!CheckInputs(tx, state, view, true, MANDATORY_SCRIPT_VERIFY_FLAGS, true, false, txdata)) {
+                return error("%s: ConnectInputs failed against MANDATORY but not STANDARD flags due to promiscuous mempool %s, %s",
+                    __func__, hash.ToString(), FormatStateMessage(state));
+            }
+            LogPrintf("Warning: -promiscuousmempoolflags set to not include currently enforced soft forks, this may break mining or otherwise cause instability!\n");
         }
 
         // This transaction should only count for fee estimation if
@@ -1326,6 +1347,49 @@ bool CScriptCheck::operator()() {
     return true;
 }
 
+bool CScriptCheck::operator()(CSignatureBatch& batch) {
+    const CScript &scriptSig = ptxTo->vin[nIn].scriptSig;
+    return VerifyScript(scriptSig, scriptPubKey, nFlags, CachingTransactionSignatureChecker(ptxTo, nIn, amount, cacheStore, *txdata, &batch), &error);
+}
+
+bool RunChecks(std::vector<CScriptCheck>& vChecks)
+{
+    if (!fBatchVerify || vChecks.size() < 2) {
+        BOOST_FOREACH(CScriptCheck& check, vChecks)
+            if (!check())
+                return false;
+        return true;
+    }
+
+    // Run every script assuming its uncached signatures are valid, noting
+    // where each one's signatures end in the batch. A script that fails even
+    // so may rely on a signature being invalid, and is run again for real.
+    CSignatureBatch batch;
+    std::vector<size_t> vEnd;
+    vEnd.reserve(vChecks.size());
+    BOOST_FOREACH(CScriptCheck& check, vChecks) {
+        const size_t nBegin = batch.size();
+        if (!check(batch)) {
+            batch.Truncate(nBegin);
+            if (!check())
+                return false;
+        }
+        vEnd.push_back(batch.size());
+    }
+    if (batch.Verify())
+        return true;
+
+    // Some signature is invalid, which need not make its script fail: find
+    // the scripts with one and run them with signatures checked one by one.
+    size_t nBegin = 0;
+    for (size_t i = 0; i < vChecks.size(); i++) {
+        if (!batch.Verify(nBegin, vEnd[i]) && !vChecks[i]())
+            return false;
+        nBegin = vEnd[i];
+    }
+    return true;
+}
+
 int GetSpendHeight(const CCoinsViewCache& inputs)
 {
     LOCK(cs_main);
@@ -1390,7 +1454,28 @@ bool CheckTxInputs(const CTransaction& tx, CValidationState& state, const CCoins
 }
 }// namespace Consensus
 
-bool CheckInputs(const CTransaction& tx, CValidationState &state, const CCoinsViewCache &inputs, bool fScriptChecks, unsigned int flags, bool cacheStore, PrecomputedTransactionData& txdata, std::vector<CScriptCheck> *pvChecks)
+namespace {
+
+/**
+ * Transactions whose scripts all passed, with given flags. Entries are
+ * SHA256(nonce || txid || flags), the nonce being cut short so the entry
+ * fits a single SHA256 block. Protected by cs_main.
+ */
+CuckooCache::cache<uint256, SignatureCacheHasher> scriptExecutionCache;
+uint256 scriptExecutionCacheNonce(GetRandHash());
+
+} // anon namespace
+
+void InitScriptExecutionCache() {
+    // nMaxCacheSize is unsigned. If -maxsigcachesize is set to zero,
+    // setup_bytes creates the minimum possible cache (2 elements).
+    size_t nMaxCacheSize = std::min(std::max((int64_t)0, GetArg("-maxsigcachesize", DEFAULT_MAX_SIG_CACHE_SIZE) / 2), MAX_MAX_SIG_CACHE_SIZE) * ((size_t) 1 << 20);
+    size_t nElems = scriptExecutionCache.setup_bytes(nMaxCacheSize);
+    LogPrintf("Using %zu MiB out of %zu requested for script execution cache, able to store %zu elements\n",
+            (nElems*sizeof(uint256)) >>20, nMaxCacheSize>>20, nElems);
+}
+
+bool CheckInputs(const CTransaction& tx, CValidationState &state, const CCoinsViewCache &inputs, bool fScriptChecks, unsigned int flags, bool cacheSigStore, bool cacheFullScriptStore, PrecomputedTransactionData& txdata, std::vector<CScriptCheck> *pvChecks)
 {
     if (!tx.IsCoinBase())
     {
@@ -1410,13 +1495,28 @@ bool CheckInputs(const CTransaction& tx, CValidationState &state, const CCoinsVi
         // Of course, if an assumed valid block is invalid due to false scriptSigs
         // this optimization would allow an invalid chain to be accepted.
         if (fScriptChecks) {
+            // First check if script executions have been cached with the same
+            // flags. Note that this assumes that the inputs provided are
+            // correct (ie that the transaction hash which is in tx's prevouts
+            // properly commits to the scriptPubKey in the inputs view of that
+            // transaction).
+            uint256 hashCacheEntry;
+            // We only use the first 19 bytes of nonce to avoid a second SHA
+            // round - giving us 19 + 32 + 4 = 55 bytes (+ 8 + 1 = 64)
+            static_assert(55 - sizeof(flags) - 32 >= 128/8, "Want at least 128 bits of nonce for script execution cache");
+            CSHA256().Write(scriptExecutionCacheNonce.begin(), 55 - sizeof(flags) - 32).Write(tx.GetHash().begin(), 32).Write((unsigned char*)&flags, sizeof(flags)).Finalize(hashCacheEntry.begin());
+            AssertLockHeld(cs_main); // CuckooCache does not lock by itself
+            if (scriptExecutionCache.contains(hashCacheEntry, !cacheFullScriptStore)) {
+                return true;
+            }
+
             for (unsigned int i = 0; i < tx.vin.size(); i++) {
                 const COutPoint &prevout = tx.vin[i].prevout;
                 const CCoins* coins = inputs.AccessCoins(prevout.hash);
                 assert(coins);
 
                 // Verify signature
-                CScriptCheck check(*coins, tx, i, flags, cacheStore, &txdata);
+                CScriptCheck check(*coins, tx, i, flags, cacheSigStore, &txdata);
                 if (pvChecks) {
                     pvChecks->push_back(CScriptCheck());
                     check.swap(pvChecks->back());
@@ -1429,7 +1529,7 @@ bool CheckInputs(const CTransaction& tx, CValidationState &state, const CCoinsVi
                         // avoid splitting the network between upgraded and
                         // non-upgraded nodes.
                         CScriptCheck check2(*coins, tx, i,
-                                flags & ~STANDARD_NOT_MANDATORY_VERIFY_FLAGS, cacheStore, &txdata);
+                                flags & ~STANDARD_NOT_MANDATORY_VERIFY_FLAGS, cacheSigStore, &txdata);
                         if (check2())
                             return state.Invalid(false, REJECT_NONSTANDARD, strprintf("non-mandatory-script-verify-flag (%s)", ScriptErrorString(check.GetScriptError())));
                     }
@@ -1443,6 +1543,12 @@ bool CheckInputs(const CTransaction& tx, CValidationState &state, const CCoinsVi
                     return state.DoS(100,false, REJECT_INVALID, strprintf("mandatory-script-verify-flag-failed (%s)", ScriptErrorString(check.GetScriptError())));
                 }
             }
+
+            if (cacheFullScriptStore && !pvChecks) {
+                // We executed all of the provided scripts, and were told to
+                // cache the result. Do so now.
+                scriptExecutionCache.insert(hashCacheEntry);
+            }
         }
     }
 
@@ -1478,6 +1584,8 @@ bool UndoWriteToDisk(const CBlockUndo& blockundo, CDiskBlockPos& pos, const uint
     return true;
 }
 
+} // anon namespace
+
 bool UndoReadFromDisk(CBlockUndo& blockundo, const CDiskBlockPos& pos, const uint256& hashBlock)
 {
     // Open history file to read
@@ -1505,6 +1613,8 @@ bool UndoReadFromDisk(CBlockUndo& blockundo, const CDiskBlockPos& pos, const uin
     return true;
 }
 
+namespace {
+
 /** Abort with a message */
 bool AbortNode(const std::string& strMessage, const std::string& userMessage="")
 {
@@ -1658,6 +1768,201 @@ void ThreadScriptCheck() {
     scriptcheckqueue.Thread();
 }
 
+namespace {
+
+/** The coins spent by a block, read from the coins database ahead of ConnectTip */
+struct PrefetchedInputs
+{
+    std::shared_ptr<const CBlock> pblock;
+    uint256 hashBlock;
+    //! Best block of the database the coins were read at, null if it changed meanwhile
+    uint256 hashCoinsBest;
+    std::vector<std::pair<uint256, CCoins> > vCoins;
+    bool fStarted;
+    bool fDone;
+    int64_t nTime;
+
+    PrefetchedInputs(const std::shared_ptr<const CBlock>& pblockIn) : pblock(pblockIn), hashBlock(pblockIn->GetHash()), fStarted(false), fDone(false), nTime(0) {}
+};
+
+CWaitableCriticalSection csPrefetch;
+CConditionVariable cvPrefetch;
+//! Blocks to prefetch the inputs of, oldest first, protected by csPrefetch
+std::list<std::shared_ptr<PrefetchedInputs> > listPrefetch;
+//! Whether the prefetch thread runs, and the view it reads, protected by csPrefetch
+bool fPrefetchRunning = false;
+CCoinsView* pcoinsPrefetch = NULL;
+
+} // anon namespace
+
+/** Most blocks to prefetch the inputs of at once */
+static const unsigned int MAX_PREFETCH_BLOCKS = 4;
+
+void ThreadPrefetchInputs(CCoinsView* pcoinsview)
+{
+    RenameThread("bitcoin-prefetch");
+    {
+        boost::unique_lock<boost::mutex> lock(csPrefetch);
+        pcoinsPrefetch = pcoinsview;
+        fPrefetchRunning = true;
+    }
+
+    try {
+        while (true) {
+            std::shared_ptr<PrefetchedInputs> prefetch;
+            {
+                boost::unique_lock<boost::mutex> lock(csPrefetch);
+                while (!prefetch) {
+                    for (const std::shared_ptr<PrefetchedInputs>& entry : listPrefetch) {
+                        if (!entry->fStarted) {
+                            prefetch = entry;
+                            break;
+                        }
+                    }
+                    if (!prefetch)
+                        cvPrefetch.wait(lock);
+                }
+                prefetch->fStarted = true;
+            }
+
+            // Read without cs_main: the database only changes when pcoinsTip
+            // is flushed, which changes its best block, so the coins are only
+            // used if that is still the same afterwards.
+            int64_t nTimeStart = GetTimeMicros();
+            std::vector<std::pair<uint256, CCoins> > vCoins;
+            uint256 hashCoinsBest = pcoinsview->GetBestBlock();
+            std::set<uint256> setSeen;
+            for (const CTransactionRef& tx : prefetch->pblock->vtx)
+                setSeen.insert(tx->GetHash());
+            for (const CTransactionRef& tx : prefetch->pblock->vtx) {
+                if (tx->IsCoinBase())
+                    continue;
+                for (const CTxIn& txin : tx->vin) {
+                    if (!setSeen.insert(txin.prevout.hash).second)
+                        continue;
+                    boost::this_thread::interruption_point();
+                    vCoins.emplace_back();
+                    vCoins.back().first = txin.prevout.hash;
+                    if (!pcoinsview->GetCoins(txin.prevout.hash, vCoins.back().second))
+                        vCoins.pop_back();
+                }
+            }
+            if (pcoinsview->GetBestBlock() != hashCoinsBest) {
+                vCoins.clear();
+                hashCoinsBest.SetNull();
+            }
+
+            {
+                boost::unique_lock<boost::mutex> lock(csPrefetch);
+                prefetch->vCoins.swap(vCoins);
+                prefetch->hashCoinsBest = hashCoinsBest;
+                prefetch->nTime = GetTimeMicros() - nTimeStart;
+                prefetch->fDone = true;
+            }
+            cvPrefetch.notify_all();
+        }
+    } catch (const boost::thread_interrupted&) {
+        {
+            boost::unique_lock<boost::mutex> lock(csPrefetch);
+            fPrefetchRunning = false;
+            pcoinsPrefetch = NULL;
+            listPrefetch.clear();
+        }
+        cvPrefetch.notify_all();
+        throw;
+    }
+}
+
+void PrefetchBlockInputs(const std::shared_ptr<const CBlock>& pblock)
+{
+    uint256 hashTip;
+    {
+        LOCK(cs_main);
+        if (chainActive.Tip() == NULL || chainActive.Tip()->GetBlockHash() != pblock->hashPrevBlock)
+            return;
+        if (mapBlockIndex.count(pblock->GetHash()))
+            return;
+        hashTip = chainActive.Tip()->GetBlockHash();
+    }
+
+    {
+        boost::unique_lock<boost::mutex> lock(csPrefetch);
+        if (!fPrefetchRunning)
+            return;
+        // Blocks that no longer build on the tip will not be connected next
+        std::list<std::shared_ptr<PrefetchedInputs> >::iterator it = listPrefetch.begin();
+        while (it != listPrefetch.end()) {
+            if ((*it)->pblock->hashPrevBlock != hashTip)
+                it = listPrefetch.erase(it);
+            else
+                it++;
+        }
+        if (listPrefetch.size() >= MAX_PREFETCH_BLOCKS)
+            return;
+        const uint256 hashBlock = pblock->GetHash();
+        for (const std::shared_ptr<PrefetchedInputs>& entry : listPrefetch)
+            if (entry->hashBlock == hashBlock)
+                return;
+        listPrefetch.push_back(std::make_shared<PrefetchedInputs>(pblock));
+    }
+    cvPrefetch.notify_all();
+}
+
+/** Forget a block that failed validation, which would otherwise keep its place until the tip changes */
+static void CancelPrefetch(const uint256& hashBlock)
+{
+    boost::unique_lock<boost::mutex> lock(csPrefetch);
+    listPrefetch.remove_if([&hashBlock](const std::shared_ptr<PrefetchedInputs>& entry) { return entry->hashBlock == hashBlock; });
+}
+
+static int64_t nTimePrefetch = 0;
+static int64_t nTimePrefetchWait = 0;
+
+/**
+ * Add the coins the prefetch thread read for the block about to be connected
+ * to pcoinsTip, waiting for it if it is still reading them.
+ */
+static void AddPrefetchedInputs(const CBlockIndex* pindexNew)
+{
+    AssertLockHeld(cs_main);
+    int64_t nTimeStart = GetTimeMicros();
+    std::shared_ptr<PrefetchedInputs> prefetch;
+    uint256 hashCoinsBest;
+    {
+        // Do not let the wait interrupt the block being connected; the
+        // prefetch thread wakes us up when it is interrupted.
+        boost::this_thread::disable_interruption noInterrupt;
+        boost::unique_lock<boost::mutex> lock(csPrefetch);
+        for (const std::shared_ptr<PrefetchedInputs>& entry : listPrefetch) {
+            if (entry->hashBlock == pindexNew->GetBlockHash()) {
+                prefetch = entry;
+                break;
+            }
+        }
+        if (!prefetch)
+            return;
+        if (prefetch->fStarted) {
+            while (!prefetch->fDone && fPrefetchRunning)
+                cvPrefetch.wait(lock);
+        }
+        // If not started yet, ConnectBlock is as quick to read them itself
+        listPrefetch.remove(prefetch);
+        if (!prefetch->fDone)
+            return;
+        if (pcoinsPrefetch != NULL)
+            hashCoinsBest = pcoinsPrefetch->GetBestBlock();
+    }
+
+    if (prefetch->hashCoinsBest.IsNull() || prefetch->hashCoinsBest != hashCoinsBest)
+        return;
+    for (std::pair<uint256, CCoins>& coins : prefetch->vCoins)
+        pcoinsTip->AddFetchedCoins(coins.first, coins.second);
+    int64_t nTimeEnd = GetTimeMicros();
+    nTimePrefetch += prefetch->nTime;
+    nTimePrefetchWait += nTimeEnd - nTimeStart;
+    LogPrint("bench", "  - Prefetch inputs: %u coins, %.2fms in the background, %.2fms waiting and adding [%.2fs, %.2fs]\n", (unsigned)prefetch->vCoins.size(), prefetch->nTime * 0.001, (nTimeEnd - nTimeStart) * 0.001, nTimePrefetch * 0.000001, nTimePrefetchWait * 0.000001);
+}
+
 // Protected by cs_main
 VersionBitsCache versionbitscache;
 
@@ -1708,10 +2013,49 @@ public:
 // Protected by cs_main
 static ThresholdConditionCache warningcache[VERSIONBITS_NUM_BITS];
 
+/** Script verification flags for a block building on pindexPrev */
+static unsigned int GetBlockScriptFlags(const CBlockIndex* pindexPrev, const CChainParams& chainparams) {
+    AssertLockHeld(cs_main);
+    const int nHeight = pindexPrev == NULL ? 0 : pindexPrev->nHeight + 1;
+
+    // BIP16 didn't become active until Apr 1 2012
+    // Always enforce BIP16
+    
+    // int64_t nBIP16SwitchTime = 1333238400;
+    // bool fStrictPayToScriptHash = (pindex->GetBlockTime() >= nBIP16SwitchTime);
+
+    // unsigned int flags = fStrictPayToScriptHash ? SCRIPT_VERIFY_P2SH : SCRIPT_VERIFY_NONE;
+    unsigned int flags = SCRIPT_VERIFY_P2SH;
+    
+
+    // Start enforcing the DERSIG (BIP66) rule
+    if (nHeight >= chainparams.GetConsensus().BIP66Height) {
+        flags |= SCRIPT_VERIFY_DERSIG;
+    }
+
+    // Start enforcing CHECKLOCKTIMEVERIFY (BIP65) rule
+    if (nHeight >= chainparams.GetConsensus().BIP65Height) {
+        flags |= SCRIPT_VERIFY_CHECKLOCKTIMEVERIFY;
+    }
+
+    if (IsBIP146Enabled(chainparams, pindexPrev)) {
+        flags |= SCRIPT_VERIFY_LOW_S;
+        flags |= SCRIPT_VERIFY_NULLFAIL;
+    }
+
+    // Start enforcing BIP112 (CHECKSEQUENCEVERIFY) using versionbits logic.
+    if (VersionBitsState(pindexPrev, chainparams.GetConsensus(), Consensus::DEPLOYMENT_CSV, versionbitscache) == THRESHOLD_ACTIVE) {
+        flags |= SCRIPT_VERIFY_CHECKSEQUENCEVERIFY;
+    }
+
+    return flags;
+}
+
 static int64_t nTimeCheck = 0;
 static int64_t nTimeForks = 0;
 static int64_t nTimeVerify = 0;
 static int64_t nTimeConnect = 0;
+static int64_t nTimeFetchInputs = 0;
 static int64_t nTimeIndex = 0;
 static int64_t nTimeCallbacks = 0;
 static int64_t nTimeTotal = 0;
@@ -1803,35 +2147,12 @@ bool ConnectBlock(const CBlock& block, CValidationState& state, CBlockIndex* pin
         }
     }
 
-    // BIP16 didn't become active until Apr 1 2012
-    // Always enforce BIP16
-    
-    // int64_t nBIP16SwitchTime = 1333238400;
-    // bool fStrictPayToScriptHash = (pindex->GetBlockTime() >= nBIP16SwitchTime);
-
-    // unsigned int flags = fStrictPayToScriptHash ? SCRIPT_VERIFY_P2SH : SCRIPT_VERIFY_NONE;
-    uint32_t flags = SCRIPT_VERIFY_P2SH;
-    
-
-    // Start enforcing the DERSIG (BIP66) rule
-    if (pindex->nHeight >= chainparams.GetConsensus().BIP66Height) {
-        flags |= SCRIPT_VERIFY_DERSIG;
-    }
+    // Get the script flags for this block
+    unsigned int flags = GetBlockScriptFlags(pindex->pprev, chainparams);
 
-    // Start enforcing CHECKLOCKTIMEVERIFY (BIP65) rule
-    if (pindex->nHeight >= chainparams.GetConsensus().BIP65Height) {
-        flags |= SCRIPT_VERIFY_CHECKLOCKTIMEVERIFY;
-    }
-
-    if (IsBIP146Enabled(chainparams, pindex->pprev)) {
-        flags |= SCRIPT_VERIFY_LOW_S;
-        flags |= SCRIPT_VERIFY_NULLFAIL;
-    }
-
-    // Start enforcing BIP68 (sequence locks) and BIP112 (CHECKSEQUENCEVERIFY) using versionbits logic.
+    // Start enforcing BIP68 (sequence locks) using versionbits logic.
     int nLockTimeFlags = 0;
     if (VersionBitsState(pindex->pprev, chainparams.GetConsensus(), Consensus::DEPLOYMENT_CSV, versionbitscache) == THRESHOLD_ACTIVE) {
-        flags |= SCRIPT_VERIFY_CHECKSEQUENCEVERIFY;
         nLockTimeFlags |= LOCKTIME_VERIFY_SEQUENCE;
     }
 
@@ -1840,12 +2161,16 @@ bool ConnectBlock(const CBlock& block, CValidationState& state, CBlockIndex* pin
 
     CBlockUndo blockundo;
 
-    CCheckQueueControl<CScriptCheck> control(fScriptChecks && nScriptCheckThreads ? &scriptcheckqueue : NULL);
+    // Signatures are only batched by the check queue, which is used even
+    // without worker threads for that
+    const bool fQueueChecks = fScriptChecks && (nScriptCheckThreads || fBatchVerify);
+    CCheckQueueControl<CScriptCheck> control(fQueueChecks ? &scriptcheckqueue : NULL);
 
     std::vector<int> prevheights;
     CAmount nFees = 0;
     int nInputs = 0;
     int64_t nSigOpsCount = 0;
+    int64_t nTimeFetch = 0;
     CDiskTxPos pos(pindex->GetBlockPos(), GetSizeOfCompactSize(block.vtx.size()));
     std::vector<std::pair<uint256, CDiskTxPos> > vPos;
     vPos.reserve(block.vtx.size());
@@ -1860,7 +2185,10 @@ bool ConnectBlock(const CBlock& block, CValidationState& state, CBlockIndex* pin
 
         if (!tx.IsCoinBase())
         {
-            if (!view.HaveInputs(tx))
+            int64_t nTimeFetchStart = GetTimeMicros();
+            bool fHaveInputs = view.HaveInputs(tx);
+            nTimeFetch += GetTimeMicros() - nTimeFetchStart;
+            if (!fHaveInputs)
                 return state.DoS(100, error("ConnectBlock(): inputs missing/spent"),
                                  REJECT_INVALID, "bad-txns-inputs-missingorspent");
 
@@ -1893,7 +2221,7 @@ bool ConnectBlock(const CBlock& block, CValidationState& state, CBlockIndex* pin
 
             std::vector<CScriptCheck> vChecks;
             bool fCacheResults = fJustCheck; /* Don't cache results if we're actually connecting blocks (still consult the cache, though) */
-            if (!CheckInputs(tx, state, view, fScriptChecks, flags, fCacheResults, txdata[i], nScriptCheckThreads ? &vChecks : NULL))
+            if (!CheckInputs(tx, state, view, fScriptChecks, flags, fCacheResults, fCacheResults, txdata[i], fQueueChecks ? &vChecks : NULL))
                 return error("ConnectBlock(): CheckInputs on %s failed with %s",
                     tx.GetHash().ToString(), FormatStateMessage(state));
             control.Add(vChecks);
@@ -1908,7 +2236,8 @@ bool ConnectBlock(const CBlock& block, CValidationState& state, CBlockIndex* pin
         vPos.push_back(std::make_pair(tx.GetHash(), pos));
         pos.nTxOffset += ::GetSerializeSize(tx, SER_DISK, CLIENT_VERSION);
     }
-    int64_t nTime3 = GetTimeMicros(); nTimeConnect += nTime3 - nTime2;
+    int64_t nTime3 = GetTimeMicros(); nTimeConnect += nTime3 - nTime2; nTimeFetchInputs += nTimeFetch;
+    LogPrint("bench", "      - Fetch inputs: %.2fms (%.3fms/txin) [%.2fs]\n", 0.001 * nTimeFetch, nInputs <= 1 ? 0 : 0.001 * nTimeFetch / (nInputs-1), nTimeFetchInputs * 0.000001);
     LogPrint("bench", "      - Connect %u transactions: %.2fms (%.3fms/tx, %.3fms/txin) [%.2fs]\n", (unsigned)block.vtx.size(), 0.001 * (nTime3 - nTime2), 0.001 * (nTime3 - nTime2) / block.vtx.size(), nInputs <= 1 ? 0 : 0.001 * (nTime3 - nTime2) / (nInputs-1), nTimeConnect * 0.000001);
     
     uint256 prevHash = uint256S("0");
@@ -2255,6 +2584,7 @@ bool static ConnectTip(CValidationState& state, const CChainParams& chainparams,
     int64_t nTime2 = GetTimeMicros(); nTimeReadFromDisk += nTime2 - nTime1;
     int64_t nTime3;
     LogPrint("bench", "  - Load block from disk: %.2fms [%.2fs]\n", (nTime2 - nTime1) * 0.001, nTimeReadFromDisk * 0.000001);
+    AddPrefetchedInputs(pindexNew);
     {
         CCoinsViewCache view(pcoinsTip);
         bool rv = ConnectBlock(blockConnecting, state, pindexNew, view, chainparams);
@@ -2519,6 +2849,7 @@ bool ActivateBestChain(CValidationState &state, const CChainParams& chainparams,
                 const CBlock& block = *(pair.second);
                 for (unsigned int i = 0; i < block.vtx.size(); i++)
                     GetMainSignals().SyncTransaction(*block.vtx[i], pair.first, i);
+                GetMainSignals().BlockConnected(pair.second, pair.first);
             }
         }
         // When we reach this point, we switched to a new tip (stored in pindexNewTip).
@@ -3160,14 +3491,19 @@ bool ProcessNewBlock(const CChainParams& chainparams, const std::shared_ptr<cons
         if (fNewBlock) *fNewBlock = false;
         CValidationState state;
         // Ensure that CheckBlock() passes before calling AcceptBlock, as
-        // belt-and-suspenders.
+        // belt-and-suspenders. Only then, with its proof of work checked,
+        // read the coins it spends while it is stored.
         bool ret = CheckBlock(*pblock, state, chainparams.GetConsensus());
+        if (ret)
+            PrefetchBlockInputs(pblock);
 
         LOCK(cs_main);
 
         if (ret) {
             // Store to disk
             ret = AcceptBlock(pblock, state, chainparams, &pindex, fForceProcessing, NULL, fNewBlock);
+            if (!ret)
+                CancelPrefetch(pblock->GetHash());
         }
         CheckBlockIndex(chainparams.GetConsensus());
         if (!ret) {
@@ -34,11 +34,13 @@
 
 class CBlockIndex;
 class CBlockTreeDB;
+class CBlockUndo;
 class CBloomFilter;
 class CChainParams;
 class CInv;
 class CConnman;
 class CScriptCheck;
+class CSignatureBatch;
 class CTxMemPool;
 class CValidationInterface;
 class CValidationState;
@@ -80,8 +82,16 @@ static const unsigned int UNDOFILE_CHUNK_SIZE = 0x100000; // 1 MiB
 static const int MAX_SCRIPTCHECK_THREADS = 16;
 /** -par default (number of script-checking threads, 0 = auto) */
 static const int DEFAULT_SCRIPTCHECK_THREADS = 0;
+/** Default for -batchverify, verifying the signatures of blocks in batches */
+static const bool DEFAULT_BATCH_VERIFY = true;
 /** Number of blocks that can be requested at any given time from a single peer. */
 static const int MAX_BLOCKS_IN_TRANSIT_PER_PEER = 64;
+/** Number of blocks that can be requested from a single peer before its download speed is known. */
+static const int INITIAL_BLOCKS_IN_TRANSIT_PER_PEER = 16;
+/** Number of blocks that can always be requested from a single peer, however slow. */
+static const int MIN_BLOCKS_IN_TRANSIT_PER_PEER = 2;
+/** Seconds worth of block data, on top of its latency, to keep requested from each peer. */
+static const unsigned int BLOCK_DOWNLOAD_QUEUE_TIME = 2;
 /** Timeout in seconds during which a peer must stall block download progress before being disconnected. */
 static const unsigned int BLOCK_STALLING_TIMEOUT = 2;
 /** Number of headers sent in one getheaders result. We rely on the assumption that if a peer sends
@@ -173,6 +183,7 @@ extern CConditionVariable cvBlockChange;
 extern std::atomic_bool fImporting;
 extern bool fReindex;
 extern int nScriptCheckThreads;
+extern bool fBatchVerify;
 extern bool fTxIndex;
 extern bool fIsBareMultisigStd;
 extern bool fRequireStandard;
@@ -269,6 +280,10 @@ bool LoadBlockIndex(const CChainParams& chainparams);
 void UnloadBlockIndex();
 /** Run an instance of the script checking thread */
 void ThreadScriptCheck();
+/** Run the thread reading the coins spent by new blocks from pcoinsview, the view beneath pcoinsTip */
+void ThreadPrefetchInputs(CCoinsView* pcoinsview);
+/** Have the coins spent by a block that builds on the tip and passed CheckBlock read in the background, ahead of ConnectTip */
+void PrefetchBlockInputs(const std::shared_ptr<const CBlock>& pblock);
 /** Check whether we are doing an initial block download (synchronizing from disk or network) */
 bool IsInitialBlockDownload();
 /** Format a string that describes several potential problems detected by the core.
@@ -376,9 +391,12 @@ int64_t GetTransactionSigOpCount(const CTransaction& tx, const CCoinsViewCache&
  * Check whether all inputs of this transaction are valid (no double spends, scripts & sigs, amounts)
  * This does not modify the UTXO set. If pvChecks is not NULL, script checks are pushed onto it
  * instead of being performed inline.
+ * Transactions whose scripts all passed with the same flags before, as recorded when
+ * cacheFullScriptStore is set and the checks ran inline, are not checked again.
  */
 bool CheckInputs(const CTransaction& tx, CValidationState &state, const CCoinsViewCache &view, bool fScriptChecks,
-                 unsigned int flags, bool cacheStore, PrecomputedTransactionData& txdata, std::vector<CScriptCheck> *pvChecks = NULL);
+                 unsigned int flags, bool cacheSigStore, bool cacheFullScriptStore, PrecomputedTransactionData& txdata,
+                 std::vector<CScriptCheck> *pvChecks = NULL);
 
 /** Apply the effects of this transaction on the UTXO set represented by view */
 void UpdateCoins(const CTransaction& tx, CCoinsViewCache& inputs, int nHeight);
@@ -462,6 +480,9 @@ public:
 
     bool operator()();
 
+    /** Check with the signatures missing from the cache added to batch, see CachingTransactionSignatureChecker */
+    bool operator()(CSignatureBatch& batch);
+
     void swap(CScriptCheck &check) {
         scriptPubKey.swap(check.scriptPubKey);
         std::swap(ptxTo, check.ptxTo);
@@ -477,11 +498,22 @@ public:
 };
 
 
+/**
+ * Run the script checks of a check queue worker, verifying their signatures
+ * as a batch when -batchverify is set. A failed batch is retried check by
+ * check, so that the failure is attributed to the right inputs.
+ */
+bool RunChecks(std::vector<CScriptCheck>& vChecks);
+
+/** Initializes the script-execution cache */
+void InitScriptExecutionCache();
+
 /** Functions for disk access for blocks */
 bool WriteBlockToDisk(const CBlock& block, CDiskBlockPos& pos, const CMessageHeader::MessageStartChars& messageStart);
 bool ReadBlockFromDisk(CBlock& block, const CDiskBlockPos& pos, const Consensus::Params& consensusParams);
 bool ReadBlockFromDisk(CBlock& block, const CBlockIndex* pindex, const Consensus::Params& consensusParams);
 bool ReadBlockHeaderFromDisk(CBlockHeader& block, const CBlockIndex* pindex, const Consensus::Params& consensusParams);
+bool UndoReadFromDisk(CBlockUndo& blockundo, const CDiskBlockPos& pos, const uint256& hashBlock);
 
 /** Functions for validating blocks and updating the block tree */
 
@@ -42,6 +42,7 @@ protected:
     virtual void GetScriptForMining(boost::shared_ptr<CReserveScript>&) {};
     virtual void ResetRequestCount(const uint256 &hash) {};
     virtual void NewPoWValidBlock(const CBlockIndex *pindex, const std::shared_ptr<const CBlock>& block) {};
+    virtual void BlockConnected(const std::shared_ptr<const CBlock>& block, const CBlockIndex *pindex) {};
     friend void ::RegisterValidationInterface(CValidationInterface*);
     friend void ::UnregisterValidationInterface(CValidationInterface*);
     friend void ::UnregisterAllValidationInterfaces();
@@ -79,6 +80,10 @@ struct CMainSignals {
      * Notifies listeners that a block which builds directly on our current tip
      * has been received and connected to the headers tree, though not validated yet */
     boost::signals2::signal<void (const CBlockIndex *, const std::shared_ptr<const CBlock>&)> NewPoWValidBlock;
+    /**
+     * Notifies listeners of a block being connected to the active chain.
+     * Called with cs_main held, after SyncTransaction for its transactions. */
+    boost::signals2::signal<void (const std::shared_ptr<const CBlock>&, const CBlockIndex *)> BlockConnected;
 };
 
 CMainSignals& GetMainSignals();
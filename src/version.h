@@ -9,7 +9,7 @@
  * network protocol versioning
  */
 
-static const int PROTOCOL_VERSION = 1090000;
+static const int PROTOCOL_VERSION = 1090001;
 
 //! initial proto version, to be increased after version/verack negotiation
 static const int INIT_PROTO_VERSION = 209;
@@ -51,4 +51,7 @@ static const int SHORT_IDS_BLOCKS_VERSION = 70014;
 //! not banning for invalid compact blocks starts with this version
 static const int INVALID_CB_NO_BAN_VERSION = 1080000;
 
+//! "sendtxrcncl" and the reconciliation of transaction announcements start with this version
+static const int TXRECONCILIATION_PROTO_VERSION = 1090001;
+
 #endif // BITCOIN_VERSION_H